@@ -0,0 +1,37 @@
+## jflags_compress_help (<target>)
+##
+## Builds the target with COMPRESS_FLAG_HELP (see jflags_define.h): the
+## flags its sources define leave their help out of the binary, which
+## jflags_pack_help packs into a compressed table to compile in instead.
+## The table is only decompressed when --help, or the like, asks for it.
+## Call it after all the sources were added to the target, from the
+## directory that added it.
+
+function (jflags_compress_help target)
+  if (NOT TARGET jflags_pack_help)
+    message (FATAL_ERROR "jflags_compress_help: this jflags has no jflags_pack_help!")
+  endif ()
+  if (JFLAGS_PACK_HELP_HEADER)
+    set (header "${JFLAGS_PACK_HELP_HEADER}")
+  else ()
+    set (header "jflags/jflags.h")
+  endif ()
+  get_target_property (sources ${target} SOURCES)
+  set (cxx_sources)
+  foreach (source IN LISTS sources)
+    if (source MATCHES "\\.(cc|cpp|cxx|C)$")
+      get_filename_component (source "${source}" ABSOLUTE)
+      list (APPEND cxx_sources "${source}")
+    endif ()
+  endforeach ()
+  set (output "${CMAKE_CURRENT_BINARY_DIR}/${target}_flag_help.cc")
+  add_custom_command (
+    OUTPUT  "${output}"
+    COMMAND jflags_pack_help -i "${header}" -o "${output}" ${cxx_sources}
+    DEPENDS jflags_pack_help ${cxx_sources}
+    COMMENT "Packing the flag help of ${target}"
+    VERBATIM
+  )
+  set_property (TARGET ${target} APPEND PROPERTY SOURCES "${output}")
+  set_property (TARGET ${target} APPEND PROPERTY COMPILE_DEFINITIONS "COMPRESS_FLAG_HELP=1")
+endfunction ()
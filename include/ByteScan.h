@@ -0,0 +1,28 @@
+////////////////////////////////////////////////////////////////////////////////
+//                                    jflags
+//
+// This file is distributed under the 3-clause Berkeley Software Distribution
+// License. See LICENSE.txt for details.
+////////////////////////////////////////////////////////////////////////////////
+// --------------------------------------------------------------------
+// The scans over the bytes of a flagfile that tokenizing it comes down
+// to.  They look at 16 bytes at a time, with SSE2 on x86 and NEON on
+// 64-bit ARM, and at one byte at a time elsewhere, and for what's left
+// at the end.
+// --------------------------------------------------------------------
+#ifndef JFLAGS_BYTE_SCAN_H_
+#define JFLAGS_BYTE_SCAN_H_
+#include "jflags_declare.h" // IWYU pragma: export
+
+namespace JFLAGS_NAMESPACE {
+
+// Returns the first byte of [p, end) that isn't whitespace, as
+// isspace() has it in the "C" locale, or end.
+const char * SkipWhitespace(const char * p, const char * end);
+
+// Returns the first byte of [p, end) that's a, b or c, or end.
+const char * FindFirstOf(const char * p, const char * end, char a, char b, char c);
+
+} // namespace JFLAGS_NAMESPACE
+
+#endif // JFLAGS_BYTE_SCAN_H_
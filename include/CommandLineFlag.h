@@ -12,14 +12,26 @@
 #ifndef JFLAGS_COMMAND_LINE_FLAG_H_
 #define JFLAGS_COMMAND_LINE_FLAG_H_
 #include "FlagValue.h"
+#include "FlagConstraint.h"
+#include "FlagHelp.h"
+#include "jflags_watcher.h"
 
 #include <string>
+#include <vector>
 
 //#include "jflags_declare.h" // IWYU pragma: export
 
 namespace JFLAGS_NAMESPACE {
 
 using std::string;
+using std::vector;
+
+// A watcher registered with RegisterFlagWatcher().
+struct FlagWatcher
+{
+    FlagWatcherFn fn;
+    void * data;
+};
 
 // --------------------------------------------------------------------
 // CommandLineFlag
@@ -40,44 +52,86 @@ public:
     ~CommandLineFlag();
 
     const char * name() const { return name_; }
-    const char * help() const { return help_; }
+    const char * help() const { return help_ != kCompressedFlagHelp ? help_ : CompressedFlagHelp(name_); }
     const char * filename() const { return file_; }
-    const char * CleanFileName() const; // nixes irrelevant prefix such as homedir
+    const char * CleanFileName() const { return clean_file_; } // nixes irrelevant prefix such as homedir
     string current_value() const { return current_->ToString(); }
     string default_value() const { return defvalue_->ToString(); }
     const char * type_name() const { return defvalue_->TypeName(); }
     ValidateFnProto validate_function() const { return validate_fn_proto_; }
+    // A flag that only has a constraint is cheap to validate, too.
+    bool validator_is_cheap() const { return validator_is_cheap_ || validate_fn_proto_ == NULL; }
+    const FlagConstraint * constraint() const { return constraint_; }
     const void * flag_ptr() const { return current_->value_buffer_; }
+    const FlagValue & current() const { return *current_; }
+    const FlagValue & defvalue() const { return *defvalue_; }
 
     void FillCommandLineFlagInfo(struct CommandLineFlagInfo * result);
+    void FillCompactFlagInfo(struct CompactFlagInfo * result);
+    void FillFlagDescriptor(struct FlagDescriptor * result);
 
-    // If validate_fn_proto_ is non-NULL, calls it on value, returns result.
-    bool Validate(const FlagValue & value) const;
+    // Whether value passes the constraint, and the validator, if any.
+    bool Allows(const FlagValue & value) const { return constraint_ == NULL || constraint_->Allows(value); }
+    bool PassesValidator(const FlagValue & value) const;
+    bool Validate(const FlagValue & value) const { return Allows(value) && PassesValidator(value); }
     bool ValidateCurrent() const { return Validate(*current_); }
 
+    // A copy of the current value, which the caller owns, for it to be
+    // validated without the registry lock.  Requires the lock.
+    FlagValue * NewCopyOfCurrent() const;
+
 private:
     // for SetFlagLocked() and setting flags_by_ptr_
     friend class FlagRegistry;
     friend class FlagSaverImpl; // for cloning the values
     // set validate_fn
-    friend bool AddFlagValidator(const void *, ValidateFnProto);
+    friend bool AddFlagValidator(const void *, ValidateFnProto, bool);
+    friend bool AddFlagConstraint(const void *, FlagValue::ValueType, const FlagConstraint *);
+    // add and remove watchers
+    friend bool AddFlagWatcher(CommandLineFlag *, FlagWatcherFn, void *);
+    friend bool RemoveFlagWatcher(CommandLineFlag *, FlagWatcherFn, void *);
 
     // This copies all the non-const members: modified, processed, defvalue, etc.
     void CopyFrom(const CommandLineFlag & src);
 
+    // Readers, which may only hold the registry lock shared, may all
+    // call this at once: modified_ is only ever flipped from false to
+    // true there, with relaxed atomic stores, and read with relaxed
+    // loads wherever the lock may be shared.
     void UpdateModifiedBit();
+    bool modified() const { return atomic_internal::LoadRelaxed(&modified_); }
+
+    // The part of filename CleanFileName() keeps: a suffix of it.
+    static const char * CleanFileName(const char * filename);
 
+    // The fields that walks over all the flags look at come first, the
+    // ones that are only needed to describe the flag last.
     const char * const name_; // Flag name
-    const char * const help_; // Help message
-    const char * const file_; // Which file did this come from?
-    bool modified_;           // Set after default assignment?
-    FlagValue * defvalue_;    // Default value for flag
     FlagValue * current_;     // Current value for flag
+    FlagValue * defvalue_;    // Default value for flag
     // This is a casted, 'generic' version of validate_fn, which actually
     // takes a flag-value as an arg (void (*validate_fn)(bool), say).
     // When we pass this to current_->Validate(), it will cast it back to
     // the proper type.  This may be NULL to mean we have no validate_fn.
     ValidateFnProto validate_fn_proto_;
+    bool validator_is_cheap_; // registered as VALIDATOR_IS_CHEAP
+    // The values the flag may take, or NULL.  Not owned: see FlagConstraint.h.
+    const FlagConstraint * constraint_;
+    // The watchers of the flag, or NULL if there are none, so that
+    // setting an unwatched flag costs a single test.  change_pending_
+    // says the flag is in its registry's list of changes to report.
+    vector<FlagWatcher> * watchers_;
+    bool modified_; // Set after default assignment?
+    bool change_pending_;
+    // Whether the flag, and its values, were constructed in the arena
+    // of their registry, rather than on their own.
+    bool in_arena_;
+    const char * const help_; // Help message
+    const char * const file_; // Which file did this come from?
+    // CleanFileName(), worked out once.  Its registry replaces it with
+    // the copy all the flags of that file share (see
+    // FlagRegistry::InternFilenameLocked()).
+    const char * clean_file_;
 
     CommandLineFlag(const CommandLineFlag &); // no copying!
     void operator=(const CommandLineFlag &);
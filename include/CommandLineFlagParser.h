@@ -15,17 +15,21 @@
 #define JFLAGS_COMMAND_LINE_FLAG_PARSER_H_
 #include "jflags_access.h"
 #include "jflags_declare.h" // IWYU pragma: export
+#include "Flagfile.h"
 
 #include <string>
 #include <map>
+#include <vector>
 
 namespace JFLAGS_NAMESPACE {
 
 class FlagRegistry;
 class CommandLineFlag;
+class FlagfilePrefetch;
 
 using std::string;
 using std::map;
+using std::vector;
 
 // CommandLineFlagParser
 //    Parsing is done in two stages.  In the first, we go through
@@ -42,8 +46,11 @@ using std::map;
 class CommandLineFlagParser
 {
 public:
-    // The argument is the flag-registry to register the parsed flags in
-    explicit CommandLineFlagParser(FlagRegistry * reg) : registry_(reg) {}
+    // The argument is the flag-registry to register the parsed flags in.
+    // Only if report_changes do the Process*Locked() functions below
+    // return messages about the flags they set (most callers don't look
+    // at them); errors are collected for ReportErrors() either way.
+    explicit CommandLineFlagParser(FlagRegistry * reg, bool report_changes = false) : registry_(reg), report_changes_(report_changes), flagfile_depth_(0), fromenv_depth_(0), prefetch_(NULL) {}
     ~CommandLineFlagParser() {}
 
     // Stage 1: Every time this is called, it reads all flags in argv.
@@ -57,7 +64,9 @@ public:
     // In jflags_reporting.cc:HandleCommandLineHelpFlags().
 
     // Stage 3: validate all the commandline flags that have validators
-    // registered.
+    // registered.  With --validator_threads, the validators that may be
+    // slow run on a few threads, on copies of the values taken under
+    // the registry lock, but without it.
     void ValidateAllFlags();
 
     // Stage 4: report any errors and return true if any were found.
@@ -81,21 +90,55 @@ public:
     // NB: Must have called registry_->Lock() before calling this function.
     string ProcessOptionsFromStringLocked(const string & contentdata, FlagSettingMode set_mode);
 
+    // The same, for flagfile contents that have already been read and
+    // split up into lines.
+    // NB: Must have called registry_->Lock() before calling this function.
+    string ProcessFlagfileContentsLocked(const Flagfile & flagfile, FlagSettingMode set_mode);
+
     // These are the 'recursive' flags, defined at the top of this file.
     // Whenever we see these flags on the commandline, we must take action.
     // These are called by ProcessSingleOptionLocked and, similarly, return
     // new values if everything went ok, or the empty-string if not.
+    // With --flagfile_threads, the files of a --flagfile list, and the
+    // ones they name in turn, are all read ahead (see FlagfilePrefetch);
+    // those named in argv even before the registry lock is taken (with
+    // the --flagfile_threads of argv too).  Off by default.
     string ProcessFlagfileLocked(const string & flagval, FlagSettingMode set_mode);
-    // diff fromenv/tryfromenv
+    // diff fromenv/tryfromenv.  The environment is read once for the
+    // whole list, which may be '*': all the flags it has a value for.
     string ProcessFromenvLocked(const string & flagval, FlagSettingMode set_mode, bool errors_are_fatal);
+    string ProcessFromenvValueLocked(CommandLineFlag * flag, const string & envval, FlagSettingMode set_mode);
+
+    // Whether a line of space-separated filename globs from a flagfile
+    // matches this program, so that the flags after it apply.  The
+    // answer is remembered in the line, for as long as the flagfile
+    // is around.  Thread-safe.
+    static bool GlobsMatchProgram(const Flagfile::Line & line);
+
+    // The indices in argv, as it was given to ParseNewCommandLineFlags(),
+    // of the args that named no flag.
+    const vector<int> & undefined_args() const { return undefined_args_; }
 
 private:
     FlagRegistry * const registry_;
+    const bool report_changes_;
     map<string, string> error_flags_; // map from name to error message
     // This could be a set<string>, but we reuse the map to minimize the .o size
     map<string, string> undefined_names_; // --[flag] name was not registered
+    vector<int> undefined_args_;          // where in argv they were
+    int flagfile_depth_;                  // for the StageTimer of each
+    int fromenv_depth_;
+    FlagfilePrefetch * prefetch_;         // the files read ahead, while parsing
 };
 
+// --------------------------------------------------------------------
+// StopFlagSources()
+//    Has the flag sources still fetching (see jflags_source.h) drop
+//    their settings, and waits for those being applied, for
+//    ShutDownCommandLineFlags(); in jflags_source.cc.
+// --------------------------------------------------------------------
+
+void StopFlagSources();
 
 } // namespace JFLAGS_NAMESPACE
 
@@ -0,0 +1,68 @@
+////////////////////////////////////////////////////////////////////////////////
+//                                    jflags
+//
+// This file is distributed under the 3-clause Berkeley Software Distribution
+// License. See LICENSE.txt for details.
+////////////////////////////////////////////////////////////////////////////////
+// --------------------------------------------------------------------
+// FlagConstraint is what RegisterFlagRange() and
+// RegisterFlagAllowedValues() attach to a flag: the values it may
+// take, which are checked before its validator, if any, without
+// calling anything through a pointer.  A constraint never changes, and
+// lives as long as the program (see jflags_validator.cc), so that the
+// flag and all the copies FlagSaver makes of it can just point to it.
+// --------------------------------------------------------------------
+#ifndef JFLAGS_FLAG_CONSTRAINT_H_
+#define JFLAGS_FLAG_CONSTRAINT_H_
+
+#include "jflags_declare.h" // IWYU pragma: export
+
+#include <string>
+#include <vector>
+
+namespace JFLAGS_NAMESPACE {
+
+using std::string;
+using std::vector;
+
+class FlagValue;
+
+class FlagConstraint
+{
+public:
+    // The values from min to max, both included, of their (numeric) type.
+    FlagConstraint(const FlagValue & min, const FlagValue & max);
+    // The (non-empty) strings of the comma-separated list values.
+    explicit FlagConstraint(const char * values);
+    ~FlagConstraint();
+
+    // Whether value, of the constrained type, is allowed.
+    bool Allows(const FlagValue & value) const;
+
+    // "[min, max]", or the strings as "a|b|c", for --help and the like.
+    const string & description() const { return description_; }
+
+private:
+    // A range: NULL for a set of strings.
+    FlagValue * min_;
+    FlagValue * max_;
+
+    // A set of strings, and an open-addressing hash index to them,
+    // each slot the index in values_ plus one, or 0 if empty.
+    vector<string> values_;
+    vector<size_t> slots_;
+
+    string description_;
+
+    static size_t HashValue(const string & value);
+    void Insert(size_t v); // values_[v] into the index
+    bool Allows(const string & value) const;
+
+    // Disallow
+    FlagConstraint(const FlagConstraint &);
+    FlagConstraint & operator=(const FlagConstraint &);
+};
+
+} // namespace JFLAGS_NAMESPACE
+
+#endif // JFLAGS_FLAG_CONSTRAINT_H_
@@ -0,0 +1,53 @@
+////////////////////////////////////////////////////////////////////////////////
+//                                    jflags
+//
+// This file is distributed under the 3-clause Berkeley Software Distribution
+// License. See LICENSE.txt for details.
+////////////////////////////////////////////////////////////////////////////////
+// --------------------------------------------------------------------
+// Compressed flag help
+//    With COMPRESS_FLAG_HELP (see jflags_define.h), the DEFINE_*
+//    macros leave the help out of the binary, and give the flag
+//    kCompressedFlagHelp instead.  jflags_pack_help (in utils/) gathers
+//    the help from the sources at build time into a packed table,
+//    which registers itself with a FlagHelpRegisterer.  The tables are
+//    only decompressed the first time a help is asked for.
+//       A table holds "name\0help\0" for each of its flags, sorted by
+//    name, compressed as:
+//       - the length (1 to kMaxPackedCodeLength, or 0 if unused) of the
+//         code for each of the kPackedHelpSymbols symbols of a
+//         canonical Huffman code, two to a byte, low nibble first;
+//       - then the codes of the symbols, each from its first bit to its
+//         last, packed from the low bit of each byte up.
+//    A symbol below 256 is that byte.  Symbol 256 + c copies an
+//    earlier run of bytes: the run is kMinPackedMatch - 1 + the value
+//    in class c long, and starts as many bytes back as the value that
+//    follows, in the class given by the next 4 bits.  A value in class
+//    c is 2^c plus the c bits that come next, low bit first.
+// --------------------------------------------------------------------
+#ifndef JFLAGS_FLAG_HELP_H_
+#define JFLAGS_FLAG_HELP_H_
+
+#include "jflags_define.h"
+
+#include <stddef.h>
+
+namespace JFLAGS_NAMESPACE {
+
+static const int kPackedLengthClasses = 9; // runs of up to 513 bytes
+static const int kPackedHelpSymbols = 256 + kPackedLengthClasses;
+static const int kMaxPackedCodeLength = 15;
+static const size_t kMinPackedMatch = 3;
+
+// Decompresses a table of size bytes into out.  Returns false if it's
+// corrupt.
+bool UnpackFlagHelp(const unsigned char * packed, size_t packed_size, char * out, size_t size);
+
+// The help of the flag, from the tables registered so far, or
+// kStrippedFlagHelp if none of them has it.  The help stays valid for
+// the life of the program.
+const char * CompressedFlagHelp(const char * name);
+
+} // namespace JFLAGS_NAMESPACE
+
+#endif // JFLAGS_FLAG_HELP_H_
@@ -12,13 +12,90 @@
 #define JFLAGS_FLAG_REGISTERER_H_
 
 #include "jflags_declare.h" // IWYU pragma: export
+#include "jflags_atomic.h"
+
+#include <stddef.h>
+#include <string>
 
 namespace JFLAGS_NAMESPACE {
 
+// --------------------------------------------------------------------
+// The type of the value of a flag, which the DEFINE_* macros know at
+// compile time: FlagTypeOf<T>::id.  These are the same as
+// FlagValue::ValueType.
+// --------------------------------------------------------------------
+
+enum FlagType
+{
+    FLAG_TYPE_BOOL = 0,
+    FLAG_TYPE_INT32 = 1,
+    FLAG_TYPE_UINT32 = 2,
+    FLAG_TYPE_INT64 = 3,
+    FLAG_TYPE_UINT64 = 4,
+    FLAG_TYPE_DOUBLE = 5,
+    FLAG_TYPE_STRING = 6,
+};
+
+template <typename T>
+struct FlagTypeOf; // only for the types of flags
+
+template <> struct FlagTypeOf<bool> { static const FlagType id = FLAG_TYPE_BOOL; };
+template <> struct FlagTypeOf<int32> { static const FlagType id = FLAG_TYPE_INT32; };
+template <> struct FlagTypeOf<uint32> { static const FlagType id = FLAG_TYPE_UINT32; };
+template <> struct FlagTypeOf<int64> { static const FlagType id = FLAG_TYPE_INT64; };
+template <> struct FlagTypeOf<uint64> { static const FlagType id = FLAG_TYPE_UINT64; };
+template <> struct FlagTypeOf<double> { static const FlagType id = FLAG_TYPE_DOUBLE; };
+template <> struct FlagTypeOf<std::string> { static const FlagType id = FLAG_TYPE_STRING; };
+
 class JFLAGS_DLL_DECL FlagRegisterer
 {
 public:
+    // The type is named as in DEFINE_VARIABLE(): "int32", "string",
+    // etc., with or without a namespace.  The DEFINE_* macros pass the
+    // FlagType instead, which saves looking the name up.
     FlagRegisterer(const char * name, const char * type, const char * help, const char * filename, void * current_storage, void * defvalue_storage);
+    FlagRegisterer(const char * name, FlagType type, const char * help, const char * filename, void * current_storage, void * defvalue_storage);
+
+    // For the DEFINE_atomic_* flags, whose current value is read by
+    // other threads while jflags sets it.  An atomic string flag has
+    // jflags' own copy of the value in current_storage, and publishes
+    // it to *atomic_string.
+    enum Atomic { ATOMIC };
+    FlagRegisterer(const char * name, const char * type, const char * help, const char * filename, void * current_storage, void * defvalue_storage, Atomic);
+    FlagRegisterer(const char * name, FlagType type, const char * help, const char * filename, void * current_storage, void * defvalue_storage, Atomic);
+    FlagRegisterer(const char * name, const char * type, const char * help, const char * filename, void * current_storage, void * defvalue_storage, AtomicStringFlag * atomic_string);
+    FlagRegisterer(const char * name, FlagType type, const char * help, const char * filename, void * current_storage, void * defvalue_storage, AtomicStringFlag * atomic_string);
+};
+
+// --------------------------------------------------------------------
+// FlagTableEntry is what the DEFINE_* macros put in the flag table,
+// instead of a FlagRegisterer, when JFLAGS_FLAG_TABLE is defined.  It
+// only holds constants, so it's initialized statically, and the whole
+// table is registered at once, the first time jflags needs the flags.
+// --------------------------------------------------------------------
+
+struct FlagTableEntry
+{
+    const char * name;
+    FlagType type;
+    const char * help;
+    const char * filename;
+    void * current_storage;
+    void * defvalue_storage;
+    bool atomic;
+};
+
+// --------------------------------------------------------------------
+// FlagHelpRegisterer is what the source jflags_pack_help generates
+// uses to register the help of the flags defined with
+// COMPRESS_FLAG_HELP: size bytes of help, compressed into packed,
+// which must outlive the program.
+// --------------------------------------------------------------------
+
+class JFLAGS_DLL_DECL FlagHelpRegisterer
+{
+public:
+    FlagHelpRegisterer(const unsigned char * packed, size_t packed_size, size_t size);
 };
 
 } // namespace JFLAGS_NAMESPACE
@@ -22,6 +22,8 @@
 #include "jflags_error.h"
 #include "jflags_access.h"
 #include "CommandLineFlag.h"
+#include "FlagRegisterer.h"
+#include "FlagStats.h"
 #include "mutex.h"
 
 #include <cstring>
@@ -47,42 +49,124 @@ using std::vector;
 //    the function will acquire it itself if needed.
 // --------------------------------------------------------------------
 
-struct StringCmp
-{ // Used by the FlagRegistry map class to compare char*'s
-    bool operator()(const char * s1, const char * s2) const
-    {
-        return (strcmp(s1, s2) < 0);
-    }
+struct FlagSnapshot;
+void UnrefFlagSnapshot(FlagSnapshot * snapshot); // in FlagSaver.cc
+
+// --------------------------------------------------------------------
+// FlagArena
+//    Where a registry constructs the flags it creates itself, along
+//    with their values: each flag is laid out right before its two
+//    FlagValues, and the flags follow each other in the order they're
+//    registered, rather than being scattered over the heap.  Nothing
+//    is freed until the arena is.
+// --------------------------------------------------------------------
+
+class FlagArena
+{
+public:
+    FlagArena() : next_(NULL), left_(0) {}
+    ~FlagArena();
+
+    // Returns size bytes, aligned for any of the objects of a flag.
+    void * Allocate(size_t size);
+
+private:
+    static const size_t kAlignment = 2 * sizeof(void *);
+    static const size_t kBlockSize = 16384;
+
+    vector<char *> blocks_;
+    char * next_;
+    size_t left_;
+
+    FlagArena(const FlagArena &);
+    FlagArena & operator=(const FlagArena &);
 };
 
 class FlagRegistry
 {
 public:
-    FlagRegistry() {}
+    FlagRegistry() : slots_(kMinSlots), ptr_slots_(kMinSlots), num_ptrs_(0), sorted_by_file_flags_valid_(false), sorted_by_name_flags_valid_(false), layout_fingerprint_(2166136261U), saver_snapshot_(NULL), locked_at_(0) {}
     ~FlagRegistry()
     {
+        UnrefFlagSnapshot(saver_snapshot_);
         // Not using STLDeleteElements as that resides in util and this
         // class is base.
-        for (FlagMap::iterator p = flags_.begin(), e = flags_.end(); p != e; ++p) {
-            CommandLineFlag * flag = p->second;
-            delete flag;
+        for (FlagIterator p = flags_.begin(), e = flags_.end(); p != e; ++p) {
+            CommandLineFlag * flag = *p;
+            if (flag->in_arena_)
+                flag->~CommandLineFlag();
+            else
+                delete flag;
         }
     }
 
     static void DeleteGlobalRegistry()
     {
         delete global_registry_;
-        global_registry_ = NULL;
+        atomic_internal::StoreRelease(&global_registry_, static_cast<FlagRegistry *>(NULL));
     }
 
     // Store a flag in this registry.  Takes ownership of the given pointer.
     void RegisterFlag(CommandLineFlag * flag);
 
-    void Lock() { lock_.Lock(); }
-    void Unlock() { lock_.Unlock(); }
+    // Creates the flag that entry describes, in the arena of this
+    // registry, and stores it.  An atomic string flag is published to
+    // atomic_string.
+    void RegisterFlag(const FlagTableEntry & entry, AtomicStringFlag * atomic_string);
+
+    // Stores the flags of a flag table (see FlagRegisterer.h) in this
+    // registry, all at once.
+    void RegisterFlagTable(const FlagTableEntry * begin, const FlagTableEntry * end);
+
+    // Releasing the lock is also when the watchers of the flags that
+    // changed meanwhile are called (see NoteChangeLocked()).  While
+    // the statistics are enabled, so is the timing of the lock.
+    void Lock()
+    {
+        if (!FlagsStatsEnabled())
+        {
+            lock_.Lock();
+            return;
+        }
+        const int64 start = StatsNanos();
+        lock_.Lock();
+        locked_at_ = StatsNanos();
+        NoteLockWait(locked_at_ - start);
+    }
+    void Unlock()
+    {
+        if (locked_at_ != 0)
+        {
+            NoteLockHold(StatsNanos() - locked_at_);
+            locked_at_ = 0;
+        }
+        if (changed_flags_.empty())
+            lock_.Unlock();
+        else
+            UnlockAndNotify();
+    }
+
+    // A shared lock, for code that only reads flags.  Holding it is
+    // enough to call the FooLocked() lookups (FindFlagLocked(),
+    // FindFlagViaPtrLocked()), but not anything that writes to a flag.
+    void ReaderLock()
+    {
+        if (!FlagsStatsEnabled())
+        {
+            lock_.ReaderLock();
+            return;
+        }
+        const int64 start = StatsNanos();
+        lock_.ReaderLock();
+        NoteLockWait(StatsNanos() - start);
+    }
+    void ReaderUnlock() { lock_.ReaderUnlock(); }
 
     // Returns the flag object for the specified name, or NULL if not found.
+    // The second form looks up the first name_len characters of name,
+    // which need not be NUL-terminated.
     CommandLineFlag * FindFlagLocked(const char * name);
+    CommandLineFlag * FindFlagLocked(const char * name, size_t name_len);
 
     // Returns the flag object whose current-value is stored at flag_ptr.
     // That is, for whom current_->value_buffer_ == flag_ptr
@@ -92,14 +176,69 @@ public:
     // form flag=value.  In that case, we set key to point to flag, and
     // modify v to point to the value (if present), and return the flag
     // with the given name.  If the flag does not exist, returns NULL
-    // and sets error_message.
+    // and sets error_message.  key and error_message can be NULL.
     CommandLineFlag * SplitArgumentLocked(const char * argument, string * key, const char ** v, string * error_message);
 
+    // The same, for an argument whose name is its first name_len
+    // characters, as a flagfile line already knows (see Flagfile.h):
+    // they're followed by the '=' of the value, or the end of argument.
+    CommandLineFlag * SplitArgumentLocked(const char * argument, size_t name_len, string * key, const char ** v, string * error_message);
+
     // Set the value of a flag.  If the flag was successfully set to
     // value, set msg to indicate the new flag-value, and return true.
     // Otherwise, set msg to indicate the error, leave flag unchanged,
-    // and return false.  msg can be NULL.
-    bool SetFlagLocked(CommandLineFlag * flag, const char * value, FlagSettingMode set_mode, string * msg);
+    // and return false.  msg can be NULL.  If report_change is false,
+    // msg is only ever set to errors, so that successfully setting a
+    // flag doesn't format a message nobody reads.
+    bool SetFlagLocked(CommandLineFlag * flag, const char * value, FlagSettingMode set_mode, string * msg, bool report_change = true);
+
+    // The same, for a value that's already been parsed into a FlagValue
+    // of the flag's type.
+    bool SetFlagLocked(CommandLineFlag * flag, const FlagValue & value, FlagSettingMode set_mode, string * msg, bool report_change = true);
+
+    // The same again, for a value that was already checked against the
+    // flag's allowed values and validator (by TryParseLocked()), which
+    // aren't run again, so it can't fail.  For FlagTransaction, whose
+    // settings must not fail halfway through.
+    void SetValidatedFlagLocked(CommandLineFlag * flag, const FlagValue & value, FlagSettingMode set_mode, string * msg, bool report_change = true);
+
+    // Notes that the current value of flag changed, if anybody watches
+    // it.  Its watchers are called when the lock is released, once no
+    // matter how many times the flag changed.  SetFlagLocked() takes
+    // care of this; it's only for code that changes flags otherwise.
+    void NoteChangeLocked(CommandLineFlag * flag);
+
+    // All the flags, sorted first by the (cleaned) filename they are
+    // defined in, then by name: the order of GetAllFlags() and
+    // ForEachFlag().  This is only sorted the first time somebody asks
+    // for it after a RegisterFlag(), and holding the shared lock is
+    // enough.
+    typedef vector<CommandLineFlag *> FlagList;
+    const FlagList & SortedByFileFlagsLocked();
+
+    // The files the flags are defined in, in the same order, each with
+    // the range [begin, end) of SortedByFileFlagsLocked() that holds its
+    // flags: --helpon and the like match each file once, and skip the
+    // flags of the files that don't match.
+    struct FlagFile
+    {
+        const char * filename; // as CleanFileName()
+        size_t begin;
+        size_t end;
+    };
+    typedef vector<FlagFile> FlagFileList;
+    const FlagFileList & FlagFilesLocked();
+
+    // The same, sorted by name only: the flags whose names start with
+    // some prefix are a range of it (see jflags_completions.cc).
+    const FlagList & SortedByNameFlagsLocked();
+
+    // Appends the flags that were set (see SerializeFlagState()) to
+    // *state, and sets them back from the size bytes at state.
+    // Restoring returns false, with the reason in *msg, if some flag
+    // couldn't be set; in FlagState.cc.
+    void SerializeStateLocked(string * state);
+    bool RestoreStateLocked(const char * state, size_t size, string * msg);
 
     static FlagRegistry * GlobalRegistry(); // returns a singleton registry
 
@@ -107,30 +246,130 @@ private:
     friend class FlagSaverImpl; // reads all the flags in order
                                                   // to copy them
     friend class CommandLineFlagParser;           // for ValidateAllFlags
-    friend void GetAllFlags(vector<CommandLineFlagInfo> *);
 
-    // The map from name to flag, for FindFlagLocked().
-    typedef map<const char *, CommandLineFlag *, StringCmp> FlagMap;
-    typedef FlagMap::iterator FlagIterator;
-    typedef FlagMap::const_iterator FlagConstIterator;
-    FlagMap flags_;
+    // All the flags, in registration order.  This is what owns them.
+    typedef FlagList::iterator FlagIterator;
+    typedef FlagList::const_iterator FlagConstIterator;
+    FlagList flags_;
+
+    // The open-addressing hash index from name to flag, for
+    // FindFlagLocked().  Each slot keeps the hash of the flag name next
+    // to the flag, so a probe only touches the flag (and its name) when
+    // the hashes match.  The number of slots is a power of two and is
+    // kept at least twice the number of flags; a NULL flag marks an
+    // empty slot.
+    struct FlagSlot
+    {
+        FlagSlot() : hash(0), flag(NULL) {}
+        uint32 hash;
+        CommandLineFlag * flag;
+    };
+    static const size_t kMinSlots = 64;
+    vector<FlagSlot> slots_;
+
+    static uint32 HashFlagName(const char * name, size_t name_len);
+    void InsertSlotLocked(uint32 hash, CommandLineFlag * flag);
+    void ResizeSlotsLocked(size_t num_slots);
+
+    // What RegisterFlag() does, under the lock.
+    void AddFlagLocked(CommandLineFlag * flag);
+    CommandLineFlag * CreateFlagLocked(const FlagTableEntry & entry, AtomicStringFlag * atomic_string);
+
+    // The flags this registry creates itself, and their values.
+    FlagArena arena_;
+
+    // The distinct CleanFileName()s of the flags, sorted by strcmp, so
+    // that the flags of a file share one pointer to it, however many
+    // times __FILE__ was spelled out.  They point into the flags' own
+    // file names, which outlive the registry, so nothing is copied.
+    vector<const char *> filenames_;
+    const char * InternFilenameLocked(const CommandLineFlag * flag);
+
+    // The same kind of hash index, from the current-value pointer to
+    // the flag, for FindFlagViaPtrLocked().  An atomic string flag is
+    // in there twice: its AtomicStringFlag leads to it too.
+    struct FlagPtrSlot
+    {
+        FlagPtrSlot() : ptr(NULL), flag(NULL) {}
+        const void * ptr;
+        CommandLineFlag * flag;
+    };
+    vector<FlagPtrSlot> ptr_slots_;
+    size_t num_ptrs_;
+
+    static size_t HashFlagPtr(const void * ptr);
+    void AddFlagPtrLocked(const void * ptr, CommandLineFlag * flag);
+
+    // The flags that have a validator, sorted by name, for
+    // ValidateAllFlags().  Picking them out is one pass over flags_,
+    // in the order of the arena, that only looks at the first few
+    // fields of each flag.
+    void ValidatedFlagsLocked(FlagList * flags) const;
+
+    // The same for SortedByFileFlagsLocked(), FlagFilesLocked() and
+    // SortedByNameFlagsLocked().  Readers only hold the registry lock
+    // shared, so sorted_lock_ makes sure only one of them does the
+    // sorting.
+    FlagList sorted_by_file_flags_;
+    FlagFileList flag_files_;
+    bool sorted_by_file_flags_valid_;
+    void SortByFileLocked(); // requires sorted_lock_
+    FlagList sorted_by_name_flags_;
+    bool sorted_by_name_flags_valid_;
+    Mutex sorted_lock_;
 
-    // The map from current-value pointer to flag, fo FindFlagViaPtrLocked().
-    typedef map<const void *, CommandLineFlag *> FlagPtrMap;
-    FlagPtrMap flags_by_ptr_;
+    // A hash of the names and types of the flags, in registration
+    // order: the state of a process with the same fingerprint refers
+    // to its flags by their index in flags_.
+    uint32 layout_fingerprint_;
+
+    // The watched flags that changed since the lock was taken, for
+    // Unlock() to report.
+    FlagList changed_flags_;
+    void UnlockAndNotify();
+
+    // The copy of all the flags that FlagSavers save against, or NULL
+    // before the first FlagSaver.  See FlagSaverImpl.
+    FlagSnapshot * saver_snapshot_;
 
     static FlagRegistry * global_registry_; // a singleton registry
 
     Mutex lock_;
     static Mutex global_registry_lock_;
 
+    // When the lock was last taken exclusively, while the statistics
+    // were enabled, or 0.
+    int64 locked_at_;
+
     static void InitGlobalRegistry();
 
+    bool SetFlagLockedImpl(CommandLineFlag * flag, const char * text, const FlagValue * value, bool validate, FlagSettingMode set_mode, string * msg, bool report_change);
+    bool SetFlagValueLocked(CommandLineFlag * flag, const char * text, const FlagValue * value, bool validate, FlagSettingMode set_mode, string * msg, bool report_change);
+
     // Disallow
     FlagRegistry(const FlagRegistry &);
     FlagRegistry & operator=(const FlagRegistry &);
 };
 
+// Parses value, checks it against flag's validator, and copies it into
+// flag_value, a FlagValue of flag's type.  Returns false, leaving
+// flag_value alone, if value doesn't parse or doesn't validate.  msg
+// is appended the error, or the new value if report_change, and can be
+// NULL.  Requires the registry lock of flag.
+bool TryParseLocked(const CommandLineFlag * flag, FlagValue * flag_value, const char * value, string * msg, bool report_change);
+
+// The value of flag in the current overlay of the calling thread, or
+// NULL if that doesn't override it (see FlagOverlay.h).  Defined in
+// FlagOverlay.cc.
+const FlagValue * OverlaidValue(const CommandLineFlag * flag);
+
+// The value of flag the calling thread sees through its overlay.
+inline const FlagValue & VisibleValue(const CommandLineFlag * flag)
+{
+    const FlagValue * const overlaid = OverlaidValue(flag);
+    return overlaid != NULL ? *overlaid : flag->current();
+}
+
 class FlagRegistryLock
 {
 public:
@@ -141,6 +380,16 @@ private:
     FlagRegistry * const fr_;
 };
 
+class FlagRegistryReaderLock
+{
+public:
+    explicit FlagRegistryReaderLock(FlagRegistry * fr) : fr_(fr) { fr_->ReaderLock(); }
+    ~FlagRegistryReaderLock() { fr_->ReaderUnlock(); }
+
+private:
+    FlagRegistry * const fr_;
+};
+
 } // namespace JFLAGS_NAMESPACE
 
 #endif // JFLAGS_FLAG_REGISTRY_H_
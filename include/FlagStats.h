@@ -0,0 +1,94 @@
+////////////////////////////////////////////////////////////////////////////////
+//                                    jflags
+//
+// This file is distributed under the 3-clause Berkeley Software Distribution
+// License. See LICENSE.txt for details.
+////////////////////////////////////////////////////////////////////////////////
+// --------------------------------------------------------------------
+// What the rest of jflags calls to keep the statistics of
+// jflags_stats.h.  Timing a stage only takes two clock readings, so
+// it's always done; the rest is only counted while enabled, which
+// FlagsStatsEnabled() tells without taking any lock.
+// --------------------------------------------------------------------
+#ifndef JFLAGS_FLAG_STATS_H_
+#define JFLAGS_FLAG_STATS_H_
+
+#include "jflags_declare.h" // IWYU pragma: export
+#include "jflags_atomic.h"
+
+#include <stddef.h>
+
+namespace JFLAGS_NAMESPACE {
+
+enum FlagsStage
+{
+    STAGE_REGISTRATION,
+    STAGE_PARSING,
+    STAGE_FLAGFILES,
+    STAGE_FROMENV,
+    STAGE_VALIDATION,
+    STAGE_HELP,
+    STAGE_SOURCES,
+    NUM_FLAGS_STAGES
+};
+
+// Nanoseconds, by a clock that doesn't go back.
+int64 StatsNanos();
+
+extern bool flags_stats_enabled;
+inline bool FlagsStatsEnabled()
+{
+    return atomic_internal::LoadRelaxed(&flags_stats_enabled);
+}
+
+void NoteStage(FlagsStage stage, int64 nanos);
+void NoteFlagfileBytes(size_t bytes);
+void NoteFlagSourceAdded();
+void NoteFlagSourceDone(bool applied);
+
+// Only to be called while FlagsStatsEnabled().
+void NoteLockWait(int64 wait_nanos);
+void NoteLockHold(int64 hold_nanos);
+void NoteFlagAccess(const char * name, bool is_set);
+
+inline void NoteFlagRead(const char * name)
+{
+    if (FlagsStatsEnabled())
+        NoteFlagAccess(name, false);
+}
+
+inline void NoteFlagSet(const char * name)
+{
+    if (FlagsStatsEnabled())
+        NoteFlagAccess(name, true);
+}
+
+// Times a stage for as long as it lives.  For a stage that can run
+// itself (--fromenv can name a --flagfile that has a --fromenv...),
+// depth counts how deep it is, and only the outermost run is timed.
+class StageTimer
+{
+public:
+    explicit StageTimer(FlagsStage stage, int * depth = NULL)
+    : stage_(stage), depth_(depth), start_(depth == NULL || (*depth)++ == 0 ? StatsNanos() : 0)
+    {
+    }
+    ~StageTimer()
+    {
+        if (depth_ == NULL || --(*depth_) == 0)
+            NoteStage(stage_, StatsNanos() - start_);
+    }
+
+private:
+    const FlagsStage stage_;
+    int * const depth_;
+    const int64 start_;
+
+    // Disallow
+    StageTimer(const StageTimer &);
+    StageTimer & operator=(const StageTimer &);
+};
+
+} // namespace JFLAGS_NAMESPACE
+
+#endif // JFLAGS_FLAG_STATS_H_
@@ -6,16 +6,19 @@
 ////////////////////////////////////////////////////////////////////////////////
 // --------------------------------------------------------------------
 // FlagValue holds the current value of a flag.  It's
-// pseudo-templatized: every operation on a FlagValue is typed.  It
-// also deals with storage-lifetime issues (so flag values don't go
-// away in a destructor), which is why we need a whole class to hold a
-// variable's value.
+// pseudo-templatized: every operation on a FlagValue is typed, and
+// goes through the table of operations of its type (see FlagValue.cc),
+// which it picks once, when it's constructed.  It also deals with
+// storage-lifetime issues (so flag values don't go away in a
+// destructor), which is why we need a whole class to hold a variable's
+// value.
 // --------------------------------------------------------------------
 #ifndef JFLAGS_FLAG_VALUE_H_
 #define JFLAGS_FLAG_VALUE_H_
 
 #include "jflags_validator.h" // For ValidateFnProto
 #include "jflags_declare.h" // IWYU pragma: export
+#include "jflags_atomic.h"
 #include "util.h"
 
 #include <string>
@@ -32,54 +35,140 @@ using std::string;
 // --------------------------------------------------------------------
 
 class CommandLineFlag;
+struct FlagValueOps;
 class FlagValue
 {
 public:
+    enum ValueType
+    {
+        FV_BOOL = 0,
+        FV_INT32 = 1,
+        FV_UINT32 = 2,
+        FV_INT64 = 3,
+        FV_UINT64 = 4,
+        FV_DOUBLE = 5,
+        FV_STRING = 6,
+        FV_MAX_INDEX = 6,
+    };
+
     FlagValue(void * valbuf, const char * type, bool transfer_ownership_of_value);
+    FlagValue(void * valbuf, ValueType type, bool transfer_ownership_of_value);
     ~FlagValue();
 
+    // Sets *type to the type named type_name ("int32", etc.) and
+    // returns true, or returns false if there's no such type.
+    static bool TypeOfName(const char * type_name, ValueType * type);
+
+    ValueType type() const { return static_cast<ValueType>(type_); }
+
+    // Sets the value from its text, which is spec, or the len bytes at
+    // spec, which then needn't be NUL-terminated.  Returns false, with
+    // the value left alone, if the text isn't a valid value of the type.
     bool ParseFrom(const char * spec);
+    bool ParseFrom(const char * spec, size_t len);
     string ToString() const;
 
+    // Writes the same text as ToString() into buf, without allocating.
+    // Like snprintf(), returns the length of the full text, and the
+    // text was truncated iff that is >= size.
+    size_t FormatInto(char * buf, size_t size) const;
+
+    // Appends the same text as ToString() to *output, without a
+    // temporary string.
+    void AppendValueTo(string * output) const;
+
+    // If the value is of exactly the type of *OUTPUT, copies it there
+    // and returns true.  Otherwise returns false and leaves it unchanged.
+    bool GetValue(bool * OUTPUT) const;
+    bool GetValue(int32 * OUTPUT) const;
+    bool GetValue(uint32 * OUTPUT) const;
+    bool GetValue(int64 * OUTPUT) const;
+    bool GetValue(uint64 * OUTPUT) const;
+    bool GetValue(double * OUTPUT) const;
+    bool GetValue(string * OUTPUT) const;
+    // A string value shared, rather than copied (see shared_).
+    bool GetValue(AtomicStringFlag::Snapshot * OUTPUT) const;
+
+    // Makes CopyFrom() set the value with atomic stores, because
+    // other threads read it directly (see jflags_atomic.h).  A string
+    // is also published to *atomic_string, whenever it's set.
+    void MakeAtomic(AtomicStringFlag * atomic_string);
+
 private:
     friend class CommandLineFlag;                 // for many things, including Validate()
     friend class FlagSaverImpl; // calls New()
     friend class FlagRegistry;                    // checks value_buffer_ for flags_by_ptr_ map
+    friend class Flagfile;                        // reads value_buffer_ for precompiled flagfiles
+    friend class FlagConstraint;                  // for New(), CopyFrom() and Between()
     template <typename T>
-    friend T GetFromEnv(const char *, const char *, T);
-    friend bool TryParseLocked(const CommandLineFlag *, FlagValue *, const char *, string *); // for New(), CopyFrom()
+    friend T GetFromEnv(const char *, T);
+    friend bool TryAssignLocked(const CommandLineFlag *, FlagValue *, const FlagValue &, bool, string *, bool); // for CopyFrom()
+    friend bool TryParseLocked(const CommandLineFlag *, FlagValue *, const char *, string *, bool);       // for TakeFrom()
 
-    enum ValueType
-    {
-        FV_BOOL = 0,
-        FV_INT32 = 1,
-        FV_UINT32 = 2,
-        FV_INT64 = 3,
-        FV_UINT64 = 4,
-        FV_DOUBLE = 5,
-        FV_STRING = 6,
-        FV_MAX_INDEX = 6,
-    };
     const char * TypeName() const;
     bool Equal(const FlagValue & x) const;
+    bool Between(const FlagValue & min, const FlagValue & max) const; // of a numeric type
     FlagValue * New() const; // creates a new one with default value
     void CopyFrom(const FlagValue & x);
+    // CopyFrom(), but x may be left with any value: a string is swapped
+    // in, instead of copied.
+    void TakeFrom(FlagValue * x);
     int ValueSize() const;
 
+    // Formats a value of any type but string into buf, which holds
+    // kScalarBufferSize bytes, NUL-terminated, and returns its length.
+    static const size_t kScalarBufferSize = 32;
+    size_t FormatScalar(char * buf) const;
+
     // Calls the given validate-fn on value_buffer_, and returns
     // whatever it returns.  But first casts validate_fn_proto to a
     // function that takes our value as an argument (eg void
     // (*validate_fn)(bool) for a bool flag).
     bool Validate(const char * flagname, ValidateFnProto validate_fn_proto) const;
 
-    void * value_buffer_; // points to the buffer holding our data
-    int8 type_;           // how to interpret value_
-    bool owns_value_;     // whether to free value on destruct
+    // The immutable string shares_value_ points to, or else NULL or a
+    // copy of the string value, for SharedCopy(), which stays good for
+    // as long as the value is equal to it.  The copies jflags makes of
+    // a string flag (for a FlagSaver, say) share the flag's value this
+    // way, rather than copying it: if the flag hasn't changed since
+    // the last copy, a new one only costs comparing them.  Only values
+    // that jflags owns (not those of FLAGS_foo) share their value.
+    SharedFlagString * SharedCopy() const; // a new reference to it
+    void ReleaseValue();
+    // Gets a string value ready to be overwritten in place: gives it an
+    // empty string of its own if it shares one, and drops shared_.
+    void Unshare();
+
+    void * value_buffer_;      // points to the buffer holding our data
+    const FlagValueOps * ops_; // what to do with it
+    int8 type_;                // how to interpret value_
+    bool owns_value_;     // whether to free value on destruct (through shared_, if shared)
+    bool atomic_;         // whether the value is read without the lock
+    bool shares_value_;   // whether value_buffer_ is shared_'s string
+    AtomicStringFlag * atomic_string_; // where a string is published, if atomic_
+    mutable SharedFlagString * shared_;
 
     FlagValue(const FlagValue &); // no copying!
     void operator=(const FlagValue &);
 };
 
+// The immutable strings that atomic string flags publish, and that the
+// copies of string flags share (see FlagValue::shared_), with the count
+// of their owners.  Defined in jflags_atomic.cc.
+string * SharedFlagStringValue(SharedFlagString * shared);
+void RefSharedFlagString(SharedFlagString * shared);
+void UnrefSharedFlagString(SharedFlagString * shared); // NULL is ok
+
+// Returns a new reference to a shared string equal to value: *cache,
+// if it is, or else a new one, which then replaces it, and lets go of
+// the old one.  Several threads may share through the same cache at
+// once, as long as none of them lets go of it meanwhile.
+SharedFlagString * ShareFlagString(SharedFlagString ** cache, const string & value);
+
+// Replaces the value of an atomic string flag with value, taking over
+// the reference given.  Only one thread at a time may call this for a
+// given flag; jflags does under the registry lock.
+void PublishAtomicString(AtomicStringFlag * flag, SharedFlagString * value);
 
 } // namespace JFLAGS_NAMESPACE
 
@@ -0,0 +1,202 @@
+////////////////////////////////////////////////////////////////////////////////
+//                                    jflags
+//
+// This file is distributed under the 3-clause Berkeley Software Distribution
+// License. See LICENSE.txt for details.
+////////////////////////////////////////////////////////////////////////////////
+// --------------------------------------------------------------------
+// Flagfile holds the contents of a flagfile, split up into the lines
+// that mean something to CommandLineFlagParser.  The whole file is
+// read into a single buffer, and lines are tokenized in place: each
+// line is NUL-terminated where it stands, so there's no per-line
+// copying or allocation.  Tokenizing is one pass over the buffer (see
+// ByteScan.h), which finds where the name of each flag ends on the way
+// to the end of its line.
+// --------------------------------------------------------------------
+#ifndef JFLAGS_FLAGFILE_H_
+#define JFLAGS_FLAGFILE_H_
+#include "jflags_declare.h" // IWYU pragma: export
+#include "util.h"
+
+#include <stddef.h>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace JFLAGS_NAMESPACE {
+
+class CommandLineFlag;
+
+using std::string;
+using std::vector;
+
+// --------------------------------------------------------------------
+// Flagfile
+//    Each line of a flagfile can be one of four things:
+//    1) A comment line -- we skip it
+//    2) An empty line -- we skip it
+//    3) A list of filenames -- starts a new filenames+flags section
+//    4) A --flag=value line -- apply if previous filenames match
+//    Only 3) and 4) end up in lines().  Leading whitespace is
+//    stripped from every line, as are the leading dashes of a flag.
+//       A flagfile can also be precompiled into a binary format (see
+//    CompileFlagfile()), which is recognized by its header.  Loading
+//    one skips tokenizing, and its flag lines carry values that were
+//    already parsed for the flag's type.
+// --------------------------------------------------------------------
+
+class Flagfile
+{
+public:
+    struct Line
+    {
+        bool is_flag;        // 4) above if true, 3) if false
+        int8 value_type;     // FlagValue::ValueType of value, or -1
+        mutable int8 match;  // of 3), see CommandLineFlagParser::GlobsMatchProgram()
+        uint32 name_size;    // of a flag line: the size of the name, up to any '='
+        const char * text;   // "flag=value", or the list of filenames
+        const void * value;  // the precompiled value in the flag's type, or NULL
+    };
+
+    Flagfile();
+    ~Flagfile();
+
+    // Reads and tokenizes the named file.  Like the rest of flagfile
+    // handling, dies if the file can't be read.
+    void ReadFile(const char * filename);
+
+    // The same, but returns false instead, leaving no lines, if the
+    // file can't be read or is a corrupt precompiled flagfile.
+    bool TryReadFile(const char * filename);
+
+    // Tokenizes a copy of the given flagfile contents.
+    void Assign(const char * contents, size_t size);
+
+    const vector<Line> & lines() const { return lines_; }
+
+    // Identifies the version of the file that was read: device, inode,
+    // size and modification time.  All zero if unknown.
+    struct Stamp
+    {
+        Stamp() : device(0), inode(0), size(0), mtime(0), mtime_nsec(0) {}
+        bool operator==(const Stamp & x) const;
+        uint64 device, inode, size;
+        int64 mtime, mtime_nsec;
+    };
+    const Stamp & stamp() const { return stamp_; }
+
+    // Sets *stamp to the current stamp of the named file, and returns
+    // true, or returns false if it can't be determined.
+    static bool StatFile(const char * filename, Stamp * stamp);
+
+    // The number of bytes of flagfile contents.
+    size_t size() const { return size_; }
+
+    // Writes the named text flagfile out in the precompiled format.
+    // Flag values are parsed for the type of the flag of that name in
+    // this program; lines for unknown flags, string flags, or values
+    // that don't parse are kept as text.  Returns false if the output
+    // can't be written.
+    static bool Compile(const char * text_filename, const char * binary_filename);
+
+private:
+    bool ReadContents(const char * filename);
+
+    // These return NULL, or what's wrong with a precompiled flagfile.
+    const char * Tokenize();
+    const char * Decode();
+
+    char * buffer_; // size_ bytes of contents, plus a terminating NUL
+    size_t size_;
+    vector<Line> lines_;
+    Stamp stamp_;
+
+    Flagfile(const Flagfile &); // no copying!
+    void operator=(const Flagfile &);
+};
+
+// --------------------------------------------------------------------
+// FlagfileHandle
+//    Reads a flagfile through the process-wide flagfile cache, if it's
+//    enabled (see EnableFlagfileCache()), or straight from disk
+//    otherwise.  A cached file is only reused while the file's
+//    device, inode, size and modification time stay the same, in which
+//    case opening it again skips both the I/O and the tokenizing.
+//       The handle holds a reference to the file, so a file that's
+//    replaced in the cache while it's still being applied (think of a
+//    nested --flagfile that was edited meanwhile) stays around until
+//    the handle goes away.  Thread-safe.
+// --------------------------------------------------------------------
+
+struct CachedFlagfile;
+class FlagfilePrefetch;
+class FlagfileHandle
+{
+public:
+    // Like Flagfile::ReadFile(), dies if the file can't be read.  Takes
+    // the file from prefetch instead, if it was read there.
+    explicit FlagfileHandle(const char * filename, FlagfilePrefetch * prefetch = NULL);
+    ~FlagfileHandle();
+
+    const Flagfile & operator*() const;
+    const Flagfile * operator->() const { return &**this; }
+
+private:
+    CachedFlagfile * file_;
+
+    FlagfileHandle(const FlagfileHandle &); // no copying!
+    void operator=(const FlagfileHandle &);
+};
+
+// --------------------------------------------------------------------
+// FlagfilePrefetch
+//    Reads a list of flagfiles ahead of their being applied, along with
+//    the flagfiles they name with --flagfile (in the sections that
+//    apply to this program), and those they name in turn.  The files
+//    of each level of nesting are read at once, on up to num_threads
+//    threads, the way FlagfileHandle reads them.  Nothing here touches
+//    the registry, so it can be done without its lock.  The files are
+//    still applied one at a time, in order, by CommandLineFlagParser;
+//    a file that couldn't be read is left for FlagfileHandle to read
+//    again, and report.  Without threads, nothing is read ahead.
+// --------------------------------------------------------------------
+
+class FlagfilePrefetch
+{
+public:
+    explicit FlagfilePrefetch(int num_threads) : num_threads_(num_threads) {}
+    ~FlagfilePrefetch();
+
+    // Reads the files that weren't read yet, then the ones they name.
+    void Fetch(const vector<string> & filenames);
+
+private:
+    friend class FlagfileHandle;
+    CachedFlagfile * Take(const string & filename); // a new reference, or NULL
+
+    const int num_threads_;
+    std::map<string, CachedFlagfile *> files_; // NULL if it couldn't be read
+
+    FlagfilePrefetch(const FlagfilePrefetch &); // no copying!
+    void operator=(const FlagfilePrefetch &);
+};
+
+// --------------------------------------------------------------------
+// NoteFlagfileForReloading()
+// ForgetFlagfilesForReloading()
+//    The files read for --flagfile are remembered, for
+//    ReloadChangedFlagfiles() to watch, along with whether each was
+//    named outside of any flagfile; in FlagfileReloader.cc.
+//    Thread-safe.
+// IsRecursiveFlag()
+//    --flagfile, --fromenv and --tryfromenv, which reloads and flag
+//    segments leave alone.
+// --------------------------------------------------------------------
+
+void NoteFlagfileForReloading(const string & filename, bool top_level);
+void ForgetFlagfilesForReloading();
+bool IsRecursiveFlag(const CommandLineFlag * flag);
+
+} // namespace JFLAGS_NAMESPACE
+
+#endif // JFLAGS_FLAGFILE_H_
@@ -8,7 +8,9 @@
 #define JFLAGS_ACCESS_H_
 
 #include "jflags_declare.h" // IWYU pragma: export
+#include "jflags_atomic.h"
 #include "jflags_infos.h"
+#include <stddef.h>
 #include <string>
 
 namespace JFLAGS_NAMESPACE {
@@ -27,9 +29,76 @@ namespace JFLAGS_NAMESPACE {
 // OUTPUT is set to the flag's value, or unchanged if we return false.
 extern JFLAGS_DLL_DECL bool GetCommandLineOption(const char * name, std::string * OUTPUT);
 
+// The same, without going through a std::string: writes the flag's value
+// as a NUL-terminated string into buf, which holds size bytes.  Return
+// true iff the flagname was found and the whole value fit into buf.
+extern JFLAGS_DLL_DECL bool GetCommandLineOptionInto(const char * name, char * buf, size_t size);
+
+// GetFlagValue reads a flag's value by name without converting it to
+// text and back.  Return true iff the flagname was found and the flag
+// has exactly the type of OUTPUT (an int32 flag can't be read as int64).
+// OUTPUT is set to the flag's value, or unchanged if we return false.
+// Example usage, from code that doesn't see DECLARE_int32(port):
+//   int32 port = 80;
+//   GetFlagValue("port", &port);
+// or, returning the given default if there's no such flag:
+//   int32 port = GetFlagValue<int32>("port", 80);
+extern JFLAGS_DLL_DECL bool GetFlagValue(const char * name, bool * OUTPUT);
+extern JFLAGS_DLL_DECL bool GetFlagValue(const char * name, int32 * OUTPUT);
+extern JFLAGS_DLL_DECL bool GetFlagValue(const char * name, uint32 * OUTPUT);
+extern JFLAGS_DLL_DECL bool GetFlagValue(const char * name, int64 * OUTPUT);
+extern JFLAGS_DLL_DECL bool GetFlagValue(const char * name, uint64 * OUTPUT);
+extern JFLAGS_DLL_DECL bool GetFlagValue(const char * name, double * OUTPUT);
+extern JFLAGS_DLL_DECL bool GetFlagValue(const char * name, std::string * OUTPUT);
+
+// Reads a string flag without copying its value: the snapshot shares
+// it, and stays the same whatever happens to the flag meanwhile (see
+// jflags_atomic.h).  Reading a flag that hasn't changed since it was
+// last read, or copied by jflags (a FlagSaver, say), costs comparing
+// the value, not allocating.  Works for any string flag, atomic or not.
+//   AtomicStringFlag::Snapshot routes;
+//   if (GetFlagValue("routes", &routes)) Load(*routes);
+extern JFLAGS_DLL_DECL bool GetFlagValue(const char * name, AtomicStringFlag::Snapshot * OUTPUT);
+
+template <typename T>
+inline T GetFlagValue(const char * name, const T & default_value = T())
+{
+    T value = default_value;
+    GetFlagValue(name, &value);
+    return value;
+}
+
+// A FlagHandle looks a flag up by name once, so that code reading the
+// same flag over and over doesn't pay for the lookup every time.  It
+// reads the flag the same way GetFlagValue() does.  A handle for a name
+// that isn't a flag is !valid(), and all its getters return false.
+// Handles stay usable until ShutDownCommandLineFlags().
+class CommandLineFlag;
+class JFLAGS_DLL_DECL FlagHandle
+{
+public:
+    explicit FlagHandle(const char * name);
+
+    bool valid() const { return flag_ != NULL; }
+
+    bool Get(bool * OUTPUT) const;
+    bool Get(int32 * OUTPUT) const;
+    bool Get(uint32 * OUTPUT) const;
+    bool Get(int64 * OUTPUT) const;
+    bool Get(uint64 * OUTPUT) const;
+    bool Get(double * OUTPUT) const;
+    bool Get(std::string * OUTPUT) const;
+    bool Get(AtomicStringFlag::Snapshot * OUTPUT) const;
+    bool GetInto(char * buf, size_t size) const; // see GetCommandLineOptionInto()
+
+private:
+    const CommandLineFlag * flag_;
+};
+
 // Return true iff the flagname was found. OUTPUT is set to the flag's
 // CommandLineFlagInfo or unchanged if we return false.
 extern JFLAGS_DLL_DECL bool GetCommandLineFlagInfo(const char * name, CommandLineFlagInfo * OUTPUT);
+extern JFLAGS_DLL_DECL bool GetCommandLineFlagInfo(const char * name, CompactFlagInfo * OUTPUT);
 
 // Return the CommandLineFlagInfo of the flagname.  exit() if name not found.
 // Example usage, to check if a flag's value is currently the default value:
@@ -61,6 +130,44 @@ enum JFLAGS_DLL_DECL FlagSettingMode
 extern JFLAGS_DLL_DECL std::string SetCommandLineOption(const char * name, const char * value);
 extern JFLAGS_DLL_DECL std::string SetCommandLineOptionWithMode(const char * name, const char * value, FlagSettingMode set_mode);
 
+// A FlagTransaction sets several flags together: either all of them
+// are set, or none are.  Set() only queues a setting; Commit() looks up,
+// parses and validates all the queued values first, and only if they
+// are all good sets them all, under a single acquisition of the
+// registry lock, so that the programmatic getters never see half of
+// them.  (As ever, FLAGS_foo readers get no such guarantee.)
+// The recursive flags (--flagfile, --fromenv, --tryfromenv) are set
+// like any other string flag, without reading the files or the
+// environment.  Example usage:
+//   FlagTransaction txn;
+//   txn.Set("port", "8080");
+//   txn.Set("host", "example.com");
+//   std::string errors;
+//   if (!txn.Commit(&errors)) ...
+class JFLAGS_DLL_DECL FlagTransaction
+{
+public:
+    FlagTransaction();
+    ~FlagTransaction();
+
+    // Queues setting flag name to value, the way SetCommandLineOptionWithMode()
+    // would.  name and value are copied.  Settings are applied in order.
+    void Set(const char * name, const char * value, FlagSettingMode set_mode = SET_FLAGS_VALUE);
+
+    // Applies all the queued settings, then forgets them.  Returns true
+    // iff they were all applied; if false, no flag was changed.  If msg
+    // is not NULL, it's set to what SetCommandLineOptionWithMode() would
+    // have returned for each setting, or to the errors if false; with
+    // msg NULL, no messages are formatted at all.
+    bool Commit(std::string * msg = NULL);
+
+private:
+    class FlagTransactionImpl * impl_; // we use pimpl here to keep API steady
+
+    FlagTransaction(const FlagTransaction &); // no copying!
+    void operator=(const FlagTransaction &);
+};
+
 } // namespace JFLAGS_NAMESPACE
 
 #endif // JFLAGS_ACCESS_H_
@@ -0,0 +1,269 @@
+////////////////////////////////////////////////////////////////////////////////
+//                                    jflags
+//
+// This file is distributed under the 3-clause Berkeley Software Distribution
+// License. See LICENSE.txt for details.
+////////////////////////////////////////////////////////////////////////////////
+// --------------------------------------------------------------------
+// The types of the flags defined with DEFINE_atomic_*, whose value
+// can be read directly by any thread while jflags sets it.
+// --------------------------------------------------------------------
+#ifndef JFLAGS_ATOMIC_H_
+#define JFLAGS_ATOMIC_H_
+
+#include <string>
+
+#include "jflags_declare.h" // IWYU pragma: export
+
+#if !defined(__ATOMIC_RELAXED) && defined(_MSC_VER)
+#include <intrin.h>
+#include <string.h>
+#endif
+
+namespace JFLAGS_NAMESPACE {
+
+// --------------------------------------------------------------------
+// A plain flag, FLAGS_foo, is an ordinary variable: reading it while
+// another thread calls SetCommandLineOption(), reads a flagfile or
+// destroys a FlagSaver is a data race.  An atomic flag is read
+// with FLAGS_foo.load() (or just FLAGS_foo, for scalars), which can
+// be done from any thread at any time, without a lock: jflags
+// updates the value with atomic stores.  The loads and stores are
+// relaxed, so while a reader always sees a whole value, it isn't
+// ordered with anything else.
+//
+// The value of an atomic flag can only be changed through jflags
+// (SetCommandLineOption() and friends, a flagfile, a FlagSaver),
+// which also keeps the validators and watchers of the flag informed.
+//
+// Example use:
+//    DEFINE_atomic_int32(max_connections, 100, "Connections to accept");
+//    DEFINE_atomic_string(banner, "hello", "What to greet clients with");
+//    ...
+//    if (num_connections < FLAGS_max_connections) {
+//       AtomicStringFlag::Snapshot banner = FLAGS_banner.load();
+//       Send(banner->data(), banner->size());
+//    }
+// --------------------------------------------------------------------
+
+namespace atomic_internal {
+
+// Loads and stores of a whole bool, int32, ..., double that are
+// atomic, but don't order anything else.
+#if defined(__ATOMIC_RELAXED) // gcc >= 4.7, clang
+
+#define JFLAGS_ATOMIC_ALIGNED(T) __attribute__((aligned(sizeof(T))))
+
+template <typename T>
+inline T LoadRelaxed(const T * p)
+{
+    T value;
+    __atomic_load(p, &value, __ATOMIC_RELAXED);
+    return value;
+}
+
+template <typename T>
+inline void StoreRelaxed(T * p, T value)
+{
+    __atomic_store(p, &value, __ATOMIC_RELAXED);
+}
+
+#elif defined(_MSC_VER)
+
+// Visual C++ aligns 8-byte types on 8 bytes, and accesses the naturally
+// aligned values of up to the size of a pointer in one go.  On 32-bit
+// x86, 8-byte values take an interlocked instruction.
+#define JFLAGS_ATOMIC_ALIGNED(T)
+
+template <typename T>
+inline T LoadRelaxed(const T * p)
+{
+#if defined(_M_IX86)
+    if (sizeof(T) == 8)
+    {
+        const __int64 bits = _InterlockedCompareExchange64(reinterpret_cast<volatile __int64 *>(const_cast<T *>(p)), 0, 0);
+        T value;
+        memcpy(&value, &bits, sizeof(value));
+        return value;
+    }
+#endif
+    return *static_cast<const volatile T *>(p);
+}
+
+template <typename T>
+inline void StoreRelaxed(T * p, T value)
+{
+#if defined(_M_IX86)
+    if (sizeof(T) == 8)
+    {
+        __int64 bits = 0;
+        memcpy(&bits, &value, sizeof(value));
+        volatile __int64 * target = reinterpret_cast<volatile __int64 *>(p);
+        for (__int64 old = *target; _InterlockedCompareExchange64(target, bits, old) != old; old = *target)
+        {
+        }
+        return;
+    }
+#endif
+    *static_cast<volatile T *>(p) = value;
+}
+
+#else // older gcc, and the rest: what fits in a register is accessed at once
+
+#if defined(__GNUC__)
+#define JFLAGS_ATOMIC_ALIGNED(T) __attribute__((aligned(sizeof(T))))
+#else
+#define JFLAGS_ATOMIC_ALIGNED(T)
+#endif
+
+template <typename T>
+inline T LoadRelaxed(const T * p)
+{
+    return *static_cast<const volatile T *>(p);
+}
+
+template <typename T>
+inline void StoreRelaxed(T * p, T value)
+{
+    *static_cast<volatile T *>(p) = value;
+}
+
+#endif
+
+// A load of a pointer that sees whatever was written before the store
+// that published it, and that store: for handing what's pointed to
+// over to other threads without a lock.
+#if defined(__ATOMIC_ACQUIRE) // gcc >= 4.7, clang
+
+template <typename T>
+inline T * LoadAcquire(T * const * p)
+{
+    return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+}
+
+template <typename T>
+inline void StoreRelease(T ** p, T * value)
+{
+    __atomic_store_n(p, value, __ATOMIC_RELEASE);
+}
+
+#elif defined(_MSC_VER)
+
+template <typename T>
+inline T * LoadAcquire(T * const * p)
+{
+    return static_cast<T *>(_InterlockedCompareExchangePointer(reinterpret_cast<void * volatile *>(const_cast<T **>(p)), NULL, NULL));
+}
+
+template <typename T>
+inline void StoreRelease(T ** p, T * value)
+{
+    _InterlockedExchangePointer(reinterpret_cast<void * volatile *>(p), value);
+}
+
+#elif defined(__GNUC__)
+
+template <typename T>
+inline T * LoadAcquire(T * const * p)
+{
+    T * const value = *static_cast<T * const volatile *>(p);
+    __sync_synchronize();
+    return value;
+}
+
+template <typename T>
+inline void StoreRelease(T ** p, T * value)
+{
+    __sync_synchronize();
+    *static_cast<T * volatile *>(p) = value;
+}
+
+#else // and hope for the best
+
+template <typename T>
+inline T * LoadAcquire(T * const * p)
+{
+    return *static_cast<T * const volatile *>(p);
+}
+
+template <typename T>
+inline void StoreRelease(T ** p, T * value)
+{
+    *static_cast<T * volatile *>(p) = value;
+}
+
+#endif
+
+} // namespace atomic_internal
+
+// --------------------------------------------------------------------
+// AtomicFlag<T>
+//    The type of the flags defined with DEFINE_atomic_bool,
+//    DEFINE_atomic_int32, etc.  It's an aggregate, for the flag to be
+//    initialized statically, like a plain flag.
+// --------------------------------------------------------------------
+
+template <typename T>
+struct AtomicFlag
+{
+    T load() const { return atomic_internal::LoadRelaxed(&value_); }
+    operator T() const { return load(); }
+
+    // jflags' own: it's only public for the flag to be an aggregate.
+    T value_ JFLAGS_ATOMIC_ALIGNED(T);
+};
+
+// --------------------------------------------------------------------
+// AtomicStringFlag
+//    The type of the flags defined with DEFINE_atomic_string.  Each
+//    value the flag takes is a new immutable string, which is shared
+//    by all the snapshots taken of it, and deleted once the last of
+//    them is gone.  Taking a snapshot never waits for a lock, nor
+//    copies the string: it only bumps a couple of counters.  It's an
+//    aggregate, for the flag to be initialized
+//    statically: until jflags gets to set its default value, the flag
+//    reads as an empty string.
+// --------------------------------------------------------------------
+
+struct SharedFlagString; // an immutable value, and the count of its owners
+class FlagValue;
+
+struct JFLAGS_DLL_DECL AtomicStringFlag
+{
+    // A value of the flag.  It stays the same, and valid, for as long
+    // as the snapshot lives, whatever happens to the flag meanwhile.
+    class JFLAGS_DLL_DECL Snapshot
+    {
+    public:
+        Snapshot(); // of the empty string
+        Snapshot(const Snapshot & other);
+        ~Snapshot();
+        Snapshot & operator=(const Snapshot & other);
+
+        const std::string & operator*() const { return *value_; }
+        const std::string * operator->() const { return value_; }
+
+    private:
+        friend struct AtomicStringFlag;
+        friend class FlagValue; // for GetFlagValue() of any string flag
+        explicit Snapshot(SharedFlagString * shared);
+
+        SharedFlagString * shared_; // NULL for the empty string
+        const std::string * value_;
+    };
+
+    Snapshot load() const;
+
+    // jflags' own: they're only public for the flag to be an aggregate.
+    // readers_[e] counts the readers that may be looking at published_
+    // in epoch e.  jflags flips epoch_ after replacing published_, and
+    // waits for the count of the epoch that ended to drop to zero
+    // before letting go of the value it replaced.
+    SharedFlagString * published_;
+    int32 epoch_;
+    mutable int32 readers_[2];
+};
+
+} // namespace JFLAGS_NAMESPACE
+
+#endif // JFLAGS_ATOMIC_H_
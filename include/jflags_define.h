@@ -63,7 +63,26 @@ namespace JFLAGS_NAMESPACE {
 // binary file. This can reduce the size of the resulting binary
 // somewhat, and may also be useful for security reasons.
 
+// If it #defines COMPRESS_FLAG_HELP instead, the help is left out of
+// the binary all the same, but is still there for --help and the like:
+// jflags_pack_help gathers it from the sources into a compressed table
+// that's linked in with them, and only decompressed the first time a
+// help is needed.  The jflags_compress_help() CMake function sets this
+// up for a target (see cmake/compress_help.cmake).
+
+// If your application #defines JFLAGS_FLAG_TABLE to a non-zero value
+// before #including this file, the non-string flags aren't registered
+// by a global constructor each, but put in a table in a section of
+// their own.  jflags registers all of them at once, the first time it
+// needs its flags, which makes for a faster start when there are lots
+// of flags.  It only works where JFLAGS_HAVE_FLAG_TABLE says it does,
+// and for the flags linked into the program itself (not those of a
+// library loaded at run time); elsewhere, the flags are registered the
+// usual way.  String flags always are: they need a global constructor
+// for their value anyway.
+
 extern JFLAGS_DLL_DECL const char kStrippedFlagHelp[];
+extern JFLAGS_DLL_DECL const char kCompressedFlagHelp[];
 
 } // namespace JFLAGS_NAMESPACE
 
@@ -73,10 +92,31 @@ extern JFLAGS_DLL_DECL const char kStrippedFlagHelp[];
 // Need this construct to avoid the 'defined but not used' warning.
 #define MAYBE_STRIPPED_HELP(txt) \
     (false ? (txt) : JFLAGS_NAMESPACE::kStrippedFlagHelp)
+#elif defined(COMPRESS_FLAG_HELP) && COMPRESS_FLAG_HELP > 0
+#define MAYBE_STRIPPED_HELP(txt) \
+    (false ? (txt) : JFLAGS_NAMESPACE::kCompressedFlagHelp)
 #else
 #define MAYBE_STRIPPED_HELP(txt) txt
 #endif
 
+// Registers a non-string flag: see JFLAGS_FLAG_TABLE above.
+#if defined(JFLAGS_FLAG_TABLE) && JFLAGS_FLAG_TABLE > 0 && JFLAGS_HAVE_FLAG_TABLE
+#define JFLAGS_FLAG_TABLE_ENTRY(name, type, help, current, defvalue, atomic)    \
+    static const JFLAGS_NAMESPACE::FlagTableEntry t_##name                      \
+      __attribute__((used, section("jflags_table"), aligned(sizeof(void *)))) = \
+        { #name, type, help, __FILE__, current, defvalue, atomic }
+#define JFLAGS_REGISTER_FLAG(name, type, help, current, defvalue) \
+    JFLAGS_FLAG_TABLE_ENTRY(name, type, help, current, defvalue, false)
+#define JFLAGS_REGISTER_ATOMIC_FLAG(name, type, help, current, defvalue) \
+    JFLAGS_FLAG_TABLE_ENTRY(name, type, help, current, defvalue, true)
+#else
+#define JFLAGS_REGISTER_FLAG(name, type, help, current, defvalue) \
+    static JFLAGS_NAMESPACE::FlagRegisterer o_##name(#name, type, help, __FILE__, current, defvalue)
+#define JFLAGS_REGISTER_ATOMIC_FLAG(name, type, help, current, defvalue)                \
+    static JFLAGS_NAMESPACE::FlagRegisterer o_##name(#name, type, help, __FILE__, current, \
+                                                     defvalue, JFLAGS_NAMESPACE::FlagRegisterer::ATOMIC)
+#endif
+
 // Each command-line flag has two variables associated with it: one
 // with the current value, and one with the default value.  However,
 // we have a third variable, which is where value is assigned; it's a
@@ -95,9 +135,9 @@ extern JFLAGS_DLL_DECL const char kStrippedFlagHelp[];
         /* We always want to export defined variables, dll or no */         \
         JFLAGS_DLL_DEFINE_FLAG type FLAGS_##name = FLAGS_nono##name;        \
         type FLAGS_no##name = FLAGS_nono##name;                             \
-        static JFLAGS_NAMESPACE::FlagRegisterer o_##name(                   \
-          #name, #type, MAYBE_STRIPPED_HELP(help), __FILE__, &FLAGS_##name, \
-          &FLAGS_no##name);                                                 \
+        JFLAGS_REGISTER_FLAG(name, JFLAGS_NAMESPACE::FlagTypeOf<type>::id,  \
+                             MAYBE_STRIPPED_HELP(help),                     \
+                             &FLAGS_##name, &FLAGS_no##name);               \
     }                                                                       \
     using fL##shorttype::FLAGS_##name
 
@@ -143,6 +183,47 @@ JFLAGS_DLL_DECL bool IsBoolFlag(bool from);
 
 #define DEFINE_double(name, val, txt) DEFINE_VARIABLE(double, D, name, val, txt)
 
+// The atomic flags (see jflags_atomic.h) are defined the same way, but
+// the current value is wrapped in an AtomicFlag, which is an aggregate
+// so that it's still initialized statically.  The default value stays
+// a plain variable: nobody but jflags reads it.
+#define DEFINE_ATOMIC_VARIABLE(type, shorttype, name, value, help)                  \
+    namespace fL##shorttype                                                         \
+    {                                                                               \
+        static const type FLAGS_nono##name = value;                                 \
+        /* We always want to export defined variables, dll or no */                 \
+        JFLAGS_DLL_DEFINE_FLAG JFLAGS_NAMESPACE::AtomicFlag<type> FLAGS_##name = {  \
+            FLAGS_nono##name                                                        \
+        };                                                                          \
+        type FLAGS_no##name = FLAGS_nono##name;                                     \
+        JFLAGS_REGISTER_ATOMIC_FLAG(name, JFLAGS_NAMESPACE::FlagTypeOf<type>::id,   \
+                                    MAYBE_STRIPPED_HELP(help),                      \
+                                    &FLAGS_##name.value_, &FLAGS_no##name);         \
+    }                                                                               \
+    using fL##shorttype::FLAGS_##name
+
+#define DEFINE_atomic_bool(name, val, txt)                           \
+    namespace fLB {                                                  \
+    typedef ::fLB::CompileAssert FLAG_##name##_value_is_not_a_bool   \
+      [(sizeof(::fLB::IsBoolFlag(val)) != sizeof(double)) ? 1 : -1]; \
+    }                                                                \
+    DEFINE_ATOMIC_VARIABLE(bool, B, name, val, txt)
+
+#define DEFINE_atomic_int32(name, val, txt) \
+    DEFINE_ATOMIC_VARIABLE(JFLAGS_NAMESPACE::int32, I, name, val, txt)
+
+#define DEFINE_atomic_uint32(name, val, txt) \
+    DEFINE_ATOMIC_VARIABLE(JFLAGS_NAMESPACE::uint32, U, name, val, txt)
+
+#define DEFINE_atomic_int64(name, val, txt) \
+    DEFINE_ATOMIC_VARIABLE(JFLAGS_NAMESPACE::int64, I64, name, val, txt)
+
+#define DEFINE_atomic_uint64(name, val, txt) \
+    DEFINE_ATOMIC_VARIABLE(JFLAGS_NAMESPACE::uint64, U64, name, val, txt)
+
+#define DEFINE_atomic_double(name, val, txt) \
+    DEFINE_ATOMIC_VARIABLE(double, D, name, val, txt)
+
 // Strings are trickier, because they're not a POD, so we can't
 // construct them at static-initialization time (instead they get
 // constructed at global-constructor time, which is much later).  To
@@ -201,7 +282,8 @@ public:
     } s_##name[2];                                                                          \
     clstring * const FLAGS_no##name = ::fLS::dont_pass0toDEFINE_string(s_##name[0].s, val); \
     static JFLAGS_NAMESPACE::FlagRegisterer                                                 \
-      o_##name(#name, "string", MAYBE_STRIPPED_HELP(txt), __FILE__,                         \
+      o_##name(#name, JFLAGS_NAMESPACE::FLAG_TYPE_STRING,                                   \
+               MAYBE_STRIPPED_HELP(txt), __FILE__,                                          \
                s_##name[0].s, new (s_##name[1].s) clstring(*FLAGS_no##name));               \
     static StringFlagDestructor d_##name(s_##name[0].s, s_##name[1].s);                     \
     extern JFLAGS_DLL_DEFINE_FLAG clstring & FLAGS_##name;                                  \
@@ -210,6 +292,28 @@ public:
     }                                                                                       \
     using fLS::FLAGS_##name
 
+// For an atomic string, the flag is an AtomicStringFlag, zero
+// initialized statically, which jflags publishes the value of its own
+// copy of the string to, whenever it changes.
+#define DEFINE_atomic_string(name, val, txt)                                                \
+    namespace fLS {                                                                         \
+    using ::fLS::clstring;                                                                  \
+    static union                                                                            \
+    {                                                                                       \
+        void * align;                                                                       \
+        char s[sizeof(clstring)];                                                           \
+    } s_##name[2];                                                                          \
+    clstring * const FLAGS_no##name = ::fLS::dont_pass0toDEFINE_string(s_##name[0].s, val); \
+    extern JFLAGS_DLL_DEFINE_FLAG JFLAGS_NAMESPACE::AtomicStringFlag FLAGS_##name;          \
+    JFLAGS_NAMESPACE::AtomicStringFlag FLAGS_##name;                                        \
+    static JFLAGS_NAMESPACE::FlagRegisterer                                                 \
+      o_##name(#name, JFLAGS_NAMESPACE::FLAG_TYPE_STRING,                                   \
+               MAYBE_STRIPPED_HELP(txt), __FILE__,                                          \
+               s_##name[0].s, new (s_##name[1].s) clstring(*FLAGS_no##name), &FLAGS_##name); \
+    static ::fLS::StringFlagDestructor d_##name(s_##name[0].s, s_##name[1].s);                     \
+    }                                                                                       \
+    using fLS::FLAGS_##name
+
 #endif // SWIG
 
 #endif // JFLAGS_DEFINE_H_
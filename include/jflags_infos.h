@@ -9,6 +9,8 @@
 
 #include "jflags_declare.h" // IWYU pragma: export
 
+#include <stddef.h>
+#include <string>
 #include <vector>
 
 namespace JFLAGS_NAMESPACE {
@@ -19,6 +21,7 @@ using std::vector;
 // These methods are the best way to get access to info about the
 // list of commandline flags.  Note that these routines are pretty slow.
 //   GetAllFlags: mostly-complete info about the list, sorted by file.
+//   ForEachFlag: the same info, without copying it, to a visitor
 //   ShowUsageWithFlags: pretty-prints the list to stdout (what --help does)
 //   ShowUsageWithFlagsRestrict: limit to filenames with restrict as a substr
 //
@@ -40,6 +43,7 @@ struct CommandLineFlagInfo
     std::string default_value; // the default value, as a string
     std::string filename;      // 'cleaned' version of filename holding the flag
     bool has_validator_fn;     // true if RegisterFlagValidator called on this flag
+    std::string constraint;    // the allowed values, "[min, max]" or "a|b|c", or ""
     bool is_default;           // true if the flag has the default value and
                                // has not been set explicitly from the cmdline
                                // or via SetCommandLineOption
@@ -52,6 +56,93 @@ struct CommandLineFlagInfo
 // Also make sure then to uncomment the corresponding unit test in
 // jflags_unittest.sh
 extern JFLAGS_DLL_DECL void GetAllFlags(std::vector<CommandLineFlagInfo> * OUTPUT);
+
+// CompactFlagInfo is the info of a CommandLineFlagInfo, for keeping
+// many of them around: the strings that never change point into the
+// registry instead of being copied, and stay valid for the life of the
+// program.  The flags of a file share their filename.  Only the values
+// are copied, and the current value only if it's not the default.
+struct CompactFlagInfo
+{
+    const char * name;          // the name of the flag
+    const char * type;          // the type of the flag: int32, etc
+    const char * description;   // the "help text" associated with the flag
+    const char * filename;      // 'cleaned' version of filename holding the flag
+    const char * constraint;    // as in CommandLineFlagInfo
+    std::string default_value;  // the default value, as a string
+    std::string modified_value; // the current value if !is_default, else ""
+    bool has_validator_fn;      // true if RegisterFlagValidator called on this flag
+    bool is_default;            // as in CommandLineFlagInfo
+    const void * flag_ptr;      // pointer to the flag's current value (i.e. FLAGS_foo)
+
+    const std::string & current_value() const { return is_default ? default_value : modified_value; }
+};
+
+// GetAllFlags(), but CompactFlagInfos.
+extern JFLAGS_DLL_DECL void GetAllFlagsCompact(std::vector<CompactFlagInfo> * OUTPUT);
+
+// FlagDescriptor is what ForEachFlag() hands out: the info of a
+// CommandLineFlagInfo, but pointing into the flag itself instead of
+// copying it.  The values are only formatted when asked for.  A
+// descriptor, and the strings it points to, are only valid while it's
+// being visited.
+class CommandLineFlag;
+struct JFLAGS_DLL_DECL FlagDescriptor
+{
+    const char * name;         // the name of the flag
+    const char * type;         // the type of the flag: int32, etc
+    const char * description;  // the "help text" associated with the flag
+    const char * filename;     // 'cleaned' version of filename holding the flag
+    bool has_validator_fn;     // true if RegisterFlagValidator called on this flag
+    const char * constraint;   // as in CommandLineFlagInfo
+    bool is_default;           // true if the flag has the default value and
+                               // has not been set explicitly from the cmdline
+                               // or via SetCommandLineOption
+    const void * flag_ptr;     // pointer to the flag's current value (i.e. FLAGS_foo)
+    const CommandLineFlag * flag; // the flag described, for the methods below
+
+    // Write the current or default value into buf, which is always
+    // NUL-terminated (if size > 0), and return its full length: if
+    // that's size or more, the value was truncated.  Like snprintf().
+    size_t FormatCurrentValue(char * buf, size_t size) const;
+    size_t FormatDefaultValue(char * buf, size_t size) const;
+
+    // Append the current or default value to *output.
+    void AppendCurrentValueTo(std::string * output) const;
+    void AppendDefaultValueTo(std::string * output) const;
+};
+
+// A FlagVisitor is called back by ForEachFlag() for every flag.
+class JFLAGS_DLL_DECL FlagVisitor
+{
+public:
+    virtual ~FlagVisitor() {}
+    virtual void Visit(const FlagDescriptor & flag) = 0;
+};
+
+// Visits every flag, in the order of GetAllFlags().  The order is kept
+// between calls, so this costs neither copying nor sorting.  The
+// registry is locked (shared) meanwhile, so the visitor must not call
+// back into jflags; the same caveat as for GetAllFlags() inside a
+// validator applies.
+extern JFLAGS_DLL_DECL void ForEachFlag(FlagVisitor * visitor);
+
+// A FlagSink receives the text WriteAllFlags() writes, a piece at a time.
+class JFLAGS_DLL_DECL FlagSink
+{
+public:
+    virtual ~FlagSink() {}
+    virtual void Write(const char * data, size_t size) = 0;
+};
+
+// Writes a "--name=value" line for every flag, in the order of
+// GetAllFlags(), to sink: the text CommandlineFlagsIntoString() returns,
+// but straight from the flags, without building CommandLineFlagInfos or
+// the whole string.  The registry is locked (shared) meanwhile, so the
+// sink must not call back into jflags; the same caveat as for
+// GetAllFlags() inside a validator applies.
+extern JFLAGS_DLL_DECL void WriteAllFlags(FlagSink * sink);
+
 // These two are actually defined in jflags_reporting.cc.
 extern JFLAGS_DLL_DECL void ShowUsageWithFlags(const char * argv0); // what --help does
 extern JFLAGS_DLL_DECL void ShowUsageWithFlagsRestrict(const char * argv0, const char * restrict);
@@ -55,6 +55,95 @@ extern JFLAGS_DLL_DECL void AllowCommandLineReparsing();
 // since their flags are not registered until they are loaded.
 extern JFLAGS_DLL_DECL void ReparseCommandLineNonHelpFlags();
 
+// Turn the process-wide flagfile cache on (or back off).  While it's
+// on, --flagfile and ReadFromFlagsFile() keep every flagfile they read
+// in memory, already split up into lines, and reuse it for as long as
+// the file's device, inode, size and modification time don't change.
+// This is meant for programs that read the same flagfiles over and
+// over.  Off by default; turning it on or off drops everything cached.
+// ClearFlagfileCache() just drops everything cached.  Thread-safe.
+extern JFLAGS_DLL_DECL void EnableFlagfileCache(bool enable);
+extern JFLAGS_DLL_DECL void ClearFlagfileCache();
+
+// Reload the flagfiles named by --flagfile (including the ones named by
+// --flagfile inside of those) that changed since they were last read
+// here, and set the flags whose values they changed.  The first call
+// only reads the files, to know what changed later.  A flag is only set
+// when the value the files give it changes: a flag that was also set
+// on the commandline, or by SetCommandLineOption(), keeps that value
+// until its line in the files is edited.  Flags whose lines are
+// removed keep their values too, and lines for --flagfile, --fromenv
+// and --tryfromenv are ignored.  All the changes of a reload are made
+// at once, so flag watchers are called once per flag (see
+// RegisterFlagWatcher()).  A file that can't be read, say because
+// it's being rewritten, is tried again the next time.  Returns the
+// number of flags set.  Thread-safe.
+extern JFLAGS_DLL_DECL int ReloadChangedFlagfiles();
+
+// Start (or stop) a thread that calls ReloadChangedFlagfiles() every
+// poll_interval_ms milliseconds, for the flagfiles of a running
+// program to be edited in place.  Starting reads the files, so it's
+// changes from then on that are picked up; starting again only changes
+// the interval.  Returns false if this build of jflags has no threads
+// (call ReloadChangedFlagfiles() yourself, then).  Don't stop the
+// thread from a flag watcher: watchers run in it.  Thread-safe.
+extern JFLAGS_DLL_DECL bool StartFlagfileReloader(int32 poll_interval_ms);
+extern JFLAGS_DLL_DECL void StopFlagfileReloader();
+
+// Share the values of the flags between the processes of a prefork
+// server through a flag segment: a file, best on a RAM filesystem like
+// /dev/shm, that they all map.  The controller process calls
+// PublishFlagSegment() after parsing its flags, and again whenever it
+// changes some, to write the values of all the flags that aren't at
+// their default, or that were published before, to path.  Each
+// publication only gives a new version to the flags whose values
+// changed.  The workers AttachFlagSegment() to it, read-only, and call
+// SyncFlagsFromSegment() to set the flags whose published version
+// changed since they last synced: without a new publication, that's a
+// check of a counter in the segment.  The thread of
+// StartFlagfileReloader() syncs the attached segment too.  A worker
+// only sets the flags it has, to values that parse and validate, and
+// leaves alone the ones it set itself until they're published again.
+//    Publishing to a segment that's already there keeps its versions
+// going, so that a restarted controller is followed like the old one.
+// PublishFlagSegment() and AttachFlagSegment() return false if path
+// can't be mapped, or if this build of jflags can't map files at all;
+// SyncFlagsFromSegment() returns the number of flags set.  Only one
+// segment is published and one attached per process.  Thread-safe.
+extern JFLAGS_DLL_DECL bool PublishFlagSegment(const char * path);
+extern JFLAGS_DLL_DECL bool AttachFlagSegment(const char * path);
+extern JFLAGS_DLL_DECL void DetachFlagSegment();
+extern JFLAGS_DLL_DECL int SyncFlagsFromSegment();
+
+// Precompile the text flagfile text_filename into a binary flagfile at
+// binary_filename, which --flagfile and ReadFromFlagsFile() read like
+// the original, only faster: no tokenizing, and flag values that are
+// already parsed.  Values are parsed for the types of the flags of this
+// program, so call it from the program that will read the file (say,
+// behind a flag of your own that's used when publishing the config);
+// lines for flags this program doesn't know are kept as text.  Returns
+// false if binary_filename can't be written; dies if text_filename
+// can't be read.
+extern JFLAGS_DLL_DECL bool CompileFlagfile(const char * text_filename, const char * binary_filename);
+
+// Save the flags that were set, on the commandline or otherwise, into
+// a compact binary state, and set them back from it: say, to hand the
+// flags of a supervisor down to the children it spawns, or to
+// checkpoint them.  Unlike CommandlineFlagsIntoString() and
+// ReadFlagsFromString(), nothing is formatted or parsed: a program
+// with the same flags, like the same binary, sets the values straight
+// from the state.  Other programs look the flags up by name, and go
+// through text only for the flags whose type changed; flags they don't
+// have are ignored.  The values are still validated, and all of them
+// are set at once.  Like the precompiled flagfiles, a state is only
+// restored on machines with the byte order it was saved with.
+// Restoring returns false, with what's wrong logged, if the state is
+// corrupt or if some flag couldn't be set; the others are set anyway.
+// --flagfile, --fromenv and --tryfromenv aren't saved: their effects
+// are.  Thread-safe.
+extern JFLAGS_DLL_DECL std::string SerializeFlagState();
+extern JFLAGS_DLL_DECL bool RestoreFlagState(const std::string & state);
+
 // Clean up memory allocated by flags.  This is only needed to reduce
 // the quantity of "potentially leaked" reports emitted by memory
 // debugging tools such as valgrind.  It is not required for normal
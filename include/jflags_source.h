@@ -0,0 +1,89 @@
+////////////////////////////////////////////////////////////////////////////////
+//                                    jflags
+//
+// This file is distributed under the 3-clause Berkeley Software Distribution
+// License. See LICENSE.txt for details.
+////////////////////////////////////////////////////////////////////////////////
+#ifndef JFLAGS_SOURCE_H_
+#define JFLAGS_SOURCE_H_
+
+#include <string>
+
+#include "jflags_declare.h" // IWYU pragma: export
+#include "jflags_access.h"
+
+namespace JFLAGS_NAMESPACE {
+
+// --------------------------------------------------------------------
+// A flag source fetches flag settings from somewhere argv, flagfiles
+// and the environment don't reach, like a config service, without
+// holding up the program: each source fetches in a thread of its own,
+// and its settings are applied in one batch, through a
+// FlagTransaction, once they're all in.  The program starts on the
+// values it has, and picks up the source's as soon as they arrive.
+//
+// The settings are applied with the mode each was queued with, so a
+// source that queues them with SET_FLAGS_DEFAULT (or
+// SET_FLAG_IF_DEFAULT) never overrides what argv, a flagfile or
+// SetCommandLineOption() set, whichever comes first: only the flags
+// that are still at their default change.  A source that fails, or
+// whose settings don't all parse and validate, changes no flag; its
+// error is logged.  Watchers of the flags that change are called in
+// the source's thread.  GetFlagsStats() counts the sources added,
+// applied and failed, and times their fetches.
+//
+// ShutDownCommandLineFlags() doesn't wait for the sources still
+// fetching: it only waits for the settings being applied, and those
+// that come in later are dropped.  Such a source is still deleted, in
+// its own thread, once its Fetch() returns, which may be after main()
+// did; a source that can't outlive what it uses should make Fetch()
+// give up by itself, with a timeout say.
+//
+// Without threads in this build of jflags, AddFlagSource() fetches
+// right away.
+//
+// Example use:
+//    class ConfigServiceSource : public FlagSource {
+//    public:
+//       const char* name() const { return "config service"; }
+//       bool Fetch(FlagTransaction* settings, std::string* error) {
+//          ... for each override:
+//             settings->Set(name, value, SET_FLAGS_DEFAULT);
+//          return true;
+//       }
+//    };
+//    ...
+//    ParseCommandLineFlags(&argc, &argv, true);
+//    AddFlagSource(new ConfigServiceSource, true);
+//    if (!WaitForCriticalFlagSources(2000))
+//       LOG(WARNING) << "starting without the config service's flags";
+// --------------------------------------------------------------------
+
+class JFLAGS_DLL_DECL FlagSource
+{
+public:
+    virtual ~FlagSource();
+
+    // What the source is called in error messages.
+    virtual const char * name() const = 0;
+
+    // Queues the source's settings in *settings.  Called once, in a
+    // thread of its own.  Returns false, with what went wrong in
+    // *error, to have none of them applied.
+    virtual bool Fetch(FlagTransaction * settings, std::string * error) = 0;
+};
+
+// Starts fetching from source, which jflags owns from then on: it's
+// deleted once its settings are applied, or dropped.  The settings of
+// a critical source are the ones WaitForCriticalFlagSources() waits
+// for.  Thread-safe.
+extern JFLAGS_DLL_DECL void AddFlagSource(FlagSource * source, bool critical = false);
+
+// Waits up to timeout_ms milliseconds (or forever, if negative) for
+// the critical sources added so far to be done fetching, and applied
+// or failed.  Returns false if some still aren't.  Thread-safe.
+extern JFLAGS_DLL_DECL bool WaitForCriticalFlagSources(int32 timeout_ms);
+
+} // namespace JFLAGS_NAMESPACE
+
+#endif // JFLAGS_SOURCE_H_
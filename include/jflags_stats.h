@@ -0,0 +1,86 @@
+////////////////////////////////////////////////////////////////////////////////
+//                                    jflags
+//
+// This file is distributed under the 3-clause Berkeley Software Distribution
+// License. See LICENSE.txt for details.
+////////////////////////////////////////////////////////////////////////////////
+#ifndef JFLAGS_STATS_H_
+#define JFLAGS_STATS_H_
+
+#include "jflags_declare.h" // IWYU pragma: export
+
+#include <string>
+#include <vector>
+
+namespace JFLAGS_NAMESPACE {
+
+// --------------------------------------------------------------------
+// Statistics about jflags itself, for finding out where a program's
+// startup time goes: registering the flags, parsing argv, reading
+// flagfiles, --fromenv, validating, handling --help and fetching from
+// flag sources (see jflags_source.h).  The time of
+// each of these stages is always kept, since the flags get registered
+// before anything can ask for it; a stage's time includes the stages
+// it runs (parsing argv includes the flagfiles it names, say).
+//    Lock times, and how often each flag is read or set by name, are
+// only counted while enabled, with EnableFlagsStats() or --jflags_stats
+// (which also prints them all to stderr at exit).  The counters are
+// sharded by thread, so that counting doesn't make threads that read
+// flags wait for each other any more than they already do.
+//
+// Example use:
+//    EnableFlagsStats(true);
+//    ...
+//    FlagsStats stats;
+//    GetFlagsStats(&stats);
+//    LOG(INFO) << "parsing took " << stats.parsing.nanos << "ns";
+// --------------------------------------------------------------------
+
+struct FlagsStageStats
+{
+    int64 calls;
+    int64 nanos; // wall time
+};
+
+struct FlagAccessStats
+{
+    std::string name;
+    int64 reads; // GetCommandLineOption(), GetFlagValue(), FlagHandle, etc.
+    int64 sets;  // by jflags: argv, flagfiles, SetCommandLineOption(), etc.
+};
+
+struct FlagsStats
+{
+    FlagsStageStats registration; // FlagRegisterer, and the flag table
+    FlagsStageStats parsing;      // argv
+    FlagsStageStats flagfiles;    // reading them in
+    FlagsStageStats fromenv;      // --fromenv and --tryfromenv
+    FlagsStageStats validation;   // ValidateAllFlags()
+    FlagsStageStats help;         // HandleCommandLineHelpFlags()
+    FlagsStageStats sources;      // fetching and applying, in their own threads
+    int64 flagfile_bytes;
+    int64 sources_added;   // by AddFlagSource(); those neither applied
+    int64 sources_applied; // nor failed are still fetching
+    int64 sources_failed;
+
+    // Only while enabled.  The hold time is of the exclusive lock only;
+    // shared holders don't wait for each other anyway.
+    int64 lock_acquisitions; // exclusive or shared
+    int64 lock_wait_nanos;
+    int64 lock_hold_nanos;
+    std::vector<FlagAccessStats> flags; // those read or set, by name
+};
+
+// Turns the counting of lock times and flag accesses on or off.  The
+// counts so far are kept either way.  Thread-safe, but not at global
+// construct time.
+extern JFLAGS_DLL_DECL void EnableFlagsStats(bool enable);
+
+extern JFLAGS_DLL_DECL void GetFlagsStats(FlagsStats * OUTPUT);
+
+// The statistics, as --jflags_stats prints them.
+extern JFLAGS_DLL_DECL std::string FlagsStatsReport();
+
+} // namespace JFLAGS_NAMESPACE
+
+#endif // JFLAGS_STATS_H_
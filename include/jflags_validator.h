@@ -10,6 +10,7 @@
 #include <string>
 
 #include "jflags_declare.h" // IWYU pragma: export
+#include "jflags_atomic.h" // for the atomic flags' validators
 
 namespace JFLAGS_NAMESPACE {
 
@@ -46,19 +47,88 @@ typedef bool (*ValidateFnProto)();
 //    DEFINE_int32(port, 0, "What port to listen on");
 //    static bool dummy = RegisterFlagValidator(&FLAGS_port, &ValidatePort);
 
+// ParseCommandLineFlags() checks the values of all the flags that have
+// a validator, and with --validator_threads=N, runs the validators on
+// up to N threads, without the registry lock.  A validator that
+// only looks at the value it's given, like ValidatePort() above, can
+// say so when it's registered, to be run right away instead:
+//    DEFINE_cheap_validator(port, &ValidatePort);
+enum FlagValidatorCost
+{
+    VALIDATOR_MAY_BE_SLOW, // looks at files, resolves hosts, etc.
+    VALIDATOR_IS_CHEAP
+};
+
 // Returns true if successfully registered, false if not (because the
 // first argument doesn't point to a command-line flag, or because a
 // validator is already registered for this flag).
-extern JFLAGS_DLL_DECL bool RegisterFlagValidator(const bool * flag, bool (*validate_fn)(const char *, bool));
-extern JFLAGS_DLL_DECL bool RegisterFlagValidator(const int32 * flag, bool (*validate_fn)(const char *, int32));
-extern JFLAGS_DLL_DECL bool RegisterFlagValidator(const uint32 * flag, bool (*validate_fn)(const char *, uint32));
-extern JFLAGS_DLL_DECL bool RegisterFlagValidator(const int64 * flag, bool (*validate_fn)(const char *, int64));
-extern JFLAGS_DLL_DECL bool RegisterFlagValidator(const uint64 * flag, bool (*validate_fn)(const char *, uint64));
-extern JFLAGS_DLL_DECL bool RegisterFlagValidator(const double * flag, bool (*validate_fn)(const char *, double));
-extern JFLAGS_DLL_DECL bool RegisterFlagValidator(const std::string * flag, bool (*validate_fn)(const char *, const std::string &));
-
-// Convenience macro for the registration of a flag validator
+extern JFLAGS_DLL_DECL bool RegisterFlagValidator(const bool * flag, bool (*validate_fn)(const char *, bool), FlagValidatorCost cost = VALIDATOR_MAY_BE_SLOW);
+extern JFLAGS_DLL_DECL bool RegisterFlagValidator(const int32 * flag, bool (*validate_fn)(const char *, int32), FlagValidatorCost cost = VALIDATOR_MAY_BE_SLOW);
+extern JFLAGS_DLL_DECL bool RegisterFlagValidator(const uint32 * flag, bool (*validate_fn)(const char *, uint32), FlagValidatorCost cost = VALIDATOR_MAY_BE_SLOW);
+extern JFLAGS_DLL_DECL bool RegisterFlagValidator(const int64 * flag, bool (*validate_fn)(const char *, int64), FlagValidatorCost cost = VALIDATOR_MAY_BE_SLOW);
+extern JFLAGS_DLL_DECL bool RegisterFlagValidator(const uint64 * flag, bool (*validate_fn)(const char *, uint64), FlagValidatorCost cost = VALIDATOR_MAY_BE_SLOW);
+extern JFLAGS_DLL_DECL bool RegisterFlagValidator(const double * flag, bool (*validate_fn)(const char *, double), FlagValidatorCost cost = VALIDATOR_MAY_BE_SLOW);
+extern JFLAGS_DLL_DECL bool RegisterFlagValidator(const std::string * flag, bool (*validate_fn)(const char *, const std::string &), FlagValidatorCost cost = VALIDATOR_MAY_BE_SLOW);
+
+// The validators of an atomic flag get the value, just like those of
+// a plain flag.  See jflags_atomic.h.  The pointer to the flag is
+// only used to find it.
+template <typename T>
+inline bool RegisterFlagValidator(const AtomicFlag<T> * flag, bool (*validate_fn)(const char *, T), FlagValidatorCost cost = VALIDATOR_MAY_BE_SLOW)
+{
+    return RegisterFlagValidator(&flag->value_, validate_fn, cost);
+}
+
+inline bool RegisterFlagValidator(const AtomicStringFlag * flag, bool (*validate_fn)(const char *, const std::string &), FlagValidatorCost cost = VALIDATOR_MAY_BE_SLOW)
+{
+    return RegisterFlagValidator(reinterpret_cast<const std::string *>(flag), validate_fn, cost);
+}
+
+// --------------------------------------------------------------------
+// Most validators only check that a number is in a range, or that a
+// string is one of a few, which a flag can also just declare: jflags
+// then checks the values itself, before the validator if there's one,
+// and shows the allowed values in --help and --helpxml.  A default
+// value that isn't allowed is caught by ParseCommandLineFlags(), as
+// for a validator.
+//
+// Example use:
+//    DEFINE_int32(port, 80, "What port to listen on");
+//    DEFINE_range(port, 1, 32767);
+//    DEFINE_string(mode, "fast", "How to go about it");
+//    DEFINE_allowed_values(mode, "fast,safe,auto");
+//
+// These return false, adding nothing, if the first argument doesn't
+// point to a flag of the type of the bounds, if min > max, or if the
+// list has no value at all (like "" or ","), which would leave the
+// flag nothing to be set to.  Declaring the values of a flag again
+// replaces them.
+// --------------------------------------------------------------------
+
+extern JFLAGS_DLL_DECL bool RegisterFlagRange(const int32 * flag, int32 min, int32 max);
+extern JFLAGS_DLL_DECL bool RegisterFlagRange(const uint32 * flag, uint32 min, uint32 max);
+extern JFLAGS_DLL_DECL bool RegisterFlagRange(const int64 * flag, int64 min, int64 max);
+extern JFLAGS_DLL_DECL bool RegisterFlagRange(const uint64 * flag, uint64 min, uint64 max);
+extern JFLAGS_DLL_DECL bool RegisterFlagRange(const double * flag, double min, double max);
+// values is a comma-separated list of the (non-empty) allowed strings.
+extern JFLAGS_DLL_DECL bool RegisterFlagAllowedValues(const std::string * flag, const char * values);
+
+inline bool RegisterFlagRange(const AtomicFlag<int32> * flag, int32 min, int32 max) { return RegisterFlagRange(&flag->value_, min, max); }
+inline bool RegisterFlagRange(const AtomicFlag<uint32> * flag, uint32 min, uint32 max) { return RegisterFlagRange(&flag->value_, min, max); }
+inline bool RegisterFlagRange(const AtomicFlag<int64> * flag, int64 min, int64 max) { return RegisterFlagRange(&flag->value_, min, max); }
+inline bool RegisterFlagRange(const AtomicFlag<uint64> * flag, uint64 min, uint64 max) { return RegisterFlagRange(&flag->value_, min, max); }
+inline bool RegisterFlagRange(const AtomicFlag<double> * flag, double min, double max) { return RegisterFlagRange(&flag->value_, min, max); }
+
+inline bool RegisterFlagAllowedValues(const AtomicStringFlag * flag, const char * values)
+{
+    return RegisterFlagAllowedValues(reinterpret_cast<const std::string *>(flag), values);
+}
+
+// Convenience macros for the registration of a flag validator
 #define DEFINE_validator(name, validator) static const bool name##_validator_registered = JFLAGS_NAMESPACE::RegisterFlagValidator(&FLAGS_##name, validator)
+#define DEFINE_cheap_validator(name, validator) static const bool name##_validator_registered = JFLAGS_NAMESPACE::RegisterFlagValidator(&FLAGS_##name, validator, JFLAGS_NAMESPACE::VALIDATOR_IS_CHEAP)
+#define DEFINE_range(name, min, max) static const bool name##_range_registered = JFLAGS_NAMESPACE::RegisterFlagRange(&FLAGS_##name, min, max)
+#define DEFINE_allowed_values(name, values) static const bool name##_allowed_values_registered = JFLAGS_NAMESPACE::RegisterFlagAllowedValues(&FLAGS_##name, values)
 
 } // namespace JFLAGS_NAMESPACE
 
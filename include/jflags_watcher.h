@@ -0,0 +1,62 @@
+////////////////////////////////////////////////////////////////////////////////
+//                                    jflags
+//
+// This file is distributed under the 3-clause Berkeley Software Distribution
+// License. See LICENSE.txt for details.
+////////////////////////////////////////////////////////////////////////////////
+#ifndef JFLAGS_WATCHER_H_
+#define JFLAGS_WATCHER_H_
+
+#include <string>
+
+#include "jflags_declare.h" // IWYU pragma: export
+
+namespace JFLAGS_NAMESPACE {
+
+// This is the function a watcher registers: it's called with the name
+// of the flag that changed, and the data it was registered with.
+typedef void (*FlagWatcherFn)(const char * flagname, void * data);
+
+// --------------------------------------------------------------------
+// Instead of polling a flag for changes, you can register a watcher
+// with it.  The watcher is called whenever the flag's value changes
+// through jflags: SetCommandLineOption() and friends, a flagfile that
+// is read, a FlagTransaction, or a FlagSaver that restores the flag.
+// It is _not_ called when you assign the value to the flag directly
+// using the = operator.
+//
+// Watchers run after the change is made, once jflags has let go of
+// its lock, so they're free to read (or set) flags.  They run in the
+// thread that made the change.  Changes are coalesced: however many
+// times a flag changes while jflags holds its lock (a whole flagfile,
+// say), its watchers are only called once, when the last of the
+// changes is in.  Setting a flag to the value it already has isn't a
+// change.
+//
+// This function is safe to call at global construct time (as in the
+// example below).
+//
+// Example use:
+//    static void OnPortChange(const char* flagname, void* server) {
+//       static_cast<Server*>(server)->Rebind(FLAGS_port);
+//    }
+//    DEFINE_int32(port, 0, "What port to listen on");
+//    ...
+//    RegisterFlagWatcher(&FLAGS_port, &OnPortChange, &server);
+
+// Returns true if successfully registered, false if not (because the
+// first argument doesn't point to, or name, a command-line flag).
+// Registering the same function and data more than once is ok, but
+// they're only called once per change.
+extern JFLAGS_DLL_DECL bool RegisterFlagWatcher(const void * flag, FlagWatcherFn watcher_fn, void * data);
+extern JFLAGS_DLL_DECL bool RegisterFlagWatcher(const char * flagname, FlagWatcherFn watcher_fn, void * data);
+
+// Returns true if the watcher was registered with the flag, and now
+// isn't anymore.  A change that was already being reported when this
+// is called may still reach the watcher once.
+extern JFLAGS_DLL_DECL bool UnregisterFlagWatcher(const void * flag, FlagWatcherFn watcher_fn, void * data);
+extern JFLAGS_DLL_DECL bool UnregisterFlagWatcher(const char * flagname, FlagWatcherFn watcher_fn, void * data);
+
+} // namespace JFLAGS_NAMESPACE
+
+#endif // JFLAGS_WATCHER_H_
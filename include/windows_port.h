@@ -77,6 +77,15 @@ inline void setenv(const char * name, const char * value, int)
             *getenv(name) = '\0'; // works when putenv() copies nameval
     }
 }
+inline void unsetenv(const char * name)
+{
+    // "FOO=" removes FOO from the environment.  The string must live
+    // forever here too.
+    const size_t name_len = strlen(name) + 2;
+    char * nameval = reinterpret_cast<char *>(malloc(name_len));
+    snprintf(nameval, name_len, "%s=", name);
+    _putenv(nameval);
+}
 #ifdef _MSC_VER
 #pragma warning(pop)
 #endif
@@ -0,0 +1,136 @@
+////////////////////////////////////////////////////////////////////////////////
+//                                    jflags
+//
+// This file is distributed under the 3-clause Berkeley Software Distribution
+// License. See LICENSE.txt for details.
+////////////////////////////////////////////////////////////////////////////////
+#include "ByteScan.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define JFLAGS_SCAN_SSE2
+#include <emmintrin.h>
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+#define JFLAGS_SCAN_NEON
+#include <arm_neon.h>
+#endif
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+namespace JFLAGS_NAMESPACE {
+
+static inline bool IsWhitespace(char c)
+{
+    // ' ', and '\t', '\n', '\v', '\f' and '\r'
+    return c == ' ' || static_cast<unsigned char>(c - '\t') <= '\r' - '\t';
+}
+
+// --------------------------------------------------------------------
+// The 16-byte blocks
+//    Each block is compared into a mask of the bytes that stop the
+//    scan, 0xff for those and 0 for the others, and the position of
+//    the first of them is taken out of the mask.
+// --------------------------------------------------------------------
+
+#if defined(JFLAGS_SCAN_SSE2)
+
+typedef __m128i Block;
+
+static inline Block LoadBlock(const char * p) { return _mm_loadu_si128(reinterpret_cast<const __m128i *>(p)); }
+static inline Block Splat(char c) { return _mm_set1_epi8(c); }
+static inline Block Equal(Block a, Block b) { return _mm_cmpeq_epi8(a, b); }
+static inline Block Or(Block a, Block b) { return _mm_or_si128(a, b); }
+
+static inline Block NotWhitespace(Block block)
+{
+    // A byte from '\t' to '\r' is one that's at most 4 once '\t' is
+    // taken off, as an unsigned byte: one that saturates to 0 once 4
+    // more are.
+    const Block control = _mm_subs_epu8(_mm_sub_epi8(block, Splat('\t')), Splat('\r' - '\t'));
+    const Block whitespace = Or(Equal(control, _mm_setzero_si128()), Equal(block, Splat(' ')));
+    return _mm_xor_si128(whitespace, _mm_set1_epi8(-1));
+}
+
+// The position of the first byte set in mask, or 16 if none is.
+static inline int FirstInMask(Block mask)
+{
+    const unsigned bits = static_cast<unsigned>(_mm_movemask_epi8(mask));
+    if (bits == 0)
+        return 16;
+#if defined(_MSC_VER)
+    unsigned long first;
+    _BitScanForward(&first, bits);
+    return static_cast<int>(first);
+#else
+    return __builtin_ctz(bits);
+#endif
+}
+
+#elif defined(JFLAGS_SCAN_NEON)
+
+typedef uint8x16_t Block;
+
+static inline Block LoadBlock(const char * p) { return vld1q_u8(reinterpret_cast<const uint8_t *>(p)); }
+static inline Block Splat(char c) { return vdupq_n_u8(static_cast<uint8_t>(c)); }
+static inline Block Equal(Block a, Block b) { return vceqq_u8(a, b); }
+static inline Block Or(Block a, Block b) { return vorrq_u8(a, b); }
+
+static inline Block NotWhitespace(Block block)
+{
+    const Block control = vcleq_u8(vsubq_u8(block, Splat('\t')), Splat('\r' - '\t'));
+    return vmvnq_u8(Or(control, Equal(block, Splat(' '))));
+}
+
+static inline int FirstInMask(Block mask)
+{
+    // Narrowing each 16-bit lane by 4 bits leaves a nibble per byte.
+    const uint64_t bits = vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(mask), 4)), 0);
+    return bits == 0 ? 16 : __builtin_ctzll(bits) / 4;
+}
+
+#endif
+
+// --------------------------------------------------------------------
+// SkipWhitespace()
+// FindFirstOf()
+// --------------------------------------------------------------------
+
+const char * SkipWhitespace(const char * p, const char * end)
+{
+#if defined(JFLAGS_SCAN_SSE2) || defined(JFLAGS_SCAN_NEON)
+    // Most lines have no leading whitespace at all: don't bother with
+    // a block for those.
+    if (p < end && !IsWhitespace(*p))
+        return p;
+    for (; end - p >= 16; p += 16)
+    {
+        const int first = FirstInMask(NotWhitespace(LoadBlock(p)));
+        if (first < 16)
+            return p + first;
+    }
+#endif
+    while (p < end && IsWhitespace(*p))
+        ++p;
+    return p;
+}
+
+const char * FindFirstOf(const char * p, const char * end, char a, char b, char c)
+{
+#if defined(JFLAGS_SCAN_SSE2) || defined(JFLAGS_SCAN_NEON)
+    const Block splat_a = Splat(a);
+    const Block splat_b = Splat(b);
+    const Block splat_c = Splat(c);
+    for (; end - p >= 16; p += 16)
+    {
+        const Block block = LoadBlock(p);
+        const int first = FirstInMask(Or(Or(Equal(block, splat_a), Equal(block, splat_b)), Equal(block, splat_c)));
+        if (first < 16)
+            return p + first;
+    }
+#endif
+    while (p < end && *p != a && *p != b && *p != c)
+        ++p;
+    return p;
+}
+
+} // namespace JFLAGS_NAMESPACE
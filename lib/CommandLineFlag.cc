@@ -23,17 +23,23 @@ namespace JFLAGS_NAMESPACE {
 // --------------------------------------------------------------------
 
 CommandLineFlag::CommandLineFlag(const char * name, const char * help, const char * filename, FlagValue * current_val, FlagValue * default_val)
-: name_(name), help_(help), file_(filename), modified_(false), defvalue_(default_val), current_(current_val), validate_fn_proto_(NULL)
+: name_(name), current_(current_val), defvalue_(default_val), validate_fn_proto_(NULL), validator_is_cheap_(false), constraint_(NULL), watchers_(NULL), modified_(false), change_pending_(false), in_arena_(false), help_(help), file_(filename), clean_file_(CleanFileName(filename))
 {
 }
 
 CommandLineFlag::~CommandLineFlag()
 {
-    delete current_;
-    delete defvalue_;
+    // Values in an arena don't own their storage, so there's nothing to
+    // destroy: the registry frees the arena.
+    if (!in_arena_)
+    {
+        delete current_;
+        delete defvalue_;
+    }
+    delete watchers_;
 }
 
-const char * CommandLineFlag::CleanFileName() const
+const char * CommandLineFlag::CleanFileName(const char * filename)
 {
     // Compute top-level directory & file that this appears in
     // search full path backwards.
@@ -41,10 +47,10 @@ const char * CommandLineFlag::CleanFileName() const
     static const char kRootDir[] = ""; // can set this to root directory,
 
     if (sizeof(kRootDir) - 1 == 0) // no prefix to strip
-        return filename();
+        return filename;
 
-    const char * clean_name = filename() + strlen(filename()) - 1;
-    while (clean_name > filename())
+    const char * clean_name = filename + strlen(filename) - 1;
+    while (clean_name > filename)
     {
         if (*clean_name == PATH_SEPARATOR)
         {
@@ -69,18 +75,54 @@ void CommandLineFlag::FillCommandLineFlagInfo(CommandLineFlagInfo * result)
     result->current_value = current_value();
     result->default_value = default_value();
     result->filename = CleanFileName();
+    // We may only hold the registry lock shared here (see
+    // UpdateModifiedBit()).
     UpdateModifiedBit();
-    result->is_default = !modified_;
+    result->is_default = !modified();
+    result->has_validator_fn = validate_function() != NULL;
+    result->constraint = constraint_ == NULL ? "" : constraint_->description();
+    result->flag_ptr = flag_ptr();
+}
+
+void CommandLineFlag::FillCompactFlagInfo(CompactFlagInfo * result)
+{
+    result->name = name();
+    result->type = type_name();
+    result->description = help();
+    result->filename = CleanFileName();
+    result->constraint = constraint_ == NULL ? "" : constraint_->description().c_str();
+    result->default_value = default_value();
+    UpdateModifiedBit(); // see FillCommandLineFlagInfo()
+    result->is_default = !modified();
+    // Not modified means the current value is the default.
+    if (result->is_default)
+        result->modified_value.clear();
+    else
+        result->modified_value = current_value();
     result->has_validator_fn = validate_function() != NULL;
     result->flag_ptr = flag_ptr();
 }
 
+void CommandLineFlag::FillFlagDescriptor(FlagDescriptor * result)
+{
+    result->name = name();
+    result->type = type_name();
+    result->description = help();
+    result->filename = CleanFileName();
+    UpdateModifiedBit(); // see FillCommandLineFlagInfo()
+    result->is_default = !modified();
+    result->has_validator_fn = validate_function() != NULL;
+    result->constraint = constraint_ == NULL ? "" : constraint_->description().c_str();
+    result->flag_ptr = flag_ptr();
+    result->flag = this;
+}
+
 void CommandLineFlag::UpdateModifiedBit()
 {
     // Update the "modified" bit in case somebody bypassed the
     // Flags API and wrote directly through the FLAGS_name variable.
-    if (!modified_ && !current_->Equal(*defvalue_))
-        modified_ = true;
+    if (!modified() && !current_->Equal(*defvalue_))
+        atomic_internal::StoreRelaxed(&modified_, true);
 }
 
 void CommandLineFlag::CopyFrom(const CommandLineFlag & src)
@@ -94,9 +136,11 @@ void CommandLineFlag::CopyFrom(const CommandLineFlag & src)
         defvalue_->CopyFrom(*src.defvalue_);
     if (validate_fn_proto_ != src.validate_fn_proto_)
         validate_fn_proto_ = src.validate_fn_proto_;
+    validator_is_cheap_ = src.validator_is_cheap_;
+    constraint_ = src.constraint_;
 }
 
-bool CommandLineFlag::Validate(const FlagValue & value) const
+bool CommandLineFlag::PassesValidator(const FlagValue & value) const
 {
     if (validate_function() == NULL)
         return true;
@@ -104,5 +148,12 @@ bool CommandLineFlag::Validate(const FlagValue & value) const
         return value.Validate(name(), validate_function());
 }
 
+FlagValue * CommandLineFlag::NewCopyOfCurrent() const
+{
+    FlagValue * const copy = current_->New();
+    copy->CopyFrom(*current_);
+    return copy;
+}
+
 } // namespace JFLAGS_NAMESPACE
 
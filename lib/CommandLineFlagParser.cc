@@ -8,17 +8,29 @@
 #include "CommandLineFlag.h"
 #include "FlagRegistry.h"
 #include "FlagRegisterer.h"
+#include "Flagfile.h"
 #include "jflags_define.h"
+#include "mutex.h"
+#include <algorithm>
+#include <stdlib.h>
 #if defined(HAVE_FNMATCH_H)
 #include <fnmatch.h>
 #elif defined(HAVE_SHLWAPI_H)
 #include <shlwapi.h>
 #endif
+#if defined(__APPLE__)
+#include <crt_externs.h> // for _NSGetEnviron
+#elif !defined(OS_WINDOWS)
+extern char ** environ;
+#endif
+#if defined(HAVE_PTHREAD) && !defined(NO_THREADS)
+#include <pthread.h>
+#endif
 
 // Special flags, type 1: the 'recursive' flags.  They set another flag's val.
 DEFINE_string(flagfile, "", "load flags from file");
 DEFINE_string(fromenv, "", "set flags from the environment"
-                           " [use 'export FLAGS_flag1=value']");
+                           " [use 'export FLAGS_flag1=value'; '*' for all of them]");
 DEFINE_string(tryfromenv, "", "set flags from the environment if present");
 
 // Special flags, type 2: the 'parsing' flags.  They modify how we parse.
@@ -27,6 +39,14 @@ DEFINE_string(undefok, "",
               "on the command line even if the program does not define a flag "
               "with that name.  IMPORTANT: flags in this list that have "
               "arguments MUST use the flag=value format");
+DEFINE_int32(validator_threads, 0,
+             "how many threads to run the flag validators that may be slow "
+             "on, once the flags are parsed; 0 runs them all on the parsing "
+             "thread, under the lock of the flags");
+DEFINE_int32(flagfile_threads, 0,
+             "how many threads to read flagfiles on, all the files of a "
+             "--flagfile list (and those they name) at once, ahead of "
+             "applying them in order; 0 reads each one as it's applied");
 
 namespace JFLAGS_NAMESPACE {
 
@@ -76,58 +96,105 @@ static void ParseFlagList(const char * value, vector<string> * flags)
     }
 }
 
-// Snarf an entire file into a C++ string.  This is just so that we
-// can do all the I/O in one place and not worry about it everywhere.
-// Plus, it's convenient to have the whole file contents at hand.
-// Adds a newline at the end of the file.
-#define PFATAL(s)           \
-    do                      \
-    {                       \
-        perror(s);          \
-        jflags_exitfunc(1); \
-    } while (0)
-
-string ReadFileIntoString(const char * filename)
+// Collects the FLAGS_* variables of the environment, by flag name, in
+// one pass: a getenv() per flag would go through all of it each time.
+static void ReadEnvironmentFlags(map<string, string> * env_flags)
 {
-    const int kBufSize = 8092;
-    char buffer[kBufSize];
-    string s;
-    FILE * fp;
-    if ((errno = SafeFOpen(&fp, filename, "r")) != 0)
-        PFATAL(filename);
-    size_t n;
-    while ((n = fread(buffer, 1, kBufSize, fp)) > 0)
+#if defined(__APPLE__)
+    char ** const env = *_NSGetEnviron();
+#elif defined(OS_WINDOWS)
+    char ** const env = _environ;
+#else
+    char ** const env = environ;
+#endif
+    static const char kPrefix[] = "FLAGS_";
+    for (char ** var = env; var != NULL && *var != NULL; ++var)
     {
-        if (ferror(fp))
-            PFATAL(filename);
-        s.append(buffer, n);
+        if (strncmp(*var, kPrefix, sizeof(kPrefix) - 1) != 0)
+            continue;
+        const char * const name = *var + sizeof(kPrefix) - 1;
+        const char * const equals = strchr(name, '=');
+        if (equals == NULL || equals == name)
+            continue;
+        // Like getenv(), the first of the same name wins.
+        env_flags->insert(make_pair(string(name, equals - name), string(equals + 1)));
+    }
+}
+
+// Collects the values of the --flagfile args in argv, up to any "--",
+// and the last --flagfile_threads, which argv is read too late for.
+static void FindFlagfileArgs(int argc, char * const * argv, vector<string> * filenames, int32 * num_threads)
+{
+    for (int i = 1; i < argc; i++)
+    {
+        const char * arg = argv[i];
+        if (arg[0] != '-')
+            continue;
+        arg += (arg[1] == '-') ? 2 : 1;
+        if (*arg == '\0')
+            return;
+        if (strncmp(arg, "flagfile", 8) != 0)
+            continue;
+        const bool is_threads = (strncmp(arg + 8, "_threads", 8) == 0);
+        const char * const end_of_name = arg + (is_threads ? 16 : 8);
+        const char * value = NULL;
+        if (*end_of_name == '=')
+            value = end_of_name + 1;
+        else if (*end_of_name == '\0' && i + 1 < argc)
+            value = argv[++i];
+        if (is_threads)
+        {
+            if (value != NULL)
+                *num_threads = static_cast<int32>(strtol(value, NULL, 10));
+            continue;
+        }
+        if (*end_of_name != '=' && *end_of_name != '\0')
+            continue;
+        for (const char * name = value; name != NULL && *name != '\0';)
+        {
+            const char * const end = name + strcspn(name, ",");
+            if (end != name)
+                filenames->push_back(string(name, end));
+            name = (*end == ',') ? end + 1 : end;
+        }
     }
-    fclose(fp);
-    return s;
 }
 
 uint32 CommandLineFlagParser::ParseNewCommandLineFlags(int * argc, char *** argv, bool remove_flags)
 {
+    StageTimer timer(STAGE_PARSING);
     const char * program_name = strrchr((*argv)[0], PATH_SEPARATOR); // nix path
     program_name = (program_name == NULL ? (*argv)[0] : program_name + 1);
 
-    int first_nonopt = *argc; // for non-options moved to the end
+    // Like getopt(), we permute non-option flags to be at the end.  The
+    // options (and their values) are packed toward the front as they're
+    // read, the program arguments are set aside, and whatever is left
+    // unread (after "--", say) goes between the two.  All in one pass.
+    char ** const args = *argv;
+    vector<char *> nonopts;
+    int num_kept = 1; // argv[0], then the options read so far
+    int first_unread = *argc;
+
+    // Read the flagfiles named in argv while nobody waits on the lock.
+    vector<string> flagfiles;
+    int32 num_threads = FLAGS_flagfile_threads;
+    FindFlagfileArgs(*argc, args, &flagfiles, &num_threads);
+    FlagfilePrefetch prefetch(num_threads);
+    prefetch.Fetch(flagfiles);
 
     registry_->Lock();
-    for (int i = 1; i < first_nonopt; i++)
+    prefetch_ = &prefetch;
+    for (int i = 1; i < *argc; i++)
     {
-        char * arg = (*argv)[i];
+        char * arg = args[i];
 
-        // Like getopt(), we permute non-option flags to be at the end.
         if (arg[0] != '-' ||                   // must be a program argument
             (arg[0] == '-' && arg[1] == '\0')) // "-" is an argument, not a flag
         {
-            memmove((*argv) + i, (*argv) + i + 1, (*argc - (i + 1)) * sizeof((*argv)[i]));
-            (*argv)[*argc - 1] = arg; // we go last
-            first_nonopt--;           // we've been pushed onto the stack
-            i--;                      // to undo the i++ in the loop
+            nonopts.push_back(arg);
             continue;
         }
+        args[num_kept++] = arg;
 
         if (arg[0] == '-')
             arg++; // allow leading '-'
@@ -137,7 +204,7 @@ uint32 CommandLineFlagParser::ParseNewCommandLineFlags(int * argc, char *** argv
         // -- alone means what it does for GNU: stop options parsing
         if (*arg == '\0')
         {
-            first_nonopt = i + 1;
+            first_unread = i + 1;
             break;
         }
 
@@ -149,6 +216,7 @@ uint32 CommandLineFlagParser::ParseNewCommandLineFlags(int * argc, char *** argv
         if (flag == NULL)
         {
             undefined_names_[key] = ""; // value isn't actually used
+            undefined_args_.push_back(i);
             error_flags_[key] = error_message;
             continue;
         }
@@ -157,10 +225,10 @@ uint32 CommandLineFlagParser::ParseNewCommandLineFlags(int * argc, char *** argv
         {
             // Boolean options are always assigned a value by SplitArgumentLocked()
             assert(strcmp(flag->type_name(), "bool") != 0);
-            if (i + 1 >= first_nonopt)
+            if (i + 1 >= *argc)
             {
                 // This flag needs a value, but there is nothing available
-                error_flags_[key] = (string(kError) + "flag '" + (*argv)[i] + "'" + " is missing its argument");
+                error_flags_[key] = (string(kError) + "flag '" + args[i] + "'" + " is missing its argument");
                 if (flag->help() && flag->help()[0] > '\001')
                     // Be useful in case we have a non-stripped description.
                     error_flags_[key] += string("; flag description: ") + flag->help();
@@ -169,7 +237,8 @@ uint32 CommandLineFlagParser::ParseNewCommandLineFlags(int * argc, char *** argv
             }
             else
             {
-                value = (*argv)[++i]; // read next arg for value
+                value = args[++i]; // read next arg for value
+                args[num_kept++] = args[i];
 
                 // Heuristic to detect the case where someone treats a string arg
                 // like a bool:
@@ -189,8 +258,15 @@ uint32 CommandLineFlagParser::ParseNewCommandLineFlags(int * argc, char *** argv
         // TODO(csilvers): only set a flag if we hadn't set it before here
         ProcessSingleOptionLocked(flag, value, SET_FLAGS_VALUE);
     }
+    prefetch_ = NULL;
     registry_->Unlock();
 
+    int first_nonopt = num_kept;
+    for (int i = first_unread; i < *argc; i++)
+        args[num_kept++] = args[i];
+    for (vector<char *>::const_iterator i = nonopts.begin(); i != nonopts.end(); ++i)
+        args[num_kept++] = *i;
+
     if (remove_flags) // Fix up argc and argv by removing command line flags
     {
         (*argv)[first_nonopt - 1] = (*argv)[0];
@@ -209,14 +285,26 @@ string CommandLineFlagParser::ProcessFlagfileLocked(const string & flagval, Flag
     if (flagval.empty())
         return "";
 
+    StageTimer timer(STAGE_FLAGFILES, &flagfile_depth_);
     string msg;
     vector<string> filename_list;
     ParseFlagList(flagval.c_str(), &filename_list); // take a list of filenames
+
+    // The outermost list reads all the files there'll be ahead, unless
+    // ParseNewCommandLineFlags() already has.  Reading them again is
+    // only looking them up.
+    FlagfilePrefetch own_prefetch(prefetch_ == NULL ? FLAGS_flagfile_threads : 0);
+    FlagfilePrefetch * const outer_prefetch = prefetch_;
+    if (prefetch_ == NULL)
+        prefetch_ = &own_prefetch;
+    prefetch_->Fetch(filename_list);
     for (size_t i = 0; i < filename_list.size(); ++i)
     {
-        const char * file = filename_list[i].c_str();
-        msg += ProcessOptionsFromStringLocked(ReadFileIntoString(file), set_mode);
+        FlagfileHandle flagfile(filename_list[i].c_str(), prefetch_);
+        NoteFlagfileForReloading(filename_list[i], flagfile_depth_ == 1);
+        msg += ProcessFlagfileContentsLocked(*flagfile, set_mode);
     }
+    prefetch_ = outer_prefetch;
     return msg;
 }
 
@@ -225,12 +313,31 @@ string CommandLineFlagParser::ProcessFromenvLocked(const string & flagval, FlagS
     if (flagval.empty())
         return "";
 
+    StageTimer timer(STAGE_FROMENV, &fromenv_depth_);
     string msg;
     vector<string> flaglist;
     ParseFlagList(flagval.c_str(), &flaglist);
 
+    map<string, string> env_flags;
+    ReadEnvironmentFlags(&env_flags);
+
     for (size_t i = 0; i < flaglist.size(); ++i)
     {
+        // '*' is every flag of this program that the environment sets,
+        // by name.  The other variables are none of our business, and
+        // the ones for fromenv and tryfromenv would only be recursion.
+        if (flaglist[i] == "*")
+        {
+            for (map<string, string>::const_iterator env = env_flags.begin(); env != env_flags.end(); ++env)
+            {
+                CommandLineFlag * flag = registry_->FindFlagLocked(env->first.c_str());
+                if (flag == NULL || strcmp(flag->name(), "fromenv") == 0 || strcmp(flag->name(), "tryfromenv") == 0)
+                    continue;
+                msg += ProcessFromenvValueLocked(flag, env->second, set_mode);
+            }
+            continue;
+        }
+
         const char * flagname = flaglist[i].c_str();
         CommandLineFlag * flag = registry_->FindFlagLocked(flagname);
         if (flag == NULL)
@@ -240,31 +347,35 @@ string CommandLineFlagParser::ProcessFromenvLocked(const string & flagval, FlagS
             continue;
         }
 
-        const string envname = string("FLAGS_") + string(flagname);
-        string envval;
-        if (!SafeGetEnv(envname.c_str(), envval))
+        map<string, string>::const_iterator env = env_flags.find(flagname);
+        if (env == env_flags.end())
         {
             if (errors_are_fatal)
-                error_flags_[flagname] = (string(kError) + envname + " not found in environment\n");
-            continue;
-        }
-
-        // Avoid infinite recursion.
-        if (envval == "fromenv" || envval == "tryfromenv")
-        {
-            error_flags_[flagname] = StringPrintf("%sinfinite recursion on environment flag '%s'\n", kError, envval.c_str());
+                error_flags_[flagname] = (string(kError) + "FLAGS_" + flagname + " not found in environment\n");
             continue;
         }
 
-        msg += ProcessSingleOptionLocked(flag, envval.c_str(), set_mode);
+        msg += ProcessFromenvValueLocked(flag, env->second, set_mode);
     }
     return msg;
 }
 
+string CommandLineFlagParser::ProcessFromenvValueLocked(CommandLineFlag * flag, const string & envval, FlagSettingMode set_mode)
+{
+    // Avoid infinite recursion.
+    if (envval == "fromenv" || envval == "tryfromenv")
+    {
+        error_flags_[flag->name()] = StringPrintf("%sinfinite recursion on environment flag '%s'\n", kError, envval.c_str());
+        return "";
+    }
+
+    return ProcessSingleOptionLocked(flag, envval.c_str(), set_mode);
+}
+
 string CommandLineFlagParser::ProcessSingleOptionLocked(CommandLineFlag * flag, const char * value, FlagSettingMode set_mode)
 {
     string msg;
-    if (value && !registry_->SetFlagLocked(flag, value, set_mode, &msg))
+    if (value && !registry_->SetFlagLocked(flag, value, set_mode, &msg, report_changes_))
     {
         error_flags_[flag->name()] = msg;
         return "";
@@ -284,18 +395,108 @@ string CommandLineFlagParser::ProcessSingleOptionLocked(CommandLineFlag * flag,
     return msg;
 }
 
+// --------------------------------------------------------------------
+// ValidateAllFlags()
+//    The validators of the flags, sorted by name, with the result of
+//    each.  Those that may be slow are given a copy of the value, for
+//    the pool of RunValidations() to run them without the registry
+//    lock; the others are run right away, under it.  The errors are
+//    then noted in the order of the flags, whoever ran them.
+// --------------------------------------------------------------------
+
+struct FlagValidation
+{
+    const CommandLineFlag * flag;
+    FlagValue * value; // NULL once validated
+    bool valid;
+};
+
+struct FlagValidationPool
+{
+    Mutex lock;
+    vector<FlagValidation> * validations;
+    size_t next; // the next one for a thread to pick up
+};
+
+// Runs the validations waiting in the pool until there are none left;
+// the validators themselves may take the registry lock.
+static void * RunValidations(void * arg)
+{
+    FlagValidationPool * const pool = static_cast<FlagValidationPool *>(arg);
+    for (;;)
+    {
+        FlagValidation * validation;
+        {
+            MutexLock l(&pool->lock);
+            while (pool->next < pool->validations->size() && (*pool->validations)[pool->next].value == NULL)
+                ++pool->next;
+            if (pool->next == pool->validations->size())
+                return NULL;
+            validation = &(*pool->validations)[pool->next++];
+        }
+        validation->valid = validation->flag->Validate(*validation->value);
+        delete validation->value;
+        validation->value = NULL;
+    }
+}
+
 void CommandLineFlagParser::ValidateAllFlags()
 {
-    FlagRegistryLock frl(registry_);
-    for (FlagRegistry::FlagConstIterator i = registry_->flags_.begin(); i != registry_->flags_.end(); ++i)
+    StageTimer timer(STAGE_VALIDATION);
+    vector<FlagValidation> validations;
+    size_t num_slow = 0;
+    int32 num_threads;
     {
-        if (!i->second->ValidateCurrent())
+        FlagRegistryLock frl(registry_);
+        num_threads = FLAGS_validator_threads;
+        FlagRegistry::FlagList flags;
+        registry_->ValidatedFlagsLocked(&flags);
+        validations.resize(flags.size());
+        for (size_t i = 0; i < flags.size(); ++i)
+        {
+            FlagValidation & validation = validations[i];
+            validation.flag = flags[i];
+            validation.value = NULL;
+            if (num_threads <= 0 || flags[i]->validator_is_cheap())
+            {
+                validation.valid = flags[i]->ValidateCurrent();
+            }
+            else
+            {
+                validation.value = flags[i]->NewCopyOfCurrent();
+                ++num_slow;
+            }
+        }
+    }
+
+    if (num_slow > 0)
+    {
+        FlagValidationPool pool;
+        pool.validations = &validations;
+        pool.next = 0;
+#if defined(HAVE_PTHREAD) && !defined(NO_THREADS)
+        // This thread is one of the pool.
+        vector<pthread_t> threads(std::min(static_cast<size_t>(num_threads), num_slow) - 1);
+        size_t num_started = 0;
+        while (num_started < threads.size() && pthread_create(&threads[num_started], NULL, &RunValidations, &pool) == 0)
+            ++num_started;
+        RunValidations(&pool);
+        for (size_t i = 0; i < num_started; ++i)
+            pthread_join(threads[i], NULL);
+#else
+        RunValidations(&pool);
+#endif
+    }
+
+    for (vector<FlagValidation>::const_iterator i = validations.begin(); i != validations.end(); ++i)
+    {
+        if (!i->valid)
         {
             // only set a message if one isn't already there.  (If there's
             // an error message, our job is done, even if it's not exactly
             // the same error.)
-            if (error_flags_[i->second->name()].empty())
-                error_flags_[i->second->name()] = string(kError) + "--" + i->second->name() + " must be set on the commandline (default value fails validation)\n";
+            if (error_flags_[i->flag->name()].empty())
+                error_flags_[i->flag->name()] = string(kError) + "--" + i->flag->name() + " must be set on the commandline (default value fails validation)\n";
         }
     }
 }
@@ -342,49 +543,32 @@ bool CommandLineFlagParser::ReportErrors()
 }
 
 string CommandLineFlagParser::ProcessOptionsFromStringLocked(const string & contentdata, FlagSettingMode set_mode)
+{
+    Flagfile flagfile;
+    flagfile.Assign(contentdata.data(), contentdata.size());
+    return ProcessFlagfileContentsLocked(flagfile, set_mode);
+}
+
+string CommandLineFlagParser::ProcessFlagfileContentsLocked(const Flagfile & flagfile, FlagSettingMode set_mode)
 {
     string retval;
-    const char * flagfile_contents = contentdata.c_str();
     bool flags_are_relevant = true; // set to false when filenames don't match
     bool in_filename_section = false;
 
-    const char * line_end = flagfile_contents;
-    // We read this file a line at a time.
-    for (; line_end; flagfile_contents = line_end + 1)
+    const vector<Flagfile::Line> & lines = flagfile.lines();
+    for (vector<Flagfile::Line>::const_iterator line = lines.begin(); line != lines.end(); ++line)
     {
-        while (*flagfile_contents && isspace(*flagfile_contents))
-            ++flagfile_contents;
-        // Windows uses "\r\n"
-        line_end = strchr(flagfile_contents, '\r');
-        if (line_end == NULL)
-            line_end = strchr(flagfile_contents, '\n');
-
-        size_t len = line_end ? line_end - flagfile_contents : strlen(flagfile_contents);
-        string line(flagfile_contents, len);
-
-        // Each line can be one of four things:
-        // 1) A comment line -- we skip it
-        // 2) An empty line -- we skip it
-        // 3) A list of filenames -- starts a new filenames+flags section
-        // 4) A --flag=value line -- apply if previous filenames match
-        if (line.empty() || line[0] == '#')
-        {
-            // comment or empty line; just ignore
-        }
-        else if (line[0] == '-')
+        // Comments and empty lines are already gone, so each line is
+        // either a --flag=value line, to apply if the previous filenames
+        // match, or a list of filenames that starts a new section.
+        if (line->is_flag)
         {                                // flag
             in_filename_section = false; // instead, it was a flag-line
             if (!flags_are_relevant)     // skip this flag; applies to someone else
                 continue;
 
-            const char * name_and_val = line.c_str() + 1; // skip the leading -
-            if (*name_and_val == '-')
-                name_and_val++; // skip second - too
-            string key;
             const char * value;
-            string error_message;
-            CommandLineFlag * flag = registry_->SplitArgumentLocked(
-              name_and_val, &key, &value, &error_message);
+            CommandLineFlag * flag = registry_->SplitArgumentLocked(line->text, line->name_size, NULL, &value, NULL);
             // By API, errors parsing flagfile lines are silently ignored.
             if (flag == NULL)
             {
@@ -394,6 +578,20 @@ string CommandLineFlagParser::ProcessOptionsFromStringLocked(const string & cont
             {
                 // "WARNING: flagname '" + key + "' missing a value\n"
             }
+            else if (line->value != NULL && line->value_type == flag->current().type())
+            {
+                // Precompiled: the value is already parsed.  Only
+                // non-string flags get one, so this is never one of the
+                // recursive flags ProcessSingleOptionLocked() looks for.
+                uint64 storage;
+                memcpy(&storage, line->value, sizeof(storage));
+                FlagValue parsed(&storage, static_cast<FlagValue::ValueType>(line->value_type), false);
+                string msg;
+                if (registry_->SetFlagLocked(flag, parsed, set_mode, &msg, report_changes_))
+                    retval += msg;
+                else
+                    error_flags_[flag->name()] = msg;
+            }
             else
             {
                 retval += ProcessSingleOptionLocked(flag, value, set_mode);
@@ -407,32 +605,72 @@ string CommandLineFlagParser::ProcessOptionsFromStringLocked(const string & cont
                 flags_are_relevant = false;
             }
 
-            // Split the line up at spaces into glob-patterns
-            const char * space = line.c_str(); // just has to be non-NULL
-            for (const char * word = line.c_str(); *space; word = space + 1)
-            {
-                if (flags_are_relevant) // we can stop as soon as we match
-                    break;
-                space = strchr(word, ' ');
-                if (space == NULL)
-                    space = word + strlen(word);
-                const string glob(word, space - word);
-                // We try matching both against the full argv0 and basename(argv0)
-                if (glob == ProgramInvocationName() // small optimization
-                    || glob == ProgramInvocationShortName()
+            if (!flags_are_relevant) // we can stop as soon as we match
+                flags_are_relevant = GlobsMatchProgram(*line);
+        }
+    }
+    return retval;
+}
+
+// --------------------------------------------------------------------
+// GlobsMatchProgram()
+//    Each section line is only matched once per name of the program
+//    (it's "UNKNOWN" until SetArgv(), which only sets it once): the
+//    answer is kept in the line itself, so that a flagfile that's
+//    applied again, from the flagfile cache or on a reload, only looks
+//    its sections up, without a lock.  Several threads may match the
+//    same line of a cached flagfile at once; they find the same answer.
+//    Matching splits a copy of the line into its globs in place, and
+//    only hands those with wildcards to fnmatch(); the others are just
+//    names.
+// --------------------------------------------------------------------
+
+static bool GlobMatchesProgram(const char * glob)
+{
+    // We try matching both against the full argv0 and basename(argv0)
+    if (strcmp(glob, ProgramInvocationName()) == 0 || strcmp(glob, ProgramInvocationShortName()) == 0)
+        return true;
 #if defined(HAVE_FNMATCH_H)
-                    || fnmatch(glob.c_str(), ProgramInvocationName(), FNM_PATHNAME) == 0 || fnmatch(glob.c_str(), ProgramInvocationShortName(), FNM_PATHNAME) == 0
+    if (strpbrk(glob, "*?[\\") == NULL)
+        return false;
+    return fnmatch(glob, ProgramInvocationName(), FNM_PATHNAME) == 0 || fnmatch(glob, ProgramInvocationShortName(), FNM_PATHNAME) == 0;
 #elif defined(HAVE_SHLWAPI_H)
-                    || PathMatchSpec(glob.c_str(), ProgramInvocationName()) || PathMatchSpec(glob.c_str(), ProgramInvocationShortName())
+    if (strpbrk(glob, "*?;") == NULL)
+        return false;
+    return PathMatchSpec(glob, ProgramInvocationName()) || PathMatchSpec(glob, ProgramInvocationShortName());
+#else
+    return false;
 #endif
-                    )
-                {
-                    flags_are_relevant = true;
-                }
-            }
+}
+
+bool CommandLineFlagParser::GlobsMatchProgram(const Flagfile::Line & line)
+{
+    // Line::match is 0 until matched, then 2 (before SetArgv()) or 4
+    // (after), plus 1 if the line matched.
+    const int8 program = GetArgvs().empty() ? 2 : 4;
+    const int8 match = atomic_internal::LoadRelaxed(&line.match);
+    if ((match & ~1) == program)
+        return (match & 1) != 0;
+
+    // Split the line up at spaces into glob-patterns
+    bool matches = false;
+    vector<char> globs(line.text, line.text + strlen(line.text) + 1);
+    for (char * word = &globs[0];;)
+    {
+        char * const space = strchr(word, ' ');
+        if (space != NULL)
+            *space = '\0';
+        if (GlobMatchesProgram(word))
+        {
+            matches = true;
+            break;
         }
+        if (space == NULL)
+            break;
+        word = space + 1;
     }
-    return retval;
+    atomic_internal::StoreRelaxed(&line.match, static_cast<int8>(program | (matches ? 1 : 0)));
+    return matches;
 }
 
 } // namespace JFLAGS_NAMESPACE
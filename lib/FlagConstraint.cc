@@ -0,0 +1,98 @@
+////////////////////////////////////////////////////////////////////////////////
+//                                    jflags
+//
+// This file is distributed under the 3-clause Berkeley Software Distribution
+// License. See LICENSE.txt for details.
+////////////////////////////////////////////////////////////////////////////////
+#include "FlagConstraint.h"
+#include "FlagValue.h"
+
+#include <assert.h>
+#include <cstring>
+
+namespace JFLAGS_NAMESPACE {
+
+FlagConstraint::FlagConstraint(const FlagValue & min, const FlagValue & max)
+: min_(min.New()), max_(max.New())
+{
+    assert(min.type() == max.type() && min.type() != FlagValue::FV_BOOL && min.type() != FlagValue::FV_STRING);
+    min_->CopyFrom(min);
+    max_->CopyFrom(max);
+    description_ = "[" + min_->ToString() + ", " + max_->ToString() + "]";
+}
+
+FlagConstraint::FlagConstraint(const char * values)
+: min_(NULL), max_(NULL)
+{
+    for (const char * p = values; p != NULL; )
+    {
+        const char * const comma = strchr(p, ',');
+        const string value = comma == NULL ? string(p) : string(p, comma - p);
+        p = comma == NULL ? NULL : comma + 1;
+        if (!value.empty() && !Allows(value))
+        {
+            values_.push_back(value);
+            // Keep the index at most half full
+            if (slots_.size() < 2 * values_.size())
+            {
+                slots_.assign(slots_.empty() ? 8 : 2 * slots_.size(), 0);
+                for (size_t v = 0; v < values_.size() - 1; ++v)
+                    Insert(v);
+            }
+            Insert(values_.size() - 1);
+            if (!description_.empty())
+                description_ += '|';
+            description_ += value;
+        }
+    }
+}
+
+FlagConstraint::~FlagConstraint()
+{
+    delete min_;
+    delete max_;
+}
+
+bool FlagConstraint::Allows(const FlagValue & value) const
+{
+    if (min_ != NULL)
+        return value.Between(*min_, *max_);
+    assert(value.type() == FlagValue::FV_STRING);
+    return Allows(*static_cast<const string *>(value.value_buffer_));
+}
+
+// 32-bit FNV-1a, as for the names of the flags in the registry.
+size_t FlagConstraint::HashValue(const string & value)
+{
+    uint32 hash = 2166136261U;
+    for (size_t i = 0; i < value.size(); ++i)
+    {
+        hash ^= static_cast<unsigned char>(value[i]);
+        hash *= 16777619U;
+    }
+    return hash;
+}
+
+void FlagConstraint::Insert(size_t v)
+{
+    const size_t mask = slots_.size() - 1;
+    size_t i = HashValue(values_[v]) & mask;
+    while (slots_[i] != 0)
+        i = (i + 1) & mask;
+    slots_[i] = v + 1;
+}
+
+bool FlagConstraint::Allows(const string & value) const
+{
+    if (slots_.empty())
+        return false;
+    const size_t mask = slots_.size() - 1;
+    for (size_t i = HashValue(value) & mask; slots_[i] != 0; i = (i + 1) & mask)
+    {
+        if (values_[slots_[i] - 1] == value)
+            return true;
+    }
+    return false;
+}
+
+} // namespace JFLAGS_NAMESPACE
@@ -0,0 +1,214 @@
+////////////////////////////////////////////////////////////////////////////////
+//                                    jflags
+//
+// This file is distributed under the 3-clause Berkeley Software Distribution
+// License. See LICENSE.txt for details.
+////////////////////////////////////////////////////////////////////////////////
+#include "FlagHelp.h"
+#include "FlagRegisterer.h"
+#include "util.h"
+#include "mutex.h"
+
+#include <string.h>
+#include <algorithm>
+#include <vector>
+
+using namespace MUTEX_NAMESPACE;
+
+namespace JFLAGS_NAMESPACE {
+
+using std::vector;
+
+// This is used by jflags_define.h, and by CommandLineFlag::help()
+const char kCompressedFlagHelp[] = "\001\002\003\004 (compressed) \004\003\002\001";
+
+// --------------------------------------------------------------------
+// UnpackFlagHelp()
+//    Decodes a bit at a time.  It only runs when someone asks for help,
+//    so keeping it small beats keeping it fast.
+// --------------------------------------------------------------------
+
+struct PackedHelpReader
+{
+    PackedHelpReader(const unsigned char * begin, const unsigned char * end) : p(begin), end(end), bit(0), overrun(false) {}
+
+    uint32 Bit()
+    {
+        if (p == end)
+        {
+            overrun = true;
+            return 0;
+        }
+        const uint32 b = (*p >> bit) & 1;
+        if (++bit == 8)
+        {
+            bit = 0;
+            ++p;
+        }
+        return b;
+    }
+
+    uint32 Bits(int n)
+    {
+        uint32 bits = 0;
+        for (int i = 0; i < n; ++i)
+            bits |= Bit() << i;
+        return bits;
+    }
+
+    uint32 ValueInClass(int c) { return (1U << c) | Bits(c); }
+
+    const unsigned char * p;
+    const unsigned char * const end;
+    int bit;
+    bool overrun;
+};
+
+// counts[n] is how many codes are n bits long, and symbols lists the
+// symbols by the length of their code, then by value.
+static int DecodeSymbol(PackedHelpReader * in, const int * counts, const int * symbols)
+{
+    int code = 0;
+    int first = 0; // the first code of the current length
+    int index = 0; // of that code's symbol
+    for (int length = 1; length <= kMaxPackedCodeLength; ++length)
+    {
+        code |= in->Bit();
+        if (code - first < counts[length])
+            return symbols[index + code - first];
+        index += counts[length];
+        first = (first + counts[length]) << 1;
+        code <<= 1;
+    }
+    return -1;
+}
+
+bool UnpackFlagHelp(const unsigned char * packed, size_t packed_size, char * out, size_t size)
+{
+    const size_t lengths_size = (kPackedHelpSymbols + 1) / 2;
+    if (packed_size < lengths_size)
+        return false;
+    int counts[kMaxPackedCodeLength + 1] = { 0 };
+    int symbols[kPackedHelpSymbols];
+    int num_symbols = 0;
+    for (int length = 1; length <= kMaxPackedCodeLength; ++length)
+    {
+        for (int symbol = 0; symbol < kPackedHelpSymbols; ++symbol)
+        {
+            if (((packed[symbol / 2] >> (symbol % 2 * 4)) & 0xf) == length)
+            {
+                symbols[num_symbols++] = symbol;
+                ++counts[length];
+            }
+        }
+    }
+
+    PackedHelpReader in(packed + lengths_size, packed + packed_size);
+    size_t done = 0;
+    while (done < size)
+    {
+        const int symbol = DecodeSymbol(&in, counts, symbols);
+        if (symbol < 0 || in.overrun)
+            return false;
+        if (symbol < 256)
+        {
+            out[done++] = static_cast<char>(symbol);
+            continue;
+        }
+        const size_t length = kMinPackedMatch - 1 + in.ValueInClass(symbol - 256);
+        const size_t offset = in.ValueInClass(static_cast<int>(in.Bits(4)));
+        if (in.overrun || offset > done || length > size - done)
+            return false;
+        for (const size_t end = done + length; done < end; ++done)
+            out[done] = out[done - offset]; // the run may overlap what it copies
+    }
+    return true;
+}
+
+// --------------------------------------------------------------------
+// FlagHelpRegisterer
+// CompressedFlagHelp()
+//    The tables register themselves in global constructors, which may
+//    run after help was asked for (those of a library loaded at run
+//    time), so looking a help up first unpacks whatever tables were
+//    registered since the last time.  The helps of all the unpacked
+//    tables are indexed together, by the flag name that precedes each
+//    of them.
+// --------------------------------------------------------------------
+
+struct PackedHelpTable
+{
+    const unsigned char * packed;
+    size_t packed_size;
+    size_t size;
+    PackedHelpTable * next;
+};
+
+static Mutex packed_help_lock(Mutex::LINKER_INITIALIZED);
+static PackedHelpTable * packed_help_tables = NULL; // not unpacked yet
+static vector<const char *> * help_index = NULL;    // names, sorted
+
+FlagHelpRegisterer::FlagHelpRegisterer(const unsigned char * packed, size_t packed_size, size_t size)
+{
+    PackedHelpTable * table = new PackedHelpTable;
+    table->packed = packed;
+    table->packed_size = packed_size;
+    table->size = size;
+    MutexLock l(&packed_help_lock);
+    table->next = packed_help_tables;
+    packed_help_tables = table;
+}
+
+struct HelpNameLess
+{
+    bool operator()(const char * a, const char * b) const { return strcmp(a, b) < 0; }
+};
+
+// Requires packed_help_lock.
+static void UnpackNewHelpTables()
+{
+    if (help_index == NULL)
+        help_index = new vector<const char *>;
+    bool added = false;
+    while (packed_help_tables != NULL)
+    {
+        PackedHelpTable * const table = packed_help_tables;
+        packed_help_tables = table->next;
+        // Owned by help_index from now on: helps live as long as the program.
+        char * const unpacked = new char[table->size];
+        if (table->size > 0 && UnpackFlagHelp(table->packed, table->packed_size, unpacked, table->size) && unpacked[table->size - 1] == '\0')
+        {
+            const char * const end = unpacked + table->size; // after a '\0'
+            for (const char * name = unpacked; name < end;)
+            {
+                const char * const help = name + strlen(name) + 1;
+                if (help == end)
+                    break; // a name without a help
+                help_index->push_back(name);
+                name = help + strlen(help) + 1;
+            }
+            added = true;
+        }
+        else
+        {
+            LOG(WARNING) << "Ignoring a corrupt table of compressed flag help";
+            delete[] unpacked;
+        }
+        delete table;
+    }
+    if (added)
+        sort(help_index->begin(), help_index->end(), HelpNameLess());
+}
+
+const char * CompressedFlagHelp(const char * name)
+{
+    MutexLock l(&packed_help_lock);
+    if (packed_help_tables != NULL || help_index == NULL)
+        UnpackNewHelpTables();
+    const vector<const char *>::const_iterator i = lower_bound(help_index->begin(), help_index->end(), name, HelpNameLess());
+    if (i == help_index->end() || strcmp(*i, name) != 0)
+        return kStrippedFlagHelp;
+    return *i + strlen(*i) + 1;
+}
+
+} // namespace JFLAGS_NAMESPACE
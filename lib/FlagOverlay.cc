@@ -0,0 +1,208 @@
+////////////////////////////////////////////////////////////////////////////////
+//                                    jflags
+//
+// This file is distributed under the 3-clause Berkeley Software Distribution
+// License. See LICENSE.txt for details.
+////////////////////////////////////////////////////////////////////////////////
+#include "FlagOverlay.h"
+#include "FlagRegistry.h"
+
+#include <vector>
+
+namespace JFLAGS_NAMESPACE {
+
+using std::string;
+using std::vector;
+
+// --------------------------------------------------------------------
+// FlagOverlayImpl
+//    The values an overlay overrides, in an open-addressing hash index
+//    from the flag, which is never more than half full.  The index
+//    starts empty, so an overlay that overrides nothing allocates
+//    nothing.
+// --------------------------------------------------------------------
+
+class FlagOverlayImpl
+{
+public:
+    explicit FlagOverlayImpl(const FlagOverlayImpl * base) : base_(base), num_values_(0) {}
+    ~FlagOverlayImpl()
+    {
+        for (vector<Slot>::const_iterator i = slots_.begin(); i != slots_.end(); ++i)
+        {
+            if (i->flag != NULL)
+                delete i->value;
+        }
+    }
+
+    // The value of flag in this overlay, or the ones it's layered on,
+    // or NULL if none of them overrides it.
+    const FlagValue * Find(const CommandLineFlag * flag) const
+    {
+        for (const FlagOverlayImpl * overlay = this; overlay != NULL; overlay = overlay->base_)
+        {
+            if (overlay->num_values_ == 0)
+                continue;
+            const Slot * slot = overlay->SlotOf(flag);
+            if (slot->flag != NULL)
+                return slot->value;
+        }
+        return NULL;
+    }
+
+    // Takes value over.
+    void Set(const CommandLineFlag * flag, FlagValue * value);
+    bool Clear(const CommandLineFlag * flag);
+
+private:
+    struct Slot
+    {
+        const CommandLineFlag * flag; // NULL if empty
+        FlagValue * value;
+    };
+
+    const FlagOverlayImpl * const base_;
+    vector<Slot> slots_;
+    size_t num_values_;
+
+    // The slot of flag, or the empty one where it would go.
+    const Slot * SlotOf(const CommandLineFlag * flag) const
+    {
+        const size_t mask = slots_.size() - 1;
+        size_t i = (reinterpret_cast<size_t>(flag) >> 4) & mask; // flags are aligned
+        while (slots_[i].flag != NULL && slots_[i].flag != flag)
+            i = (i + 1) & mask;
+        return &slots_[i];
+    }
+    Slot * SlotOf(const CommandLineFlag * flag) { return const_cast<Slot *>(static_cast<const FlagOverlayImpl *>(this)->SlotOf(flag)); }
+
+    void Rehash(size_t num_slots);
+
+    FlagOverlayImpl(const FlagOverlayImpl &); // no copying!
+    void operator=(const FlagOverlayImpl &);
+};
+
+void FlagOverlayImpl::Rehash(size_t num_slots)
+{
+    vector<Slot> old_slots(num_slots);
+    old_slots.swap(slots_);
+    for (size_t i = 0; i < slots_.size(); ++i)
+        slots_[i].flag = NULL;
+    for (vector<Slot>::const_iterator i = old_slots.begin(); i != old_slots.end(); ++i)
+    {
+        if (i->flag != NULL)
+            *SlotOf(i->flag) = *i;
+    }
+}
+
+void FlagOverlayImpl::Set(const CommandLineFlag * flag, FlagValue * value)
+{
+    if (2 * (num_values_ + 1) > slots_.size())
+        Rehash(slots_.empty() ? 8 : 2 * slots_.size());
+    Slot * slot = SlotOf(flag);
+    if (slot->flag == NULL)
+        ++num_values_;
+    else
+        delete slot->value;
+    slot->flag = flag;
+    slot->value = value;
+}
+
+bool FlagOverlayImpl::Clear(const CommandLineFlag * flag)
+{
+    if (num_values_ == 0)
+        return false;
+    Slot * slot = SlotOf(flag);
+    if (slot->flag == NULL)
+        return false;
+    delete slot->value;
+    slot->flag = NULL;
+    --num_values_;
+    // The flags after it in its run may have been pushed past where it
+    // was: put them back where they'd go now.
+    const size_t mask = slots_.size() - 1;
+    for (size_t i = (slot - &slots_[0] + 1) & mask; slots_[i].flag != NULL; i = (i + 1) & mask)
+    {
+        const Slot moved = slots_[i];
+        slots_[i].flag = NULL;
+        *SlotOf(moved.flag) = moved;
+    }
+    return true;
+}
+
+// --------------------------------------------------------------------
+// The current overlay of each thread
+//    Builds without threads only have the one thread to worry about.
+// --------------------------------------------------------------------
+
+#if (!defined(HAVE_PTHREAD) && !defined(OS_WINDOWS)) || defined(NO_THREADS)
+static const FlagOverlayImpl * current_overlay = NULL;
+#elif defined(_MSC_VER)
+static __declspec(thread) const FlagOverlayImpl * current_overlay = NULL;
+#else
+static __thread const FlagOverlayImpl * current_overlay = NULL;
+#endif
+
+const FlagValue * OverlaidValue(const CommandLineFlag * flag)
+{
+    const FlagOverlayImpl * const overlay = current_overlay;
+    return overlay == NULL ? NULL : overlay->Find(flag);
+}
+
+// --------------------------------------------------------------------
+// FlagOverlay
+// ScopedFlagOverlay
+// --------------------------------------------------------------------
+
+FlagOverlay::FlagOverlay(const FlagOverlay * base)
+: impl_(new FlagOverlayImpl(base == NULL ? NULL : base->impl_))
+{
+}
+
+FlagOverlay::~FlagOverlay()
+{
+    delete impl_;
+}
+
+string FlagOverlay::Set(const char * name, const char * value)
+{
+    if (name == NULL || value == NULL)
+        return "";
+    FlagRegistry * const registry = FlagRegistry::GlobalRegistry();
+    FlagRegistryReaderLock frl(registry); // only the flag's validator can look at it
+    const CommandLineFlag * flag = registry->FindFlagLocked(name);
+    if (flag == NULL)
+        return "";
+    FlagValue * const overlaid = flag->NewCopyOfCurrent();
+    string msg;
+    if (!TryParseLocked(flag, overlaid, value, &msg, true))
+    {
+        delete overlaid;
+        return "";
+    }
+    impl_->Set(flag, overlaid);
+    return msg;
+}
+
+bool FlagOverlay::Clear(const char * name)
+{
+    if (name == NULL)
+        return false;
+    FlagRegistry * const registry = FlagRegistry::GlobalRegistry();
+    FlagRegistryReaderLock frl(registry);
+    const CommandLineFlag * flag = registry->FindFlagLocked(name);
+    return flag != NULL && impl_->Clear(flag);
+}
+
+ScopedFlagOverlay::ScopedFlagOverlay(const FlagOverlay * overlay)
+: previous_(current_overlay)
+{
+    current_overlay = overlay == NULL ? NULL : overlay->impl_;
+}
+
+ScopedFlagOverlay::~ScopedFlagOverlay()
+{
+    current_overlay = previous_;
+}
+
+} // namespace JFLAGS_NAMESPACE
@@ -8,6 +8,9 @@
 #include "FlagRegistry.h"
 #include "FlagValue.h"
 #include "CommandLineFlag.h"
+#include "jflags_error.h"
+
+#include <cstring>
 
 namespace JFLAGS_NAMESPACE {
 
@@ -22,19 +25,55 @@ namespace JFLAGS_NAMESPACE {
 //    values in a global destructor.
 // --------------------------------------------------------------------
 
-FlagRegisterer::FlagRegisterer(const char * name, const char * type, const char * help, const char * filename, void * current_storage, void * defvalue_storage)
+static void RegisterFlag(const char * name, FlagType type, const char * help, const char * filename, void * current_storage, void * defvalue_storage, bool atomic, AtomicStringFlag * atomic_string)
+{
+    const FlagTableEntry entry = { name, type, help, filename, current_storage, defvalue_storage, atomic };
+    FlagRegistry * const registry = FlagRegistry::GlobalRegistry(); // default registry
+    StageTimer timer(STAGE_REGISTRATION);
+    // Importantly, the flag will never be deleted, so storage is always good.
+    registry->RegisterFlag(entry, atomic_string);
+}
+
+// The type named type, as in DEFINE_VARIABLE(): we get rid of the
+// namespace components, if any.
+static FlagType TypeOfName(const char * name, const char * type)
 {
-    if (help == NULL)
-        help = "";
-    // FlagValue expects the type-name to not include any namespace
-    // components, so we get rid of those, if any.
     if (strchr(type, ':'))
         type = strrchr(type, ':') + 1;
-    FlagValue * current = new FlagValue(current_storage, type, false);
-    FlagValue * defvalue = new FlagValue(defvalue_storage, type, false);
-    // Importantly, flag_ will never be deleted, so storage is always good.
-    CommandLineFlag * flag = new CommandLineFlag(name, help, filename, current, defvalue);
-    FlagRegistry::GlobalRegistry()->RegisterFlag(flag); // default registry
+    FlagValue::ValueType value_type;
+    if (!FlagValue::TypeOfName(type, &value_type))
+        ReportError(DIE, "ERROR: flag '%s' has unknown type '%s'\n", name, type);
+    return static_cast<FlagType>(value_type);
+}
+
+FlagRegisterer::FlagRegisterer(const char * name, const char * type, const char * help, const char * filename, void * current_storage, void * defvalue_storage)
+{
+    RegisterFlag(name, TypeOfName(name, type), help, filename, current_storage, defvalue_storage, false, NULL);
+}
+
+FlagRegisterer::FlagRegisterer(const char * name, FlagType type, const char * help, const char * filename, void * current_storage, void * defvalue_storage)
+{
+    RegisterFlag(name, type, help, filename, current_storage, defvalue_storage, false, NULL);
+}
+
+FlagRegisterer::FlagRegisterer(const char * name, const char * type, const char * help, const char * filename, void * current_storage, void * defvalue_storage, Atomic)
+{
+    RegisterFlag(name, TypeOfName(name, type), help, filename, current_storage, defvalue_storage, true, NULL);
+}
+
+FlagRegisterer::FlagRegisterer(const char * name, FlagType type, const char * help, const char * filename, void * current_storage, void * defvalue_storage, Atomic)
+{
+    RegisterFlag(name, type, help, filename, current_storage, defvalue_storage, true, NULL);
+}
+
+FlagRegisterer::FlagRegisterer(const char * name, const char * type, const char * help, const char * filename, void * current_storage, void * defvalue_storage, AtomicStringFlag * atomic_string)
+{
+    RegisterFlag(name, TypeOfName(name, type), help, filename, current_storage, defvalue_storage, true, atomic_string);
+}
+
+FlagRegisterer::FlagRegisterer(const char * name, FlagType type, const char * help, const char * filename, void * current_storage, void * defvalue_storage, AtomicStringFlag * atomic_string)
+{
+    RegisterFlag(name, type, help, filename, current_storage, defvalue_storage, true, atomic_string);
 }
 
 } // namespace JFLAGS_NAMESPACE
@@ -6,11 +6,30 @@
 ////////////////////////////////////////////////////////////////////////////////
 #include "FlagRegistry.h"
 
+#include <algorithm>
+#include <new>
 #include <utility> // for pair<>
 
+// The flag table: all the FlagTableEntries that the DEFINE_* macros put
+// in the jflags_table section, between the symbols the linker defines
+// for it.  Without any, neither is defined, and both are NULL.
+#if JFLAGS_HAVE_FLAG_TABLE
+extern "C" {
+extern const JFLAGS_NAMESPACE::FlagTableEntry __start_jflags_table[] __attribute__((weak, visibility("hidden")));
+extern const JFLAGS_NAMESPACE::FlagTableEntry __stop_jflags_table[] __attribute__((weak, visibility("hidden")));
+}
+#define JFLAGS_FLAG_TABLE_BEGIN __start_jflags_table
+#define JFLAGS_FLAG_TABLE_END __stop_jflags_table
+#else
+#define JFLAGS_FLAG_TABLE_BEGIN NULL
+#define JFLAGS_FLAG_TABLE_END NULL
+#endif
+
 namespace JFLAGS_NAMESPACE {
 
+using std::make_pair;
 using std::pair;
+using std::sort;
 
 // --------------------------------------------------------------------
 // FlagRegistry
@@ -22,16 +41,58 @@ using std::pair;
 //    the function will acquire it itself if needed.
 // --------------------------------------------------------------------
 
+const size_t FlagRegistry::kMinSlots;
+
+// 32-bit FNV-1a.  Flag names are short, so something simple that mixes
+// every byte is all we need here.
+uint32 FlagRegistry::HashFlagName(const char * name, size_t name_len)
+{
+    uint32 hash = 2166136261U;
+    for (size_t i = 0; i < name_len; ++i)
+    {
+        hash ^= static_cast<unsigned char>(name[i]);
+        hash *= 16777619U;
+    }
+    return hash;
+}
+
+void FlagRegistry::InsertSlotLocked(uint32 hash, CommandLineFlag * flag)
+{
+    const size_t mask = slots_.size() - 1;
+    size_t i = hash & mask;
+    while (slots_[i].flag != NULL)
+        i = (i + 1) & mask;
+    slots_[i].hash = hash;
+    slots_[i].flag = flag;
+}
+
+void FlagRegistry::ResizeSlotsLocked(size_t num_slots)
+{
+    vector<FlagSlot> old_slots(num_slots);
+    old_slots.swap(slots_);
+    for (size_t i = 0; i < old_slots.size(); ++i)
+    {
+        if (old_slots[i].flag != NULL)
+            InsertSlotLocked(old_slots[i].hash, old_slots[i].flag);
+    }
+}
+
 void FlagRegistry::RegisterFlag(CommandLineFlag * flag)
 {
     Lock();
-    pair<FlagIterator, bool> ins = flags_.insert(pair<const char *, CommandLineFlag *>(flag->name(), flag));
-    if (ins.second == false)
-    { // means the name was already in the map
-        if (strcmp(ins.first->second->filename(), flag->filename()) != 0)
+    AddFlagLocked(flag);
+    Unlock();
+}
+
+void FlagRegistry::AddFlagLocked(CommandLineFlag * flag)
+{
+    CommandLineFlag * const existing = FindFlagLocked(flag->name());
+    if (existing != NULL)
+    { // means the name was already in the registry
+        if (strcmp(existing->filename(), flag->filename()) != 0)
         {
             ReportError(DIE, "ERROR: flag '%s' was defined more than once (in files '%s' and '%s').\n",
-                        flag->name(), ins.first->second->filename(),
+                        flag->name(), existing->filename(),
                         flag->filename());
         }
         else
@@ -42,49 +103,283 @@ void FlagRegistry::RegisterFlag(CommandLineFlag * flag)
                         "and dynamically into this executable.\n",
                         flag->name(), flag->filename(), flag->filename());
         }
+        return; // in case jflags_exitfunc didn't exit: keep the first one
+    }
+    flag->clean_file_ = InternFilenameLocked(flag);
+    flags_.push_back(flag);
+    sorted_by_file_flags_valid_ = false;
+    sorted_by_name_flags_valid_ = false;
+    for (const char * p = flag->name(); ; ++p)
+    {
+        layout_fingerprint_ ^= static_cast<unsigned char>(*p);
+        layout_fingerprint_ *= 16777619U;
+        if (*p == '\0')
+            break;
+    }
+    layout_fingerprint_ ^= static_cast<uint32>(flag->current_->type());
+    layout_fingerprint_ *= 16777619U;
+
+    // Grow the hash index once it gets half full, then add the new flag.
+    if (2 * flags_.size() > slots_.size())
+        ResizeSlotsLocked(2 * slots_.size());
+    InsertSlotLocked(HashFlagName(flag->name(), strlen(flag->name())), flag);
+
+    // Also add to the index by pointer.  An atomic string flag is
+    // found by the AtomicStringFlag, not jflags' own copy of the value.
+    AddFlagPtrLocked(flag->current_->value_buffer_, flag);
+    if (flag->current_->atomic_string_ != NULL)
+        AddFlagPtrLocked(flag->current_->atomic_string_, flag);
+}
+
+struct FilenameCmp
+{
+    bool operator()(const char * a, const char * b) const { return strcmp(a, b) < 0; }
+};
+
+const char * FlagRegistry::InternFilenameLocked(const CommandLineFlag * flag)
+{
+    // The flags of a file register one after the other.
+    if (!flags_.empty() && flags_.back()->file_ == flag->file_)
+        return flags_.back()->clean_file_;
+    const vector<const char *>::iterator i = lower_bound(filenames_.begin(), filenames_.end(), flag->clean_file_, FilenameCmp());
+    if (i != filenames_.end() && strcmp(*i, flag->clean_file_) == 0)
+        return *i;
+    filenames_.insert(i, flag->clean_file_);
+    return flag->clean_file_;
+}
+
+size_t FlagRegistry::HashFlagPtr(const void * ptr)
+{
+    // The low bits are alignment; multiplying mixes the rest upwards,
+    // and the high half of the product is what ends up in the index.
+    const size_t bits = reinterpret_cast<size_t>(ptr) >> 3;
+    return (bits * static_cast<size_t>(0x9E3779B97F4A7C15ULL)) >> (sizeof(size_t) * 4);
+}
+
+void FlagRegistry::AddFlagPtrLocked(const void * ptr, CommandLineFlag * flag)
+{
+    if (2 * (num_ptrs_ + 1) > ptr_slots_.size())
+    {
+        vector<FlagPtrSlot> old_slots(2 * ptr_slots_.size());
+        old_slots.swap(ptr_slots_);
+        num_ptrs_ = 0;
+        for (size_t i = 0; i < old_slots.size(); ++i)
+        {
+            if (old_slots[i].ptr != NULL)
+                AddFlagPtrLocked(old_slots[i].ptr, old_slots[i].flag);
+        }
+    }
+    const size_t mask = ptr_slots_.size() - 1;
+    size_t i = HashFlagPtr(ptr) & mask;
+    while (ptr_slots_[i].ptr != NULL && ptr_slots_[i].ptr != ptr)
+        i = (i + 1) & mask;
+    if (ptr_slots_[i].ptr == NULL)
+        ++num_ptrs_;
+    ptr_slots_[i].ptr = ptr;
+    ptr_slots_[i].flag = flag;
+}
+
+// --------------------------------------------------------------------
+// FlagArena
+// --------------------------------------------------------------------
+
+const size_t FlagArena::kAlignment;
+const size_t FlagArena::kBlockSize;
+
+FlagArena::~FlagArena()
+{
+    for (vector<char *>::iterator b = blocks_.begin(); b != blocks_.end(); ++b)
+        delete[] *b;
+}
+
+void * FlagArena::Allocate(size_t size)
+{
+    size = (size + kAlignment - 1) & ~(kAlignment - 1);
+    if (size > left_)
+    {
+        // A block of its own for what doesn't fit in a whole one.
+        const size_t block_size = size > kBlockSize ? size : kBlockSize;
+        blocks_.push_back(new char[block_size]);
+        next_ = blocks_.back();
+        left_ = block_size;
     }
-    // Also add to the flags_by_ptr_ map.
-    flags_by_ptr_[flag->current_->value_buffer_] = flag;
+    void * const result = next_;
+    next_ += size;
+    left_ -= size;
+    return result;
+}
+
+// --------------------------------------------------------------------
+// RegisterFlag()
+// RegisterFlagTable()
+//    The flags the registry creates itself go in its arena, each
+//    followed by its values; for a table, the hash index is grown to
+//    fit them all beforehand.  ~FlagRegistry() destroys them in place
+//    before the arena goes.
+// --------------------------------------------------------------------
+
+CommandLineFlag * FlagRegistry::CreateFlagLocked(const FlagTableEntry & entry, AtomicStringFlag * atomic_string)
+{
+    const FlagValue::ValueType type = static_cast<FlagValue::ValueType>(entry.type);
+    const size_t flag_size = (sizeof(CommandLineFlag) + sizeof(void *) - 1) & ~(sizeof(void *) - 1);
+    char * const node = static_cast<char *>(arena_.Allocate(flag_size + 2 * sizeof(FlagValue)));
+    FlagValue * const values = reinterpret_cast<FlagValue *>(node + flag_size);
+    FlagValue * current = new (&values[0]) FlagValue(entry.current_storage, type, false);
+    FlagValue * defvalue = new (&values[1]) FlagValue(entry.defvalue_storage, type, false);
+    if (entry.atomic)
+        current->MakeAtomic(atomic_string);
+    CommandLineFlag * flag = new (node) CommandLineFlag(entry.name, entry.help != NULL ? entry.help : "", entry.filename, current, defvalue);
+    flag->in_arena_ = true;
+    return flag;
+}
+
+void FlagRegistry::RegisterFlag(const FlagTableEntry & entry, AtomicStringFlag * atomic_string)
+{
+    Lock();
+    AddFlagLocked(CreateFlagLocked(entry, atomic_string));
+    Unlock();
+}
+
+void FlagRegistry::RegisterFlagTable(const FlagTableEntry * begin, const FlagTableEntry * end)
+{
+    const size_t num_flags = end - begin;
+    if (num_flags == 0)
+        return;
+
+    Lock();
+    flags_.reserve(flags_.size() + num_flags);
+    size_t num_slots = slots_.size();
+    while (2 * (flags_.size() + num_flags) > num_slots)
+        num_slots *= 2;
+    if (num_slots != slots_.size())
+        ResizeSlotsLocked(num_slots);
+    for (const FlagTableEntry * entry = begin; entry != end; ++entry)
+        AddFlagLocked(CreateFlagLocked(*entry, NULL));
     Unlock();
 }
 
 CommandLineFlag * FlagRegistry::FindFlagLocked(const char * name)
 {
-    FlagConstIterator i = flags_.find(name);
-    if (i == flags_.end())
-        return NULL;
-    else
-        return i->second;
+    return FindFlagLocked(name, strlen(name));
 }
 
-CommandLineFlag * FlagRegistry::FindFlagViaPtrLocked(const void * flag_ptr)
+CommandLineFlag * FlagRegistry::FindFlagLocked(const char * name, size_t name_len)
 {
-    FlagPtrMap::const_iterator i = flags_by_ptr_.find(flag_ptr);
-    if (i == flags_by_ptr_.end())
-        return NULL;
-    else
-        return i->second;
+    const uint32 hash = HashFlagName(name, name_len);
+    const size_t mask = slots_.size() - 1;
+    for (size_t i = hash & mask; slots_[i].flag != NULL; i = (i + 1) & mask)
+    {
+        if (slots_[i].hash != hash)
+            continue;
+        const char * const flag_name = slots_[i].flag->name();
+        if (strncmp(flag_name, name, name_len) == 0 && flag_name[name_len] == '\0')
+            return slots_[i].flag;
+    }
+    return NULL;
 }
 
-CommandLineFlag * FlagRegistry::SplitArgumentLocked(const char * arg, string * key, const char ** v, string * error_message)
+struct FlagNameCmp
 {
-    // Find the flag object for this option
-    const char * flag_name;
-    const char * value = strchr(arg, '=');
-    if (value == NULL)
+    bool operator()(const CommandLineFlag * a, const CommandLineFlag * b) const
     {
-        key->assign(arg);
-        *v = NULL;
+        return strcmp(a->name(), b->name()) < 0;
     }
-    else
+};
+
+void FlagRegistry::ValidatedFlagsLocked(FlagList * flags) const
+{
+    flags->clear();
+    for (FlagConstIterator i = flags_.begin(); i != flags_.end(); ++i)
+    {
+        if ((*i)->validate_fn_proto_ != NULL || (*i)->constraint_ != NULL)
+            flags->push_back(*i);
+    }
+    sort(flags->begin(), flags->end(), FlagNameCmp());
+}
+
+struct FilenameFlagnameCmp
+{
+    bool operator()(const CommandLineFlag * a, const CommandLineFlag * b) const
     {
-        // Strip out the "=value" portion from arg
-        key->assign(arg, value - arg);
-        *v = ++value; // advance past the '='
+        // The file names are interned: the same file, the same pointer.
+        int cmp = a->CleanFileName() == b->CleanFileName() ? 0 : strcmp(a->CleanFileName(), b->CleanFileName());
+        if (cmp == 0)
+            cmp = strcmp(a->name(), b->name()); // secondary sort key
+        return cmp < 0;
     }
-    flag_name = key->c_str();
+};
 
-    CommandLineFlag * flag = FindFlagLocked(flag_name);
+void FlagRegistry::SortByFileLocked()
+{
+    if (sorted_by_file_flags_valid_)
+        return;
+    sorted_by_file_flags_ = flags_;
+    sort(sorted_by_file_flags_.begin(), sorted_by_file_flags_.end(), FilenameFlagnameCmp());
+    flag_files_.clear();
+    for (size_t i = 0; i < sorted_by_file_flags_.size(); ++i)
+    {
+        const char * filename = sorted_by_file_flags_[i]->CleanFileName();
+        if (flag_files_.empty() || flag_files_.back().filename != filename) // interned
+        {
+            FlagFile file = { filename, i, i };
+            flag_files_.push_back(file);
+        }
+        flag_files_.back().end = i + 1;
+    }
+    sorted_by_file_flags_valid_ = true;
+}
+
+const FlagRegistry::FlagList & FlagRegistry::SortedByFileFlagsLocked()
+{
+    MutexLock l(&sorted_lock_);
+    SortByFileLocked();
+    return sorted_by_file_flags_;
+}
+
+const FlagRegistry::FlagFileList & FlagRegistry::FlagFilesLocked()
+{
+    MutexLock l(&sorted_lock_);
+    SortByFileLocked();
+    return flag_files_;
+}
+
+const FlagRegistry::FlagList & FlagRegistry::SortedByNameFlagsLocked()
+{
+    MutexLock l(&sorted_lock_);
+    if (!sorted_by_name_flags_valid_)
+    {
+        sorted_by_name_flags_ = flags_;
+        sort(sorted_by_name_flags_.begin(), sorted_by_name_flags_.end(), FlagNameCmp());
+        sorted_by_name_flags_valid_ = true;
+    }
+    return sorted_by_name_flags_;
+}
+
+CommandLineFlag * FlagRegistry::FindFlagViaPtrLocked(const void * flag_ptr)
+{
+    const size_t mask = ptr_slots_.size() - 1;
+    for (size_t i = HashFlagPtr(flag_ptr) & mask; ptr_slots_[i].ptr != NULL; i = (i + 1) & mask)
+    {
+        if (ptr_slots_[i].ptr == flag_ptr)
+            return ptr_slots_[i].flag;
+    }
+    return NULL;
+}
+
+CommandLineFlag * FlagRegistry::SplitArgumentLocked(const char * arg, string * key, const char ** v, string * error_message)
+{
+    const char * value = strchr(arg, '=');
+    return SplitArgumentLocked(arg, value == NULL ? strlen(arg) : value - arg, key, v, error_message);
+}
+
+CommandLineFlag * FlagRegistry::SplitArgumentLocked(const char * arg, size_t key_len, string * key, const char ** v, string * error_message)
+{
+    // Strip out the "=value" portion, if any, from arg
+    *v = arg[key_len] == '=' ? arg + key_len + 1 : NULL;
+    if (key)
+        key->assign(arg, key_len);
+
+    CommandLineFlag * flag = FindFlagLocked(arg, key_len);
 
     if (flag == NULL)
     {
@@ -92,28 +387,32 @@ CommandLineFlag * FlagRegistry::SplitArgumentLocked(const char * arg, string * k
         // The one exception is if 1) the flag-name is 'nox', 2) there
         // exists a flag named 'x', and 3) 'x' is a boolean flag.
         // In that case, we want to return flag 'x'.
-        if (!(flag_name[0] == 'n' && flag_name[1] == 'o'))
+        if (!(key_len >= 2 && arg[0] == 'n' && arg[1] == 'o'))
         {
             // flag-name is not 'nox', so we're not in the exception case.
-            *error_message = StringPrintf("%sunknown command line flag '%s'\n", kError, key->c_str());
+            if (error_message)
+                *error_message = StringPrintf("%sunknown command line flag '%.*s'\n", kError, static_cast<int>(key_len), arg);
             return NULL;
         }
-        flag = FindFlagLocked(flag_name + 2);
+        flag = FindFlagLocked(arg + 2, key_len - 2);
         if (flag == NULL)
         {
             // No flag named 'x' exists, so we're not in the exception case.
-            *error_message = StringPrintf("%sunknown command line flag '%s'\n", kError, key->c_str());
+            if (error_message)
+                *error_message = StringPrintf("%sunknown command line flag '%.*s'\n", kError, static_cast<int>(key_len), arg);
             return NULL;
         }
         if (strcmp(flag->type_name(), "bool") != 0)
         {
             // 'x' exists but is not boolean, so we're not in the exception case.
-            *error_message = StringPrintf("%sboolean value (%s) specified for %s command line flag\n", kError, key->c_str(), flag->type_name());
+            if (error_message)
+                *error_message = StringPrintf("%sboolean value (%.*s) specified for %s command line flag\n", kError, static_cast<int>(key_len), arg, flag->type_name());
             return NULL;
         }
         // We're in the exception case!
         // Make up a fake value to replace the "no" we stripped out
-        key->assign(flag_name + 2); // the name without the "no"
+        if (key)
+            key->assign(arg + 2, key_len - 2); // the name without the "no"
         *v = "0";
     }
 
@@ -124,35 +423,109 @@ CommandLineFlag * FlagRegistry::SplitArgumentLocked(const char * arg, string * k
     return flag;
 }
 
-bool TryParseLocked(const CommandLineFlag * flag, FlagValue * flag_value, const char * value, string * msg)
+// Whether flag may take tentative_value; if not, says why in *msg.
+static bool AllowsLocked(const CommandLineFlag * flag, const FlagValue & tentative_value, string * msg)
 {
-    // Use tenative_value, not flag_value, until we know value is valid.
-    FlagValue * tentative_value = flag_value->New();
-    if (!tentative_value->ParseFrom(value))
+    if (!flag->Allows(tentative_value))
     {
         if (msg)
-            StringAppendF(msg, "%sillegal value '%s' specified for %s flag '%s'\n", kError, value, flag->type_name(), flag->name());
-        delete tentative_value;
+            StringAppendF(msg, "%snew value '%s' for flag '%s' is not one of its allowed values: %s\n", kError, tentative_value.ToString().c_str(), flag->name(), flag->constraint()->description().c_str());
         return false;
     }
-    else if (!flag->Validate(*tentative_value))
+    if (!flag->PassesValidator(tentative_value))
     {
         if (msg)
-            StringAppendF(msg, "%sfailed validation of new value '%s' for flag '%s'\n", kError, tentative_value->ToString().c_str(), flag->name());
-        delete tentative_value;
+            StringAppendF(msg, "%sfailed validation of new value '%s' for flag '%s'\n", kError, tentative_value.ToString().c_str(), flag->name());
         return false;
     }
-    else
+    return true;
+}
+
+bool TryAssignLocked(const CommandLineFlag * flag, FlagValue * flag_value, const FlagValue & tentative_value, bool validate, string * msg, bool report_change)
+{
+    if (validate && !AllowsLocked(flag, tentative_value, msg))
+        return false;
+    flag_value->CopyFrom(tentative_value);
+    if (msg && report_change)
+        StringAppendF(msg, "%s set to %s\n", flag->name(), flag_value->ToString().c_str());
+    return true;
+}
+
+bool TryParseLocked(const CommandLineFlag * flag, FlagValue * flag_value, const char * value, string * msg, bool report_change)
+{
+    // Use tenative_value, not flag_value, until we know value is valid.
+    // It lives on the stack: every type but string fits in 8 bytes, and
+    // an empty string doesn't allocate until the value is parsed into it.
+    // A string is then swapped in, rather than copied.
+    uint64 scalar_value = 0;
+    string string_value;
+    const FlagValue::ValueType type = flag_value->type();
+    FlagValue tentative_value(type == FlagValue::FV_STRING ? static_cast<void *>(&string_value) : &scalar_value, type, false);
+    if (!tentative_value.ParseFrom(value))
     {
-        flag_value->CopyFrom(*tentative_value);
         if (msg)
-            StringAppendF(msg, "%s set to %s\n", flag->name(), flag_value->ToString().c_str());
-        delete tentative_value;
-        return true;
+            StringAppendF(msg, "%sillegal value '%s' specified for %s flag '%s'\n", kError, value, flag->type_name(), flag->name());
+        return false;
     }
+    if (!AllowsLocked(flag, tentative_value, msg))
+        return false;
+    flag_value->TakeFrom(&tentative_value);
+    if (msg && report_change)
+        StringAppendF(msg, "%s set to %s\n", flag->name(), flag_value->ToString().c_str());
+    return true;
 }
 
-bool FlagRegistry::SetFlagLocked(CommandLineFlag * flag, const char * value, FlagSettingMode set_mode, string * msg)
+// Sets flag_value from either text, which is parsed, or an already
+// parsed value; whichever isn't NULL.  The value is only checked
+// against the flag's validator if validate.
+static bool TrySetLocked(const CommandLineFlag * flag, FlagValue * flag_value, const char * text, const FlagValue * value, bool validate, string * msg, bool report_change)
+{
+    if (text)
+        return TryParseLocked(flag, flag_value, text, msg, report_change);
+    else
+        return TryAssignLocked(flag, flag_value, *value, validate, msg, report_change);
+}
+
+bool FlagRegistry::SetFlagLocked(CommandLineFlag * flag, const char * value, FlagSettingMode set_mode, string * msg, bool report_change)
+{
+    return SetFlagLockedImpl(flag, value, NULL, true, set_mode, msg, report_change);
+}
+
+bool FlagRegistry::SetFlagLocked(CommandLineFlag * flag, const FlagValue & value, FlagSettingMode set_mode, string * msg, bool report_change)
+{
+    assert(value.type() == flag->current_->type());
+    return SetFlagLockedImpl(flag, NULL, &value, true, set_mode, msg, report_change);
+}
+
+void FlagRegistry::SetValidatedFlagLocked(CommandLineFlag * flag, const FlagValue & value, FlagSettingMode set_mode, string * msg, bool report_change)
+{
+    assert(value.type() == flag->current_->type());
+    const bool set = SetFlagLockedImpl(flag, NULL, &value, false, set_mode, msg, report_change);
+    assert(set);
+    (void)set;
+}
+
+bool FlagRegistry::SetFlagLockedImpl(CommandLineFlag * flag, const char * text, const FlagValue * value, bool validate, FlagSettingMode set_mode, string * msg, bool report_change)
+{
+    if (flag->watchers_ == NULL)
+        return SetFlagValueLocked(flag, text, value, validate, set_mode, msg, report_change);
+
+    // Keep the old value, on the stack like in TryParseLocked(), to
+    // tell whether the flag really changed.  A string is owned, to
+    // share the flag's value instead of copying it.
+    uint64 scalar_value = 0;
+    const FlagValue::ValueType type = flag->current_->type();
+    const bool is_string = (type == FlagValue::FV_STRING);
+    FlagValue old_value(is_string ? static_cast<void *>(new string) : &scalar_value, type, is_string);
+    old_value.CopyFrom(*flag->current_);
+    if (!SetFlagValueLocked(flag, text, value, validate, set_mode, msg, report_change))
+        return false;
+    if (!flag->current_->Equal(old_value))
+        NoteChangeLocked(flag);
+    return true;
+}
+
+bool FlagRegistry::SetFlagValueLocked(CommandLineFlag * flag, const char * text, const FlagValue * value, bool validate, FlagSettingMode set_mode, string * msg, bool report_change)
 {
     flag->UpdateModifiedBit();
     switch (set_mode)
@@ -160,7 +533,7 @@ bool FlagRegistry::SetFlagLocked(CommandLineFlag * flag, const char * value, Fla
         case SET_FLAGS_VALUE:
         {
             // set or modify the flag's value
-            if (!TryParseLocked(flag, flag->current_, value, msg))
+            if (!TrySetLocked(flag, flag->current_, text, value, validate, msg, report_change))
                 return false;
             flag->modified_ = true;
             break;
@@ -170,11 +543,11 @@ bool FlagRegistry::SetFlagLocked(CommandLineFlag * flag, const char * value, Fla
             // set the flag's value, but only if it hasn't been set by someone else
             if (!flag->modified_)
             {
-                if (!TryParseLocked(flag, flag->current_, value, msg))
+                if (!TrySetLocked(flag, flag->current_, text, value, validate, msg, report_change))
                     return false;
                 flag->modified_ = true;
             }
-            else
+            else if (msg && report_change)
             {
                 *msg = StringPrintf("%s set to %s", flag->name(), flag->current_value().c_str());
             }
@@ -183,11 +556,11 @@ bool FlagRegistry::SetFlagLocked(CommandLineFlag * flag, const char * value, Fla
         case SET_FLAGS_DEFAULT:
         {
             // modify the flag's default-value
-            if (!TryParseLocked(flag, flag->defvalue_, value, msg))
+            if (!TrySetLocked(flag, flag->defvalue_, text, value, validate, msg, report_change))
                 return false;
             if (!flag->modified_)
                 // Need to set both defvalue *and* current, in this case
-                TryParseLocked(flag, flag->current_, value, NULL);
+                flag->current_->CopyFrom(*flag->defvalue_);
             break;
         }
         default:
@@ -198,19 +571,64 @@ bool FlagRegistry::SetFlagLocked(CommandLineFlag * flag, const char * value, Fla
         }
     }
 
+    NoteFlagSet(flag->name());
     return true;
 }
 
+void FlagRegistry::NoteChangeLocked(CommandLineFlag * flag)
+{
+    if (flag->watchers_ != NULL && !flag->change_pending_)
+    {
+        flag->change_pending_ = true;
+        changed_flags_.push_back(flag);
+    }
+}
+
+void FlagRegistry::UnlockAndNotify()
+{
+    // Copy out whom to call, so that the watchers can run without the
+    // lock, even if watchers are registered or unregistered meanwhile.
+    vector<pair<const char *, FlagWatcher> > calls;
+    for (FlagConstIterator i = changed_flags_.begin(); i != changed_flags_.end(); ++i)
+    {
+        CommandLineFlag * const flag = *i;
+        flag->change_pending_ = false;
+        if (flag->watchers_ == NULL)
+            continue; // unregistered since it changed
+        for (vector<FlagWatcher>::const_iterator w = flag->watchers_->begin(); w != flag->watchers_->end(); ++w)
+            calls.push_back(make_pair(flag->name(), *w));
+    }
+    changed_flags_.clear();
+    lock_.Unlock();
+
+    for (vector<pair<const char *, FlagWatcher> >::const_iterator c = calls.begin(); c != calls.end(); ++c)
+        c->second.fn(c->first, c->second.data);
+}
+
 // Get the singleton FlagRegistry object
 FlagRegistry * FlagRegistry::global_registry_ = NULL;
 Mutex FlagRegistry::global_registry_lock_(Mutex::LINKER_INITIALIZED);
 
 FlagRegistry * FlagRegistry::GlobalRegistry()
 {
+    // The first call can come from any thread, whether a FlagRegisterer
+    // registering itself or, with the flag table, whoever looks at the
+    // flags first.  So the registry is only published, with a release
+    // store, once it's filled in, and the unlocked fast path reads it
+    // with an acquire load, to see it filled in too.
+    FlagRegistry * registry = atomic_internal::LoadAcquire(&global_registry_);
+    if (registry)
+        return registry;
     MutexLock acquire_lock(&global_registry_lock_);
-    if (!global_registry_)
-        global_registry_ = new FlagRegistry;
-    return global_registry_;
+    registry = global_registry_;
+    if (!registry)
+    {
+        registry = new FlagRegistry;
+        StageTimer timer(STAGE_REGISTRATION);
+        registry->RegisterFlagTable(JFLAGS_FLAG_TABLE_BEGIN, JFLAGS_FLAG_TABLE_END);
+        atomic_internal::StoreRelease(&global_registry_, registry);
+    }
+    return registry;
 }
 
 } // namespace JFLAGS_NAMESPACE
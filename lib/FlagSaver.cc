@@ -7,12 +7,64 @@
 #include "FlagSaver.h"
 #include "FlagRegistry.h"
 
+#include <utility>
 #include <vector>
 
 namespace JFLAGS_NAMESPACE {
 
+using std::make_pair;
+using std::pair;
 using std::vector;
 
+// --------------------------------------------------------------------
+// FlagSnapshot
+//    A copy of the states of all the flags of a registry, in the
+//    registry's registration order.  The registry keeps the latest
+//    one, and each FlagSaverImpl holds a reference to the one it
+//    saved against, so a snapshot stays around until both are done
+//    with it.
+// --------------------------------------------------------------------
+
+struct FlagSnapshot
+{
+    FlagSnapshot() : refs(1) {}
+    ~FlagSnapshot()
+    {
+        for (vector<CommandLineFlag *>::const_iterator it = flags.begin(); it != flags.end(); ++it)
+            delete *it;
+    }
+
+    vector<CommandLineFlag *> flags;
+    int refs; // protected by snapshot_refs_lock
+
+private:
+    FlagSnapshot(const FlagSnapshot &); // no copying!
+    void operator=(const FlagSnapshot &);
+};
+
+// Not the registry lock: a FlagSaver may outlive the registry.
+static Mutex snapshot_refs_lock(Mutex::LINKER_INITIALIZED);
+
+static FlagSnapshot * RefFlagSnapshot(FlagSnapshot * snapshot)
+{
+    MutexLock l(&snapshot_refs_lock);
+    ++snapshot->refs;
+    return snapshot;
+}
+
+void UnrefFlagSnapshot(FlagSnapshot * snapshot)
+{
+    if (snapshot == NULL)
+        return;
+    bool last_ref;
+    {
+        MutexLock l(&snapshot_refs_lock);
+        last_ref = (--snapshot->refs == 0);
+    }
+    if (last_ref)
+        delete snapshot;
+}
+
 // --------------------------------------------------------------------
 // FlagSaverImpl
 //    This class stores the states of all flags at construct time,
@@ -20,6 +72,16 @@ using std::vector;
 //    Its major implementation challenge is that it never modifies
 //    pointers in the 'main' registry, so global FLAG_* vars always
 //    point to the right place.
+//       Rather than copying every flag, it saves the flags as the
+//    registry's FlagSnapshot plus a delta: a copy of just the flags
+//    that differ from the snapshot.  As flags may be assigned to
+//    directly (FLAGS_foo = ...) without the registry knowing, there
+//    is no telling which flags changed short of comparing them, but
+//    comparing is cheap; it's the copies, and the allocations they
+//    take, that aren't.  So saving and restoring compare each flag
+//    once, and only copy the flags that changed.  When the delta
+//    grows too big, the saver takes a new snapshot for the registry
+//    (and for the savers that come after it) instead.
 // --------------------------------------------------------------------
 
 class FlagSaverImpl
@@ -35,41 +97,75 @@ public:
     void SaveFromRegistry();
 
     // Restores the saved flag states into the flag registry.  We
-    // assume no flags were added or deleted from the registry since
-    // the SaveFromRegistry; if they were, that's trouble!  Must be
+    // assume no flags were deleted from the registry since the
+    // SaveFromRegistry; flags added since are left alone.  Must be
     // called when the registry mutex is not held.
     void RestoreToRegistry();
 
 private:
+    // Returns a new copy of flag, with the same state.
+    static CommandLineFlag * Clone(const CommandLineFlag & flag);
+
+    // Whether a and b are in the same state, as far as CopyFrom() goes.
+    static bool SameState(const CommandLineFlag & a, const CommandLineFlag & b);
+
+    // Takes a new snapshot of all the flags for the registry, and
+    // saves against that, with an empty delta.
+    void TakeSnapshotLocked();
+
     FlagRegistry * const main_registry_;
-    vector<CommandLineFlag *> backup_registry_;
+    FlagSnapshot * snapshot_;                               // the saved states...
+    typedef vector<pair<size_t, CommandLineFlag *> > FlagDelta;
+    FlagDelta delta_;                                       // ...but for these, by index
 
     FlagSaverImpl(const FlagSaverImpl &); // no copying!
     void operator=(const FlagSaverImpl &);
 };
 
-// --------------------------------------------------------------------
-// FlagSaver
-// FlagSaverImpl
-//    This class stores the states of all flags at construct time,
-//    and restores all flags to that state at destruct time.
-//    Its major implementation challenge is that it never modifies
-//    pointers in the 'main' registry, so global FLAG_* vars always
-//    point to the right place.
-// --------------------------------------------------------------------
-
 // Constructs an empty FlagSaverImpl object.
 FlagSaverImpl::FlagSaverImpl(FlagRegistry * main_registry)
-: main_registry_(main_registry)
+: main_registry_(main_registry), snapshot_(NULL)
 {
 }
 
 FlagSaverImpl::~FlagSaverImpl()
 {
     // reclaim memory from each of our CommandLineFlags
-    vector<CommandLineFlag *>::const_iterator it;
-    for (it = backup_registry_.begin(); it != backup_registry_.end(); ++it)
-        delete *it;
+    for (FlagDelta::const_iterator it = delta_.begin(); it != delta_.end(); ++it)
+        delete it->second;
+    UnrefFlagSnapshot(snapshot_);
+}
+
+CommandLineFlag * FlagSaverImpl::Clone(const CommandLineFlag & flag)
+{
+    // Sets up all the const variables in the copy correctly (help_, so
+    // as not to decompress a compressed help)
+    CommandLineFlag * copy = new CommandLineFlag(flag.name(), flag.help_, flag.filename(), flag.current_->New(), flag.defvalue_->New());
+    // Sets up all the non-const variables in the copy correctly
+    copy->CopyFrom(flag);
+    return copy;
+}
+
+bool FlagSaverImpl::SameState(const CommandLineFlag & a, const CommandLineFlag & b)
+{
+    return a.modified() == b.modified() && a.validate_fn_proto_ == b.validate_fn_proto_ && a.validator_is_cheap_ == b.validator_is_cheap_ && a.constraint_ == b.constraint_ && a.current_->Equal(*b.current_) && a.defvalue_->Equal(*b.defvalue_);
+}
+
+void FlagSaverImpl::TakeSnapshotLocked()
+{
+    for (FlagDelta::const_iterator it = delta_.begin(); it != delta_.end(); ++it)
+        delete it->second;
+    delta_.clear();
+
+    const FlagRegistry::FlagList & flags = main_registry_->flags_;
+    FlagSnapshot * snapshot = new FlagSnapshot;
+    snapshot->flags.reserve(flags.size());
+    for (FlagRegistry::FlagConstIterator it = flags.begin(); it != flags.end(); ++it)
+        snapshot->flags.push_back(Clone(**it));
+
+    UnrefFlagSnapshot(main_registry_->saver_snapshot_);
+    main_registry_->saver_snapshot_ = snapshot; // the registry's reference
+    snapshot_ = RefFlagSnapshot(snapshot);
 }
 
 // Saves the flag states from the flag registry into this object.
@@ -78,31 +174,55 @@ FlagSaverImpl::~FlagSaverImpl()
 void FlagSaverImpl::SaveFromRegistry()
 {
     FlagRegistryLock frl(main_registry_);
-    assert(backup_registry_.empty()); // call only once!
-    for (FlagRegistry::FlagConstIterator it = main_registry_->flags_.begin(); it != main_registry_->flags_.end(); ++it)
+    assert(snapshot_ == NULL); // call only once!
+    const FlagRegistry::FlagList & flags = main_registry_->flags_;
+    FlagSnapshot * const snapshot = main_registry_->saver_snapshot_;
+    if (snapshot == NULL || snapshot->flags.size() != flags.size()) // first saver, or new flags
+    {
+        TakeSnapshotLocked();
+        return;
+    }
+
+    // Past this many changed flags, a new snapshot is worth it.
+    const size_t max_delta = 16 + flags.size() / 8;
+    for (size_t i = 0; i < flags.size(); ++i)
     {
-        const CommandLineFlag * main = it->second;
-        // Sets up all the const variables in backup correctly
-        CommandLineFlag * backup = new CommandLineFlag(main->name(), main->help(), main->filename(), main->current_->New(), main->defvalue_->New());
-        // Sets up all the non-const variables in backup correctly
-        backup->CopyFrom(*main);
-        backup_registry_.push_back(backup); // add it to a convenient list
+        if (SameState(*flags[i], *snapshot->flags[i]))
+            continue;
+        if (delta_.size() == max_delta)
+        {
+            TakeSnapshotLocked();
+            return;
+        }
+        delta_.push_back(make_pair(i, Clone(*flags[i])));
     }
+    snapshot_ = RefFlagSnapshot(snapshot);
 }
 
 // Restores the saved flag states into the flag registry.  We
-// assume no flags were added or deleted from the registry since
-// the SaveFromRegistry; if they were, that's trouble!  Must be
+// assume no flags were deleted from the registry since the
+// SaveFromRegistry; flags added since are left alone.  Must be
 // called when the registry mutex is not held.
 void FlagSaverImpl::RestoreToRegistry()
 {
     FlagRegistryLock frl(main_registry_);
-    vector<CommandLineFlag *>::const_iterator it;
-    for (it = backup_registry_.begin(); it != backup_registry_.end(); ++it)
+    const FlagRegistry::FlagList & flags = main_registry_->flags_;
+    const size_t num_saved = snapshot_->flags.size() < flags.size() ? snapshot_->flags.size() : flags.size();
+    FlagDelta::const_iterator delta = delta_.begin();
+    for (size_t i = 0; i < num_saved; ++i)
     {
-        CommandLineFlag * main = main_registry_->FindFlagLocked((*it)->name());
-        if (main != NULL) // if NULL, flag got deleted from registry(!)
-            main->CopyFrom(**it);
+        const CommandLineFlag * saved = snapshot_->flags[i];
+        if (delta != delta_.end() && delta->first == i)
+        {
+            saved = delta->second;
+            ++delta;
+        }
+        if (!SameState(*flags[i], *saved))
+        {
+            if (flags[i]->watchers_ != NULL && !flags[i]->current_->Equal(*saved->current_))
+                main_registry_->NoteChangeLocked(flags[i]);
+            flags[i]->CopyFrom(*saved);
+        }
     }
 }
 
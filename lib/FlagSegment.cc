@@ -0,0 +1,465 @@
+////////////////////////////////////////////////////////////////////////////////
+//                                    jflags
+//
+// This file is distributed under the 3-clause Berkeley Software Distribution
+// License. See LICENSE.txt for details.
+////////////////////////////////////////////////////////////////////////////////
+#include "Flagfile.h"
+#include "FlagRegistry.h"
+#include "jflags_parser.h"
+#include "util.h"
+#include "mutex.h"
+
+#include <cstring>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+#if defined(HAVE_SYS_MMAN_H) && defined(HAVE_UNISTD_H)
+#define JFLAGS_HAVE_FLAG_SEGMENTS
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using namespace MUTEX_NAMESPACE;
+
+namespace JFLAGS_NAMESPACE {
+
+using std::map;
+using std::pair;
+using std::string;
+using std::vector;
+
+#ifdef JFLAGS_HAVE_FLAG_SEGMENTS
+
+// --------------------------------------------------------------------
+// The flag segment
+//    A header, then one entry per flag: its version, the sizes of its
+//    name and value, and the name and value themselves, each followed
+//    by a '\0' and padded to 4 bytes.  The entries are rewritten as a
+//    whole under a sequence lock: the writer makes the sequence odd,
+//    writes, and makes it even again, and a reader copies the entries
+//    out and only keeps the copy if the sequence was the same even
+//    number before and after.  The version of a flag is the version of
+//    the segment when its value last changed, so that a reader only
+//    sets the flags whose version is past the one it last synced.
+//    The segment only grows, doubling: readers map it again when they
+//    find it grew.
+// --------------------------------------------------------------------
+
+static const uint32 kFlagSegmentMagic = 0x6a667367; // "jfsg"
+static const size_t kMinFlagSegmentLength = 64 * 1024;
+static const int kMaxSyncAttempts = 100;
+
+struct FlagSegmentHeader
+{
+    uint32 magic;
+    uint32 sequence; // odd while the entries are being written
+    uint32 version;  // the highest version of a flag
+    uint32 reserved;
+    uint64 length;   // of the whole segment
+    uint64 size;     // of the entries
+};
+
+struct FlagSegmentEntry
+{
+    uint32 version;
+    uint32 name_size;
+    uint32 value_size;
+};
+
+static size_t EntrySize(size_t name_size, size_t value_size)
+{
+    return (sizeof(FlagSegmentEntry) + name_size + 1 + value_size + 1 + 3) & ~static_cast<size_t>(3);
+}
+
+// Orders the writes to (and reads of) the entries with the ones of the
+// sequence, for processes that map the segment at once.
+static void SegmentFence()
+{
+#if defined(__ATOMIC_SEQ_CST)
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+#else
+    __sync_synchronize();
+#endif
+}
+
+struct PublishedFlag
+{
+    PublishedFlag() : version(0) {}
+
+    string value;
+    uint32 version;
+};
+
+typedef map<string, PublishedFlag> PublishedFlags;
+
+// Calls fn(name, value, version) for the entries of the size bytes at
+// entries.  Returns false if they don't make sense.
+template <typename Fn>
+static bool ForEachSegmentEntry(const char * entries, size_t size, Fn fn)
+{
+    for (size_t offset = 0; offset < size; )
+    {
+        FlagSegmentEntry entry;
+        if (size - offset < sizeof(entry))
+            return false;
+        memcpy(&entry, entries + offset, sizeof(entry));
+        if (entry.name_size > size || entry.value_size > size || EntrySize(entry.name_size, entry.value_size) > size - offset)
+            return false;
+        const char * const name = entries + offset + sizeof(entry);
+        fn(string(name, entry.name_size), string(name + entry.name_size + 1, entry.value_size), entry.version);
+        offset += EntrySize(entry.name_size, entry.value_size);
+    }
+    return true;
+}
+
+// Maps length bytes of fd, read-only or not; NULL if that fails.
+static char * MapSegment(int fd, size_t length, bool writable)
+{
+    void * const base = mmap(NULL, length, writable ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, fd, 0);
+    return base == MAP_FAILED ? NULL : static_cast<char *>(base);
+}
+
+// --------------------------------------------------------------------
+// PublishFlagSegment()
+// --------------------------------------------------------------------
+
+struct FlagSegmentWriter
+{
+    FlagSegmentWriter() : fd(-1), base(NULL), length(0), version(0) {}
+    ~FlagSegmentWriter()
+    {
+        if (base != NULL)
+            munmap(base, length);
+        if (fd >= 0)
+            close(fd);
+    }
+
+    FlagSegmentHeader * header() const { return reinterpret_cast<FlagSegmentHeader *>(base); }
+
+    string path;
+    int fd;
+    char * base;
+    size_t length;
+    PublishedFlags flags; // what's in the segment
+    uint32 version;
+};
+
+static FlagSegmentWriter * segment_writer = NULL;
+static Mutex segment_writer_lock(Mutex::LINKER_INITIALIZED);
+
+struct CollectPublishedFlag
+{
+    explicit CollectPublishedFlag(PublishedFlags * flags) : flags_(flags) {}
+    void operator()(const string & name, const string & value, uint32 version) const
+    {
+        PublishedFlag & flag = (*flags_)[name];
+        flag.value = value;
+        flag.version = version;
+    }
+
+    PublishedFlags * flags_;
+};
+
+// Opens (or creates) the segment at path, and picks up where whoever
+// published there last left it.
+static FlagSegmentWriter * OpenFlagSegmentWriter(const char * path)
+{
+    FlagSegmentWriter * writer = new FlagSegmentWriter;
+    writer->path = path;
+    writer->fd = open(path, O_RDWR | O_CREAT, 0644);
+    struct stat st;
+    if (writer->fd < 0 || fstat(writer->fd, &st) != 0)
+    {
+        delete writer;
+        return NULL;
+    }
+    writer->length = static_cast<size_t>(st.st_size);
+    if (writer->length >= sizeof(FlagSegmentHeader))
+        writer->base = MapSegment(writer->fd, writer->length, true);
+    if (writer->base != NULL && writer->header()->magic == kFlagSegmentMagic && writer->header()->size <= writer->length - sizeof(FlagSegmentHeader))
+    {
+        const FlagSegmentHeader & header = *writer->header();
+        if (ForEachSegmentEntry(writer->base + sizeof(header), static_cast<size_t>(header.size), CollectPublishedFlag(&writer->flags)))
+            writer->version = header.version;
+        else
+            writer->flags.clear();
+        return writer;
+    }
+
+    // Something else, or nothing: start over.
+    if (writer->base != NULL)
+        munmap(writer->base, writer->length);
+    writer->length = kMinFlagSegmentLength;
+    writer->base = ftruncate(writer->fd, writer->length) == 0 ? MapSegment(writer->fd, writer->length, true) : NULL;
+    if (writer->base == NULL)
+    {
+        delete writer;
+        return NULL;
+    }
+    memset(writer->base, 0, sizeof(FlagSegmentHeader));
+    writer->header()->length = writer->length;
+    writer->header()->magic = kFlagSegmentMagic;
+    return writer;
+}
+
+// Makes room for size bytes of entries.
+static bool GrowFlagSegment(FlagSegmentWriter * writer, size_t size)
+{
+    size_t length = writer->length;
+    while (length - sizeof(FlagSegmentHeader) < size)
+        length *= 2;
+    if (length == writer->length)
+        return true;
+    char * const base = ftruncate(writer->fd, length) == 0 ? MapSegment(writer->fd, length, true) : NULL;
+    if (base == NULL)
+        return false;
+    munmap(writer->base, writer->length);
+    writer->base = base;
+    writer->length = length;
+    atomic_internal::StoreRelaxed(&writer->header()->length, static_cast<uint64>(length));
+    return true;
+}
+
+bool PublishFlagSegment(const char * path)
+{
+    MutexLock l(&segment_writer_lock);
+    if (segment_writer != NULL && segment_writer->path != path)
+    {
+        delete segment_writer;
+        segment_writer = NULL;
+    }
+    if (segment_writer == NULL && (segment_writer = OpenFlagSegmentWriter(path)) == NULL)
+        return false;
+    FlagSegmentWriter & writer = *segment_writer;
+
+    vector<pair<string, string> > values;
+    {
+        FlagRegistry * const registry = FlagRegistry::GlobalRegistry();
+        FlagRegistryReaderLock frl(registry);
+        const FlagRegistry::FlagList & flags = registry->SortedByFileFlagsLocked();
+        for (FlagRegistry::FlagList::const_iterator i = flags.begin(); i != flags.end(); ++i)
+        {
+            const CommandLineFlag * flag = *i;
+            if (IsRecursiveFlag(flag))
+                continue;
+            string value = flag->current_value();
+            if (value != flag->default_value() || writer.flags.count(flag->name()) != 0)
+                values.push_back(make_pair(string(flag->name()), value));
+        }
+    }
+
+    bool changed = writer.header()->size == 0 && !values.empty();
+    for (vector<pair<string, string> >::const_iterator i = values.begin(); i != values.end(); ++i)
+    {
+        PublishedFlag & flag = writer.flags[i->first];
+        if (flag.version == 0 || flag.value != i->second)
+        {
+            flag.value = i->second;
+            flag.version = writer.version + 1;
+            changed = true;
+        }
+    }
+    if (!changed)
+        return true;
+
+    size_t size = 0;
+    for (PublishedFlags::const_iterator i = writer.flags.begin(); i != writer.flags.end(); ++i)
+        size += EntrySize(i->first.size(), i->second.value.size());
+    if (!GrowFlagSegment(&writer, size))
+        return false;
+
+    FlagSegmentHeader * const header = writer.header();
+    const uint32 sequence = atomic_internal::LoadRelaxed(&header->sequence) | 1;
+    atomic_internal::StoreRelaxed(&header->sequence, sequence);
+    SegmentFence();
+    char * p = writer.base + sizeof(FlagSegmentHeader);
+    for (PublishedFlags::const_iterator i = writer.flags.begin(); i != writer.flags.end(); ++i)
+    {
+        FlagSegmentEntry entry;
+        entry.version = i->second.version;
+        entry.name_size = static_cast<uint32>(i->first.size());
+        entry.value_size = static_cast<uint32>(i->second.value.size());
+        const size_t entry_size = EntrySize(entry.name_size, entry.value_size);
+        memset(p, 0, entry_size);
+        memcpy(p, &entry, sizeof(entry));
+        memcpy(p + sizeof(entry), i->first.data(), entry.name_size);
+        memcpy(p + sizeof(entry) + entry.name_size + 1, i->second.value.data(), entry.value_size);
+        p += entry_size;
+    }
+    writer.version += 1;
+    header->version = writer.version;
+    header->size = size;
+    SegmentFence();
+    atomic_internal::StoreRelaxed(&header->sequence, sequence + 1);
+    return true;
+}
+
+// --------------------------------------------------------------------
+// AttachFlagSegment()
+// DetachFlagSegment()
+// SyncFlagsFromSegment()
+//    Syncing copies the entries out of the segment under the reader's
+//    lock, and sets the flags they change with the registry lock, all
+//    in one go, like ReloadChangedFlagfiles().  The reader's lock is
+//    held until they're set: two syncs that read one after the other,
+//    but set the other way round, would leave the flags on the older
+//    values, which the segment then wouldn't change again.
+// --------------------------------------------------------------------
+
+struct FlagSegmentReader
+{
+    FlagSegmentReader() : fd(-1), base(NULL), length(0), sequence(0), version(0) {}
+    ~FlagSegmentReader()
+    {
+        if (base != NULL)
+            munmap(const_cast<char *>(base), length);
+        if (fd >= 0)
+            close(fd);
+    }
+
+    const FlagSegmentHeader * header() const { return reinterpret_cast<const FlagSegmentHeader *>(base); }
+
+    int fd;
+    const char * base;
+    size_t length;
+    uint32 sequence; // of the last sync
+    uint32 version;  // of the last sync
+};
+
+static FlagSegmentReader * segment_reader = NULL;
+static Mutex segment_reader_lock(Mutex::LINKER_INITIALIZED);
+
+bool AttachFlagSegment(const char * path)
+{
+    FlagSegmentReader * reader = new FlagSegmentReader;
+    reader->fd = open(path, O_RDONLY);
+    struct stat st;
+    if (reader->fd >= 0 && fstat(reader->fd, &st) == 0 && static_cast<size_t>(st.st_size) >= sizeof(FlagSegmentHeader))
+    {
+        reader->length = static_cast<size_t>(st.st_size);
+        reader->base = MapSegment(reader->fd, reader->length, false);
+    }
+    if (reader->base == NULL || reader->header()->magic != kFlagSegmentMagic)
+    {
+        delete reader;
+        return false;
+    }
+    MutexLock l(&segment_reader_lock);
+    delete segment_reader;
+    segment_reader = reader;
+    return true;
+}
+
+void DetachFlagSegment()
+{
+    MutexLock l(&segment_reader_lock);
+    delete segment_reader;
+    segment_reader = NULL;
+}
+
+struct CollectNewerFlag
+{
+    CollectNewerFlag(uint32 version, vector<pair<string, string> > * values) : version_(version), values_(values) {}
+    void operator()(const string & name, const string & value, uint32 version) const
+    {
+        if (version > version_)
+            values_->push_back(make_pair(name, value));
+    }
+
+    uint32 version_;
+    vector<pair<string, string> > * values_;
+};
+
+// Copies the entries that changed since the last sync, if the segment
+// changed; false if it didn't, or if it can't be read right now.
+static bool ReadChangedEntries(FlagSegmentReader * reader, vector<pair<string, string> > * values)
+{
+    vector<char> entries;
+    for (int attempt = 0; attempt < kMaxSyncAttempts; ++attempt)
+    {
+        const FlagSegmentHeader * header = reader->header();
+        const uint32 sequence = atomic_internal::LoadRelaxed(&header->sequence);
+        if (sequence == reader->sequence)
+            return false;
+        if (sequence & 1)
+            continue; // being written
+        const size_t length = static_cast<size_t>(atomic_internal::LoadRelaxed(&header->length));
+        if (length > reader->length)
+        {
+            char * const base = MapSegment(reader->fd, length, false);
+            if (base == NULL)
+                return false;
+            munmap(const_cast<char *>(reader->base), reader->length);
+            reader->base = base;
+            reader->length = length;
+            continue;
+        }
+        SegmentFence();
+        const uint32 version = header->version;
+        const size_t size = static_cast<size_t>(header->size);
+        if (size <= reader->length - sizeof(FlagSegmentHeader))
+            entries.assign(reader->base + sizeof(FlagSegmentHeader), reader->base + sizeof(FlagSegmentHeader) + size);
+        SegmentFence();
+        if (atomic_internal::LoadRelaxed(&header->sequence) != sequence || entries.size() != size)
+            continue;
+
+        const bool ok = ForEachSegmentEntry(entries.empty() ? NULL : &entries[0], entries.size(), CollectNewerFlag(reader->version, values));
+        reader->sequence = sequence;
+        reader->version = version;
+        return ok;
+    }
+    return false;
+}
+
+int SyncFlagsFromSegment()
+{
+    vector<pair<string, string> > values;
+    MutexLock l(&segment_reader_lock);
+    if (segment_reader == NULL || !ReadChangedEntries(segment_reader, &values) || values.empty())
+        return 0;
+
+    int num_set = 0;
+    FlagRegistry * const registry = FlagRegistry::GlobalRegistry();
+    FlagRegistryLock frl(registry);
+    for (vector<pair<string, string> >::const_iterator i = values.begin(); i != values.end(); ++i)
+    {
+        CommandLineFlag * flag = registry->FindFlagLocked(i->first.c_str());
+        if (flag == NULL || IsRecursiveFlag(flag) || flag->current_value() == i->second)
+            continue;
+        string msg;
+        if (registry->SetFlagLocked(flag, i->second.c_str(), SET_FLAGS_VALUE, &msg, false))
+            ++num_set;
+        else
+            LOG(WARNING) << "Ignoring the published value of flag '" << flag->name() << "': " << msg;
+    }
+    return num_set;
+}
+
+#else // no mmap
+
+bool PublishFlagSegment(const char *)
+{
+    return false;
+}
+
+bool AttachFlagSegment(const char *)
+{
+    return false;
+}
+
+void DetachFlagSegment()
+{
+}
+
+int SyncFlagsFromSegment()
+{
+    return 0;
+}
+
+#endif
+
+} // namespace JFLAGS_NAMESPACE
@@ -0,0 +1,215 @@
+////////////////////////////////////////////////////////////////////////////////
+//                                    jflags
+//
+// This file is distributed under the 3-clause Berkeley Software Distribution
+// License. See LICENSE.txt for details.
+////////////////////////////////////////////////////////////////////////////////
+#include "FlagRegistry.h"
+#include "Flagfile.h"
+#include "jflags_parser.h"
+#include "util.h"
+
+#include <cstring>
+#include <string>
+#include <vector>
+
+namespace JFLAGS_NAMESPACE {
+
+using std::string;
+using std::vector;
+
+// --------------------------------------------------------------------
+// The flag state format
+//    FlagStateHeader
+//    FlagStateEntry     num_entries times, one per flag set
+//    char               strings_size bytes of NUL-terminated names and
+//                       string values
+//    Like the precompiled flagfiles, all integers are in the byte
+//    order of the machine that saved the state.  An entry holds the
+//    value's bytes as its FlagValue does, or for a string the offset
+//    of the string, whose size is in value_size.
+// --------------------------------------------------------------------
+
+static const char kFlagStateMagic[8] = "\177jfstat";
+static const uint32 kFlagStateByteOrder = 0x01020304;
+static const uint32 kFlagStateVersion = 1;
+
+struct FlagStateHeader
+{
+    char magic[8];      // kFlagStateMagic
+    uint32 byte_order;  // kFlagStateByteOrder
+    uint32 version;     // kFlagStateVersion
+    uint32 fingerprint; // of the registry (see layout_fingerprint_)
+    uint32 num_flags;   // in the registry
+    uint32 num_entries;
+    uint32 strings_size;
+    uint32 checksum;    // of everything after the header
+    uint32 reserved;
+};
+
+struct FlagStateEntry
+{
+    uint32 index;       // in the registry's flags_
+    uint32 name_offset; // into the strings
+    uint32 value_size;  // of a string value
+    int8 value_type;    // FlagValue::ValueType
+    uint8 reserved[3];
+    uint64 value;       // the value's bytes, or the offset of a string
+};
+
+COMPILE_ASSERT(sizeof(FlagStateHeader) == 40, flag_state_header_size);
+COMPILE_ASSERT(sizeof(FlagStateEntry) == 24, flag_state_entry_size);
+
+// 32-bit FNV-1a.
+static uint32 Checksum(const char * data, size_t size)
+{
+    uint32 hash = 2166136261U;
+    for (size_t i = 0; i < size; ++i)
+    {
+        hash ^= static_cast<unsigned char>(data[i]);
+        hash *= 16777619U;
+    }
+    return hash;
+}
+
+void FlagRegistry::SerializeStateLocked(string * state)
+{
+    vector<FlagStateEntry> entries;
+    string strings;
+    for (size_t i = 0; i < flags_.size(); ++i)
+    {
+        const CommandLineFlag * flag = flags_[i];
+        if ((!flag->modified() && flag->current_->Equal(*flag->defvalue_)) || IsRecursiveFlag(flag))
+            continue;
+        FlagStateEntry entry;
+        memset(&entry, 0, sizeof(entry));
+        entry.index = static_cast<uint32>(i);
+        entry.name_offset = static_cast<uint32>(strings.size());
+        entry.value_type = static_cast<int8>(flag->current_->type());
+        strings.append(flag->name(), strlen(flag->name()) + 1);
+        if (flag->current_->type() == FlagValue::FV_STRING)
+        {
+            const string & value = *static_cast<const string *>(flag->current_->value_buffer_);
+            entry.value = strings.size();
+            entry.value_size = static_cast<uint32>(value.size());
+            strings.append(value.c_str(), value.size() + 1);
+        }
+        else
+        {
+            FlagValue value(&entry.value, flag->current_->type(), false);
+            value.CopyFrom(*flag->current_);
+        }
+        entries.push_back(entry);
+    }
+
+    const size_t start = state->size();
+    state->append(sizeof(FlagStateHeader), '\0');
+    if (!entries.empty())
+        state->append(reinterpret_cast<const char *>(&entries[0]), entries.size() * sizeof(FlagStateEntry));
+    state->append(strings);
+
+    FlagStateHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, kFlagStateMagic, sizeof(header.magic));
+    header.byte_order = kFlagStateByteOrder;
+    header.version = kFlagStateVersion;
+    header.fingerprint = layout_fingerprint_;
+    header.num_flags = static_cast<uint32>(flags_.size());
+    header.num_entries = static_cast<uint32>(entries.size());
+    header.strings_size = static_cast<uint32>(strings.size());
+    header.checksum = Checksum(state->data() + start + sizeof(header), state->size() - start - sizeof(header));
+    state->replace(start, sizeof(header), reinterpret_cast<const char *>(&header), sizeof(header));
+}
+
+bool FlagRegistry::RestoreStateLocked(const char * state, size_t size, string * msg)
+{
+    FlagStateHeader header;
+    if (size < sizeof(header))
+    {
+        *msg = "flag state is corrupt";
+        return false;
+    }
+    memcpy(&header, state, sizeof(header));
+    if (memcmp(header.magic, kFlagStateMagic, sizeof(header.magic)) != 0 || header.byte_order != kFlagStateByteOrder || header.version != kFlagStateVersion)
+    {
+        *msg = "flag state was saved by another version or machine";
+        return false;
+    }
+    const char * const entries = state + sizeof(header);
+    const char * const strings = entries + static_cast<size_t>(header.num_entries) * sizeof(FlagStateEntry);
+    if (header.num_entries > size / sizeof(FlagStateEntry) || sizeof(header) + static_cast<size_t>(header.num_entries) * sizeof(FlagStateEntry) + header.strings_size != size ||
+        (header.strings_size > 0 && strings[header.strings_size - 1] != '\0') || Checksum(entries, size - sizeof(header)) != header.checksum)
+    {
+        *msg = "flag state is corrupt";
+        return false;
+    }
+
+    // The same flags, in the same order: no need to look them up.  The
+    // name is still compared, for a fingerprint that only happens to be
+    // the same not to set the wrong flag.
+    const bool same_layout = header.fingerprint == layout_fingerprint_ && header.num_flags == flags_.size();
+    bool ok = true;
+    for (uint32 i = 0; i < header.num_entries; ++i)
+    {
+        FlagStateEntry entry;
+        memcpy(&entry, entries + i * sizeof(entry), sizeof(entry));
+        if (entry.name_offset >= header.strings_size || entry.value_type < 0 || entry.value_type > FlagValue::FV_MAX_INDEX ||
+            (entry.value_type == FlagValue::FV_STRING && (entry.value >= header.strings_size || entry.value_size >= header.strings_size - entry.value)))
+        {
+            *msg = "flag state is corrupt";
+            return false;
+        }
+        const char * const name = strings + entry.name_offset;
+        CommandLineFlag * flag = same_layout && entry.index < flags_.size() ? flags_[entry.index] : NULL;
+        if (flag == NULL || strcmp(flag->name(), name) != 0)
+            flag = FindFlagLocked(name);
+        if (flag == NULL)
+            continue; // not a flag of this program
+
+        string string_value;
+        if (entry.value_type == FlagValue::FV_STRING)
+            string_value.assign(strings + entry.value, entry.value_size);
+        const FlagValue::ValueType type = static_cast<FlagValue::ValueType>(entry.value_type);
+        const FlagValue value(type == FlagValue::FV_STRING ? static_cast<void *>(&string_value) : &entry.value, type, false);
+        string error;
+        const bool set = type == flag->current_->type() ? SetFlagLocked(flag, value, SET_FLAGS_VALUE, &error, false)
+                                                        : SetFlagLocked(flag, value.ToString().c_str(), SET_FLAGS_VALUE, &error, false);
+        if (!set)
+        {
+            if (ok)
+                *msg = error;
+            ok = false;
+        }
+    }
+    return ok;
+}
+
+// --------------------------------------------------------------------
+// SerializeFlagState()
+// RestoreFlagState()
+// --------------------------------------------------------------------
+
+string SerializeFlagState()
+{
+    string state;
+    FlagRegistry * const registry = FlagRegistry::GlobalRegistry();
+    FlagRegistryReaderLock frl(registry);
+    registry->SerializeStateLocked(&state);
+    return state;
+}
+
+bool RestoreFlagState(const string & state)
+{
+    string msg;
+    FlagRegistry * const registry = FlagRegistry::GlobalRegistry();
+    bool ok;
+    {
+        FlagRegistryLock frl(registry);
+        ok = registry->RestoreStateLocked(state.data(), state.size(), &msg);
+    }
+    if (!ok)
+        LOG(WARNING) << "Not all of the flag state was restored: " << msg;
+    return ok;
+}
+
+} // namespace JFLAGS_NAMESPACE
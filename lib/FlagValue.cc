@@ -5,275 +5,756 @@
 // License. See LICENSE.txt for details.
 ////////////////////////////////////////////////////////////////////////////////
 #include "FlagValue.h"
+#include "FlagRegisterer.h"
 #include <assert.h>
-#include <cstring>
 #include <errno.h>
+#include <float.h>
+#include <stdlib.h>
+#include <cstring>
 
 namespace JFLAGS_NAMESPACE {
 
 // This could be a templated method of FlagValue, but doing so adds to the
 // size of the .o.  Since there's no type-safety here anyway, macro is ok.
 #define VALUE_AS(type) *reinterpret_cast<type *>(value_buffer_)
-#define OTHER_VALUE_AS(fv, type) *reinterpret_cast<type *>(fv.value_buffer_)
-#define SET_VALUE_AS(type, value) VALUE_AS(type) = (value)
+
+const size_t FlagValue::kScalarBufferSize;
 
 // --------------------------------------------------------------------
-// FlagValue
-//    This represent the value a single flag might have.  The major
-//    functionality is to convert from a string to an object of a
-//    given type, and back.  Thread-compatible.
+// The parsing kernels behind ParseFrom().  They take the text as a
+// (pointer, length) pair, don't care about the locale, and never touch
+// errno.  Like ParseFrom() always did, they accept what strtoll() and
+// friends accept in the "C" locale, as long as that is the whole text.
 // --------------------------------------------------------------------
 
-FlagValue::FlagValue(void * valbuf, const char * type, bool transfer_ownership_of_value)
-: value_buffer_(valbuf), owns_value_(transfer_ownership_of_value)
+static inline bool IsSpace(char c)
 {
-    for (type_ = 0; type_ <= FV_MAX_INDEX; ++type_)
-    {
-        if (!strcmp(type, TypeName()))
-            break;
-    }
-    assert(type_ <= FV_MAX_INDEX); // Unknown typename
+    return c == ' ' || (c >= '\t' && c <= '\r');
 }
 
-FlagValue::~FlagValue()
+// lowercase_word must be all lowercase ASCII letters.
+static inline bool EqualsIgnoringCase(const char * text, size_t len, const char * lowercase_word)
 {
-    if (!owns_value_)
-        return;
-
-    switch (type_)
+    for (size_t i = 0; i < len; ++i)
     {
-        case FV_BOOL: delete reinterpret_cast<bool *>(value_buffer_); break;
-        case FV_INT32: delete reinterpret_cast<int32 *>(value_buffer_); break;
-        case FV_UINT32: delete reinterpret_cast<uint32 *>(value_buffer_); break;
-        case FV_INT64: delete reinterpret_cast<int64 *>(value_buffer_); break;
-        case FV_UINT64: delete reinterpret_cast<uint64 *>(value_buffer_); break;
-        case FV_DOUBLE: delete reinterpret_cast<double *>(value_buffer_); break;
-        case FV_STRING: delete reinterpret_cast<string *>(value_buffer_); break;
+        if ((text[i] | 0x20) != lowercase_word[i])
+            return false;
     }
+    return lowercase_word[len] == '\0';
 }
 
-bool FlagValue::ParseFrom(const char * value)
+static bool ParseBool(const char * value, size_t len, bool * result)
 {
-    if (type_ == FV_BOOL)
+    // "1", "t", "true", "y", "yes" and "0", "f", "false", "n", "no".
+    if (len == 1)
     {
-        const char * kTrue[] = { "1", "t", "true", "y", "yes" };
-        const char * kFalse[] = { "0", "f", "false", "n", "no" };
-        COMPILE_ASSERT(sizeof(kTrue) == sizeof(kFalse), true_false_equal);
-        for (size_t i = 0; i < sizeof(kTrue) / sizeof(*kTrue); ++i)
-        {
-            if (strcasecmp(value, kTrue[i]) == 0)
-            {
-                SET_VALUE_AS(bool, true);
-                return true;
-            }
-            else if (strcasecmp(value, kFalse[i]) == 0)
-            {
-                SET_VALUE_AS(bool, false);
-                return true;
-            }
-        }
-        return false; // didn't match a legal input
+        const char c = value[0];
+        if (c == '1' || EqualsIgnoringCase(value, len, "t") || EqualsIgnoringCase(value, len, "y"))
+            *result = true;
+        else if (c == '0' || EqualsIgnoringCase(value, len, "f") || EqualsIgnoringCase(value, len, "n"))
+            *result = false;
+        else
+            return false;
+        return true;
+    }
+    if (EqualsIgnoringCase(value, len, "true") || EqualsIgnoringCase(value, len, "yes"))
+    {
+        *result = true;
+        return true;
     }
-    else if (type_ == FV_STRING)
+    if (EqualsIgnoringCase(value, len, "false") || EqualsIgnoringCase(value, len, "no"))
     {
-        SET_VALUE_AS(string, value);
+        *result = false;
         return true;
     }
+    return false;
+}
 
-    // OK, it's likely to be numeric, and we'll be using a strtoXXX method.
-    if (value[0] == '\0') // empty-string is only allowed for string type.
+// Parses [p, end) as an optionally signed integer: leading whitespace,
+// a '+' or '-', then digits in base 10, or in base 16 after an optional
+// "0x".  There must be at least one digit, and only digits to the end.
+// Sets *negative and *magnitude; returns false if the text isn't such
+// a number or the magnitude doesn't fit in a uint64.
+static bool ParseInteger(const char * p, const char * end, int base, bool * negative, uint64 * magnitude)
+{
+    while (p != end && IsSpace(*p))
+        ++p;
+    *negative = false;
+    if (p != end && (*p == '+' || *p == '-'))
+        *negative = (*p++ == '-');
+    if (base == 16 && end - p >= 2 && p[0] == '0' && (p[1] | 0x20) == 'x')
+        p += 2;
+    if (p == end)
         return false;
-    char * end;
-    // Leading 0x puts us in base 16.  But leading 0 does not put us in base 8!
-    // It caused too many bugs when we had that behavior.
-    int base = 10; // by default
-    if (value[0] == '0' && (value[1] == 'x' || value[1] == 'X'))
-        base = 16;
-    errno = 0;
 
-    switch (type_)
+    uint64 r = 0;
+    if (base == 10)
     {
-        case FV_INT32:
+        const uint64 kMaxBeforeLastDigit = ~static_cast<uint64>(0) / 10;
+        const unsigned kMaxLastDigit = static_cast<unsigned>(~static_cast<uint64>(0) % 10);
+        for (; p != end; ++p)
         {
-            const int64 r = strto64(value, &end, base);
-            if (errno || end != value + strlen(value))
-                return false;               // bad parse
-            if (static_cast<int32>(r) != r) // worked, but number out of range
+            const unsigned digit = static_cast<unsigned char>(*p) - '0';
+            if (digit > 9)
                 return false;
-            SET_VALUE_AS(int32, static_cast<int32>(r));
-            return true;
+            if (r >= kMaxBeforeLastDigit && (r > kMaxBeforeLastDigit || digit > kMaxLastDigit))
+                return false; // overflow
+            r = r * 10 + digit;
         }
-        case FV_UINT32:
+    }
+    else
+    {
+        for (; p != end; ++p)
         {
-            while (*value == ' ')
-                value++;
-            if (*value == '-')
-                return false; // negative number
-            const uint64 r = strtou64(value, &end, base);
-            if (errno || end != value + strlen(value))
-                return false;                // bad parse
-            if (static_cast<uint32>(r) != r) // worked, but number out of range
+            const unsigned c = static_cast<unsigned char>(*p);
+            unsigned digit;
+            if (c - '0' <= 9)
+                digit = c - '0';
+            else if ((c | 0x20) - 'a' <= 5)
+                digit = (c | 0x20) - 'a' + 10;
+            else
                 return false;
-            SET_VALUE_AS(uint32, static_cast<uint32>(r));
-            return true;
+            if (r >> 60)
+                return false; // overflow
+            r = (r << 4) | digit;
         }
-        case FV_INT64:
+    }
+    *magnitude = r;
+    return true;
+}
+
+static bool ParseInt64(const char * value, size_t len, int base, int64 * result)
+{
+    bool negative;
+    uint64 magnitude;
+    if (!ParseInteger(value, value + len, base, &negative, &magnitude))
+        return false;
+    const uint64 kMaxMagnitude = static_cast<uint64>(~static_cast<uint64>(0) >> 1) + negative;
+    if (magnitude > kMaxMagnitude)
+        return false; // out of range
+    *result = negative ? static_cast<int64>(0 - magnitude) : static_cast<int64>(magnitude);
+    return true;
+}
+
+static bool ParseUint64(const char * value, size_t len, int base, uint64 * result)
+{
+    bool negative;
+    uint64 magnitude;
+    if (!ParseInteger(value, value + len, base, &negative, &magnitude) || negative)
+        return false; // we don't allow negative numbers, not even -0
+    *result = magnitude;
+    return true;
+}
+
+// The powers of ten that a double holds exactly.
+static const double kExactPowersOfTen[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22,
+};
+static const int kMaxExactPowerOfTen = 22;
+
+// Parses a plain decimal number ("-12.5e3"), when that can be done
+// exactly: the digits, without the decimal point, fit in the 53 bits of
+// a double's mantissa, and the exponent is within what a double holds
+// exactly.  Then a single multiplication or division is correctly
+// rounded.  Returns false for anything else, for strtod() to deal with.
+static bool ParseDoubleFast(const char * p, const char * end, double * result)
+{
+#if (defined(FLT_EVAL_METHOD) && FLT_EVAL_METHOD != 0) || (defined(__FLT_EVAL_METHOD__) && __FLT_EVAL_METHOD__ != 0)
+    // Extended precision intermediates would round twice.
+    return false;
+#else
+    while (p != end && IsSpace(*p))
+        ++p;
+    bool negative = false;
+    if (p != end && (*p == '+' || *p == '-'))
+        negative = (*p++ == '-');
+
+    uint64 mantissa = 0;
+    int num_digits = 0; // significant ones, in mantissa
+    int exponent = 0;
+    bool any_digits = false;
+    for (; p != end && static_cast<unsigned>(*p - '0') <= 9; ++p, any_digits = true)
+    {
+        if (mantissa == 0 && *p == '0')
+            continue; // leading zeros
+        if (++num_digits > 19)
+            return false;
+        mantissa = mantissa * 10 + (*p - '0');
+    }
+    if (p != end && *p == '.')
+    {
+        for (++p; p != end && static_cast<unsigned>(*p - '0') <= 9; ++p, any_digits = true)
         {
-            const int64 r = strto64(value, &end, base);
-            if (errno || end != value + strlen(value))
-                return false; // bad parse
-            SET_VALUE_AS(int64, r);
-            return true;
+            --exponent;
+            if (mantissa == 0 && *p == '0')
+                continue;
+            if (++num_digits > 19)
+                return false;
+            mantissa = mantissa * 10 + (*p - '0');
         }
-        case FV_UINT64:
+    }
+    if (!any_digits)
+        return false;
+    if (p != end && (*p | 0x20) == 'e')
+    {
+        ++p;
+        bool negative_exponent = false;
+        if (p != end && (*p == '+' || *p == '-'))
+            negative_exponent = (*p++ == '-');
+        if (p == end)
+            return false;
+        int explicit_exponent = 0;
+        for (; p != end && static_cast<unsigned>(*p - '0') <= 9; ++p)
         {
-            while (*value == ' ')
-                value++;
-            if (*value == '-')
-                return false; // negative number
-            const uint64 r = strtou64(value, &end, base);
-            if (errno || end != value + strlen(value))
-                return false; // bad parse
-            SET_VALUE_AS(uint64, r);
-            return true;
+            if (explicit_exponent > 10000)
+                return false; // out of our range anyway; let strtod() say
+            explicit_exponent = explicit_exponent * 10 + (*p - '0');
         }
-        case FV_DOUBLE:
+        exponent += negative_exponent ? -explicit_exponent : explicit_exponent;
+    }
+    if (p != end)
+        return false;
+
+    if (mantissa == 0)
+    {
+        *result = negative ? -0.0 : 0.0;
+        return true;
+    }
+    if (mantissa > (static_cast<uint64>(1) << 53) || exponent < -kMaxExactPowerOfTen || exponent > kMaxExactPowerOfTen)
+        return false;
+    double r = static_cast<double>(mantissa);
+    if (exponent < 0)
+        r /= kExactPowersOfTen[-exponent];
+    else
+        r *= kExactPowersOfTen[exponent];
+    *result = negative ? -r : r;
+    return true;
+#endif
+}
+
+static bool ParseDouble(const char * value, size_t len, double * result)
+{
+    if (ParseDoubleFast(value, value + len, result))
+        return true;
+
+    // Hex, infinities, NaNs, long mantissas, big exponents, and garbage.
+    // strtod() wants a NUL-terminated string, which value need not be.
+    char buf[64];
+    string copy;
+    const char * text = buf;
+    if (len < sizeof(buf))
+    {
+        memcpy(buf, value, len);
+        buf[len] = '\0';
+    }
+    else
+    {
+        copy.assign(value, len);
+        text = copy.c_str();
+    }
+    const int saved_errno = errno;
+    errno = 0;
+    char * end;
+    const double r = strtod(text, &end);
+    const bool ok = (errno == 0 && end == text + len);
+    errno = saved_errno;
+    if (ok)
+        *result = r;
+    return ok;
+}
+
+// Leading 0x puts us in base 16.  But leading 0 does not put us in base 8!
+// It caused too many bugs when we had that behavior.
+static inline int NumericBase(const char * value, size_t len)
+{
+    return (len >= 2 && value[0] == '0' && (value[1] == 'x' || value[1] == 'X')) ? 16 : 10;
+}
+
+// What ParseFrom() does for each type.  Empty text is only allowed for
+// strings (and isn't a bool either).
+static bool ParseValue(const char * value, size_t len, bool * result)
+{
+    return ParseBool(value, len, result);
+}
+
+static bool ParseValue(const char * value, size_t len, int32 * result)
+{
+    int64 r;
+    if (len == 0 || !ParseInt64(value, len, NumericBase(value, len), &r))
+        return false;               // bad parse
+    if (static_cast<int32>(r) != r) // worked, but number out of range
+        return false;
+    *result = static_cast<int32>(r);
+    return true;
+}
+
+static bool ParseValue(const char * value, size_t len, uint32 * result)
+{
+    uint64 r;
+    if (len == 0 || !ParseUint64(value, len, NumericBase(value, len), &r))
+        return false;                // bad parse
+    if (static_cast<uint32>(r) != r) // worked, but number out of range
+        return false;
+    *result = static_cast<uint32>(r);
+    return true;
+}
+
+static bool ParseValue(const char * value, size_t len, int64 * result)
+{
+    return len != 0 && ParseInt64(value, len, NumericBase(value, len), result);
+}
+
+static bool ParseValue(const char * value, size_t len, uint64 * result)
+{
+    return len != 0 && ParseUint64(value, len, NumericBase(value, len), result);
+}
+
+static bool ParseValue(const char * value, size_t len, double * result)
+{
+    return len != 0 && ParseDouble(value, len, result);
+}
+
+static bool ParseValue(const char * value, size_t len, string * result)
+{
+    result->assign(value, len);
+    return true;
+}
+
+// --------------------------------------------------------------------
+// The formatting kernels behind ToString(), FormatInto() and
+// AppendValueTo().  Every type but string is formatted into a small
+// buffer on the stack; integers without going through printf(), and
+// doubles with the fewest digits that still read back as the same
+// double.
+// --------------------------------------------------------------------
+
+static size_t FormatInteger(uint64 magnitude, bool negative, char * buf)
+{
+    char digits[20]; // enough for 2^64-1
+    size_t num_digits = 0;
+    do
+    {
+        digits[num_digits++] = static_cast<char>('0' + magnitude % 10);
+        magnitude /= 10;
+    } while (magnitude != 0);
+
+    size_t len = 0;
+    if (negative)
+        buf[len++] = '-';
+    while (num_digits > 0)
+        buf[len++] = digits[--num_digits];
+    buf[len] = '\0';
+    return len;
+}
+
+static size_t FormatSigned(int64 value, char * buf)
+{
+    const uint64 magnitude = value < 0 ? 0 - static_cast<uint64>(value) : static_cast<uint64>(value);
+    return FormatInteger(magnitude, value < 0, buf);
+}
+
+static size_t FormatDouble(double value, char * buf, size_t size)
+{
+    // 17 significant digits always read back as the same double, but
+    // most values need fewer, and "0.1" reads better than
+    // "0.10000000000000001".  Any double that has a representation with
+    // at most 15 digits gets it from %.15g.
+    for (int precision = 15; precision < 17; ++precision)
+    {
+        const int len = snprintf(buf, size, "%.*g", precision, value);
+        double read_back;
+        if (len > 0 && static_cast<size_t>(len) < size && ParseDouble(buf, len, &read_back) && read_back == value)
+            return len;
+    }
+    const int len = snprintf(buf, size, "%.17g", value);
+    return len < 0 ? 0 : static_cast<size_t>(len);
+}
+
+// What FormatScalar() does for each type but string.
+static size_t FormatValue(bool value, char * buf, size_t)
+{
+    const char * text = value ? "true" : "false";
+    const size_t len = strlen(text);
+    memcpy(buf, text, len + 1);
+    return len;
+}
+
+static size_t FormatValue(int32 value, char * buf, size_t) { return FormatSigned(value, buf); }
+static size_t FormatValue(uint32 value, char * buf, size_t) { return FormatInteger(value, false, buf); }
+static size_t FormatValue(int64 value, char * buf, size_t) { return FormatSigned(value, buf); }
+static size_t FormatValue(uint64 value, char * buf, size_t) { return FormatInteger(value, false, buf); }
+static size_t FormatValue(double value, char * buf, size_t size) { return FormatDouble(value, buf, size); }
+
+static size_t FormatValue(const string &, char * buf, size_t)
+{
+    assert(false); // strings aren't formatted
+    buf[0] = '\0';
+    return 0;
+}
+
+// --------------------------------------------------------------------
+// FlagValueOps
+//    What each operation on a FlagValue does, for one type of value.
+//    A FlagValue points to the table of its type, so that an operation
+//    is a call through it rather than a switch on the type.  All the
+//    tables are made by ValueOps<T>, from ParseValue() and
+//    FormatValue() for T and what T itself can do: another type of
+//    value only needs those, a ValueType and a line in kValueOps.
+// --------------------------------------------------------------------
+
+struct FlagValueOps
+{
+    const char * type_name;
+    int value_size;
+    void * (*create)(); // a new value, with the default value of the type
+    void (*destroy)(void * value);
+    bool (*parse)(void * value, const char * text, size_t len);
+    size_t (*format)(const void * value, char * buf, size_t size); // not for strings
+    bool (*validate)(const char * flagname, ValidateFnProto validate_fn_proto, const void * value);
+    bool (*equal)(const void * a, const void * b);
+    bool (*between)(const void * value, const void * min, const void * max); // NULL if no range
+    void (*copy)(void * to, const void * from);
+    void (*store_atomic)(void * to, const void * from, AtomicStringFlag * atomic_string);
+};
+
+// How a validator takes the value.
+template <typename T>
+struct ValidatorArg
+{
+    typedef T type;
+};
+template <>
+struct ValidatorArg<string>
+{
+    typedef const string & type;
+};
+
+template <typename T>
+struct ValueOps
+{
+    static const T & Of(const void * value) { return *static_cast<const T *>(value); }
+
+    static void * Create() { return new T(); }
+    static void Destroy(void * value) { delete static_cast<T *>(value); }
+    static bool Parse(void * value, const char * text, size_t len) { return ParseValue(text, len, static_cast<T *>(value)); }
+    static size_t Format(const void * value, char * buf, size_t size) { return FormatValue(Of(value), buf, size); }
+
+    // Casts validate_fn_proto to a function that takes our value as an
+    // argument (eg bool (*validate_fn)(const char *, bool) for a bool
+    // flag), and calls it.
+    static bool Validate(const char * flagname, ValidateFnProto validate_fn_proto, const void * value)
+    {
+        return reinterpret_cast<bool (*)(const char *, typename ValidatorArg<T>::type)>(validate_fn_proto)(flagname, Of(value));
+    }
+
+    static bool Equal(const void * a, const void * b) { return Of(a) == Of(b); }
+    static bool Between(const void * value, const void * min, const void * max) { return Of(min) <= Of(value) && Of(value) <= Of(max); }
+    static void Copy(void * to, const void * from) { *static_cast<T *>(to) = Of(from); }
+
+    // Readers load with atomic_internal::LoadRelaxed(); the value is
+    // only ever changed here, under the registry lock.
+    static void StoreAtomic(void * to, const void * from, AtomicStringFlag *) { atomic_internal::StoreRelaxed(static_cast<T *>(to), Of(from)); }
+};
+
+// A string is only read through the value FlagValue publishes.
+template <>
+void ValueOps<string>::StoreAtomic(void * to, const void * from, AtomicStringFlag *)
+{
+    Copy(to, from);
+}
+
+#define VALUE_OPS(type, name, between)                                                                         \
+    {                                                                                                          \
+        name, sizeof(type), &ValueOps<type>::Create, &ValueOps<type>::Destroy, &ValueOps<type>::Parse,          \
+          &ValueOps<type>::Format, &ValueOps<type>::Validate, &ValueOps<type>::Equal, between,                 \
+          &ValueOps<type>::Copy, &ValueOps<type>::StoreAtomic                                                  \
+    }
+
+// Indexed by ValueType.  Only holds constants, so this is initialized
+// statically, before any flag gets registered.
+static const FlagValueOps kValueOps[] = {
+    VALUE_OPS(bool, "bool", NULL),
+    VALUE_OPS(int32, "int32", &ValueOps<int32>::Between),
+    VALUE_OPS(uint32, "uint32", &ValueOps<uint32>::Between),
+    VALUE_OPS(int64, "int64", &ValueOps<int64>::Between),
+    VALUE_OPS(uint64, "uint64", &ValueOps<uint64>::Between),
+    VALUE_OPS(double, "double", &ValueOps<double>::Between),
+    VALUE_OPS(string, "string", NULL),
+};
+
+#undef VALUE_OPS
+
+COMPILE_ASSERT(sizeof(kValueOps) / sizeof(kValueOps[0]) == FlagValue::FV_MAX_INDEX + 1, one_table_per_value_type);
+COMPILE_ASSERT(static_cast<int>(FLAG_TYPE_BOOL) == FlagValue::FV_BOOL && static_cast<int>(FLAG_TYPE_INT32) == FlagValue::FV_INT32 &&
+                 static_cast<int>(FLAG_TYPE_UINT32) == FlagValue::FV_UINT32 && static_cast<int>(FLAG_TYPE_INT64) == FlagValue::FV_INT64 &&
+                 static_cast<int>(FLAG_TYPE_UINT64) == FlagValue::FV_UINT64 && static_cast<int>(FLAG_TYPE_DOUBLE) == FlagValue::FV_DOUBLE &&
+                 static_cast<int>(FLAG_TYPE_STRING) == FlagValue::FV_STRING,
+               flag_types_are_value_types);
+
+// --------------------------------------------------------------------
+// FlagValue
+//    This represent the value a single flag might have.  The major
+//    functionality is to convert from a string to an object of a
+//    given type, and back.  Thread-compatible.
+// --------------------------------------------------------------------
+
+bool FlagValue::TypeOfName(const char * type_name, ValueType * type)
+{
+    for (int i = 0; i <= FV_MAX_INDEX; ++i)
+    {
+        if (strcmp(type_name, kValueOps[i].type_name) == 0)
         {
-            const double r = strtod(value, &end);
-            if (errno || end != value + strlen(value))
-                return false; // bad parse
-            SET_VALUE_AS(double, r);
+            *type = static_cast<ValueType>(i);
             return true;
         }
-        default:
-        {
-            assert(false); // unknown type
-            return false;
-        }
     }
+    return false;
+}
+
+FlagValue::FlagValue(void * valbuf, const char * type, bool transfer_ownership_of_value)
+: value_buffer_(valbuf), ops_(NULL), type_(0), owns_value_(transfer_ownership_of_value), atomic_(false), shares_value_(false), atomic_string_(NULL), shared_(NULL)
+{
+    ValueType value_type = FV_BOOL;
+    const bool known = TypeOfName(type, &value_type);
+    assert(known); // Unknown typename
+    (void)known;
+    type_ = value_type;
+    ops_ = &kValueOps[type_];
+}
+
+FlagValue::FlagValue(void * valbuf, ValueType type, bool transfer_ownership_of_value)
+: value_buffer_(valbuf), ops_(&kValueOps[type]), type_(type), owns_value_(transfer_ownership_of_value), atomic_(false), shares_value_(false), atomic_string_(NULL), shared_(NULL)
+{
+    assert(type_ <= FV_MAX_INDEX);
+}
+
+FlagValue::~FlagValue()
+{
+    ReleaseValue();
+}
+
+bool FlagValue::ParseFrom(const char * value)
+{
+    return ParseFrom(value, strlen(value));
+}
+
+bool FlagValue::ParseFrom(const char * value, size_t len)
+{
+    if (type_ == FV_STRING)
+        Unshare(); // parsing a string can't fail: it's overwritten
+    return ops_->parse(value_buffer_, value, len);
+}
+
+size_t FlagValue::FormatScalar(char * buf) const
+{
+    return ops_->format(value_buffer_, buf, kScalarBufferSize);
 }
 
 string FlagValue::ToString() const
 {
-    char intbuf[64]; // enough to hold even the biggest number
-    switch (type_)
+    if (type_ == FV_STRING)
+        return VALUE_AS(string);
+    char buf[kScalarBufferSize];
+    const size_t len = FormatScalar(buf);
+    return string(buf, len);
+}
+
+void FlagValue::AppendValueTo(string * output) const
+{
+    if (type_ == FV_STRING)
     {
-        case FV_BOOL: return VALUE_AS(bool) ? "true" : "false";
-        case FV_INT32: snprintf(intbuf, sizeof(intbuf), "%" PRId32, VALUE_AS(int32)); return intbuf;
-        case FV_UINT32: snprintf(intbuf, sizeof(intbuf), "%" PRIu32, VALUE_AS(uint32)); return intbuf;
-        case FV_INT64: snprintf(intbuf, sizeof(intbuf), "%" PRId64, VALUE_AS(int64)); return intbuf;
-        case FV_UINT64: snprintf(intbuf, sizeof(intbuf), "%" PRIu64, VALUE_AS(uint64)); return intbuf;
-        case FV_DOUBLE: snprintf(intbuf, sizeof(intbuf), "%.17g", VALUE_AS(double)); return intbuf;
-        case FV_STRING: return VALUE_AS(string);
-        // clang-format off
-        default: assert(false); return ""; // unknown type
-        // clang-format on
+        output->append(VALUE_AS(string));
+        return;
     }
+    char buf[kScalarBufferSize];
+    const size_t len = FormatScalar(buf);
+    output->append(buf, len);
 }
 
-bool FlagValue::Validate(const char * flagname, ValidateFnProto validate_fn_proto) const
+size_t FlagValue::FormatInto(char * buf, size_t size) const
 {
-    switch (type_)
+    const char * text;
+    size_t len;
+    char scalar_buf[kScalarBufferSize];
+    if (type_ == FV_STRING)
+    {
+        const string & value = VALUE_AS(string);
+        text = value.data();
+        len = value.size();
+    }
+    else
+    {
+        text = scalar_buf;
+        len = FormatScalar(scalar_buf);
+    }
+    if (size > 0)
     {
-        case FV_BOOL: return reinterpret_cast<bool (*)(const char *, bool)>(validate_fn_proto)(flagname, VALUE_AS(bool));
-        case FV_INT32: return reinterpret_cast<bool (*)(const char *, int32)>(validate_fn_proto)(flagname, VALUE_AS(int32));
-        case FV_UINT32: return reinterpret_cast<bool (*)(const char *, uint32)>(validate_fn_proto)(flagname, VALUE_AS(uint32));
-        case FV_INT64: return reinterpret_cast<bool (*)(const char *, int64)>(validate_fn_proto)(flagname, VALUE_AS(int64));
-        case FV_UINT64: return reinterpret_cast<bool (*)(const char *, uint64)>(validate_fn_proto)(flagname, VALUE_AS(uint64));
-        case FV_DOUBLE: return reinterpret_cast<bool (*)(const char *, double)>(validate_fn_proto)(flagname, VALUE_AS(double));
-        case FV_STRING: return reinterpret_cast<bool (*)(const char *, const string &)>(validate_fn_proto)(flagname, VALUE_AS(string));
-        // clang-format off
-        default: assert(false); return false; // unknown type
-        // clang-format on
+        const size_t n = len < size ? len : size - 1;
+        memcpy(buf, text, n);
+        buf[n] = '\0';
     }
+    return len;
+}
+
+#define DEFINE_GET_VALUE(type, fv_type)             \
+    bool FlagValue::GetValue(type * OUTPUT) const   \
+    {                                               \
+        if (type_ != fv_type)                       \
+            return false;                           \
+        *OUTPUT = VALUE_AS(type);                   \
+        return true;                                \
+    }
+
+DEFINE_GET_VALUE(bool, FV_BOOL)
+DEFINE_GET_VALUE(int32, FV_INT32)
+DEFINE_GET_VALUE(uint32, FV_UINT32)
+DEFINE_GET_VALUE(int64, FV_INT64)
+DEFINE_GET_VALUE(uint64, FV_UINT64)
+DEFINE_GET_VALUE(double, FV_DOUBLE)
+DEFINE_GET_VALUE(string, FV_STRING)
+
+#undef DEFINE_GET_VALUE
+
+bool FlagValue::GetValue(AtomicStringFlag::Snapshot * OUTPUT) const
+{
+    if (type_ != FV_STRING)
+        return false;
+    *OUTPUT = AtomicStringFlag::Snapshot(SharedCopy());
+    return true;
+}
+
+bool FlagValue::Validate(const char * flagname, ValidateFnProto validate_fn_proto) const
+{
+    return ops_->validate(flagname, validate_fn_proto, value_buffer_);
 }
 
 const char * FlagValue::TypeName() const
 {
-    static const char types[] = "bool\0xx"
-                                "int32\0x"
-                                "uint32\0"
-                                "int64\0x"
-                                "uint64\0"
-                                "double\0"
-                                "string";
-    if (type_ > FV_MAX_INDEX)
-    {
-        assert(false);
-        return "";
-    }
-    // Directly indexing the strings in the 'types' string, each of them is 7
-    // bytes long.
-    return &types[type_ * 7];
+    return ops_->type_name;
 }
 
 bool FlagValue::Equal(const FlagValue & x) const
 {
-    if (type_ != x.type_)
-        return false;
-    switch (type_)
+    // Copies that share a string are equal without comparing it.
+    return type_ == x.type_ && (value_buffer_ == x.value_buffer_ || ops_->equal(value_buffer_, x.value_buffer_));
+}
+
+bool FlagValue::Between(const FlagValue & min, const FlagValue & max) const
+{
+    assert(type_ == min.type_ && type_ == max.type_);
+    assert(ops_->between != NULL); // bool and string have no range
+    return ops_->between(value_buffer_, min.value_buffer_, max.value_buffer_);
+}
+
+FlagValue * FlagValue::New() const
+{
+    return new FlagValue(ops_->create(), type(), true);
+}
+
+// --------------------------------------------------------------------
+// FlagValue::CopyFrom()
+// FlagValue::TakeFrom()
+//    A value that jflags owns doesn't copy a string: it shares x's, the
+//    one x.SharedCopy() returns.  A flag's own value (FLAGS_foo) is
+//    still copied into, but it then shares x's string as its shared_,
+//    if x has one, for the next copy made of the flag to be free.  An
+//    atomic string flag publishes its SharedCopy(), which the copies
+//    made of the flag then share too.
+// --------------------------------------------------------------------
+
+void FlagValue::CopyFrom(const FlagValue & x)
+{
+    assert(type_ == x.type_);
+    if (type_ == FV_STRING && owns_value_)
     {
-        case FV_BOOL: return VALUE_AS(bool) == OTHER_VALUE_AS(x, bool);
-        case FV_INT32: return VALUE_AS(int32) == OTHER_VALUE_AS(x, int32);
-        case FV_UINT32: return VALUE_AS(uint32) == OTHER_VALUE_AS(x, uint32);
-        case FV_INT64: return VALUE_AS(int64) == OTHER_VALUE_AS(x, int64);
-        case FV_UINT64: return VALUE_AS(uint64) == OTHER_VALUE_AS(x, uint64);
-        case FV_DOUBLE: return VALUE_AS(double) == OTHER_VALUE_AS(x, double);
-        case FV_STRING: return VALUE_AS(string) == OTHER_VALUE_AS(x, string);
-        // clang-format off
-        default: assert(false); return false; // unknown type
-        // clang-format on
+        SharedFlagString * const shared = x.SharedCopy();
+        ReleaseValue();
+        shared_ = shared;
+        shares_value_ = true;
+        value_buffer_ = SharedFlagStringValue(shared);
+        return;
     }
+    if (type_ == FV_STRING && &x != this)
+    {
+        Unshare();
+        if (x.shares_value_)
+        {
+            RefSharedFlagString(x.shared_);
+            shared_ = x.shared_;
+        }
+    }
+    if (atomic_)
+        ops_->store_atomic(value_buffer_, x.value_buffer_, atomic_string_);
+    else
+        ops_->copy(value_buffer_, x.value_buffer_);
+    if (atomic_string_ != NULL)
+        PublishAtomicString(atomic_string_, SharedCopy());
 }
 
-FlagValue * FlagValue::New() const
+void FlagValue::TakeFrom(FlagValue * x)
 {
-    const char * type = TypeName();
-    switch (type_)
+    assert(type_ == x->type_);
+    if (type_ != FV_STRING || x->shares_value_ || x == this)
     {
-        case FV_BOOL: return new FlagValue(new bool(false), type, true);
-        case FV_INT32: return new FlagValue(new int32(0), type, true);
-        case FV_UINT32: return new FlagValue(new uint32(0), type, true);
-        case FV_INT64: return new FlagValue(new int64(0), type, true);
-        case FV_UINT64: return new FlagValue(new uint64(0), type, true);
-        case FV_DOUBLE: return new FlagValue(new double(0.0), type, true);
-        case FV_STRING: return new FlagValue(new string, type, true);
-        // clang-format off
-        default: assert(false); return NULL; // unknown type
-        // clang-format on
+        CopyFrom(*x);
+        return;
     }
+    Unshare();
+    x->Unshare();
+    string & value = VALUE_AS(string);
+    value.swap(*static_cast<string *>(x->value_buffer_));
+    if (atomic_string_ != NULL)
+        PublishAtomicString(atomic_string_, SharedCopy());
 }
 
-void FlagValue::CopyFrom(const FlagValue & x)
+SharedFlagString * FlagValue::SharedCopy() const
 {
-    assert(type_ == x.type_);
-    switch (type_)
+    assert(type_ == FV_STRING);
+    if (shares_value_)
     {
-        case FV_BOOL: SET_VALUE_AS(bool, OTHER_VALUE_AS(x, bool)); break;
-        case FV_INT32: SET_VALUE_AS(int32, OTHER_VALUE_AS(x, int32)); break;
-        case FV_UINT32: SET_VALUE_AS(uint32, OTHER_VALUE_AS(x, uint32)); break;
-        case FV_INT64: SET_VALUE_AS(int64, OTHER_VALUE_AS(x, int64)); break;
-        case FV_UINT64: SET_VALUE_AS(uint64, OTHER_VALUE_AS(x, uint64)); break;
-        case FV_DOUBLE: SET_VALUE_AS(double, OTHER_VALUE_AS(x, double)); break;
-        case FV_STRING: SET_VALUE_AS(string, OTHER_VALUE_AS(x, string)); break;
-        // clang-format off
-        default: assert(false); // unknown type
-        // clang-format on
+        RefSharedFlagString(shared_);
+        return shared_;
     }
+    return ShareFlagString(&shared_, VALUE_AS(string));
 }
 
-int FlagValue::ValueSize() const
+void FlagValue::ReleaseValue()
+{
+    if (owns_value_ && !shares_value_)
+        ops_->destroy(value_buffer_);
+    UnrefSharedFlagString(shared_);
+    shared_ = NULL;
+    shares_value_ = false;
+}
+
+void FlagValue::Unshare()
 {
-    if (type_ > FV_MAX_INDEX)
+    if (shares_value_)
+    {
+        string * const own = new string;
+        ReleaseValue();
+        value_buffer_ = own;
+    }
+    else
     {
-        assert(false); // unknown type
-        return 0;
+        UnrefSharedFlagString(shared_);
+        shared_ = NULL;
     }
-    static const uint8 valuesize[] = {
-        sizeof(bool), sizeof(int32), sizeof(uint32), sizeof(int64),
-        sizeof(uint64), sizeof(double), sizeof(string),
-    };
-    return valuesize[type_];
+}
+
+void FlagValue::MakeAtomic(AtomicStringFlag * atomic_string)
+{
+    assert((type_ == FV_STRING) == (atomic_string != NULL));
+    atomic_ = true;
+    atomic_string_ = atomic_string;
+    if (atomic_string_ != NULL)
+        PublishAtomicString(atomic_string_, SharedCopy());
+}
+
+int FlagValue::ValueSize() const
+{
+    return ops_->value_size;
 }
 
 } // namespace JFLAGS_NAMESPACE
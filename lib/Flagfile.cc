@@ -0,0 +1,620 @@
+////////////////////////////////////////////////////////////////////////////////
+//                                    jflags
+//
+// This file is distributed under the 3-clause Berkeley Software Distribution
+// License. See LICENSE.txt for details.
+////////////////////////////////////////////////////////////////////////////////
+#include "Flagfile.h"
+#include "ByteScan.h"
+#include "CommandLineFlagParser.h"
+#include "FlagRegistry.h"
+#include "jflags_parser.h"
+#include "util.h"
+#include "mutex.h"
+
+#include <stddef.h>
+#include <algorithm>
+#include <cstring>
+#include <map>
+#if defined(HAVE_PTHREAD) && !defined(NO_THREADS)
+#include <pthread.h>
+#endif
+
+using namespace MUTEX_NAMESPACE;
+
+namespace JFLAGS_NAMESPACE {
+
+// --------------------------------------------------------------------
+// Flagfile
+//    Each line of a flagfile can be one of four things:
+//    1) A comment line -- we skip it
+//    2) An empty line -- we skip it
+//    3) A list of filenames -- starts a new filenames+flags section
+//    4) A --flag=value line -- apply if previous filenames match
+//    Only 3) and 4) end up in lines().  Leading whitespace is
+//    stripped from every line, as are the leading dashes of a flag.
+// --------------------------------------------------------------------
+
+#define PFATAL(s)           \
+    do                      \
+    {                       \
+        perror(s);          \
+        jflags_exitfunc(1); \
+    } while (0)
+
+#if defined(HAVE_SYS_STAT_H)
+static void StampFromStat(const struct stat & st, Flagfile::Stamp * stamp)
+{
+    stamp->device = static_cast<uint64>(st.st_dev);
+    stamp->inode = static_cast<uint64>(st.st_ino);
+    stamp->size = static_cast<uint64>(st.st_size);
+    stamp->mtime = static_cast<int64>(st.st_mtime);
+#if defined(_STATBUF_ST_NSEC)
+    stamp->mtime_nsec = static_cast<int64>(st.st_mtim.tv_nsec);
+#endif
+}
+#endif
+
+bool Flagfile::Stamp::operator==(const Stamp & x) const
+{
+    return device == x.device && inode == x.inode && size == x.size && mtime == x.mtime && mtime_nsec == x.mtime_nsec;
+}
+
+bool Flagfile::StatFile(const char * filename, Stamp * stamp)
+{
+#if defined(HAVE_SYS_STAT_H)
+    struct stat st;
+    if (stat(filename, &st) != 0)
+        return false;
+    StampFromStat(st, stamp);
+    return true;
+#else
+    return false;
+#endif
+}
+
+// Reads the whole file into a malloc()ed, NUL-terminated buffer.  The
+// buffer is sized from the file's size, so that a regular file is read
+// with a single allocation and a single fread(); we still keep reading
+// (and growing) for things that don't have a size, like pipes.  Returns
+// NULL, with errno set, if the file can't be read.
+static char * ReadWholeFile(const char * filename, size_t * size, Flagfile::Stamp * stamp)
+{
+    FILE * fp;
+    // Binary mode, so precompiled flagfiles come through untouched; the
+    // tokenizer handles "\r\n" itself.
+    if ((errno = SafeFOpen(&fp, filename, "rb")) != 0)
+        return NULL;
+    size_t capacity = 8192;
+#if defined(HAVE_SYS_STAT_H)
+    struct stat st;
+    if (fstat(fileno(fp), &st) == 0)
+    {
+        StampFromStat(st, stamp);
+        if (st.st_size > 0)
+            capacity = static_cast<size_t>(st.st_size) + 1; // +1 to see the EOF
+    }
+#endif
+    char * buffer = static_cast<char *>(malloc(capacity));
+    size_t n = 0;
+    for (;;)
+    {
+        n += fread(buffer + n, 1, capacity - n, fp);
+        if (ferror(fp))
+        {
+            const int error = errno;
+            free(buffer);
+            fclose(fp);
+            errno = error;
+            return NULL;
+        }
+        if (n < capacity)
+            break; // a short read means we're at EOF
+        capacity *= 2;
+        buffer = static_cast<char *>(realloc(buffer, capacity));
+    }
+    fclose(fp);
+    buffer[n] = '\0';
+    *size = n;
+    return buffer;
+}
+
+Flagfile::Flagfile()
+: buffer_(NULL), size_(0)
+{
+}
+
+Flagfile::~Flagfile()
+{
+    free(buffer_);
+}
+
+void Flagfile::ReadFile(const char * filename)
+{
+    if (!ReadContents(filename))
+        PFATAL(filename);
+    const char * const problem = Tokenize();
+    if (problem != NULL)
+        ReportError(DIE, "ERROR: precompiled flagfile '%s' %s\n", filename, problem);
+}
+
+bool Flagfile::TryReadFile(const char * filename)
+{
+    return ReadContents(filename) && Tokenize() == NULL;
+}
+
+bool Flagfile::ReadContents(const char * filename)
+{
+    free(buffer_);
+    lines_.clear();
+    stamp_ = Stamp();
+    size_ = 0;
+    buffer_ = ReadWholeFile(filename, &size_, &stamp_);
+    if (buffer_ == NULL)
+        return false;
+    NoteFlagfileBytes(size_);
+    return true;
+}
+
+void Flagfile::Assign(const char * contents, size_t size)
+{
+    free(buffer_);
+    buffer_ = static_cast<char *>(malloc(size + 1));
+    memcpy(buffer_, contents, size);
+    buffer_[size] = '\0';
+    size_ = size;
+    stamp_ = Stamp();
+    const char * const problem = Tokenize();
+    if (problem != NULL)
+        ReportError(DIE, "ERROR: precompiled flagfile '%s' %s\n", "<flagfile contents>", problem);
+}
+
+// --------------------------------------------------------------------
+// The precompiled flagfile format
+//    BinaryFlagfileHeader
+//    BinaryFlagfileEntry    num_lines times, one per Line
+//    char                   strings_size bytes of NUL-terminated texts
+//    All integers are in the byte order of the machine that compiled
+//    the file; a machine with another byte order won't load it.
+// --------------------------------------------------------------------
+
+static const char kBinaryFlagfileMagic[8] = "\177jflags";
+static const uint32 kBinaryFlagfileByteOrder = 0x01020304;
+static const uint32 kBinaryFlagfileVersion = 1;
+
+struct BinaryFlagfileHeader
+{
+    char magic[8];      // kBinaryFlagfileMagic
+    uint32 byte_order;  // kBinaryFlagfileByteOrder
+    uint32 version;     // kBinaryFlagfileVersion
+    uint32 num_lines;
+    uint32 strings_size;
+    uint32 checksum;    // of everything after the header
+    uint32 reserved;
+};
+
+struct BinaryFlagfileEntry
+{
+    uint32 text_offset; // into the strings
+    uint8 is_flag;
+    int8 value_type;    // FlagValue::ValueType of value, or -1
+    uint8 reserved[2];
+    uint64 value;       // the value's bytes, as a FlagValue holds them
+};
+
+COMPILE_ASSERT(sizeof(BinaryFlagfileHeader) == 32, binary_flagfile_header_size);
+COMPILE_ASSERT(sizeof(BinaryFlagfileEntry) == 16, binary_flagfile_entry_size);
+
+// 32-bit FNV-1a.
+static uint32 Checksum(const char * data, size_t size)
+{
+    uint32 hash = 2166136261U;
+    for (size_t i = 0; i < size; ++i)
+    {
+        hash ^= static_cast<unsigned char>(data[i]);
+        hash *= 16777619U;
+    }
+    return hash;
+}
+
+const char * Flagfile::Tokenize()
+{
+    lines_.clear();
+    if (size_ >= sizeof(BinaryFlagfileHeader) && memcmp(buffer_, kBinaryFlagfileMagic, sizeof(kBinaryFlagfileMagic)) == 0)
+        return Decode();
+
+    char * p = buffer_;
+    char * const end = buffer_ + size_;
+    while (p < end)
+    {
+        // This skips line breaks too, and so empty lines.
+        char * line = const_cast<char *>(SkipWhitespace(p, end));
+        char * name = line;
+        if (*name == '-')
+        {
+            ++name; // skip the leading -
+            if (*name == '-')
+                ++name; // skip second - too
+        }
+
+        // One pass to the end of the line, for "\n" and Windows' "\r\n"
+        // alike, which is then terminated in place.  The '=' of a flag
+        // line, if any, ends its name on the way.
+        p = const_cast<char *>(FindFirstOf(name, end, '\n', '\r', '='));
+        const size_t name_size = p - name;
+        if (p < end && *p == '=')
+            p = const_cast<char *>(FindFirstOf(p + 1, end, '\n', '\r', '\n'));
+        *p++ = '\0'; // at end, this is the terminating NUL of buffer_
+
+        if (*line == '\0' || *line == '#')
+            continue; // comment or empty line; just ignore
+
+        Line l;
+        l.is_flag = (*line == '-');
+        l.value_type = -1;
+        l.match = 0;
+        l.name_size = l.is_flag ? static_cast<uint32>(name_size) : 0;
+        l.text = l.is_flag ? name : line;
+        l.value = NULL;
+        lines_.push_back(l);
+    }
+    return NULL;
+}
+
+const char * Flagfile::Decode()
+{
+    BinaryFlagfileHeader header;
+    memcpy(&header, buffer_, sizeof(header));
+    if (header.byte_order != kBinaryFlagfileByteOrder || header.version != kBinaryFlagfileVersion)
+        return "was compiled for another version or machine";
+
+    const char * const entries = buffer_ + sizeof(header);
+    const char * const strings = entries + static_cast<size_t>(header.num_lines) * sizeof(BinaryFlagfileEntry);
+    const size_t expected_size = sizeof(header) + static_cast<size_t>(header.num_lines) * sizeof(BinaryFlagfileEntry) + header.strings_size;
+    if (header.num_lines > size_ / sizeof(BinaryFlagfileEntry) || expected_size != size_ || (header.strings_size > 0 && strings[header.strings_size - 1] != '\0') || Checksum(entries, size_ - sizeof(header)) != header.checksum)
+        return "is corrupt";
+
+    lines_.resize(header.num_lines);
+    for (uint32 i = 0; i < header.num_lines; ++i)
+    {
+        BinaryFlagfileEntry entry;
+        memcpy(&entry, entries + i * sizeof(entry), sizeof(entry));
+        if (entry.text_offset >= header.strings_size || entry.value_type > FlagValue::FV_MAX_INDEX)
+        {
+            lines_.clear();
+            return "is corrupt";
+        }
+        lines_[i].is_flag = (entry.is_flag != 0);
+        lines_[i].value_type = entry.value_type;
+        lines_[i].match = 0;
+        lines_[i].text = strings + entry.text_offset;
+        lines_[i].name_size = lines_[i].is_flag ? static_cast<uint32>(strcspn(lines_[i].text, "=")) : 0;
+        lines_[i].value = entry.value_type < 0 ? NULL : entries + i * sizeof(entry) + offsetof(BinaryFlagfileEntry, value);
+    }
+    return NULL;
+}
+
+bool Flagfile::Compile(const char * text_filename, const char * binary_filename)
+{
+    Flagfile text;
+    text.ReadFile(text_filename);
+
+    vector<BinaryFlagfileEntry> entries(text.lines().size());
+    string strings;
+    {
+        FlagRegistry * const registry = FlagRegistry::GlobalRegistry();
+        FlagRegistryReaderLock frl(registry);
+        for (size_t i = 0; i < entries.size(); ++i)
+        {
+            const Line & line = text.lines()[i];
+            BinaryFlagfileEntry & entry = entries[i];
+            memset(&entry, 0, sizeof(entry));
+            entry.text_offset = static_cast<uint32>(strings.size());
+            entry.is_flag = line.is_flag;
+            entry.value_type = -1;
+
+            const char * value = NULL;
+            CommandLineFlag * flag = line.is_flag ? registry->SplitArgumentLocked(line.text, line.name_size, NULL, &value, NULL) : NULL;
+            if (flag != NULL && value != NULL && flag->current().type() != FlagValue::FV_STRING)
+            {
+                FlagValue parsed(&entry.value, flag->current().type(), false);
+                if (parsed.ParseFrom(value))
+                {
+                    // Spell it the canonical way, so that --nox comes back
+                    // as x=0 and the value matches the text.
+                    entry.value_type = static_cast<int8>(flag->current().type());
+                    strings.append(flag->name());
+                    strings.append("=");
+                    strings.append(value);
+                    strings.append(1, '\0');
+                    continue;
+                }
+                entry.value = 0;
+            }
+            strings.append(line.text);
+            strings.append(1, '\0');
+        }
+    }
+
+    string contents(sizeof(BinaryFlagfileHeader), '\0');
+    if (!entries.empty())
+        contents.append(reinterpret_cast<const char *>(&entries[0]), entries.size() * sizeof(BinaryFlagfileEntry));
+    contents.append(strings);
+
+    BinaryFlagfileHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, kBinaryFlagfileMagic, sizeof(header.magic));
+    header.byte_order = kBinaryFlagfileByteOrder;
+    header.version = kBinaryFlagfileVersion;
+    header.num_lines = static_cast<uint32>(entries.size());
+    header.strings_size = static_cast<uint32>(strings.size());
+    header.checksum = Checksum(contents.data() + sizeof(header), contents.size() - sizeof(header));
+    contents.replace(0, sizeof(header), reinterpret_cast<const char *>(&header), sizeof(header));
+
+    FILE * fp;
+    if (SafeFOpen(&fp, binary_filename, "wb") != 0)
+        return false;
+    const bool ok = fwrite(contents.data(), 1, contents.size(), fp) == contents.size();
+    return fclose(fp) == 0 && ok;
+}
+
+bool CompileFlagfile(const char * text_filename, const char * binary_filename)
+{
+    return Flagfile::Compile(text_filename, binary_filename);
+}
+
+// --------------------------------------------------------------------
+// FlagfileHandle
+//    Reads a flagfile through the process-wide flagfile cache, if it's
+//    enabled, or straight from disk otherwise.
+// --------------------------------------------------------------------
+
+struct CachedFlagfile
+{
+    CachedFlagfile() : refs(1) {}
+    Flagfile flagfile;
+    int refs; // handles, plus one while it's in the cache
+};
+
+typedef std::map<string, CachedFlagfile *> FlagfileCacheMap;
+static FlagfileCacheMap * flagfile_cache = NULL; // NULL when disabled
+static Mutex flagfile_cache_lock(Mutex::LINKER_INITIALIZED);
+
+static void UnrefLocked(CachedFlagfile * file)
+{
+    if (--file->refs == 0)
+        delete file;
+}
+
+static void ClearFlagfileCacheLocked()
+{
+    for (FlagfileCacheMap::iterator i = flagfile_cache->begin(); i != flagfile_cache->end(); ++i)
+        UnrefLocked(i->second);
+    flagfile_cache->clear();
+}
+
+// Opens the named file the way FlagfileHandle does, and returns a
+// reference to it; or NULL, if it can't be read and !must_read.
+static CachedFlagfile * OpenFlagfile(const char * filename, bool must_read)
+{
+    Flagfile::Stamp stamp;
+    {
+        MutexLock l(&flagfile_cache_lock);
+        if (flagfile_cache != NULL && Flagfile::StatFile(filename, &stamp))
+        {
+            FlagfileCacheMap::iterator i = flagfile_cache->find(filename);
+            if (i != flagfile_cache->end() && i->second->flagfile.stamp() == stamp)
+            {
+                ++i->second->refs;
+                return i->second;
+            }
+        }
+    }
+
+    // Do the actual reading without holding the lock.
+    CachedFlagfile * file = new CachedFlagfile;
+    if (must_read)
+    {
+        file->flagfile.ReadFile(filename);
+    }
+    else if (!file->flagfile.TryReadFile(filename))
+    {
+        delete file;
+        return NULL;
+    }
+
+    MutexLock l(&flagfile_cache_lock);
+    // Only cache what we know the version of; and don't bother with a
+    // file that changed between the stat() above and reading it.
+    if (flagfile_cache != NULL && file->flagfile.stamp() == stamp && !(stamp == Flagfile::Stamp()))
+    {
+        CachedFlagfile *& slot = (*flagfile_cache)[filename];
+        if (slot != NULL)
+            UnrefLocked(slot);
+        slot = file;
+        ++file->refs;
+    }
+    return file;
+}
+
+FlagfileHandle::FlagfileHandle(const char * filename, FlagfilePrefetch * prefetch)
+: file_(NULL)
+{
+    if (prefetch != NULL)
+        file_ = prefetch->Take(filename);
+    if (file_ == NULL)
+        file_ = OpenFlagfile(filename, true);
+}
+
+FlagfileHandle::~FlagfileHandle()
+{
+    MutexLock l(&flagfile_cache_lock);
+    UnrefLocked(file_);
+}
+
+const Flagfile & FlagfileHandle::operator*() const
+{
+    return file_->flagfile;
+}
+
+// --------------------------------------------------------------------
+// FlagfilePrefetch
+//    Each level is read by a pool of threads, the calling thread being
+//    one of them, which pick up the files in turn.  The flagfiles that
+//    a level names are found the way ProcessFlagfileContentsLocked()
+//    would apply them: --flagfile lines, in the sections that match
+//    this program.
+// --------------------------------------------------------------------
+
+#if defined(HAVE_PTHREAD) && !defined(NO_THREADS)
+
+struct FlagfileReadPool
+{
+    Mutex lock;
+    const vector<string> * filenames;
+    vector<CachedFlagfile *> * files;
+    size_t next; // the next one for a thread to pick up
+};
+
+static void * ReadFlagfiles(void * arg)
+{
+    FlagfileReadPool * const pool = static_cast<FlagfileReadPool *>(arg);
+    for (;;)
+    {
+        size_t i;
+        {
+            MutexLock l(&pool->lock);
+            if (pool->next == pool->filenames->size())
+                return NULL;
+            i = pool->next++;
+        }
+        (*pool->files)[i] = OpenFlagfile((*pool->filenames)[i].c_str(), false);
+    }
+}
+
+// Appends the files named by the --flagfile lines of flagfile that
+// apply to this program to *filenames.
+static void FindNestedFlagfiles(const Flagfile & flagfile, vector<string> * filenames)
+{
+    static const char kFlagfile[] = "flagfile";
+    static const size_t kFlagfileSize = sizeof(kFlagfile) - 1;
+    bool flags_are_relevant = true;
+    bool in_filename_section = false;
+    for (vector<Flagfile::Line>::const_iterator line = flagfile.lines().begin(); line != flagfile.lines().end(); ++line)
+    {
+        if (!line->is_flag)
+        {
+            if (!in_filename_section)
+            {
+                in_filename_section = true;
+                flags_are_relevant = false;
+            }
+            if (!flags_are_relevant)
+                flags_are_relevant = CommandLineFlagParser::GlobsMatchProgram(*line);
+            continue;
+        }
+        in_filename_section = false;
+        if (!flags_are_relevant || line->name_size != kFlagfileSize || strncmp(line->text, kFlagfile, kFlagfileSize) != 0 || line->text[kFlagfileSize] != '=')
+            continue;
+        for (const char * name = line->text + kFlagfileSize + 1; *name != '\0';)
+        {
+            const char * const end = name + strcspn(name, ",");
+            if (end != name)
+                filenames->push_back(string(name, end));
+            name = (*end == ',') ? end + 1 : end;
+        }
+    }
+}
+
+#endif
+
+FlagfilePrefetch::~FlagfilePrefetch()
+{
+    MutexLock l(&flagfile_cache_lock);
+    for (std::map<string, CachedFlagfile *>::iterator i = files_.begin(); i != files_.end(); ++i)
+    {
+        if (i->second != NULL)
+            UnrefLocked(i->second);
+    }
+}
+
+void FlagfilePrefetch::Fetch(const vector<string> & filenames)
+{
+#if defined(HAVE_PTHREAD) && !defined(NO_THREADS)
+    if (num_threads_ <= 0)
+        return;
+    vector<string> level;
+    vector<string> named = filenames;
+    for (;;)
+    {
+        level.clear();
+        for (vector<string>::const_iterator i = named.begin(); i != named.end(); ++i)
+        {
+            if (files_.insert(make_pair(*i, static_cast<CachedFlagfile *>(NULL))).second)
+                level.push_back(*i);
+        }
+        if (level.empty())
+            return;
+
+        vector<CachedFlagfile *> files(level.size(), static_cast<CachedFlagfile *>(NULL));
+        FlagfileReadPool pool;
+        pool.filenames = &level;
+        pool.files = &files;
+        pool.next = 0;
+        vector<pthread_t> threads(std::min(static_cast<size_t>(num_threads_), level.size()) - 1);
+        size_t num_started = 0;
+        while (num_started < threads.size() && pthread_create(&threads[num_started], NULL, &ReadFlagfiles, &pool) == 0)
+            ++num_started;
+        ReadFlagfiles(&pool);
+        for (size_t i = 0; i < num_started; ++i)
+            pthread_join(threads[i], NULL);
+
+        named.clear();
+        for (size_t i = 0; i < level.size(); ++i)
+        {
+            files_[level[i]] = files[i];
+            if (files[i] != NULL)
+                FindNestedFlagfiles(files[i]->flagfile, &named);
+        }
+    }
+#else
+    (void)filenames;
+#endif
+}
+
+CachedFlagfile * FlagfilePrefetch::Take(const string & filename)
+{
+    std::map<string, CachedFlagfile *>::const_iterator i = files_.find(filename);
+    if (i == files_.end() || i->second == NULL)
+        return NULL;
+    MutexLock l(&flagfile_cache_lock);
+    ++i->second->refs;
+    return i->second;
+}
+
+void EnableFlagfileCache(bool enable)
+{
+    MutexLock l(&flagfile_cache_lock);
+    if (flagfile_cache != NULL)
+    {
+        ClearFlagfileCacheLocked();
+        if (!enable)
+        {
+            delete flagfile_cache;
+            flagfile_cache = NULL;
+        }
+    }
+    else if (enable)
+    {
+        flagfile_cache = new FlagfileCacheMap;
+    }
+}
+
+void ClearFlagfileCache()
+{
+    MutexLock l(&flagfile_cache_lock);
+    if (flagfile_cache != NULL)
+        ClearFlagfileCacheLocked();
+}
+
+} // namespace JFLAGS_NAMESPACE
@@ -0,0 +1,415 @@
+////////////////////////////////////////////////////////////////////////////////
+//                                    jflags
+//
+// This file is distributed under the 3-clause Berkeley Software Distribution
+// License. See LICENSE.txt for details.
+////////////////////////////////////////////////////////////////////////////////
+#include "Flagfile.h"
+#include "FlagRegistry.h"
+#include "CommandLineFlagParser.h"
+#include "jflags_parser.h"
+#include "util.h"
+#include "mutex.h"
+
+#include <cstring>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+#if defined(HAVE_PTHREAD) && !defined(NO_THREADS)
+#include <pthread.h>
+#include <sys/time.h>
+#endif
+
+using namespace MUTEX_NAMESPACE;
+
+namespace JFLAGS_NAMESPACE {
+
+using std::map;
+using std::pair;
+using std::string;
+using std::vector;
+
+// --------------------------------------------------------------------
+// ReloadChangedFlagfiles()
+//    Every file read for --flagfile is remembered, along with the
+//    flag settings it had for this program the last time it was read
+//    here, and the files it named with --flagfile, where it named them.
+//    A reload only re-reads the files whose stamp changed, and only
+//    sets the flags whose settings, as all the files together have
+//    them, changed.  Like when parsing, the files named outside of any
+//    flagfile are applied in turn, each with the files it names
+//    expanded in place, and the last setting of a flag wins.  Reading
+//    and splitting up the files only takes the registry lock shared;
+//    the exclusive lock is only held to set the flags that changed,
+//    all in one go.
+//       The names of the files are noted while the parser holds the
+//    registry lock, so they go into a list of their own, with a lock
+//    that's never held while taking another.  The reloading state has
+//    its own lock, which is let go of before setting the flags, for
+//    flag watchers to be free to do what they want.
+// --------------------------------------------------------------------
+
+struct WatchedFlagfile
+{
+    explicit WatchedFlagfile(const string & name) : filename(name), loaded(false) {}
+
+    // A NULL flag stands for a file named by --flagfile, in the string.
+    typedef vector<pair<CommandLineFlag *, string> > Settings;
+
+    string filename;
+    bool loaded;           // whether settings (and stamp) were read yet
+    Flagfile::Stamp stamp; // of the file settings were read from
+    Settings settings;     // the flags the file sets for this program, in order
+};
+
+// The names of the files, in the order they were first read for
+// --flagfile, and of those that weren't named in another flagfile.
+static vector<string> * noted_flagfiles = NULL;
+static vector<string> * noted_top_flagfiles = NULL;
+static Mutex noted_flagfiles_lock(Mutex::LINKER_INITIALIZED);
+
+// The files being watched: noted_flagfiles, then the files they name
+// that weren't read yet.
+typedef vector<WatchedFlagfile> WatchedFlagfiles;
+static WatchedFlagfiles * watched_flagfiles = NULL;
+static Mutex reload_lock(Mutex::LINKER_INITIALIZED);
+
+// Appends filename to *filenames, unless it's already there.
+static void NoteOnce(vector<string> * filenames, const string & filename)
+{
+    for (vector<string>::const_iterator i = filenames->begin(); i != filenames->end(); ++i)
+    {
+        if (*i == filename)
+            return;
+    }
+    filenames->push_back(filename);
+}
+
+void NoteFlagfileForReloading(const string & filename, bool top_level)
+{
+    MutexLock l(&noted_flagfiles_lock);
+    if (noted_flagfiles == NULL)
+    {
+        noted_flagfiles = new vector<string>;
+        noted_top_flagfiles = new vector<string>;
+    }
+    NoteOnce(noted_flagfiles, filename);
+    if (top_level)
+        NoteOnce(noted_top_flagfiles, filename);
+}
+
+void ForgetFlagfilesForReloading()
+{
+    MutexLock l(&reload_lock);
+    delete watched_flagfiles;
+    watched_flagfiles = NULL;
+    MutexLock m(&noted_flagfiles_lock);
+    delete noted_flagfiles;
+    noted_flagfiles = NULL;
+    delete noted_top_flagfiles;
+    noted_top_flagfiles = NULL;
+}
+
+bool IsRecursiveFlag(const CommandLineFlag * flag)
+{
+    return strcmp(flag->name(), "flagfile") == 0 || strcmp(flag->name(), "fromenv") == 0 || strcmp(flag->name(), "tryfromenv") == 0;
+}
+
+// Collects the settings of the flags of flagfile, and the files it
+// names with --flagfile, the way
+// CommandLineFlagParser::ProcessFlagfileContentsLocked() would apply
+// them.  Lines that wouldn't apply are silently ignored, like there.
+static void ReadSettingsLocked(FlagRegistry * registry, const Flagfile & flagfile, WatchedFlagfile::Settings * settings)
+{
+    bool flags_are_relevant = true; // set to false when filenames don't match
+    bool in_filename_section = false;
+
+    const vector<Flagfile::Line> & lines = flagfile.lines();
+    for (vector<Flagfile::Line>::const_iterator line = lines.begin(); line != lines.end(); ++line)
+    {
+        if (line->is_flag)
+        {
+            in_filename_section = false;
+            if (!flags_are_relevant)
+                continue;
+            const char * value;
+            CommandLineFlag * flag = registry->SplitArgumentLocked(line->text, line->name_size, NULL, &value, NULL);
+            if (flag == NULL || value == NULL)
+                continue;
+            if (!IsRecursiveFlag(flag))
+            {
+                settings->push_back(make_pair(flag, string(value)));
+            }
+            else if (strcmp(flag->name(), "flagfile") == 0)
+            {
+                for (const char * name = value; *name != '\0';)
+                {
+                    const char * const end = name + strcspn(name, ",");
+                    if (end != name)
+                        settings->push_back(make_pair(static_cast<CommandLineFlag *>(NULL), string(name, end)));
+                    name = (*end == ',') ? end + 1 : end;
+                }
+            }
+        }
+        else
+        {
+            if (!in_filename_section)
+            {
+                in_filename_section = true;
+                flags_are_relevant = false;
+            }
+            if (!flags_are_relevant)
+                flags_are_relevant = CommandLineFlagParser::GlobsMatchProgram(*line);
+        }
+    }
+}
+
+// Re-reads file if it was never read, or if force and its stamp
+// changed.  Returns whether its settings were read, with the old ones
+// in *old_settings.
+static bool RefreshWatchedFlagfile(WatchedFlagfile * file, bool force, WatchedFlagfile::Settings * old_settings)
+{
+    Flagfile::Stamp stamp;
+    if (file->loaded && (!force || !Flagfile::StatFile(file->filename.c_str(), &stamp) || stamp == file->stamp))
+        return false;
+
+    Flagfile flagfile;
+    if (!flagfile.TryReadFile(file->filename.c_str()))
+        return false; // maybe it's being rewritten; try again next time
+
+    WatchedFlagfile::Settings settings;
+    FlagRegistry * const registry = FlagRegistry::GlobalRegistry();
+    {
+        FlagRegistryReaderLock frl(registry);
+        ReadSettingsLocked(registry, flagfile, &settings);
+    }
+    file->settings.swap(settings);
+    old_settings->swap(settings);
+    file->stamp = flagfile.stamp();
+    file->loaded = true;
+    return true;
+}
+
+typedef map<CommandLineFlag *, const string *> FlagSettingMap;
+typedef map<string, size_t> FlagfileIndex; // into the watched files
+
+// Starts watching the files that the settings of file name, and that
+// aren't watched yet.
+static void WatchNestedFlagfiles(WatchedFlagfiles * files, FlagfileIndex * index, size_t file)
+{
+    for (size_t i = 0; i < (*files)[file].settings.size(); ++i)
+    {
+        const pair<CommandLineFlag *, string> & setting = (*files)[file].settings[i];
+        if (setting.first == NULL && index->insert(make_pair(setting.second, files->size())).second)
+            files->push_back(WatchedFlagfile(setting.second));
+    }
+}
+
+// Applies the settings of file, with the files it names expanded in
+// place, to where what's applied before leaves each flag.  settings[i]
+// are the settings of the i-th watched file, as of before or after
+// the reload.  A file that names itself, however indirectly, isn't
+// expanded again.
+static void CombineSettings(const vector<const WatchedFlagfile::Settings *> & settings, const FlagfileIndex & index, size_t file, vector<bool> * expanding, FlagSettingMap * combined)
+{
+    if ((*expanding)[file])
+        return;
+    (*expanding)[file] = true;
+    for (WatchedFlagfile::Settings::const_iterator s = settings[file]->begin(); s != settings[file]->end(); ++s)
+    {
+        if (s->first != NULL)
+        {
+            (*combined)[s->first] = &s->second;
+            continue;
+        }
+        FlagfileIndex::const_iterator nested = index.find(s->second);
+        if (nested != index.end())
+            CombineSettings(settings, index, nested->second, expanding, combined);
+    }
+    (*expanding)[file] = false;
+}
+
+static void CombineAllSettings(const vector<const WatchedFlagfile::Settings *> & settings, const FlagfileIndex & index, const vector<string> & top_level, FlagSettingMap * combined)
+{
+    vector<bool> expanding(settings.size(), false);
+    for (vector<string>::const_iterator name = top_level.begin(); name != top_level.end(); ++name)
+    {
+        FlagfileIndex::const_iterator file = index.find(*name);
+        if (file != index.end())
+            CombineSettings(settings, index, file->second, &expanding, combined);
+    }
+}
+
+typedef vector<pair<CommandLineFlag *, string> > FlagChanges;
+
+// Re-reads the watched files that changed, and finds the flags whose
+// settings changed.  Returns false if none did.
+static bool FindChangedSettings(FlagChanges * changes)
+{
+    MutexLock l(&reload_lock); // one reload at a time
+    if (watched_flagfiles == NULL)
+        watched_flagfiles = new WatchedFlagfiles;
+    WatchedFlagfiles & files = *watched_flagfiles;
+    FlagfileIndex index;
+    for (size_t i = 0; i < files.size(); ++i)
+        index[files[i].filename] = i;
+    vector<string> top_level;
+    {
+        MutexLock m(&noted_flagfiles_lock);
+        if (noted_flagfiles != NULL)
+        {
+            for (vector<string>::const_iterator i = noted_flagfiles->begin(); i != noted_flagfiles->end(); ++i)
+            {
+                if (index.insert(make_pair(*i, files.size())).second)
+                    files.push_back(WatchedFlagfile(*i));
+            }
+            top_level = *noted_top_flagfiles;
+        }
+    }
+
+    // What's never been read is only read, to compare with later.
+    WatchedFlagfile::Settings unused;
+    for (size_t i = 0; i < files.size(); ++i)
+    {
+        RefreshWatchedFlagfile(&files[i], false, &unused);
+        WatchNestedFlagfiles(&files, &index, i);
+    }
+
+    // Re-read what changed, keeping the old settings for the comparison.
+    // A file first named by one that changed is read here, and had no
+    // settings before.
+    vector<WatchedFlagfile::Settings> old_settings;
+    vector<bool> changed;
+    bool any_changed = false;
+    for (size_t i = 0; i < files.size(); ++i)
+    {
+        old_settings.push_back(WatchedFlagfile::Settings());
+        changed.push_back(RefreshWatchedFlagfile(&files[i], true, &old_settings[i]));
+        any_changed = any_changed || changed[i];
+        WatchNestedFlagfiles(&files, &index, i);
+    }
+    if (!any_changed)
+        return false;
+
+    vector<const WatchedFlagfile::Settings *> settings_before, settings_after;
+    for (size_t i = 0; i < files.size(); ++i)
+    {
+        settings_before.push_back(changed[i] ? &old_settings[i] : &files[i].settings);
+        settings_after.push_back(&files[i].settings);
+    }
+    FlagSettingMap before, after;
+    CombineAllSettings(settings_before, index, top_level, &before);
+    CombineAllSettings(settings_after, index, top_level, &after);
+    for (FlagSettingMap::const_iterator i = after.begin(); i != after.end(); ++i)
+    {
+        FlagSettingMap::const_iterator old = before.find(i->first);
+        if (old == before.end() || *old->second != *i->second)
+            changes->push_back(make_pair(i->first, *i->second));
+    }
+    return !changes->empty();
+}
+
+int ReloadChangedFlagfiles()
+{
+    FlagChanges changes;
+    if (!FindChangedSettings(&changes))
+        return 0;
+
+    int num_set = 0;
+    FlagRegistry * const registry = FlagRegistry::GlobalRegistry();
+    FlagRegistryLock frl(registry);
+    for (FlagChanges::const_iterator i = changes.begin(); i != changes.end(); ++i)
+    {
+        string msg;
+        if (registry->SetFlagLocked(i->first, i->second.c_str(), SET_FLAGS_VALUE, &msg, false))
+            ++num_set;
+        else
+            LOG(WARNING) << "Ignoring the reloaded value of flag '" << i->first->name() << "': " << msg;
+    }
+    return num_set;
+}
+
+// --------------------------------------------------------------------
+// StartFlagfileReloader()
+// StopFlagfileReloader()
+//    The reloader thread waits on a condition variable, rather than
+//    sleeping, so that stopping it doesn't have to wait for the end of
+//    the interval.  Only with pthreads; other builds have to call
+//    ReloadChangedFlagfiles() (and SyncFlagsFromSegment()) themselves.
+// --------------------------------------------------------------------
+
+#if defined(HAVE_PTHREAD) && !defined(NO_THREADS)
+
+static pthread_mutex_t reloader_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t reloader_wakeup = PTHREAD_COND_INITIALIZER;
+static bool reloader_running = false;
+static bool reloader_stopping = false;
+static int32 reloader_interval_ms = 0;
+static pthread_t reloader_thread;
+
+static void * RunFlagfileReloader(void *)
+{
+    pthread_mutex_lock(&reloader_mutex);
+    while (!reloader_stopping)
+    {
+        struct timeval now;
+        gettimeofday(&now, NULL);
+        const int64 deadline_us = static_cast<int64>(now.tv_sec) * 1000000 + now.tv_usec + static_cast<int64>(reloader_interval_ms) * 1000;
+        struct timespec deadline;
+        deadline.tv_sec = static_cast<time_t>(deadline_us / 1000000);
+        deadline.tv_nsec = static_cast<long>(deadline_us % 1000000) * 1000;
+        pthread_cond_timedwait(&reloader_wakeup, &reloader_mutex, &deadline);
+        if (reloader_stopping)
+            break;
+        pthread_mutex_unlock(&reloader_mutex);
+        ReloadChangedFlagfiles();
+        SyncFlagsFromSegment();
+        pthread_mutex_lock(&reloader_mutex);
+    }
+    pthread_mutex_unlock(&reloader_mutex);
+    return NULL;
+}
+
+bool StartFlagfileReloader(int32 poll_interval_ms)
+{
+    ReloadChangedFlagfiles(); // read the files as they are now
+
+    pthread_mutex_lock(&reloader_mutex);
+    reloader_interval_ms = poll_interval_ms > 0 ? poll_interval_ms : 1;
+    bool ok = true;
+    if (!reloader_running)
+    {
+        reloader_stopping = false;
+        reloader_running = ok = (pthread_create(&reloader_thread, NULL, &RunFlagfileReloader, NULL) == 0);
+    }
+    pthread_mutex_unlock(&reloader_mutex);
+    return ok;
+}
+
+void StopFlagfileReloader()
+{
+    pthread_mutex_lock(&reloader_mutex);
+    const bool running = reloader_running;
+    reloader_stopping = true;
+    reloader_running = false;
+    pthread_cond_signal(&reloader_wakeup);
+    pthread_mutex_unlock(&reloader_mutex);
+    if (running)
+        pthread_join(reloader_thread, NULL);
+}
+
+#else // no threads
+
+bool StartFlagfileReloader(int32)
+{
+    return false;
+}
+
+void StopFlagfileReloader()
+{
+}
+
+#endif
+
+} // namespace JFLAGS_NAMESPACE
@@ -9,13 +9,16 @@
 #include "CommandLineFlagParser.h"
 
 #include <assert.h>
+#include <vector>
 
 namespace JFLAGS_NAMESPACE {
 
 using std::string;
+using std::vector;
 
 // --------------------------------------------------------------------
 // GetCommandLineOption()
+// GetCommandLineOptionInto()
 // GetCommandLineFlagInfo()
 // GetCommandLineFlagInfoOrDie()
 // SetCommandLineOption()
@@ -30,6 +33,9 @@ using std::string;
 //       For GetCommandLineOption, return false if no such flag
 //    is known, true otherwise.  We clear "value" if a suitable
 //    flag is found.
+//       The getters only take the registry lock shared, so readers
+//    don't serialize behind each other, only behind writers.  They
+//    see the values of the current overlay (see FlagOverlay.h).
 // --------------------------------------------------------------------
 
 bool GetCommandLineOption(const char * name, string * value)
@@ -39,13 +45,14 @@ bool GetCommandLineOption(const char * name, string * value)
     assert(value);
 
     FlagRegistry * const registry = FlagRegistry::GlobalRegistry();
-    FlagRegistryLock frl(registry);
+    FlagRegistryReaderLock frl(registry);
     CommandLineFlag * flag = registry->FindFlagLocked(name);
     if (flag == NULL)
         return false;
     else
     {
-        *value = flag->current_value();
+        NoteFlagRead(flag->name());
+        *value = VisibleValue(flag).ToString();
         return true;
     }
 }
@@ -55,18 +62,139 @@ bool GetCommandLineFlagInfo(const char * name, CommandLineFlagInfo * OUTPUT)
     if (NULL == name)
         return false;
     FlagRegistry * const registry = FlagRegistry::GlobalRegistry();
-    FlagRegistryLock frl(registry);
+    FlagRegistryReaderLock frl(registry);
     CommandLineFlag * flag = registry->FindFlagLocked(name);
     if (flag == NULL)
         return false;
     else
     {
         assert(OUTPUT);
+        NoteFlagRead(flag->name());
         flag->FillCommandLineFlagInfo(OUTPUT);
+        const FlagValue * const overlaid = OverlaidValue(flag);
+        if (overlaid != NULL)
+        {
+            OUTPUT->current_value = overlaid->ToString();
+            OUTPUT->is_default = false;
+        }
         return true;
     }
 }
 
+bool GetCommandLineFlagInfo(const char * name, CompactFlagInfo * OUTPUT)
+{
+    if (NULL == name)
+        return false;
+    FlagRegistry * const registry = FlagRegistry::GlobalRegistry();
+    FlagRegistryReaderLock frl(registry);
+    CommandLineFlag * flag = registry->FindFlagLocked(name);
+    if (flag == NULL)
+        return false;
+    else
+    {
+        assert(OUTPUT);
+        NoteFlagRead(flag->name());
+        flag->FillCompactFlagInfo(OUTPUT);
+        const FlagValue * const overlaid = OverlaidValue(flag);
+        if (overlaid != NULL)
+        {
+            OUTPUT->modified_value = overlaid->ToString();
+            OUTPUT->is_default = false;
+        }
+        return true;
+    }
+}
+
+bool GetCommandLineOptionInto(const char * name, char * buf, size_t size)
+{
+    if (NULL == name)
+        return false;
+    assert(buf || size == 0);
+
+    FlagRegistry * const registry = FlagRegistry::GlobalRegistry();
+    FlagRegistryReaderLock frl(registry);
+    CommandLineFlag * flag = registry->FindFlagLocked(name);
+    if (flag == NULL)
+        return false;
+    NoteFlagRead(flag->name());
+    return VisibleValue(flag).FormatInto(buf, size) < size;
+}
+
+// --------------------------------------------------------------------
+// GetFlagValue()
+// FlagHandle
+//    Typed reads of a flag by name, straight from the flag's
+//    FlagValue: no formatting, no parsing, no allocation (except for
+//    copying out a string flag, of course).
+// --------------------------------------------------------------------
+
+template <typename T>
+static bool GetFlagValueImpl(const char * name, T * OUTPUT)
+{
+    if (NULL == name)
+        return false;
+    assert(OUTPUT);
+
+    FlagRegistry * const registry = FlagRegistry::GlobalRegistry();
+    FlagRegistryReaderLock frl(registry);
+    CommandLineFlag * flag = registry->FindFlagLocked(name);
+    if (flag == NULL)
+        return false;
+    NoteFlagRead(flag->name());
+    return VisibleValue(flag).GetValue(OUTPUT);
+}
+
+bool GetFlagValue(const char * name, bool * OUTPUT) { return GetFlagValueImpl(name, OUTPUT); }
+bool GetFlagValue(const char * name, int32 * OUTPUT) { return GetFlagValueImpl(name, OUTPUT); }
+bool GetFlagValue(const char * name, uint32 * OUTPUT) { return GetFlagValueImpl(name, OUTPUT); }
+bool GetFlagValue(const char * name, int64 * OUTPUT) { return GetFlagValueImpl(name, OUTPUT); }
+bool GetFlagValue(const char * name, uint64 * OUTPUT) { return GetFlagValueImpl(name, OUTPUT); }
+bool GetFlagValue(const char * name, double * OUTPUT) { return GetFlagValueImpl(name, OUTPUT); }
+bool GetFlagValue(const char * name, string * OUTPUT) { return GetFlagValueImpl(name, OUTPUT); }
+bool GetFlagValue(const char * name, AtomicStringFlag::Snapshot * OUTPUT) { return GetFlagValueImpl(name, OUTPUT); }
+
+FlagHandle::FlagHandle(const char * name)
+: flag_(NULL)
+{
+    if (NULL == name)
+        return;
+    FlagRegistry * const registry = FlagRegistry::GlobalRegistry();
+    FlagRegistryReaderLock frl(registry);
+    flag_ = registry->FindFlagLocked(name);
+    if (flag_ != NULL)
+        NoteFlagRead(flag_->name()); // the reads through the handle aren't by name
+}
+
+template <typename T>
+static bool GetHandleValue(const CommandLineFlag * flag, T * OUTPUT)
+{
+    if (flag == NULL)
+        return false;
+    assert(OUTPUT);
+
+    FlagRegistryReaderLock frl(FlagRegistry::GlobalRegistry());
+    return VisibleValue(flag).GetValue(OUTPUT);
+}
+
+bool FlagHandle::Get(bool * OUTPUT) const { return GetHandleValue(flag_, OUTPUT); }
+bool FlagHandle::Get(int32 * OUTPUT) const { return GetHandleValue(flag_, OUTPUT); }
+bool FlagHandle::Get(uint32 * OUTPUT) const { return GetHandleValue(flag_, OUTPUT); }
+bool FlagHandle::Get(int64 * OUTPUT) const { return GetHandleValue(flag_, OUTPUT); }
+bool FlagHandle::Get(uint64 * OUTPUT) const { return GetHandleValue(flag_, OUTPUT); }
+bool FlagHandle::Get(double * OUTPUT) const { return GetHandleValue(flag_, OUTPUT); }
+bool FlagHandle::Get(string * OUTPUT) const { return GetHandleValue(flag_, OUTPUT); }
+bool FlagHandle::Get(AtomicStringFlag::Snapshot * OUTPUT) const { return GetHandleValue(flag_, OUTPUT); }
+
+bool FlagHandle::GetInto(char * buf, size_t size) const
+{
+    if (flag_ == NULL)
+        return false;
+    assert(buf || size == 0);
+
+    FlagRegistryReaderLock frl(FlagRegistry::GlobalRegistry());
+    return VisibleValue(flag_).FormatInto(buf, size) < size;
+}
+
 CommandLineFlagInfo GetCommandLineFlagInfoOrDie(const char * name)
 {
     CommandLineFlagInfo info;
@@ -86,7 +214,7 @@ string SetCommandLineOptionWithMode(const char * name, const char * value, FlagS
     CommandLineFlag * flag = registry->FindFlagLocked(name);
     if (flag)
     {
-        CommandLineFlagParser parser(registry);
+        CommandLineFlagParser parser(registry, true);
         result = parser.ProcessSingleOptionLocked(flag, value, set_mode);
         if (!result.empty())
         {
@@ -103,5 +231,107 @@ string SetCommandLineOption(const char * name, const char * value)
     return SetCommandLineOptionWithMode(name, value, SET_FLAGS_VALUE);
 }
 
+// --------------------------------------------------------------------
+// FlagTransaction
+//    Commit() makes two passes over the settings, both under the
+//    registry lock.  The first looks up, parses and validates each
+//    value into storage of its own, and gives up at the first error
+//    unless the caller wants all the messages; the second copies the
+//    values into the flags without validating them again, so that a
+//    validator that answers differently the second time (it looks at
+//    another flag of the batch, say) can't leave half of them set.
+// --------------------------------------------------------------------
+
+class FlagTransactionImpl
+{
+public:
+    struct Setting
+    {
+        string name;
+        string value;
+        FlagSettingMode set_mode;
+
+        // Filled in by the first pass of Commit().
+        CommandLineFlag * flag;
+        uint64 scalar_value; // for all the types but string
+        string string_value;
+
+        // Where the parsed value of the given type goes.
+        void * storage(FlagValue::ValueType type)
+        {
+            if (type == FlagValue::FV_STRING)
+                return &string_value;
+            return &scalar_value;
+        }
+    };
+    vector<Setting> settings;
+};
+
+FlagTransaction::FlagTransaction()
+: impl_(new FlagTransactionImpl)
+{
+}
+
+FlagTransaction::~FlagTransaction()
+{
+    delete impl_;
+}
+
+void FlagTransaction::Set(const char * name, const char * value, FlagSettingMode set_mode)
+{
+    assert(name && value);
+    impl_->settings.push_back(FlagTransactionImpl::Setting());
+    FlagTransactionImpl::Setting & setting = impl_->settings.back();
+    setting.name = name;
+    setting.value = value;
+    setting.set_mode = set_mode;
+    setting.flag = NULL;
+    setting.scalar_value = 0;
+}
+
+bool FlagTransaction::Commit(string * msg)
+{
+    if (msg)
+        msg->clear();
+    vector<FlagTransactionImpl::Setting> & settings = impl_->settings;
+    bool ok = true;
+    {
+        FlagRegistry * const registry = FlagRegistry::GlobalRegistry();
+        FlagRegistryLock frl(registry);
+
+        vector<FlagTransactionImpl::Setting>::iterator it;
+        for (it = settings.begin(); it != settings.end() && (ok || msg); ++it)
+        {
+            it->flag = registry->FindFlagLocked(it->name.c_str());
+            if (it->flag == NULL)
+            {
+                if (msg)
+                    StringAppendF(msg, "%sunknown command line flag '%s'\n", kError, it->name.c_str());
+                ok = false;
+                continue;
+            }
+            const FlagValue::ValueType type = it->flag->current().type();
+            FlagValue parsed(it->storage(type), type, false);
+            if (!TryParseLocked(it->flag, &parsed, it->value.c_str(), msg, false))
+                ok = false;
+        }
+
+        if (ok)
+        {
+            for (it = settings.begin(); it != settings.end(); ++it)
+            {
+                const FlagValue::ValueType type = it->flag->current().type();
+                const FlagValue parsed(it->storage(type), type, false);
+                string set_msg;
+                registry->SetValidatedFlagLocked(it->flag, parsed, it->set_mode, msg ? &set_msg : NULL);
+                if (msg)
+                    *msg += set_msg;
+            }
+        }
+    }
+    settings.clear();
+    return ok;
+}
+
 } // namespace JFLAGS_NAMESPACE
 
@@ -0,0 +1,240 @@
+////////////////////////////////////////////////////////////////////////////////
+//                                    jflags
+//
+// This file is distributed under the 3-clause Berkeley Software Distribution
+// License. See LICENSE.txt for details.
+////////////////////////////////////////////////////////////////////////////////
+#include "jflags_atomic.h"
+#include "FlagValue.h"
+#include "mutex.h"
+#include "util.h"
+
+#include <string>
+#if defined(OS_WINDOWS)
+#include <windows.h>
+#elif defined(HAVE_PTHREAD)
+#include <sched.h>
+#endif
+
+using namespace MUTEX_NAMESPACE;
+
+namespace JFLAGS_NAMESPACE {
+
+using std::string;
+
+// --------------------------------------------------------------------
+// The few read-modify-write operations that AtomicStringFlag needs,
+// all of them sequentially consistent.
+// --------------------------------------------------------------------
+
+namespace {
+
+#if defined(__ATOMIC_SEQ_CST) // gcc >= 4.7, clang
+
+inline int32 Load(const int32 * p) { return __atomic_load_n(p, __ATOMIC_SEQ_CST); }
+inline void Store(int32 * p, int32 value) { __atomic_store_n(p, value, __ATOMIC_SEQ_CST); }
+inline int32 Add(int32 * p, int32 increment) { return __atomic_add_fetch(p, increment, __ATOMIC_SEQ_CST); }
+inline SharedFlagString * Load(SharedFlagString * const * p) { return __atomic_load_n(p, __ATOMIC_SEQ_CST); }
+inline SharedFlagString * Exchange(SharedFlagString ** p, SharedFlagString * value) { return __atomic_exchange_n(p, value, __ATOMIC_SEQ_CST); }
+
+#elif defined(__GNUC__)
+
+inline int32 Load(const int32 * p) { return __sync_add_and_fetch(const_cast<int32 *>(p), 0); }
+inline void Store(int32 * p, int32 value) { __sync_synchronize(); *static_cast<volatile int32 *>(p) = value; __sync_synchronize(); }
+inline int32 Add(int32 * p, int32 increment) { return __sync_add_and_fetch(p, increment); }
+inline SharedFlagString * Load(SharedFlagString * const * p) { return __sync_val_compare_and_swap(const_cast<SharedFlagString **>(p), NULL, NULL); }
+inline SharedFlagString * Exchange(SharedFlagString ** p, SharedFlagString * value)
+{
+    __sync_synchronize(); // __sync_lock_test_and_set() is only an acquire barrier
+    return __sync_lock_test_and_set(p, value);
+}
+
+#elif defined(_MSC_VER)
+
+inline int32 Load(const int32 * p) { return _InterlockedCompareExchange(reinterpret_cast<volatile long *>(const_cast<int32 *>(p)), 0, 0); }
+inline void Store(int32 * p, int32 value) { _InterlockedExchange(reinterpret_cast<volatile long *>(p), value); }
+inline int32 Add(int32 * p, int32 increment) { return _InterlockedExchangeAdd(reinterpret_cast<volatile long *>(p), increment) + increment; }
+inline SharedFlagString * Load(SharedFlagString * const * p)
+{
+    return static_cast<SharedFlagString *>(_InterlockedCompareExchangePointer(reinterpret_cast<void * volatile *>(const_cast<SharedFlagString **>(p)), NULL, NULL));
+}
+inline SharedFlagString * Exchange(SharedFlagString ** p, SharedFlagString * value)
+{
+    return static_cast<SharedFlagString *>(_InterlockedExchangePointer(reinterpret_cast<void * volatile *>(p), value));
+}
+
+#else
+#error Do not know how to do atomic operations with your compiler
+#endif
+
+// Lets the readers that are in the middle of taking a snapshot go on.
+inline void YieldToReaders()
+{
+#if defined(OS_WINDOWS)
+    SwitchToThread();
+#elif defined(HAVE_PTHREAD)
+    sched_yield();
+#endif
+}
+
+// What a snapshot of a flag that's not been published yet reads as.
+// A function, for it to be there even in global constructors.
+const string & EmptyString()
+{
+    static const string empty;
+    return empty;
+}
+
+} // namespace
+
+// --------------------------------------------------------------------
+// SharedFlagString
+//    A value of an atomic string flag, or of a copy of a string flag
+//    (see FlagValue::shared_).  The flag owns one reference to the
+//    value it publishes, and each snapshot of it one more.  The value
+//    never changes once it's shared.
+// --------------------------------------------------------------------
+
+struct SharedFlagString
+{
+    explicit SharedFlagString(const string & v) : refs(1), value(v) {}
+
+    int32 refs;
+    string value;
+};
+
+static void Ref(SharedFlagString * shared)
+{
+    if (shared != NULL)
+        Add(&shared->refs, 1);
+}
+
+static void Unref(SharedFlagString * shared)
+{
+    if (shared != NULL && Add(&shared->refs, -1) == 0)
+        delete shared;
+}
+
+string * SharedFlagStringValue(SharedFlagString * shared)
+{
+    return &shared->value;
+}
+
+void RefSharedFlagString(SharedFlagString * shared)
+{
+    Ref(shared);
+}
+
+void UnrefSharedFlagString(SharedFlagString * shared)
+{
+    Unref(shared);
+}
+
+// --------------------------------------------------------------------
+// ShareFlagString()
+//    Several readers may share the value of the same flag at once,
+//    under the registry's reader lock, so they only look at *cache,
+//    and replace it, under share_lock: a reader takes its reference to
+//    the cached value there, before comparing it, so the one that
+//    replaces it can let go of the old value right away.  The values
+//    are compared, and copied, outside the lock.
+// --------------------------------------------------------------------
+
+static Mutex share_lock(Mutex::LINKER_INITIALIZED);
+
+SharedFlagString * ShareFlagString(SharedFlagString ** cache, const string & value)
+{
+    SharedFlagString * cached;
+    {
+        MutexLock l(&share_lock);
+        cached = *cache;
+        Ref(cached);
+    }
+    if (cached != NULL && cached->value == value)
+        return cached;
+    Unref(cached);
+
+    SharedFlagString * const copy = new SharedFlagString(value); // the caller's reference
+    Ref(copy);                                                    // and the cache's
+    SharedFlagString * replaced;
+    {
+        MutexLock l(&share_lock);
+        replaced = *cache;
+        *cache = copy;
+    }
+    Unref(replaced);
+    return copy;
+}
+
+// --------------------------------------------------------------------
+// AtomicStringFlag::load()
+// PublishAtomicString()
+//    A reader counts itself in the current epoch, then takes a
+//    reference to published_.  If the epoch ended between its looking
+//    at it and counting itself, the writer might not wait for it, so
+//    it counts itself in the new epoch instead.  The writer replaces
+//    published_ first, then ends the epoch: the readers of the new
+//    epoch can only see the new value, so once the count of the old
+//    epoch drops to zero, nobody is left to take a reference to the
+//    old value but its own snapshots.
+// --------------------------------------------------------------------
+
+AtomicStringFlag::Snapshot::Snapshot()
+: shared_(NULL), value_(&EmptyString())
+{
+}
+
+AtomicStringFlag::Snapshot::Snapshot(SharedFlagString * shared)
+: shared_(shared), value_(shared != NULL ? &shared->value : &EmptyString())
+{
+}
+
+AtomicStringFlag::Snapshot::Snapshot(const Snapshot & other)
+: shared_(other.shared_), value_(other.value_)
+{
+    Ref(shared_);
+}
+
+AtomicStringFlag::Snapshot::~Snapshot()
+{
+    Unref(shared_);
+}
+
+AtomicStringFlag::Snapshot & AtomicStringFlag::Snapshot::operator=(const Snapshot & other)
+{
+    Ref(other.shared_); // first, in case it's the same value
+    Unref(shared_);
+    shared_ = other.shared_;
+    value_ = other.value_;
+    return *this;
+}
+
+AtomicStringFlag::Snapshot AtomicStringFlag::load() const
+{
+    int32 epoch = Load(&epoch_);
+    for (;;)
+    {
+        Add(&readers_[epoch], 1);
+        const int32 now = Load(&epoch_);
+        if (now == epoch)
+            break;
+        Add(&readers_[epoch], -1);
+        epoch = now;
+    }
+    SharedFlagString * shared = Load(&published_);
+    Ref(shared);
+    Add(&readers_[epoch], -1);
+    return Snapshot(shared);
+}
+
+void PublishAtomicString(AtomicStringFlag * flag, SharedFlagString * value)
+{
+    SharedFlagString * old = Exchange(&flag->published_, value);
+    const int32 epoch = Load(&flag->epoch_);
+    Store(&flag->epoch_, epoch ^ 1);
+    while (Load(&flag->readers_[epoch]) != 0)
+        YieldToReaders();
+    Unref(old);
+}
+
+} // namespace JFLAGS_NAMESPACE
@@ -29,15 +29,15 @@
 #include <stdlib.h>
 #include <string.h> // for strlen
 
-#include <set>
+#include <algorithm>
 #include <string>
 #include <utility>
 #include <vector>
 
 #include "jflags.h"
+#include "FlagRegistry.h"
 #include "util.h"
 
-using std::set;
 using std::string;
 using std::vector;
 
@@ -47,6 +47,11 @@ DEFINE_string(tab_completion_word, "",
               "completion on this value.");
 DEFINE_int32(tab_completion_columns, 80,
              "Number of columns to use in output for tab completion");
+DEFINE_string(tab_completion_export, "",
+              "If non-empty, HandleCommandLineCompletions() will hijack the "
+              "process and write an index of the flags to this file, for "
+              "jflags_completions.sh to complete from without running the "
+              "binary.");
 
 namespace JFLAGS_NAMESPACE {
 namespace {
@@ -56,6 +61,11 @@ namespace {
 struct CompletionOptions;
 struct NotableFlags;
 
+// Flags to complete, in the order of GetAllFlags().  These point into
+// a vector of CommandLineFlagInfos in that same order, so they're
+// sorted by address too.
+typedef vector<const CommandLineFlagInfo *> FlagSet;
+
 // The entry point if flag completion is to be used.
 static void PrintFlagCompletionInfo(void);
 
@@ -65,32 +75,41 @@ static void CanonicalizeCursorWordAndSearchOptions(const string & cursor_word, s
 static bool RemoveTrailingChar(string * str, char c);
 
 // 2) Find all matches
-static void FindMatchingFlags(const vector<CommandLineFlagInfo> & all_flags,
-                              const CompletionOptions & options,
+static void FindMatchingFlags(const CompletionOptions & options,
                               const string & match_token,
-                              set<const CommandLineFlagInfo *> * all_matches,
+                              vector<CommandLineFlagInfo> * all_matches,
                               string * longest_common_prefix);
 
-static bool DoesSingleFlagMatch(const CommandLineFlagInfo & flag, const CompletionOptions & options, const string & match_token);
+static bool DoesSingleFlagMatch(const CommandLineFlag & flag, const CompletionOptions & options, const string & match_token);
 
 // 3) Categorize matches
-static void CategorizeAllMatchingFlags(const set<const CommandLineFlagInfo *> & all_matches,
+static void CategorizeAllMatchingFlags(const FlagSet & all_matches,
                                        const string & search_token, const string & module,
                                        const string & package_dir,
                                        NotableFlags * notable_flags);
 
-static void TryFindModuleAndPackageDir(const vector<CommandLineFlagInfo> & all_flags, string * module, string * package_dir);
+static void TryFindModuleAndPackageDir(string * module, string * package_dir);
+
+enum FlagLocation
+{
+    FLAG_IN_MODULE,
+    FLAG_IN_PACKAGE,
+    FLAG_IN_SUBPACKAGE,
+    FLAG_ELSEWHERE
+};
+
+static FlagLocation LocateFlag(const string & filename, const string & module, const string & package_dir);
 
 // 4) Decide which flags to use
-static void FinalizeCompletionOutput(const set<const CommandLineFlagInfo *> & matching_flags,
+static void FinalizeCompletionOutput(const FlagSet & matching_flags,
                                      CompletionOptions * options,
                                      NotableFlags * notable_flags,
                                      vector<string> * completions);
 
-static void RetrieveUnusedFlags(const set<const CommandLineFlagInfo *> & matching_flags, const NotableFlags & notable_flags, set<const CommandLineFlagInfo *> * unused_flags);
+static void RetrieveUnusedFlags(const FlagSet & matching_flags, const NotableFlags & notable_flags, FlagSet * unused_flags);
 
 // 5) Output matches
-static void OutputSingleGroupWithLimit(const set<const CommandLineFlagInfo *> & group,
+static void OutputSingleGroupWithLimit(const FlagSet & group,
                                        const string & line_indentation, const string & header, const string & footer,
                                        bool long_output_format, int * remaining_line_limit,
                                        size_t * completion_elements_added, vector<string> * completions);
@@ -132,7 +151,6 @@ struct CompletionOptions
 // be placed in any of the 'lower' sets.
 struct NotableFlags
 {
-    typedef set<const CommandLineFlagInfo *> FlagSet;
     FlagSet perfect_match_flag;
     FlagSet module_flags;      // Found in module file
     FlagSet package_flags;     // Found in same directory as module file
@@ -151,14 +169,10 @@ static void PrintFlagCompletionInfo(void)
 
     DVLOG(1) << "Identified canonical_token: '" << canonical_token << "'";
 
-    vector<CommandLineFlagInfo> all_flags;
-    set<const CommandLineFlagInfo *> matching_flags;
-    GetAllFlags(&all_flags);
-    DVLOG(2) << "Found " << all_flags.size() << " flags overall";
-
+    vector<CommandLineFlagInfo> matching_infos;
     string longest_common_prefix;
-    FindMatchingFlags(all_flags, options, canonical_token, &matching_flags, &longest_common_prefix);
-    DVLOG(1) << "Identified " << matching_flags.size() << " matching flags";
+    FindMatchingFlags(options, canonical_token, &matching_infos, &longest_common_prefix);
+    DVLOG(1) << "Identified " << matching_infos.size() << " matching flags";
     DVLOG(1) << "Identified " << longest_common_prefix << " as longest common prefix.";
     if (longest_common_prefix.size() > canonical_token.size())
     {
@@ -170,15 +184,18 @@ static void PrintFlagCompletionInfo(void)
         fprintf(stdout, "--%s", longest_common_prefix.c_str());
         return;
     }
-    if (matching_flags.empty())
+    if (matching_infos.empty())
     {
         VLOG(1) << "There were no matching flags, returning nothing.";
         return;
     }
+    FlagSet matching_flags;
+    for (vector<CommandLineFlagInfo>::const_iterator it = matching_infos.begin(); it != matching_infos.end(); ++it)
+        matching_flags.push_back(&*it);
 
     string module;
     string package_dir;
-    TryFindModuleAndPackageDir(all_flags, &module, &package_dir);
+    TryFindModuleAndPackageDir(&module, &package_dir);
     DVLOG(1) << "Identified module: '" << module << "'";
     DVLOG(1) << "Identified package_dir: '" << package_dir << "'";
 
@@ -271,61 +288,97 @@ static bool RemoveTrailingChar(string * str, char c)
 }
 
 // 2) Find all matches (and helper methods)
-static void FindMatchingFlags(const vector<CommandLineFlagInfo> & all_flags,
-                              const CompletionOptions & options,
+
+// Orders flags by name, or (name) prefix: the flags whose names start
+// with a prefix are a range of the flags sorted by name.
+struct FlagNamePrefixLess
+{
+    bool operator()(const CommandLineFlag * flag, const string & prefix) const { return strncmp(flag->name(), prefix.c_str(), prefix.size()) < 0; }
+    bool operator()(const string & prefix, const CommandLineFlag * flag) const { return strncmp(prefix.c_str(), flag->name(), prefix.size()) < 0; }
+};
+
+// The order of GetAllFlags().
+struct FlagFilenameLess
+{
+    bool operator()(const CommandLineFlag * a, const CommandLineFlag * b) const
+    {
+        int cmp = strcmp(a->CleanFileName(), b->CleanFileName());
+        if (cmp == 0)
+            cmp = strcmp(a->name(), b->name());
+        return cmp < 0;
+    }
+};
+
+// Finds the flags that match, and the longest prefix common to all of
+// their names.  A plain prefix search only binary-searches the flags
+// for its range; the others look at every flag.  The infos of the
+// flags are only filled in when they're needed: when the common prefix
+// isn't longer than match_token, else it's all bash is told.
+static void FindMatchingFlags(const CompletionOptions & options,
                               const string & match_token,
-                              set<const CommandLineFlagInfo *> * all_matches,
+                              vector<CommandLineFlagInfo> * all_matches,
                               string * longest_common_prefix)
 {
     all_matches->clear();
-    bool first_match = true;
-    for (vector<CommandLineFlagInfo>::const_iterator it = all_flags.begin(); it != all_flags.end(); ++it)
+    longest_common_prefix->clear();
+    FlagRegistry * const registry = FlagRegistry::GlobalRegistry();
+    FlagRegistryReaderLock frl(registry);
+    const FlagRegistry::FlagList & by_name = registry->SortedByNameFlagsLocked();
+
+    FlagRegistry::FlagList matches;
+    if (!options.flag_name_substring_search)
     {
-        if (DoesSingleFlagMatch(*it, options, match_token))
+        matches.assign(lower_bound(by_name.begin(), by_name.end(), match_token, FlagNamePrefixLess()),
+                       upper_bound(by_name.begin(), by_name.end(), match_token, FlagNamePrefixLess()));
+    }
+    else
+    {
+        for (FlagRegistry::FlagList::const_iterator it = by_name.begin(); it != by_name.end(); ++it)
         {
-            all_matches->insert(&*it);
-            if (first_match)
-            {
-                first_match = false;
-                *longest_common_prefix = it->name;
-            }
-            else
-            {
-                if (longest_common_prefix->empty() || it->name.empty())
-                {
-                    longest_common_prefix->clear();
-                    continue;
-                }
-                string::size_type pos = 0;
-                while (pos < longest_common_prefix->size() && pos < it->name.size() && (*longest_common_prefix)[pos] == it->name[pos])
-                    ++pos;
-                longest_common_prefix->erase(pos);
-            }
+            if (DoesSingleFlagMatch(**it, options, match_token))
+                matches.push_back(*it);
         }
     }
+    if (matches.empty())
+        return;
+
+    // Sorted by name, the prefix common to all is the one of the first
+    // and the last.
+    const char * const first = matches.front()->name();
+    const char * const last = matches.back()->name();
+    size_t pos = 0;
+    while (first[pos] != '\0' && first[pos] == last[pos])
+        ++pos;
+    longest_common_prefix->assign(first, pos);
+    if (longest_common_prefix->size() > match_token.size())
+        return;
+
+    sort(matches.begin(), matches.end(), FlagFilenameLess());
+    all_matches->resize(matches.size());
+    for (size_t i = 0; i < matches.size(); ++i)
+        matches[i]->FillCommandLineFlagInfo(&(*all_matches)[i]);
 }
 
-// Given the set of all flags, the parsed match options, and the
-// canonical search token, produce the set of all candidate matching
-// flags for subsequent analysis or filtering.
-static bool DoesSingleFlagMatch(const CommandLineFlagInfo & flag, const CompletionOptions & options, const string & match_token)
+// Given a flag, the parsed match options, and the canonical search
+// token, tells whether the flag is a candidate for subsequent
+// analysis or filtering.
+static bool DoesSingleFlagMatch(const CommandLineFlag & flag, const CompletionOptions & options, const string & match_token)
 {
     // Is there a prefix match?
-    string::size_type pos = flag.name.find(match_token);
-    if (pos == 0)
+    if (strncmp(flag.name(), match_token.c_str(), match_token.size()) == 0)
         return true;
 
     // Is there a substring match if we want it?
-    if (options.flag_name_substring_search && pos != string::npos)
+    if (options.flag_name_substring_search && strstr(flag.name(), match_token.c_str()) != NULL)
         return true;
 
     // Is there a location match if we want it?
-    if (options.flag_location_substring_search && flag.filename.find(match_token) != string::npos)
+    if (options.flag_location_substring_search && strstr(flag.CleanFileName(), match_token.c_str()) != NULL)
         return true;
 
     // TODO(user): All searches should probably be case-insensitive
     // (especially this one...)
-    if (options.flag_description_substring_search && flag.description.find(match_token) != string::npos)
+    if (options.flag_description_substring_search && strstr(flag.help(), match_token.c_str()) != NULL)
         return true;
 
     return false;
@@ -335,7 +388,7 @@ static bool DoesSingleFlagMatch(const CommandLineFlagInfo & flag, const Completi
 
 // Given a set of matching flags, categorize them by
 // likely relevence to this specific binary
-static void CategorizeAllMatchingFlags(const set<const CommandLineFlagInfo *> & all_matches,
+static void CategorizeAllMatchingFlags(const FlagSet & all_matches,
                                        const string & search_token,
                                        const string & module,      // empty if we couldn't find any
                                        const string & package_dir, // empty if we couldn't find any
@@ -347,33 +400,28 @@ static void CategorizeAllMatchingFlags(const set<const CommandLineFlagInfo *> &
     notable_flags->most_common_flags.clear();
     notable_flags->subpackage_flags.clear();
 
-    for (set<const CommandLineFlagInfo *>::const_iterator it = all_matches.begin(); it != all_matches.end(); ++it)
+    for (FlagSet::const_iterator it = all_matches.begin(); it != all_matches.end(); ++it)
     {
         DVLOG(2) << "Examining match '" << (*it)->name << "'";
         DVLOG(7) << "  filename: '" << (*it)->filename << "'";
-        string::size_type pos = string::npos;
-        if (!package_dir.empty())
-            pos = (*it)->filename.find(package_dir);
-        string::size_type slash = string::npos;
-        if (pos != string::npos) // candidate for package or subpackage match
-            slash = (*it)->filename.find(PATH_SEPARATOR, pos + package_dir.size() + 1);
+        const FlagLocation location = LocateFlag((*it)->filename, module, package_dir);
 
         if ((*it)->name == search_token)
         {
             // Exact match on some flag's name
-            notable_flags->perfect_match_flag.insert(*it);
+            notable_flags->perfect_match_flag.push_back(*it);
             DVLOG(3) << "Result: perfect match";
         }
-        else if (!module.empty() && (*it)->filename == module)
+        else if (location == FLAG_IN_MODULE)
         {
             // Exact match on module filename
-            notable_flags->module_flags.insert(*it);
+            notable_flags->module_flags.push_back(*it);
             DVLOG(3) << "Result: module match";
         }
-        else if (!package_dir.empty() && pos != string::npos && slash == string::npos)
+        else if (location == FLAG_IN_PACKAGE)
         {
             // In the package, since there was no slash after the package portion
-            notable_flags->package_flags.insert(*it);
+            notable_flags->package_flags.push_back(*it);
             DVLOG(3) << "Result: package match";
         }
         else if (false)
@@ -382,10 +430,10 @@ static void CategorizeAllMatchingFlags(const set<const CommandLineFlagInfo *> &
             // TODO(user): Compile this list.
             DVLOG(3) << "Result: most-common match";
         }
-        else if (!package_dir.empty() && pos != string::npos && slash != string::npos)
+        else if (location == FLAG_IN_SUBPACKAGE)
         {
             // In a subdirectory of the package
-            notable_flags->subpackage_flags.insert(*it);
+            notable_flags->subpackage_flags.push_back(*it);
             DVLOG(3) << "Result: subpackage match";
         }
 
@@ -393,12 +441,29 @@ static void CategorizeAllMatchingFlags(const set<const CommandLineFlagInfo *> &
     }
 }
 
+// Where filename is, relative to the module and the package directory
+// of the binary, which are empty if they couldn't be found.
+static FlagLocation LocateFlag(const string & filename, const string & module, const string & package_dir)
+{
+    if (!module.empty() && filename == module)
+        return FLAG_IN_MODULE;
+    string::size_type pos = string::npos;
+    if (!package_dir.empty())
+        pos = filename.find(package_dir);
+    if (pos == string::npos)
+        return FLAG_ELSEWHERE;
+    // In the package if there's no slash after the package portion
+    if (filename.find(PATH_SEPARATOR, pos + package_dir.size() + 1) == string::npos)
+        return FLAG_IN_PACKAGE;
+    return FLAG_IN_SUBPACKAGE;
+}
+
 static void PushNameWithSuffix(vector<string> * suffixes, const char * suffix)
 {
     suffixes->push_back(StringPrintf("/%s%s", ProgramInvocationShortName(), suffix));
 }
 
-static void TryFindModuleAndPackageDir(const vector<CommandLineFlagInfo> & all_flags, string * module, string * package_dir)
+static void TryFindModuleAndPackageDir(string * module, string * package_dir)
 {
     module->clear();
     package_dir->clear();
@@ -417,16 +482,20 @@ static void TryFindModuleAndPackageDir(const vector<CommandLineFlagInfo> & all_f
     PushNameWithSuffix(&suffixes, "-unittest.");
     PushNameWithSuffix(&suffixes, "_unittest.");
 
-    for (vector<CommandLineFlagInfo>::const_iterator it = all_flags.begin(); it != all_flags.end(); ++it)
+    FlagRegistry * const registry = FlagRegistry::GlobalRegistry();
+    FlagRegistryReaderLock frl(registry);
+    const FlagRegistry::FlagList & flags = registry->SortedByFileFlagsLocked();
+    for (FlagRegistry::FlagList::const_iterator it = flags.begin(); it != flags.end(); ++it)
     {
+        const string filename = (*it)->CleanFileName();
         for (vector<string>::const_iterator suffix = suffixes.begin(); suffix != suffixes.end(); ++suffix)
         {
             // TODO(user): Make sure the match is near the end of the string
-            if (it->filename.find(*suffix) != string::npos)
+            if (filename.find(*suffix) != string::npos)
             {
-                *module = it->filename;
-                string::size_type sep = it->filename.rfind(PATH_SEPARATOR);
-                *package_dir = it->filename.substr(0, (sep == string::npos) ? 0 : sep);
+                *module = filename;
+                string::size_type sep = filename.rfind(PATH_SEPARATOR);
+                *package_dir = filename.substr(0, (sep == string::npos) ? 0 : sep);
                 return;
             }
         }
@@ -438,7 +507,7 @@ struct DisplayInfoGroup
 {
     const char * header;
     const char * footer;
-    set<const CommandLineFlagInfo *> * group;
+    FlagSet * group;
 
     int SizeInLines() const
     {
@@ -452,7 +521,7 @@ struct DisplayInfoGroup
 };
 
 // 4) Finalize and trim output flag set
-static void FinalizeCompletionOutput(const set<const CommandLineFlagInfo *> & matching_flags,
+static void FinalizeCompletionOutput(const FlagSet & matching_flags,
                                      CompletionOptions * options,
                                      NotableFlags * notable_flags,
                                      vector<string> * completions)
@@ -503,7 +572,7 @@ static void FinalizeCompletionOutput(const set<const CommandLineFlagInfo *> & ma
         output_groups.push_back(group);
     }
 
-    set<const CommandLineFlagInfo *> obscure_flags; // flags not notable
+    FlagSet obscure_flags; // flags not notable
     if (lines_so_far < max_desired_lines)
     {
         RetrieveUnusedFlags(matching_flags, *notable_flags, &obscure_flags);
@@ -545,21 +614,25 @@ static void FinalizeCompletionOutput(const set<const CommandLineFlagInfo *> & ma
     }
 }
 
-static void RetrieveUnusedFlags(const set<const CommandLineFlagInfo *> & matching_flags, const NotableFlags & notable_flags, set<const CommandLineFlagInfo *> * unused_flags)
+static void RetrieveUnusedFlags(const FlagSet & matching_flags, const NotableFlags & notable_flags, FlagSet * unused_flags)
 {
     // Remove from 'matching_flags' set all members of the sets of
     // flags we've already printed (specifically, those in notable_flags)
-    for (set<const CommandLineFlagInfo *>::const_iterator it = matching_flags.begin(); it != matching_flags.end(); ++it)
+    for (FlagSet::const_iterator it = matching_flags.begin(); it != matching_flags.end(); ++it)
     {
-        if (notable_flags.perfect_match_flag.count(*it) || notable_flags.module_flags.count(*it) || notable_flags.package_flags.count(*it) || notable_flags.most_common_flags.count(*it) || notable_flags.subpackage_flags.count(*it))
+        if (binary_search(notable_flags.perfect_match_flag.begin(), notable_flags.perfect_match_flag.end(), *it) ||
+            binary_search(notable_flags.module_flags.begin(), notable_flags.module_flags.end(), *it) ||
+            binary_search(notable_flags.package_flags.begin(), notable_flags.package_flags.end(), *it) ||
+            binary_search(notable_flags.most_common_flags.begin(), notable_flags.most_common_flags.end(), *it) ||
+            binary_search(notable_flags.subpackage_flags.begin(), notable_flags.subpackage_flags.end(), *it))
             continue;
-        unused_flags->insert(*it);
+        unused_flags->push_back(*it);
     }
 }
 
 // 5) Output matches (and helper methods)
 
-static void OutputSingleGroupWithLimit(const set<const CommandLineFlagInfo *> & group,
+static void OutputSingleGroupWithLimit(const FlagSet & group,
                                        const string & line_indentation, const string & header, const string & footer,
                                        bool long_output_format, int * remaining_line_limit,
                                        size_t * completion_elements_output, vector<string> * completions)
@@ -574,7 +647,7 @@ static void OutputSingleGroupWithLimit(const set<const CommandLineFlagInfo *> &
         completions->push_back(line_indentation + header);
         completions->push_back(line_indentation + string(header.size(), '-'));
     }
-    for (set<const CommandLineFlagInfo *>::const_iterator it = group.begin(); it != group.end() && *remaining_line_limit > 0; ++it)
+    for (FlagSet::const_iterator it = group.begin(); it != group.end() && *remaining_line_limit > 0; ++it)
     {
         --*remaining_line_limit;
         ++*completion_elements_output;
@@ -634,10 +707,76 @@ static string GetLongFlagLine(const string & line_indentation, const CommandLine
     }
     return output;
 }
+
+// The completion index
+//
+// What jflags_completions.sh needs to complete a plain prefix without
+// running the binary: a first line naming the format, comment lines
+// with the module and package directory, then one line per flag, in
+// the order of GetAllFlags(), of tab-separated fields:
+//    name  location  type  default  description
+// where location is one of module, package, subpackage or other.
+// Tabs and line breaks in the fields are written as spaces.
+static const char kCompletionIndexFormat[] = "jflags-completions 1";
+
+static void AppendIndexField(string * line, const char * field)
+{
+    line->push_back('\t');
+    for (const char * p = field; *p != '\0'; ++p)
+        line->push_back(*p == '\t' || *p == '\n' || *p == '\r' ? ' ' : *p);
+}
+
+static bool ExportCompletionIndex(const string & filename)
+{
+    static const char * const kLocationNames[] = { "module", "package", "subpackage", "other" };
+
+    string module;
+    string package_dir;
+    TryFindModuleAndPackageDir(&module, &package_dir);
+
+    string index = StringPrintf("%s\n# module: %s\n# package: %s\n", kCompletionIndexFormat, module.c_str(), package_dir.c_str());
+    {
+        FlagRegistry * const registry = FlagRegistry::GlobalRegistry();
+        FlagRegistryReaderLock frl(registry);
+        const FlagRegistry::FlagList & flags = registry->SortedByFileFlagsLocked();
+        for (FlagRegistry::FlagList::const_iterator it = flags.begin(); it != flags.end(); ++it)
+        {
+            const CommandLineFlag & flag = **it;
+            index.append(flag.name());
+            AppendIndexField(&index, kLocationNames[LocateFlag(flag.CleanFileName(), module, package_dir)]);
+            AppendIndexField(&index, flag.type_name());
+            AppendIndexField(&index, flag.default_value().c_str());
+            AppendIndexField(&index, flag.help());
+            index.push_back('\n');
+        }
+    }
+
+    // Written aside and renamed, so the script never reads half an index.
+    const string tmp_filename = filename + ".tmp";
+    FILE * fp;
+    if (SafeFOpen(&fp, tmp_filename.c_str(), "w") != 0)
+        return false;
+    const bool written = fwrite(index.data(), 1, index.size(), fp) == index.size();
+    if (fclose(fp) != 0 || !written)
+        return false;
+#ifdef OS_WINDOWS
+    remove(filename.c_str()); // rename() doesn't replace files there
+#endif
+    return rename(tmp_filename.c_str(), filename.c_str()) == 0;
+}
 } // anonymous
 
 void HandleCommandLineCompletions(void)
 {
+    if (!FLAGS_tab_completion_export.empty())
+    {
+        if (!ExportCompletionIndex(FLAGS_tab_completion_export))
+        {
+            fprintf(stderr, "ERROR: can't write the completion index '%s'\n", FLAGS_tab_completion_export.c_str());
+            jflags_exitfunc(1);
+        }
+        jflags_exitfunc(0);
+    }
     if (FLAGS_tab_completion_word.empty())
         return;
     PrintFlagCompletionInfo();
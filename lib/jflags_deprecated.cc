@@ -9,6 +9,7 @@
 #include "FlagSaver.h"
 #include "FlagRegistry.h"
 #include "CommandLineFlagParser.h"
+#include "Flagfile.h"
 
 #include <string>
 
@@ -16,8 +17,6 @@ namespace JFLAGS_NAMESPACE {
 
 using std::string;
 
-string ReadFileIntoString(const char * filename);
-
 // --------------------------------------------------------------------
 // CommandlineFlagsIntoString()
 // ReadFlagsFromString()
@@ -55,23 +54,34 @@ static string TheseCommandlineFlagsIntoString(const vector<CommandLineFlagInfo>
     return retval;
 }
 
+namespace {
+class StringFlagSink : public FlagSink
+{
+public:
+    explicit StringFlagSink(string * output) : output_(output) {}
+    virtual void Write(const char * data, size_t size) { output_->append(data, size); }
+
+private:
+    string * const output_;
+};
+} // namespace
+
 string CommandlineFlagsIntoString()
 {
-    vector<CommandLineFlagInfo> sorted_flags;
-    GetAllFlags(&sorted_flags);
-    return TheseCommandlineFlagsIntoString(sorted_flags);
+    string retval;
+    StringFlagSink sink(&retval);
+    WriteAllFlags(&sink);
+    return retval;
 }
 
-bool ReadFlagsFromString(const string & flagfilecontents,
-                         const char * /*prog_name*/, // TODO(csilvers): nix this
-                         bool errors_are_fatal)
+static bool ReadFlagsFromFlagfile(const Flagfile & flagfile, bool errors_are_fatal)
 {
     FlagRegistry * const registry = FlagRegistry::GlobalRegistry();
     FlagSaver saved_states;
 
     CommandLineFlagParser parser(registry);
     registry->Lock();
-    parser.ProcessOptionsFromStringLocked(flagfilecontents, SET_FLAGS_VALUE);
+    parser.ProcessFlagfileContentsLocked(flagfile, SET_FLAGS_VALUE);
     registry->Unlock();
     // Should we handle --help and such when reading flags from a string?  Sure.
     HandleCommandLineHelpFlags();
@@ -86,6 +96,15 @@ bool ReadFlagsFromString(const string & flagfilecontents,
     return true;
 }
 
+bool ReadFlagsFromString(const string & flagfilecontents,
+                         const char * /*prog_name*/, // TODO(csilvers): nix this
+                         bool errors_are_fatal)
+{
+    Flagfile flagfile;
+    flagfile.Assign(flagfilecontents.data(), flagfilecontents.size());
+    return ReadFlagsFromFlagfile(flagfile, errors_are_fatal);
+}
+
 // TODO(csilvers): nix prog_name in favor of ProgramInvocationShortName()
 bool AppendFlagsIntoFile(const string & filename, const char * prog_name)
 {
@@ -114,9 +133,10 @@ bool AppendFlagsIntoFile(const string & filename, const char * prog_name)
     return true;
 }
 
-bool ReadFromFlagsFile(const string & filename, const char * prog_name, bool errors_are_fatal)
+bool ReadFromFlagsFile(const string & filename, const char * /*prog_name*/, bool errors_are_fatal)
 {
-    return ReadFlagsFromString(ReadFileIntoString(filename.c_str()), prog_name, errors_are_fatal);
+    FlagfileHandle flagfile(filename.c_str());
+    return ReadFlagsFromFlagfile(*flagfile, errors_are_fatal);
 }
 
 } // namespace JFLAGS_NAMESPACE
@@ -6,6 +6,7 @@
 ////////////////////////////////////////////////////////////////////////////////
 #include "jflags_env.h"
 #include "jflags_error.h"
+#include "FlagRegisterer.h"
 #include "FlagValue.h"
 #include "util.h"
 
@@ -24,11 +25,11 @@ namespace JFLAGS_NAMESPACE {
 // --------------------------------------------------------------------
 
 template <typename T>
-T GetFromEnv(const char * varname, const char * type, T dflt)
+T GetFromEnv(const char * varname, T dflt)
 {
     std::string valstr;
     if (SafeGetEnv(varname, valstr)) {
-        FlagValue ifv(new T, type, true);
+        FlagValue ifv(new T, static_cast<FlagValue::ValueType>(FlagTypeOf<T>::id), true);
         if (!ifv.ParseFrom(valstr.c_str()))
             ReportError(DIE, "ERROR: error parsing env variable '%s' with value '%s'\n", varname, valstr.c_str());
         return OTHER_VALUE_AS(ifv, T);
@@ -53,27 +54,27 @@ T GetFromEnv(const char * varname, const char * type, T dflt)
 
 bool BoolFromEnv(const char * v, bool dflt)
 {
-    return GetFromEnv(v, "bool", dflt);
+    return GetFromEnv(v, dflt);
 }
 int32 Int32FromEnv(const char * v, int32 dflt)
 {
-    return GetFromEnv(v, "int32", dflt);
+    return GetFromEnv(v, dflt);
 }
 uint32 Uint32FromEnv(const char * v, uint32 dflt)
 {
-    return GetFromEnv(v, "uint32", dflt);
+    return GetFromEnv(v, dflt);
 }
 int64 Int64FromEnv(const char * v, int64 dflt)
 {
-    return GetFromEnv(v, "int64", dflt);
+    return GetFromEnv(v, dflt);
 }
 uint64 Uint64FromEnv(const char * v, uint64 dflt)
 {
-    return GetFromEnv(v, "uint64", dflt);
+    return GetFromEnv(v, dflt);
 }
 double DoubleFromEnv(const char * v, double dflt)
 {
-    return GetFromEnv(v, "double", dflt);
+    return GetFromEnv(v, dflt);
 }
 
 #ifdef _MSC_VER
@@ -8,6 +8,7 @@
 #include "FlagRegistry.h"
 
 #include <algorithm>
+#include <cstring>
 #include <string>
 
 namespace JFLAGS_NAMESPACE {
@@ -31,21 +32,164 @@ struct FilenameFlagnameCmp
             cmp = strcmp(a.name.c_str(), b.name.c_str()); // secondary sort key
         return cmp < 0;
     }
+
+    bool operator()(const CompactFlagInfo & a, const CompactFlagInfo & b) const
+    {
+        int cmp = strcmp(a.filename, b.filename);
+        if (cmp == 0)
+            cmp = strcmp(a.name, b.name);
+        return cmp < 0;
+    }
 };
 
 void GetAllFlags(vector<CommandLineFlagInfo> * OUTPUT)
 {
+    const size_t old_size = OUTPUT->size();
+    FlagRegistry * const registry = FlagRegistry::GlobalRegistry();
+    registry->ReaderLock();
+    const FlagRegistry::FlagList & flags = registry->SortedByFileFlagsLocked();
+    OUTPUT->reserve(old_size + flags.size());
+    for (FlagRegistry::FlagList::const_iterator i = flags.begin(); i != flags.end(); ++i)
+    {
+        OUTPUT->push_back(CommandLineFlagInfo());
+        (*i)->FillCommandLineFlagInfo(&OUTPUT->back());
+    }
+    registry->ReaderUnlock();
+    // The flags come sorted, but whatever was in OUTPUT already has to
+    // be sorted in with them.
+    if (old_size > 0)
+        sort(OUTPUT->begin(), OUTPUT->end(), FilenameFlagnameCmp());
+}
+
+void GetAllFlagsCompact(vector<CompactFlagInfo> * OUTPUT)
+{
+    const size_t old_size = OUTPUT->size();
     FlagRegistry * const registry = FlagRegistry::GlobalRegistry();
-    registry->Lock();
-    for (FlagRegistry::FlagConstIterator i = registry->flags_.begin(); i != registry->flags_.end(); ++i)
+    FlagRegistryReaderLock frl(registry);
+    const FlagRegistry::FlagList & flags = registry->SortedByFileFlagsLocked();
+    OUTPUT->resize(old_size + flags.size());
+    for (size_t i = 0; i < flags.size(); ++i)
+        flags[i]->FillCompactFlagInfo(&(*OUTPUT)[old_size + i]);
+    if (old_size > 0)
+        sort(OUTPUT->begin(), OUTPUT->end(), FilenameFlagnameCmp());
+}
+
+// --------------------------------------------------------------------
+// ForEachFlag()
+//    Hands out descriptors of the flags in the registry's order by
+//    file, which it keeps from one call to the next.
+// --------------------------------------------------------------------
+
+size_t FlagDescriptor::FormatCurrentValue(char * buf, size_t size) const
+{
+    return flag->current().FormatInto(buf, size);
+}
+
+size_t FlagDescriptor::FormatDefaultValue(char * buf, size_t size) const
+{
+    return flag->defvalue().FormatInto(buf, size);
+}
+
+void FlagDescriptor::AppendCurrentValueTo(string * output) const
+{
+    flag->current().AppendValueTo(output);
+}
+
+void FlagDescriptor::AppendDefaultValueTo(string * output) const
+{
+    flag->defvalue().AppendValueTo(output);
+}
+
+void ForEachFlag(FlagVisitor * visitor)
+{
+    FlagRegistry * const registry = FlagRegistry::GlobalRegistry();
+    FlagRegistryReaderLock frl(registry);
+    const FlagRegistry::FlagList & flags = registry->SortedByFileFlagsLocked();
+    FlagDescriptor descriptor;
+    for (FlagRegistry::FlagList::const_iterator i = flags.begin(); i != flags.end(); ++i)
+    {
+        (*i)->FillFlagDescriptor(&descriptor);
+        visitor->Visit(descriptor);
+    }
+}
+
+// --------------------------------------------------------------------
+// WriteAllFlags()
+//    Walks the registry itself, in its order by file, and puts the
+//    lines together in a buffer on the stack that's handed to the
+//    sink whenever it fills up.  Save for values too long for the
+//    buffer, that doesn't allocate anything.
+// --------------------------------------------------------------------
+
+class BufferedFlagSink
+{
+public:
+    explicit BufferedFlagSink(FlagSink * sink) : sink_(sink), size_(0) {}
+    ~BufferedFlagSink() { Flush(); }
+
+    void Append(const char * data, size_t size)
+    {
+        if (size > sizeof(buffer_) - size_)
+        {
+            Flush();
+            if (size > sizeof(buffer_))
+            {
+                sink_->Write(data, size);
+                return;
+            }
+        }
+        memcpy(buffer_ + size_, data, size);
+        size_ += size;
+    }
+
+    void AppendValue(const FlagValue & value)
+    {
+        size_t size = value.FormatInto(buffer_ + size_, sizeof(buffer_) - size_);
+        if (size < sizeof(buffer_) - size_)
+        {
+            size_ += size;
+            return;
+        }
+        Flush();
+        size = value.FormatInto(buffer_, sizeof(buffer_));
+        if (size < sizeof(buffer_))
+        {
+            size_ = size;
+            return;
+        }
+        string text; // a long string value
+        value.AppendValueTo(&text);
+        sink_->Write(text.data(), text.size());
+    }
+
+    void Flush()
+    {
+        if (size_ > 0)
+            sink_->Write(buffer_, size_);
+        size_ = 0;
+    }
+
+private:
+    FlagSink * const sink_;
+    char buffer_[4096];
+    size_t size_;
+};
+
+void WriteAllFlags(FlagSink * sink)
+{
+    FlagRegistry * const registry = FlagRegistry::GlobalRegistry();
+    FlagRegistryReaderLock frl(registry);
+    const FlagRegistry::FlagList & flags = registry->SortedByFileFlagsLocked();
+
+    BufferedFlagSink out(sink);
+    for (FlagRegistry::FlagList::const_iterator i = flags.begin(); i != flags.end(); ++i)
     {
-        CommandLineFlagInfo fi;
-        i->second->FillCommandLineFlagInfo(&fi);
-        OUTPUT->push_back(fi);
+        out.Append("--", 2);
+        out.Append((*i)->name(), strlen((*i)->name()));
+        out.Append("=", 1);
+        out.AppendValue((*i)->current());
+        out.Append("\n", 1);
     }
-    registry->Unlock();
-    // Now sort the flags, first by filename they occur in, then alphabetically
-    sort(OUTPUT->begin(), OUTPUT->end(), FilenameFlagnameCmp());
 }
 
 // --------------------------------------------------------------------
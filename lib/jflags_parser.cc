@@ -9,6 +9,7 @@
 #include "jflags_declare.h" // IWYU pragma: export
 #include "CommandLineFlagParser.h"
 #include "FlagRegistry.h"
+#include "Flagfile.h"
 
 // Special flags, type 1: the 'recursive' flags.  They set another flag's val.
 DECLARE_string(flagfile);
@@ -21,6 +22,10 @@ namespace JFLAGS_NAMESPACE {
 // Enables deferred processing of flags in dynamically loaded libraries.
 bool allow_command_line_reparsing = false;
 
+// The indices in GetArgvs() of the args that the last parse of it made
+// no sense of, for the next reparse to try again.  NULL until then.
+static vector<int> * reparse_args = NULL;
+
 // --------------------------------------------------------------------
 // ParseCommandLineFlags()
 // ParseCommandLineNonHelpFlags()
@@ -32,10 +37,32 @@ bool allow_command_line_reparsing = false;
 //    the parsing of the flags and the printing of any help output.
 // --------------------------------------------------------------------
 
-static uint32 ParseCommandLineFlagsInternal(int * argc, char *** argv, bool remove_flags, bool do_report)
+// Whether argv is the one SetArgv() saved, that reparsing goes through.
+static bool IsSavedArgv(int argc, char ** argv)
+{
+    const vector<string> & argvs = GetArgvs();
+    if (static_cast<int>(argvs.size()) != argc)
+        return false;
+    for (int i = 0; i < argc; ++i)
+    {
+        if (argvs[i] != argv[i])
+            return false;
+    }
+    return true;
+}
+
+static uint32 ParseCommandLineFlagsInternal(int * argc, char *** argv, bool remove_flags, bool do_report, vector<int> * undefined_args = NULL)
 {
     SetArgv(*argc, const_cast<const char **>(*argv)); // save it for later
 
+    // If reparsing is allowed, the first reparse only has to try again
+    // what the parse of the saved argv made no sense of.
+    if (undefined_args == NULL && allow_command_line_reparsing && reparse_args == NULL && IsSavedArgv(*argc, *argv))
+    {
+        reparse_args = new vector<int>;
+        undefined_args = reparse_args;
+    }
+
     FlagRegistry * const registry = FlagRegistry::GlobalRegistry();
     CommandLineFlagParser parser(registry);
 
@@ -57,6 +84,9 @@ static uint32 ParseCommandLineFlagsInternal(int * argc, char *** argv, bool remo
     if (do_report)
         HandleCommandLineHelpFlags(); // may cause us to exit on --help, etc.
 
+    if (undefined_args != NULL)
+        *undefined_args = parser.undefined_args();
+
     // See if any of the unset flags fail their validation checks
     parser.ValidateAllFlags();
 
@@ -85,28 +115,85 @@ uint32 ParseCommandLineNonHelpFlags(int * argc, char *** argv, bool remove_flags
 //    dlopen, to get the new flags.  But you have to explicitly
 //    Allow() it; otherwise, you get the normal default behavior
 //    of unrecognized flags calling a fatal error.
-// TODO(csilvers): this isn't used.  Just delete it?
+//       A reparse only tries the args that named no flag the last
+//    time argv was parsed, and what may be their values, so that it's
+//    only as slow as what's left.  (If reparsing is only allowed after
+//    ParseCommandLineFlags(), the first reparse goes through it all.)
+//    Flagfiles and the environment aren't kept track of like that:
+//    with any of them, each reparse goes through all of argv again,
+//    setting again the flags that were already set.
 // --------------------------------------------------------------------
 
 void AllowCommandLineReparsing() { allow_command_line_reparsing = true; }
 
+// Adds the args in pending to args, along with the values of those
+// that now name a flag that takes its value from the next arg.
+static void AddArgsToReparse(const vector<string> & argvs, const vector<int> & pending, vector<int> * args)
+{
+    FlagRegistry * const registry = FlagRegistry::GlobalRegistry();
+    FlagRegistryReaderLock frl(registry);
+    int next = 1; // the first arg not in args yet
+    for (vector<int>::const_iterator k = pending.begin(); k != pending.end(); ++k)
+    {
+        if (*k < next)
+            continue; // already there, as a value
+        args->push_back(*k);
+        next = *k + 1;
+
+        const char * arg = argvs[*k].c_str() + 1; // they all begin with '-'
+        if (arg[0] == '-')
+            arg++; // or '--'
+        const char * value;
+        if (next < static_cast<int>(argvs.size()) && registry->SplitArgumentLocked(arg, NULL, &value, NULL) != NULL && value == NULL)
+            args->push_back(next++);
+    }
+}
+
 void ReparseCommandLineNonHelpFlags()
 {
-    // We make a copy of argc and argv to pass in
     const vector<string> & argvs = GetArgvs();
-    int tmp_argc = static_cast<int>(argvs.size());
+    vector<int> args; // the indices in argvs of the args to parse
+    if (reparse_args != NULL && FLAGS_flagfile.empty() && FLAGS_fromenv.empty() && FLAGS_tryfromenv.empty())
+    {
+        AddArgsToReparse(argvs, *reparse_args, &args);
+    }
+    else
+    {
+        for (int i = 1; i < static_cast<int>(argvs.size()); ++i)
+            args.push_back(i);
+    }
+
+    // We make a copy of argc and argv to pass in
+    int tmp_argc = static_cast<int>(args.size()) + 1;
     char ** tmp_argv = new char *[tmp_argc + 1];
-    for (int i = 0; i < tmp_argc; ++i)
-        tmp_argv[i] = strdup(argvs[i].c_str()); // TODO(csilvers): don't dup
+    tmp_argv[0] = strdup(argvs[0].c_str()); // TODO(csilvers): don't dup
+    for (int i = 1; i < tmp_argc; ++i)
+        tmp_argv[i] = strdup(argvs[args[i - 1]].c_str());
+
+    vector<int> undefined_args;
+    ParseCommandLineFlagsInternal(&tmp_argc, &tmp_argv, false, false, &undefined_args);
 
-    ParseCommandLineNonHelpFlags(&tmp_argc, &tmp_argv, false);
+    if (reparse_args == NULL)
+        reparse_args = new vector<int>;
+    reparse_args->clear();
+    for (vector<int>::const_iterator i = undefined_args.begin(); i != undefined_args.end(); ++i)
+        reparse_args->push_back(args[*i - 1]);
 
     for (int i = 0; i < tmp_argc; ++i)
         free(tmp_argv[i]);
     delete[] tmp_argv;
 }
 
-void ShutDownCommandLineFlags() { FlagRegistry::DeleteGlobalRegistry(); }
+void ShutDownCommandLineFlags()
+{
+    StopFlagfileReloader();
+    StopFlagSources();
+    ForgetFlagfilesForReloading();
+    ClearFlagfileCache();
+    delete reparse_args;
+    reparse_args = NULL;
+    FlagRegistry::DeleteGlobalRegistry();
+}
 
 } // namespace JFLAGS_NAMESPACE
 
@@ -36,6 +36,8 @@
 #include "jflags.h"
 #include "jflags_completions.h"
 #include "util.h"
+#include "FlagRegistry.h"
+#include "FlagStats.h"
 
 // The 'reporting' flags.  They all call jflags_exitfunc().
 DEFINE_bool(help, false, "show help on all flags [tip: all flags can have two dashes]");
@@ -60,51 +62,170 @@ using std::vector;
 // This is used by this file, and also in jflags_reporting.cc
 const char kStrippedFlagHelp[] = "\001\002\003\004 (unknown) \004\003\002\001";
 
+// --------------------------------------------------------------------
+// HelpWriter
+//    Where the help goes: a buffer that's written out to a file, or
+//    appended to a string, whenever it fills up.  The flags are
+//    described straight into it, from the registry, rather than
+//    through a CommandLineFlagInfo and a string per flag.
+// --------------------------------------------------------------------
+
+class HelpWriter
+{
+public:
+    explicit HelpWriter(FILE * file) : file_(file), text_(NULL), size_(0) {}
+    explicit HelpWriter(string * text) : file_(NULL), text_(text), size_(0) {}
+    ~HelpWriter() { Flush(); }
+
+    void Append(const char * data, size_t size)
+    {
+        if (size > sizeof(buffer_) - size_)
+        {
+            Flush();
+            if (size > sizeof(buffer_))
+            {
+                Write(data, size);
+                return;
+            }
+        }
+        memcpy(buffer_ + size_, data, size);
+        size_ += size;
+    }
+    void Append(const char * text) { Append(text, strlen(text)); }
+
+    // Simple xml-escaping: escape & and < only.
+    void AppendXMLText(const char * text, size_t size)
+    {
+        const char * const end = text + size;
+        for (const char * p = text; p != end; ++p)
+        {
+            if (*p != '&' && *p != '<')
+                continue;
+            Append(text, p - text);
+            Append(*p == '&' ? "&amp;" : "&lt;");
+            text = p + 1;
+        }
+        Append(text, end - text);
+    }
+    void AppendXMLText(const char * text) { AppendXMLText(text, strlen(text)); }
+
+    void Flush()
+    {
+        Write(buffer_, size_);
+        size_ = 0;
+    }
+
+private:
+    FILE * const file_;
+    string * const text_;
+    char buffer_[4096];
+    size_t size_;
+
+    void Write(const char * data, size_t size)
+    {
+        if (size == 0)
+            return;
+        if (file_ != NULL)
+            fwrite(data, 1, size, file_);
+        else
+            text_->append(data, size);
+    }
+};
+
+// A value to describe: the one of a flag, or the text of it in a
+// CommandLineFlagInfo.
+struct HelpValue
+{
+    const FlagValue * value;
+    const string * text;
+
+    size_t size() const { return value != NULL ? value->FormatInto(NULL, 0) : text->size(); }
+
+    void AppendTo(HelpWriter * out, bool xml) const
+    {
+        char buf[256];
+        string long_value;
+        const char * data = buf;
+        size_t size;
+        if (value == NULL)
+        {
+            data = text->data();
+            size = text->size();
+        }
+        else if ((size = value->FormatInto(buf, sizeof(buf))) >= sizeof(buf))
+        {
+            value->AppendValueTo(&long_value); // a long string value
+            data = long_value.data();
+        }
+        if (xml)
+            out->AppendXMLText(data, size);
+        else
+            out->Append(data, size);
+    }
+};
+
 // --------------------------------------------------------------------
 // DescribeOneFlag()
 // DescribeOneFlagInXML()
-//    Routines that pretty-print info about a flag.  These use
-//    a CommandLineFlagInfo, which is the way the jflags
-//    API exposes static info about a flag.
+//    Routines that pretty-print info about a flag.  The public
+//    DescribeOneFlag() describes a CommandLineFlagInfo, which is the
+//    way the jflags API exposes static info about a flag; --help and
+//    --helpxml describe the flags of the registry.
 // --------------------------------------------------------------------
 
 static const int kLineLength = 80;
 
-static void AddString(const string & s, string * final_string, int * chars_in_line)
+// Starts a field of size chars, on a line of its own if it doesn't fit
+// on this one.
+static void StartField(HelpWriter * out, size_t size, int * chars_in_line)
 {
-    const int slen = static_cast<int>(s.length());
+    const int slen = static_cast<int>(size);
     if (*chars_in_line + 1 + slen >= kLineLength) // < 80 chars/line
     {
-        *final_string += "\n      ";
+        out->Append("\n      ", 7);
         *chars_in_line = 6;
     }
     else
     {
-        *final_string += " ";
+        out->Append(" ", 1);
         *chars_in_line += 1;
     }
-    *final_string += s;
     *chars_in_line += slen;
 }
 
-static string PrintStringFlagsWithQuotes(const CommandLineFlagInfo & flag, const string & text, bool current)
+static void AddField(HelpWriter * out, const char * label, const char * text, int * chars_in_line)
 {
-    const char * c_string = (current ? flag.current_value.c_str() : flag.default_value.c_str());
-    if (strcmp(flag.type.c_str(), "string") == 0) // add quotes for strings
-        return StringPrintf("%s: \"%s\"", text.c_str(), c_string);
-    else
-        return StringPrintf("%s: %s", text.c_str(), c_string);
+    const size_t label_size = strlen(label);
+    const size_t text_size = strlen(text);
+    StartField(out, label_size + text_size, chars_in_line);
+    out->Append(label, label_size);
+    out->Append(text, text_size);
 }
 
-// Create a descriptive string for a flag.
-// Goes to some trouble to make pretty line breaks.
-string DescribeOneFlag(const CommandLineFlagInfo & flag)
+static void AddValueField(HelpWriter * out, const char * label, const HelpValue & value, bool quoted, int * chars_in_line)
 {
-    string main_part;
-    SStringPrintf(&main_part, "    -%s (%s)", flag.name.c_str(), flag.description.c_str());
-    const char * c_string = main_part.c_str();
-    int chars_left = static_cast<int>(main_part.length());
-    string final_string = "";
+    const size_t label_size = strlen(label);
+    StartField(out, label_size + 2 + value.size() + (quoted ? 2 : 0), chars_in_line);
+    out->Append(label, label_size);
+    out->Append(quoted ? ": \"" : ": ");
+    value.AppendTo(out, false);
+    if (quoted) // add quotes for strings
+        out->Append("\"", 1);
+}
+
+// Describes a flag, going to some trouble to make pretty line breaks.
+// The first part is put together in *main_part, which is only kept
+// around so that its buffer gets reused from one flag to the next.
+static void DescribeFlagTo(HelpWriter * out, string * main_part, const char * name, const char * description, const char * type,
+                           const char * constraint, const HelpValue & default_value, const HelpValue * current_value)
+{
+    main_part->assign("    -");
+    main_part->append(name);
+    main_part->append(" (");
+    main_part->append(description);
+    main_part->append(")");
+    const char * c_string = main_part->c_str();
+    int chars_left = static_cast<int>(main_part->length());
     int chars_in_line = 0; // how many chars in current line so far?
     while (1)
     {
@@ -113,14 +234,14 @@ string DescribeOneFlag(const CommandLineFlagInfo & flag)
         if (newline == NULL && chars_in_line + chars_left < kLineLength)
         {
             // The whole remainder of the string fits on this line
-            final_string += c_string;
+            out->Append(c_string, chars_left);
             chars_in_line += chars_left;
             break;
         }
         if (newline != NULL && newline - c_string < kLineLength - chars_in_line)
         {
             int n = static_cast<int>(newline - c_string);
-            final_string.append(c_string, n);
+            out->Append(c_string, n);
             chars_left -= n + 1;
             c_string += n + 1;
         }
@@ -134,11 +255,11 @@ string DescribeOneFlag(const CommandLineFlagInfo & flag)
             {
                 // Couldn't find any whitespace to make a line break.  Just dump the
                 // rest out!
-                final_string += c_string;
+                out->Append(c_string, chars_left);
                 chars_in_line = kLineLength; // next part gets its own line for sure!
                 break;
             }
-            final_string += string(c_string, whitespace);
+            out->Append(c_string, whitespace);
             chars_in_line += whitespace;
             while (isspace(c_string[whitespace]))
                 ++whitespace;
@@ -147,55 +268,88 @@ string DescribeOneFlag(const CommandLineFlagInfo & flag)
         }
         if (*c_string == '\0')
             break;
-        StringAppendF(&final_string, "\n      ");
+        out->Append("\n      ", 7);
         chars_in_line = 6;
     }
 
     // Append data type
-    AddString(string("type: ") + flag.type, &final_string, &chars_in_line);
+    AddField(out, "type: ", type, &chars_in_line);
+    if (*constraint != '\0')
+        AddField(out, "allowed: ", constraint, &chars_in_line);
     // The listed default value will be the actual default from the flag
     // definition in the originating source file, unless the value has
     // subsequently been modified using SetCommandLineOptionWithMode() with mode
     // SET_FLAGS_DEFAULT, or by setting FLAGS_foo = bar before
     // ParseCommandLineFlags().
-    AddString(PrintStringFlagsWithQuotes(flag, "default", false), &final_string, &chars_in_line);
-    if (!flag.is_default)
-        AddString(PrintStringFlagsWithQuotes(flag, "currently", true), &final_string, &chars_in_line);
+    const bool quoted = strcmp(type, "string") == 0;
+    AddValueField(out, "default", default_value, quoted, &chars_in_line);
+    if (current_value != NULL)
+        AddValueField(out, "currently", *current_value, quoted, &chars_in_line);
+
+    out->Append("\n", 1);
+}
 
-    StringAppendF(&final_string, "\n");
+// Describes a flag of the registry.
+static void DescribeFlagTo(HelpWriter * out, string * main_part, const FlagDescriptor & flag)
+{
+    const HelpValue default_value = { &flag.flag->defvalue(), NULL };
+    const HelpValue current_value = { &flag.flag->current(), NULL };
+    DescribeFlagTo(out, main_part, flag.name, flag.description, flag.type, flag.constraint, default_value, flag.is_default ? NULL : &current_value);
+}
+
+string DescribeOneFlag(const CommandLineFlagInfo & flag)
+{
+    string final_string;
+    {
+        HelpWriter out(&final_string);
+        string main_part;
+        const HelpValue default_value = { NULL, &flag.default_value };
+        const HelpValue current_value = { NULL, &flag.current_value };
+        DescribeFlagTo(&out, &main_part, flag.name.c_str(), flag.description.c_str(), flag.type.c_str(), flag.constraint.c_str(), default_value,
+                       flag.is_default ? NULL : &current_value);
+    }
     return final_string;
 }
 
-// Simple routine to xml-escape a string: escape & and < only.
-static string XMLText(const string & txt)
+static void AddXMLTag(HelpWriter * out, const char * tag, const char * text)
 {
-    string ans = txt;
-    for (string::size_type pos = 0; (pos = ans.find("&", pos)) != string::npos;)
-        ans.replace(pos++, 1, "&amp;");
-    for (string::size_type pos = 0; (pos = ans.find("<", pos)) != string::npos;)
-        ans.replace(pos++, 1, "&lt;");
-    return ans;
+    out->Append("<");
+    out->Append(tag);
+    out->Append(">");
+    out->AppendXMLText(text);
+    out->Append("</");
+    out->Append(tag);
+    out->Append(">");
 }
 
-static void AddXMLTag(string * r, const char * tag, const string & txt)
+static void AddXMLTag(HelpWriter * out, const char * tag, const HelpValue & value)
 {
-    StringAppendF(r, "<%s>%s</%s>", tag, XMLText(txt).c_str(), tag);
+    out->Append("<");
+    out->Append(tag);
+    out->Append(">");
+    value.AppendTo(out, true);
+    out->Append("</");
+    out->Append(tag);
+    out->Append(">");
 }
 
-static string DescribeOneFlagInXML(const CommandLineFlagInfo & flag)
+static void DescribeOneFlagInXML(HelpWriter * out, const FlagDescriptor & flag)
 {
     // The file and flagname could have been attributes, but default
     // and meaning need to avoid attribute normalization.  This way it
     // can be parsed by simple programs, in addition to xml parsers.
-    string r("<flag>");
-    AddXMLTag(&r, "file", flag.filename);
-    AddXMLTag(&r, "name", flag.name);
-    AddXMLTag(&r, "meaning", flag.description);
-    AddXMLTag(&r, "default", flag.default_value);
-    AddXMLTag(&r, "current", flag.current_value);
-    AddXMLTag(&r, "type", flag.type);
-    r += "</flag>";
-    return r;
+    const HelpValue default_value = { &flag.flag->defvalue(), NULL };
+    const HelpValue current_value = { &flag.flag->current(), NULL };
+    out->Append("<flag>");
+    AddXMLTag(out, "file", flag.filename);
+    AddXMLTag(out, "name", flag.name);
+    AddXMLTag(out, "meaning", flag.description);
+    AddXMLTag(out, "default", default_value);
+    AddXMLTag(out, "current", current_value);
+    AddXMLTag(out, "type", flag.type);
+    if (*flag.constraint != '\0')
+        AddXMLTag(out, "allowed", flag.constraint);
+    out->Append("</flag>");
 }
 
 // --------------------------------------------------------------------
@@ -205,9 +359,10 @@ static string DescribeOneFlagInXML(const CommandLineFlagInfo & flag)
 //    These routines variously expose the registry's list of flag
 //    values.  ShowUsage*() prints the flag-value information
 //    to stdout in a user-readable format (that's what --help uses).
-//    The Restrict() version limits what flags are shown.
-//    ShowXMLOfFlags() prints the flag-value information to stdout
-//    in a machine-readable format.  In all cases, the flags are
+//    The Restrict() version limits what flags are shown, matching
+//    each file once, and only looking at the flags of the files that
+//    match.  ShowXMLOfFlags() prints the flag-value information to
+//    stdout in a machine-readable format.  In all cases, the flags are
 //    sorted: first by filename they are defined in, then by flagname.
 // --------------------------------------------------------------------
 
@@ -223,18 +378,27 @@ static string Dirname(const string & filename)
     return filename.substr(0, (sep == string::npos) ? 0 : sep);
 }
 
+static bool SameDirname(const char * a, const char * b)
+{
+    const char * sep_a = strrchr(a, PATH_SEPARATOR);
+    const char * sep_b = strrchr(b, PATH_SEPARATOR);
+    const size_t len_a = sep_a == NULL ? 0 : sep_a - a;
+    const size_t len_b = sep_b == NULL ? 0 : sep_b - b;
+    return len_a == len_b && memcmp(a, b, len_a) == 0;
+}
+
 // Test whether a filename contains at least one of the substrings.
-static bool FileMatchesSubstring(const string & filename, const vector<string> & substrings)
+static bool FileMatchesSubstring(const char * filename, const vector<string> & substrings)
 {
     for (vector<string>::const_iterator target = substrings.begin(); target != substrings.end(); ++target)
     {
-        if (strstr(filename.c_str(), target->c_str()) != NULL)
+        if (strstr(filename, target->c_str()) != NULL)
             return true;
         // If the substring starts with a '/', that means that we want
         // the string to be at the beginning of a directory component.
         // That should match the first directory component as well, so
         // we allow '/foo' to match a filename of 'foo'.
-        if (!target->empty() && (*target)[0] == PATH_SEPARATOR && strncmp(filename.c_str(), target->c_str() + 1, strlen(target->c_str() + 1)) == 0)
+        if (!target->empty() && (*target)[0] == PATH_SEPARATOR && strncmp(filename, target->c_str() + 1, strlen(target->c_str() + 1)) == 0)
             return true;
     }
     return false;
@@ -247,39 +411,52 @@ static bool FileMatchesSubstring(const string & filename, const vector<string> &
 // by '--help' and its variants.
 static void ShowUsageWithFlagsMatching(const char * argv0, const vector<string> & substrings)
 {
-    fprintf(stdout, "%s: %s\n", Basename(argv0), ProgramUsage());
-
-    vector<CommandLineFlagInfo> flags;
-    GetAllFlags(&flags); // flags are sorted by filename, then flagname
-
-    string last_filename;        // so we know when we're at a new file
-    bool first_directory = true; // controls blank lines between dirs
-    bool found_match = false;    // stays false iff no dir matches restrict
-    for (vector<CommandLineFlagInfo>::const_iterator flag = flags.begin(); flag != flags.end(); ++flag)
+    HelpWriter out(stdout);
+    out.Append(Basename(argv0));
+    out.Append(": ");
+    out.Append(ProgramUsage());
+    out.Append("\n");
+
+    FlagRegistry * const registry = FlagRegistry::GlobalRegistry();
+    FlagRegistryReaderLock frl(registry);
+    const FlagRegistry::FlagList & flags = registry->SortedByFileFlagsLocked();
+    const FlagRegistry::FlagFileList & files = registry->FlagFilesLocked();
+
+    const char * last_filename = ""; // so we know when we're at a new file
+    bool first_directory = true;     // controls blank lines between dirs
+    bool shown = false;
+    FlagDescriptor flag;
+    string main_part;
+    for (FlagRegistry::FlagFileList::const_iterator file = files.begin(); file != files.end(); ++file)
     {
-        if (substrings.empty() || FileMatchesSubstring(flag->filename, substrings))
+        if (!substrings.empty() && !FileMatchesSubstring(file->filename, substrings))
+            continue;
+        for (size_t i = file->begin; i < file->end; ++i)
         {
-            // If the flag has been stripped, pretend that it doesn't exist.
-            if (flag->description == kStrippedFlagHelp)
+            flags[i]->FillFlagDescriptor(&flag);
+            // If a flag has been stripped, pretend that it doesn't exist.
+            if (strcmp(flag.description, kStrippedFlagHelp) == 0)
                 continue;
-            found_match = true;                  // this flag passed the match!
-            if (flag->filename != last_filename) // new file
+            if (file->filename != last_filename) // new file
             {
-                if (Dirname(flag->filename) != Dirname(last_filename)) // new dir!
+                if (!SameDirname(file->filename, last_filename)) // new dir!
                 {
                     if (!first_directory)
-                        fprintf(stdout, "\n\n"); // put blank lines between directories
+                        out.Append("\n\n"); // put blank lines between directories
                     first_directory = false;
                 }
-                fprintf(stdout, "\n  Flags from %s:\n", flag->filename.c_str());
-                last_filename = flag->filename;
+                out.Append("\n  Flags from ");
+                out.Append(file->filename);
+                out.Append(":\n");
+                last_filename = file->filename;
             }
             // Now print this flag
-            fprintf(stdout, "%s", DescribeOneFlag(*flag).c_str());
+            DescribeFlagTo(&out, &main_part, flag);
+            shown = true;
         }
     }
-    if (!found_match && !substrings.empty())
-        fprintf(stdout, "\n  No modules matched: use -help\n");
+    if (!shown && !substrings.empty()) // no dir matches restrict
+        out.Append("\n  No modules matched: use -help\n");
 }
 
 void ShowUsageWithFlagsRestrict(const char * argv0, const char * restrict)
@@ -298,23 +475,33 @@ void ShowUsageWithFlags(const char * argv0)
 // Convert the help, program, and usage to xml.
 static void ShowXMLOfFlags(const char * prog_name)
 {
-    vector<CommandLineFlagInfo> flags;
-    GetAllFlags(&flags); // flags are sorted: by filename, then flagname
-
+    HelpWriter out(stdout);
     // XML.  There is no corresponding schema yet
-    fprintf(stdout, "<?xml version=\"1.0\"?>\n");
+    out.Append("<?xml version=\"1.0\"?>\n");
     // The document
-    fprintf(stdout, "<AllFlags>\n");
+    out.Append("<AllFlags>\n");
     // the program name and usage
-    fprintf(stdout, "<program>%s</program>\n",
-            XMLText(Basename(prog_name)).c_str());
-    fprintf(stdout, "<usage>%s</usage>\n", XMLText(ProgramUsage()).c_str());
+    AddXMLTag(&out, "program", Basename(prog_name));
+    out.Append("\n");
+    AddXMLTag(&out, "usage", ProgramUsage());
+    out.Append("\n");
     // All the flags
-    for (vector<CommandLineFlagInfo>::const_iterator flag = flags.begin(); flag != flags.end(); ++flag)
-        if (flag->description != kStrippedFlagHelp)
-            fprintf(stdout, "%s\n", DescribeOneFlagInXML(*flag).c_str());
+    {
+        FlagRegistry * const registry = FlagRegistry::GlobalRegistry();
+        FlagRegistryReaderLock frl(registry);
+        const FlagRegistry::FlagList & flags = registry->SortedByFileFlagsLocked();
+        FlagDescriptor flag;
+        for (FlagRegistry::FlagList::const_iterator i = flags.begin(); i != flags.end(); ++i)
+        {
+            (*i)->FillFlagDescriptor(&flag);
+            if (strcmp(flag.description, kStrippedFlagHelp) == 0)
+                continue;
+            DescribeOneFlagInXML(&out, flag);
+            out.Append("\n");
+        }
+    }
     // The end of the document
-    fprintf(stdout, "</AllFlags>\n");
+    out.Append("</AllFlags>\n");
 }
 
 // --------------------------------------------------------------------
@@ -334,6 +521,20 @@ static void ShowVersion()
 #endif
 }
 
+// Appends the package (directory, with a trailing separator) of every
+// file that matches any of the target substrings.
+static void AppendMatchingPackages(const vector<string> & substrings, vector<string> * packages)
+{
+    FlagRegistry * const registry = FlagRegistry::GlobalRegistry();
+    FlagRegistryReaderLock frl(registry);
+    const FlagRegistry::FlagFileList & files = registry->FlagFilesLocked();
+    for (FlagRegistry::FlagFileList::const_iterator file = files.begin(); file != files.end(); ++file)
+    {
+        if (FileMatchesSubstring(file->filename, substrings))
+            packages->push_back(Dirname(file->filename) + PATH_SEPARATOR);
+    }
+}
+
 static void AppendPrognameStrings(vector<string> * substrings, const char * progname)
 {
     string r("");
@@ -354,6 +555,7 @@ static void AppendPrognameStrings(vector<string> * substrings, const char * prog
 
 void HandleCommandLineHelpFlags()
 {
+    StageTimer timer(STAGE_HELP);
     const char * progname = ProgramInvocationShortName();
 
     HandleCommandLineCompletions();
@@ -392,21 +594,18 @@ void HandleCommandLineHelpFlags()
         // the user can pick progname, and it may not relate to the file
         // where main() resides.  So instead, we search the flags for a
         // filename like "/progname.cc", and take the dirname of that.
-        vector<CommandLineFlagInfo> flags;
-        GetAllFlags(&flags);
+        vector<string> packages;
+        AppendMatchingPackages(substrings, &packages);
         string last_package;
-        for (vector<CommandLineFlagInfo>::const_iterator flag = flags.begin(); flag != flags.end(); ++flag)
+        for (vector<string>::const_iterator package = packages.begin(); package != packages.end(); ++package)
         {
-            if (!FileMatchesSubstring(flag->filename, substrings))
-                continue;
-            const string package = Dirname(flag->filename) + PATH_SEPARATOR;
-            if (package != last_package)
+            if (*package != last_package)
             {
-                ShowUsageWithFlagsRestrict(progname, package.c_str());
-                VLOG(7) << "Found package: " << package;
+                ShowUsageWithFlagsRestrict(progname, package->c_str());
+                VLOG(7) << "Found package: " << *package;
                 if (!last_package.empty()) // means this isn't our first pkg
                     LOG(WARNING) << "Multiple packages contain a file=" << progname;
-                last_package = package;
+                last_package = *package;
             }
         }
         if (last_package.empty()) // never found a package to print
@@ -0,0 +1,186 @@
+////////////////////////////////////////////////////////////////////////////////
+//                                    jflags
+//
+// This file is distributed under the 3-clause Berkeley Software Distribution
+// License. See LICENSE.txt for details.
+////////////////////////////////////////////////////////////////////////////////
+#include "jflags_source.h"
+#include "CommandLineFlagParser.h"
+#include "FlagStats.h"
+#include "util.h"
+
+#include <string>
+#if defined(HAVE_PTHREAD) && !defined(NO_THREADS)
+#include <pthread.h>
+#include <sys/time.h>
+#endif
+
+namespace JFLAGS_NAMESPACE {
+
+using std::string;
+
+FlagSource::~FlagSource()
+{
+}
+
+// Applies the settings that source fetched, if it did, or logs why
+// not.  started is when the fetch started, by StatsNanos().
+static void ApplyFlagSettings(FlagSource * source, FlagTransaction * settings, bool fetched, string * error, int64 started)
+{
+    const bool applied = fetched && settings->Commit(error);
+    if (!applied)
+        LOG(WARNING) << "Ignoring the flags of source '" << source->name() << "': " << *error;
+    NoteStage(STAGE_SOURCES, StatsNanos() - started);
+    NoteFlagSourceDone(applied);
+}
+
+// Fetches the settings of source and applies them, then deletes it.
+static void ApplyFlagSource(FlagSource * source)
+{
+    const int64 started = StatsNanos();
+    FlagTransaction settings;
+    string error;
+    const bool fetched = source->Fetch(&settings, &error);
+    ApplyFlagSettings(source, &settings, fetched, &error, started);
+    delete source;
+}
+
+// --------------------------------------------------------------------
+// AddFlagSource()
+// WaitForCriticalFlagSources()
+// StopFlagSources()
+//    Each source gets a detached thread of its own: a source that's
+//    slow to fetch only holds up what waits for it, and nothing is
+//    left to join once it's done.  The sources are counted under a
+//    mutex, with a condition variable that's signaled whenever one is
+//    done: the critical ones still fetching, for the waiters, and the
+//    ones whose settings are being applied, for StopFlagSources().
+//    Stopping starts a new generation of sources, so that those of the
+//    old one that are still fetching drop their settings when they're
+//    done, rather than apply them to a registry that may be gone.
+// --------------------------------------------------------------------
+
+#if defined(HAVE_PTHREAD) && !defined(NO_THREADS)
+
+struct FetchingFlagSource
+{
+    FlagSource * source;
+    bool critical;
+    int64 generation; // of sources_generation, when added
+};
+
+static pthread_mutex_t sources_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t source_done = PTHREAD_COND_INITIALIZER;
+static int critical_sources_fetching = 0;
+static int sources_applying = 0;
+static int64 sources_generation = 0;
+
+static void * RunFlagSource(void * arg)
+{
+    FetchingFlagSource * const fetching = static_cast<FetchingFlagSource *>(arg);
+    const int64 started = StatsNanos();
+    FlagTransaction settings;
+    string error;
+    const bool fetched = fetching->source->Fetch(&settings, &error);
+
+    pthread_mutex_lock(&sources_mutex);
+    const bool stopped = (fetching->generation != sources_generation);
+    if (!stopped)
+        ++sources_applying;
+    pthread_mutex_unlock(&sources_mutex);
+
+    if (!stopped)
+        ApplyFlagSettings(fetching->source, &settings, fetched, &error, started);
+    delete fetching->source;
+
+    pthread_mutex_lock(&sources_mutex);
+    if (!stopped)
+        --sources_applying;
+    if (fetching->critical)
+        --critical_sources_fetching;
+    pthread_cond_broadcast(&source_done);
+    pthread_mutex_unlock(&sources_mutex);
+    delete fetching;
+    return NULL;
+}
+
+void AddFlagSource(FlagSource * source, bool critical)
+{
+    NoteFlagSourceAdded();
+    FetchingFlagSource * fetching = new FetchingFlagSource;
+    fetching->source = source;
+    fetching->critical = critical;
+
+    pthread_mutex_lock(&sources_mutex);
+    fetching->generation = sources_generation;
+    pthread_t thread;
+    const bool started = (pthread_create(&thread, NULL, &RunFlagSource, fetching) == 0);
+    if (started)
+    {
+        pthread_detach(thread);
+        if (critical)
+            ++critical_sources_fetching;
+    }
+    pthread_mutex_unlock(&sources_mutex);
+
+    if (!started) // fetch without a thread, then
+    {
+        ApplyFlagSource(source);
+        delete fetching;
+    }
+}
+
+bool WaitForCriticalFlagSources(int32 timeout_ms)
+{
+    struct timespec deadline;
+    if (timeout_ms >= 0)
+    {
+        struct timeval now;
+        gettimeofday(&now, NULL);
+        const int64 deadline_us = static_cast<int64>(now.tv_sec) * 1000000 + now.tv_usec + static_cast<int64>(timeout_ms) * 1000;
+        deadline.tv_sec = static_cast<time_t>(deadline_us / 1000000);
+        deadline.tv_nsec = static_cast<long>(deadline_us % 1000000) * 1000;
+    }
+
+    pthread_mutex_lock(&sources_mutex);
+    while (critical_sources_fetching > 0)
+    {
+        if (timeout_ms < 0)
+            pthread_cond_wait(&source_done, &sources_mutex);
+        else if (pthread_cond_timedwait(&source_done, &sources_mutex, &deadline) != 0)
+            break;
+    }
+    const bool done = (critical_sources_fetching == 0);
+    pthread_mutex_unlock(&sources_mutex);
+    return done;
+}
+
+void StopFlagSources()
+{
+    pthread_mutex_lock(&sources_mutex);
+    ++sources_generation;
+    while (sources_applying > 0)
+        pthread_cond_wait(&source_done, &sources_mutex);
+    pthread_mutex_unlock(&sources_mutex);
+}
+
+#else // no threads
+
+void AddFlagSource(FlagSource * source, bool)
+{
+    NoteFlagSourceAdded();
+    ApplyFlagSource(source);
+}
+
+bool WaitForCriticalFlagSources(int32)
+{
+    return true;
+}
+
+void StopFlagSources()
+{
+}
+
+#endif
+
+} // namespace JFLAGS_NAMESPACE
@@ -0,0 +1,289 @@
+////////////////////////////////////////////////////////////////////////////////
+//                                    jflags
+//
+// This file is distributed under the 3-clause Berkeley Software Distribution
+// License. See LICENSE.txt for details.
+////////////////////////////////////////////////////////////////////////////////
+#include "jflags_stats.h"
+#include "FlagRegisterer.h"
+#include "jflags_define.h"
+#include "jflags_watcher.h"
+#include "FlagStats.h"
+#include "util.h"
+#include "mutex.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <map>
+#include <string>
+#include <vector>
+#if defined(OS_WINDOWS)
+#include <windows.h>
+#elif !defined(CLOCK_MONOTONIC)
+#include <sys/time.h>
+#endif
+#if defined(HAVE_PTHREAD) && !defined(NO_THREADS) && !defined(OS_WINDOWS)
+#include <pthread.h>
+#endif
+
+DEFINE_bool(jflags_stats, false, "keep statistics of jflags itself, and print them to stderr at exit");
+
+using namespace MUTEX_NAMESPACE;
+
+namespace JFLAGS_NAMESPACE {
+
+using std::map;
+using std::string;
+using std::vector;
+
+// --------------------------------------------------------------------
+// The statistics
+//    Stages are few and far between, so they just share a lock.  What
+//    happens on every lock or every access by name is counted in one
+//    of a few shards, picked by thread, each with its own lock: two
+//    threads only wait for each other to count if they share a shard.
+//    The shards live as long as the program, so that flags read in
+//    global destructors find them (or find counting turned off).
+// --------------------------------------------------------------------
+
+bool flags_stats_enabled = false;
+
+static Mutex stats_lock(Mutex::LINKER_INITIALIZED);
+static FlagsStageStats stage_stats[NUM_FLAGS_STAGES];
+static int64 flagfile_bytes_read = 0;
+static int64 flag_sources_added = 0;
+static int64 flag_sources_applied = 0;
+static int64 flag_sources_failed = 0;
+
+struct FlagAccessCounts
+{
+    FlagAccessCounts() : reads(0), sets(0) {}
+
+    int64 reads;
+    int64 sets;
+};
+
+// By the address of the flag's name, which lives as long as the flag.
+typedef map<const char *, FlagAccessCounts> FlagAccessCountMap;
+
+struct StatsShard
+{
+    StatsShard() : lock_acquisitions(0), lock_wait_nanos(0), lock_hold_nanos(0) {}
+
+    Mutex lock;
+    int64 lock_acquisitions;
+    int64 lock_wait_nanos;
+    int64 lock_hold_nanos;
+    FlagAccessCountMap flags;
+    char padding[64]; // keeps the next shard's lock off this one's cache line
+};
+
+static const size_t kNumStatsShards = 16;
+
+struct StatsShards
+{
+    ~StatsShards() { flags_stats_enabled = false; } // before the shards go
+
+    StatsShard shard[kNumStatsShards];
+};
+
+static StatsShards stats_shards;
+
+static StatsShard & ThisThreadShard()
+{
+#if defined(OS_WINDOWS)
+    const uint64 id = GetCurrentThreadId();
+#elif defined(HAVE_PTHREAD) && !defined(NO_THREADS)
+    const pthread_t self = pthread_self();
+    uint64 id = 0;
+    memcpy(&id, &self, sizeof(self) < sizeof(id) ? sizeof(self) : sizeof(id));
+#else
+    const uint64 id = 0;
+#endif
+    // Thread ids are often aligned addresses: the top bits of the
+    // product are mixed from all of them.
+    return stats_shards.shard[(id * 0x9E3779B97F4A7C15ULL) >> 60];
+}
+
+int64 StatsNanos()
+{
+#if defined(OS_WINDOWS)
+    LARGE_INTEGER count, frequency;
+    QueryPerformanceCounter(&count);
+    QueryPerformanceFrequency(&frequency);
+    return count.QuadPart / frequency.QuadPart * 1000000000 + count.QuadPart % frequency.QuadPart * 1000000000 / frequency.QuadPart;
+#elif defined(CLOCK_MONOTONIC)
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return static_cast<int64>(now.tv_sec) * 1000000000 + now.tv_nsec;
+#else
+    struct timeval now;
+    gettimeofday(&now, NULL);
+    return static_cast<int64>(now.tv_sec) * 1000000000 + static_cast<int64>(now.tv_usec) * 1000;
+#endif
+}
+
+void NoteStage(FlagsStage stage, int64 nanos)
+{
+    MutexLock l(&stats_lock);
+    ++stage_stats[stage].calls;
+    stage_stats[stage].nanos += nanos;
+}
+
+void NoteFlagfileBytes(size_t bytes)
+{
+    MutexLock l(&stats_lock);
+    flagfile_bytes_read += bytes;
+}
+
+void NoteFlagSourceAdded()
+{
+    MutexLock l(&stats_lock);
+    ++flag_sources_added;
+}
+
+void NoteFlagSourceDone(bool applied)
+{
+    MutexLock l(&stats_lock);
+    ++(applied ? flag_sources_applied : flag_sources_failed);
+}
+
+void NoteLockWait(int64 wait_nanos)
+{
+    StatsShard & shard = ThisThreadShard();
+    MutexLock l(&shard.lock);
+    ++shard.lock_acquisitions;
+    shard.lock_wait_nanos += wait_nanos;
+}
+
+void NoteLockHold(int64 hold_nanos)
+{
+    StatsShard & shard = ThisThreadShard();
+    MutexLock l(&shard.lock);
+    shard.lock_hold_nanos += hold_nanos;
+}
+
+void NoteFlagAccess(const char * name, bool is_set)
+{
+    StatsShard & shard = ThisThreadShard();
+    MutexLock l(&shard.lock);
+    FlagAccessCounts & counts = shard.flags[name];
+    if (is_set)
+        ++counts.sets;
+    else
+        ++counts.reads;
+}
+
+// --------------------------------------------------------------------
+// EnableFlagsStats()
+// GetFlagsStats()
+// FlagsStatsReport()
+//    --jflags_stats enables the statistics through a watcher, which
+//    also has them printed at exit the first time.
+// --------------------------------------------------------------------
+
+void EnableFlagsStats(bool enable)
+{
+    atomic_internal::StoreRelaxed(&flags_stats_enabled, enable);
+}
+
+void GetFlagsStats(FlagsStats * OUTPUT)
+{
+    {
+        MutexLock l(&stats_lock);
+        OUTPUT->registration = stage_stats[STAGE_REGISTRATION];
+        OUTPUT->parsing = stage_stats[STAGE_PARSING];
+        OUTPUT->flagfiles = stage_stats[STAGE_FLAGFILES];
+        OUTPUT->fromenv = stage_stats[STAGE_FROMENV];
+        OUTPUT->validation = stage_stats[STAGE_VALIDATION];
+        OUTPUT->help = stage_stats[STAGE_HELP];
+        OUTPUT->sources = stage_stats[STAGE_SOURCES];
+        OUTPUT->flagfile_bytes = flagfile_bytes_read;
+        OUTPUT->sources_added = flag_sources_added;
+        OUTPUT->sources_applied = flag_sources_applied;
+        OUTPUT->sources_failed = flag_sources_failed;
+    }
+
+    OUTPUT->lock_acquisitions = OUTPUT->lock_wait_nanos = OUTPUT->lock_hold_nanos = 0;
+    map<string, FlagAccessCounts> flags; // sorted by name
+    for (size_t i = 0; i < kNumStatsShards; ++i)
+    {
+        StatsShard & shard = stats_shards.shard[i];
+        MutexLock l(&shard.lock);
+        OUTPUT->lock_acquisitions += shard.lock_acquisitions;
+        OUTPUT->lock_wait_nanos += shard.lock_wait_nanos;
+        OUTPUT->lock_hold_nanos += shard.lock_hold_nanos;
+        for (FlagAccessCountMap::const_iterator f = shard.flags.begin(); f != shard.flags.end(); ++f)
+        {
+            FlagAccessCounts & counts = flags[f->first];
+            counts.reads += f->second.reads;
+            counts.sets += f->second.sets;
+        }
+    }
+
+    OUTPUT->flags.clear();
+    for (map<string, FlagAccessCounts>::const_iterator f = flags.begin(); f != flags.end(); ++f)
+    {
+        FlagAccessStats stats;
+        stats.name = f->first;
+        stats.reads = f->second.reads;
+        stats.sets = f->second.sets;
+        OUTPUT->flags.push_back(stats);
+    }
+}
+
+static void AppendStage(string * report, const char * name, const FlagsStageStats & stage)
+{
+    StringAppendF(report, "  %-14s %10" PRId64 " %12.3f\n", name, stage.calls, stage.nanos / 1e6);
+}
+
+string FlagsStatsReport()
+{
+    FlagsStats stats;
+    GetFlagsStats(&stats);
+
+    string report = StringPrintf("jflags statistics:\n  %-14s %10s %12s\n", "stage", "calls", "ms");
+    AppendStage(&report, "registration", stats.registration);
+    AppendStage(&report, "parsing", stats.parsing);
+    AppendStage(&report, "flagfiles", stats.flagfiles);
+    AppendStage(&report, "fromenv", stats.fromenv);
+    AppendStage(&report, "validation", stats.validation);
+    AppendStage(&report, "help", stats.help);
+    AppendStage(&report, "sources", stats.sources);
+    StringAppendF(&report, "  flagfile bytes read: %" PRId64 "\n", stats.flagfile_bytes);
+    if (stats.sources_added > 0)
+        StringAppendF(&report, "  flag sources: %" PRId64 " added, %" PRId64 " applied, %" PRId64 " failed\n",
+                      stats.sources_added, stats.sources_applied, stats.sources_failed);
+    StringAppendF(&report, "  registry lock: %" PRId64 " acquisitions, %.3f ms waiting, %.3f ms held\n",
+                  stats.lock_acquisitions, stats.lock_wait_nanos / 1e6, stats.lock_hold_nanos / 1e6);
+    if (!stats.flags.empty())
+    {
+        StringAppendF(&report, "  %-30s %10s %10s\n", "flag", "reads", "sets");
+        for (vector<FlagAccessStats>::const_iterator f = stats.flags.begin(); f != stats.flags.end(); ++f)
+            StringAppendF(&report, "  %-30s %10" PRId64 " %10" PRId64 "\n", f->name.c_str(), f->reads, f->sets);
+    }
+    return report;
+}
+
+static void PrintFlagsStatsAtExit()
+{
+    fprintf(stderr, "%s", FlagsStatsReport().c_str());
+}
+
+static void OnStatsFlagChange(const char *, void *)
+{
+    EnableFlagsStats(FLAGS_jflags_stats);
+    static bool printing_at_exit = false;
+    MutexLock l(&stats_lock);
+    if (FLAGS_jflags_stats && !printing_at_exit)
+    {
+        printing_at_exit = true;
+        atexit(&PrintFlagsStatsAtExit);
+    }
+}
+
+static const bool stats_flag_watched = RegisterFlagWatcher(&FLAGS_jflags_stats, &OnStatsFlagChange, NULL);
+
+} // namespace JFLAGS_NAMESPACE
@@ -6,13 +6,16 @@
 ////////////////////////////////////////////////////////////////////////////////
 #include "jflags_validator.h"
 #include "FlagRegistry.h"
+#include "FlagConstraint.h"
 
 #include <cstring>
 #include <string>
+#include <vector>
 
 namespace JFLAGS_NAMESPACE {
 
 using std::string;
+using std::vector;
 
 // --------------------------------------------------------------------
 // AddFlagValidator()
@@ -22,7 +25,7 @@ using std::string;
 //    declarations for these classes possible).
 // --------------------------------------------------------------------
 
-bool AddFlagValidator(const void * flag_ptr, ValidateFnProto validate_fn_proto)
+bool AddFlagValidator(const void * flag_ptr, ValidateFnProto validate_fn_proto, bool is_cheap)
 {
     // We want a lock around this routine, in case two threads try to
     // add a validator (hopefully the same one!) at once.  We could use
@@ -40,6 +43,7 @@ bool AddFlagValidator(const void * flag_ptr, ValidateFnProto validate_fn_proto)
     }
     else if (validate_fn_proto == flag->validate_function())
     {
+        flag->validator_is_cheap_ = is_cheap;
         return true; // ok to register the same function over and over again
     }
     else if (validate_fn_proto != NULL && flag->validate_function() != NULL)
@@ -50,6 +54,7 @@ bool AddFlagValidator(const void * flag_ptr, ValidateFnProto validate_fn_proto)
     else
     {
         flag->validate_fn_proto_ = validate_fn_proto;
+        flag->validator_is_cheap_ = is_cheap;
         return true;
     }
 }
@@ -66,33 +71,108 @@ bool AddFlagValidator(const void * flag_ptr, ValidateFnProto validate_fn_proto)
 //       This function is not thread-safe.
 // --------------------------------------------------------------------
 
-bool RegisterFlagValidator(const bool * flag, bool (*validate_fn)(const char *, bool))
+bool RegisterFlagValidator(const bool * flag, bool (*validate_fn)(const char *, bool), FlagValidatorCost cost)
 {
-    return AddFlagValidator(flag, reinterpret_cast<ValidateFnProto>(validate_fn));
+    return AddFlagValidator(flag, reinterpret_cast<ValidateFnProto>(validate_fn), cost == VALIDATOR_IS_CHEAP);
 }
-bool RegisterFlagValidator(const int32 * flag, bool (*validate_fn)(const char *, int32))
+bool RegisterFlagValidator(const int32 * flag, bool (*validate_fn)(const char *, int32), FlagValidatorCost cost)
 {
-    return AddFlagValidator(flag, reinterpret_cast<ValidateFnProto>(validate_fn));
+    return AddFlagValidator(flag, reinterpret_cast<ValidateFnProto>(validate_fn), cost == VALIDATOR_IS_CHEAP);
 }
-bool RegisterFlagValidator(const uint32 * flag, bool (*validate_fn)(const char *, uint32))
+bool RegisterFlagValidator(const uint32 * flag, bool (*validate_fn)(const char *, uint32), FlagValidatorCost cost)
 {
-    return AddFlagValidator(flag, reinterpret_cast<ValidateFnProto>(validate_fn));
+    return AddFlagValidator(flag, reinterpret_cast<ValidateFnProto>(validate_fn), cost == VALIDATOR_IS_CHEAP);
 }
-bool RegisterFlagValidator(const int64 * flag, bool (*validate_fn)(const char *, int64))
+bool RegisterFlagValidator(const int64 * flag, bool (*validate_fn)(const char *, int64), FlagValidatorCost cost)
 {
-    return AddFlagValidator(flag, reinterpret_cast<ValidateFnProto>(validate_fn));
+    return AddFlagValidator(flag, reinterpret_cast<ValidateFnProto>(validate_fn), cost == VALIDATOR_IS_CHEAP);
 }
-bool RegisterFlagValidator(const uint64 * flag, bool (*validate_fn)(const char *, uint64))
+bool RegisterFlagValidator(const uint64 * flag, bool (*validate_fn)(const char *, uint64), FlagValidatorCost cost)
 {
-    return AddFlagValidator(flag, reinterpret_cast<ValidateFnProto>(validate_fn));
+    return AddFlagValidator(flag, reinterpret_cast<ValidateFnProto>(validate_fn), cost == VALIDATOR_IS_CHEAP);
 }
-bool RegisterFlagValidator(const double * flag, bool (*validate_fn)(const char *, double))
+bool RegisterFlagValidator(const double * flag, bool (*validate_fn)(const char *, double), FlagValidatorCost cost)
 {
-    return AddFlagValidator(flag, reinterpret_cast<ValidateFnProto>(validate_fn));
+    return AddFlagValidator(flag, reinterpret_cast<ValidateFnProto>(validate_fn), cost == VALIDATOR_IS_CHEAP);
 }
-bool RegisterFlagValidator(const string * flag, bool (*validate_fn)(const char *, const string &))
+bool RegisterFlagValidator(const string * flag, bool (*validate_fn)(const char *, const string &), FlagValidatorCost cost)
 {
-    return AddFlagValidator(flag, reinterpret_cast<ValidateFnProto>(validate_fn));
+    return AddFlagValidator(flag, reinterpret_cast<ValidateFnProto>(validate_fn), cost == VALIDATOR_IS_CHEAP);
+}
+
+// --------------------------------------------------------------------
+// AddFlagConstraint()
+// RegisterFlagRange()
+// RegisterFlagAllowedValues()
+//    The constraints are kept for as long as the program runs, even
+//    once replaced, since FlagSavers may have copies of the flags
+//    that point to them.  Takes ownership of constraint.
+// --------------------------------------------------------------------
+
+bool AddFlagConstraint(const void * flag_ptr, FlagValue::ValueType type, const FlagConstraint * constraint)
+{
+    static vector<const FlagConstraint *> * all_constraints = NULL;
+    FlagRegistry * const registry = FlagRegistry::GlobalRegistry();
+    FlagRegistryLock frl(registry);
+    CommandLineFlag * flag = registry->FindFlagViaPtrLocked(flag_ptr);
+    if (!flag)
+    {
+        LOG(WARNING) << "Ignoring the allowed values for flag pointer " << flag_ptr << ": no flag found at that address";
+        delete constraint;
+        return false;
+    }
+    else if (flag->current().type() != type)
+    {
+        LOG(WARNING) << "Ignoring the allowed values for flag '" << flag->name() << "': they aren't of its type, " << flag->type_name();
+        delete constraint;
+        return false;
+    }
+    else if (constraint->description().empty())
+    {
+        LOG(WARNING) << "Ignoring the allowed values for flag '" << flag->name() << "': there are none";
+        delete constraint;
+        return false;
+    }
+    if (all_constraints == NULL)
+        all_constraints = new vector<const FlagConstraint *>;
+    all_constraints->push_back(constraint);
+    flag->constraint_ = constraint;
+    return true;
+}
+
+template <typename T>
+static bool AddFlagRange(const T * flag, T min, T max, FlagValue::ValueType type)
+{
+    if (max < min)
+        return false;
+    FlagValue min_value(&min, type, false);
+    FlagValue max_value(&max, type, false);
+    return AddFlagConstraint(flag, type, new FlagConstraint(min_value, max_value));
+}
+
+bool RegisterFlagRange(const int32 * flag, int32 min, int32 max)
+{
+    return AddFlagRange(flag, min, max, FlagValue::FV_INT32);
+}
+bool RegisterFlagRange(const uint32 * flag, uint32 min, uint32 max)
+{
+    return AddFlagRange(flag, min, max, FlagValue::FV_UINT32);
+}
+bool RegisterFlagRange(const int64 * flag, int64 min, int64 max)
+{
+    return AddFlagRange(flag, min, max, FlagValue::FV_INT64);
+}
+bool RegisterFlagRange(const uint64 * flag, uint64 min, uint64 max)
+{
+    return AddFlagRange(flag, min, max, FlagValue::FV_UINT64);
+}
+bool RegisterFlagRange(const double * flag, double min, double max)
+{
+    return AddFlagRange(flag, min, max, FlagValue::FV_DOUBLE);
+}
+bool RegisterFlagAllowedValues(const string * flag, const char * values)
+{
+    return values != NULL && AddFlagConstraint(flag, FlagValue::FV_STRING, new FlagConstraint(values));
 }
 
 } // namespace JFLAGS_NAMESPACE
@@ -0,0 +1,112 @@
+////////////////////////////////////////////////////////////////////////////////
+//                                    jflags
+//
+// This file is distributed under the 3-clause Berkeley Software Distribution
+// License. See LICENSE.txt for details.
+////////////////////////////////////////////////////////////////////////////////
+#include "jflags_watcher.h"
+#include "FlagRegistry.h"
+
+#include <string>
+#include <vector>
+
+namespace JFLAGS_NAMESPACE {
+
+using std::string;
+using std::vector;
+
+// --------------------------------------------------------------------
+// AddFlagWatcher()
+// RemoveFlagWatcher()
+//    These are helper functions for RegisterFlagWatcher() and
+//    UnregisterFlagWatcher(), defined below.  The caller holds the
+//    registry lock.
+// --------------------------------------------------------------------
+
+bool AddFlagWatcher(CommandLineFlag * flag, FlagWatcherFn watcher_fn, void * data)
+{
+    if (flag->watchers_ == NULL)
+        flag->watchers_ = new vector<FlagWatcher>;
+    for (vector<FlagWatcher>::const_iterator w = flag->watchers_->begin(); w != flag->watchers_->end(); ++w)
+    {
+        if (w->fn == watcher_fn && w->data == data)
+            return true; // ok to register the same watcher over and over again
+    }
+    FlagWatcher watcher = { watcher_fn, data };
+    flag->watchers_->push_back(watcher);
+    return true;
+}
+
+bool RemoveFlagWatcher(CommandLineFlag * flag, FlagWatcherFn watcher_fn, void * data)
+{
+    if (flag->watchers_ == NULL)
+        return false;
+    for (vector<FlagWatcher>::iterator w = flag->watchers_->begin(); w != flag->watchers_->end(); ++w)
+    {
+        if (w->fn == watcher_fn && w->data == data)
+        {
+            flag->watchers_->erase(w);
+            if (flag->watchers_->empty())
+            {
+                // Back to an unwatched flag, that's cheap to set
+                delete flag->watchers_;
+                flag->watchers_ = NULL;
+            }
+            return true;
+        }
+    }
+    return false;
+}
+
+// --------------------------------------------------------------------
+// RegisterFlagWatcher()
+// UnregisterFlagWatcher()
+//    RegisterFlagWatcher() is the function that clients use to be
+//    told about the changes of a flag, instead of polling it.  The
+//    flag is given by the address of its value (&FLAGS_foo), or by
+//    its name.  Both functions are thread-safe.
+// --------------------------------------------------------------------
+
+bool RegisterFlagWatcher(const void * flag_ptr, FlagWatcherFn watcher_fn, void * data)
+{
+    FlagRegistry * const registry = FlagRegistry::GlobalRegistry();
+    FlagRegistryLock frl(registry);
+    CommandLineFlag * flag = registry->FindFlagViaPtrLocked(flag_ptr);
+    if (!flag)
+    {
+        LOG(WARNING) << "Ignoring RegisterFlagWatcher() for flag pointer " << flag_ptr << ": no flag found at that address";
+        return false;
+    }
+    return AddFlagWatcher(flag, watcher_fn, data);
+}
+
+bool RegisterFlagWatcher(const char * flagname, FlagWatcherFn watcher_fn, void * data)
+{
+    FlagRegistry * const registry = FlagRegistry::GlobalRegistry();
+    FlagRegistryLock frl(registry);
+    CommandLineFlag * flag = registry->FindFlagLocked(flagname);
+    if (!flag)
+    {
+        LOG(WARNING) << "Ignoring RegisterFlagWatcher() for flag '" << flagname << "': no such flag";
+        return false;
+    }
+    return AddFlagWatcher(flag, watcher_fn, data);
+}
+
+bool UnregisterFlagWatcher(const void * flag_ptr, FlagWatcherFn watcher_fn, void * data)
+{
+    FlagRegistry * const registry = FlagRegistry::GlobalRegistry();
+    FlagRegistryLock frl(registry);
+    CommandLineFlag * flag = registry->FindFlagViaPtrLocked(flag_ptr);
+    return flag != NULL && RemoveFlagWatcher(flag, watcher_fn, data);
+}
+
+bool UnregisterFlagWatcher(const char * flagname, FlagWatcherFn watcher_fn, void * data)
+{
+    FlagRegistry * const registry = FlagRegistry::GlobalRegistry();
+    FlagRegistryLock frl(registry);
+    CommandLineFlag * flag = registry->FindFlagLocked(flagname);
+    return flag != NULL && RemoveFlagWatcher(flag, watcher_fn, data);
+}
+
+} // namespace JFLAGS_NAMESPACE
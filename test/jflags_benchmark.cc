@@ -0,0 +1,601 @@
+////////////////////////////////////////////////////////////////////////////////
+//                                    jflags
+//
+// This file is distributed under the 3-clause Berkeley Software Distribution
+// License. See LICENSE.txt for details.
+////////////////////////////////////////////////////////////////////////////////
+//
+// Benchmarks for jflags.  The microbenchmarks time the jflags way of
+// doing something against a reference implementation (usually, the way
+// jflags used to do it) and print the time per operation of both.  The
+// suite registers --num_flags synthetic flags, spread over --num_files
+// fake source files, and times the whole API against them: parsing,
+// lookups (from 1 to --max_threads threads), setting, saving and
+// restoring, listing, help and completions.  Run with --iterations to
+// trade precision for time, and with --benchmark_format=json for
+// results to keep track of over time.
+
+#include <jflags/jflags.h>
+
+#include "config.h"
+#include "util.h"
+#include "FlagValue.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <string>
+#include <vector>
+#if defined(OS_WINDOWS)
+#include <io.h>
+#include <windows.h>
+#elif defined(HAVE_UNISTD_H)
+#include <unistd.h>
+#endif
+#if !defined(OS_WINDOWS) && !defined(CLOCK_MONOTONIC)
+#include <sys/time.h>
+#endif
+#if defined(HAVE_PTHREAD) && !defined(NO_THREADS)
+#include <pthread.h>
+#endif
+
+DEFINE_int32(iterations, 200000, "Number of times each benchmark loops over its inputs");
+DEFINE_int32(argv_benchmark_flag, 0, "Set over and over by the argv benchmark");
+DEFINE_int32(num_flags, 2000, "Number of synthetic flags the suite registers");
+DEFINE_int32(num_files, 100, "Number of fake files the synthetic flags are spread over");
+DEFINE_int32(max_threads, 4, "Up to how many threads the suite looks flags up from");
+DEFINE_string(benchmark_tmpdir, ".", "Where the suite writes its flagfile");
+DEFINE_string(benchmark_format, "text", "How to print the results: text, or json for one object per line");
+
+DECLARE_bool(helpxml);
+DECLARE_string(tab_completion_word);
+
+namespace JFLAGS_NAMESPACE {
+namespace {
+
+// Keeps the compiler from optimizing away the work being timed.
+volatile uint64 benchmark_sink;
+
+// Wall time, from a clock that only goes forward: what's timed may
+// block, and the threaded suites time threads together.
+double Seconds() {
+#if defined(OS_WINDOWS)
+  LARGE_INTEGER count, frequency;
+  QueryPerformanceCounter(&count);
+  QueryPerformanceFrequency(&frequency);
+  return static_cast<double>(count.QuadPart) / frequency.QuadPart;
+#elif defined(CLOCK_MONOTONIC)
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec + now.tv_nsec * 1e-9;
+#else
+  struct timeval now;
+  gettimeofday(&now, NULL);
+  return now.tv_sec + now.tv_usec * 1e-6;
+#endif
+}
+
+// Times fn over all the inputs, FLAGS_iterations times over, and
+// returns nanoseconds per call.
+template <typename Fn>
+double NanosPerCall(Fn fn, const char* const* inputs, size_t num_inputs) {
+  uint64 sink = 0;
+  const double start = Seconds();
+  for (int32 i = 0; i < FLAGS_iterations; ++i) {
+    for (size_t j = 0; j < num_inputs; ++j)
+      sink += fn(inputs[j]);
+  }
+  const double seconds = Seconds() - start;
+  benchmark_sink = sink;
+  return seconds * 1e9 / (static_cast<double>(FLAGS_iterations) * num_inputs);
+}
+
+bool JsonOutput() {
+  return FLAGS_benchmark_format == "json";
+}
+
+void Report(const char* name, double reference_ns, double jflags_ns) {
+  if (JsonOutput()) {
+    printf("{\"benchmark\": \"%s\", \"reference_ns\": %.1f, "
+           "\"jflags_ns\": %.1f}\n", name, reference_ns, jflags_ns);
+  } else {
+    printf("%-24s %10.1f ns %10.1f ns %8.2fx\n", name, reference_ns,
+           jflags_ns, jflags_ns > 0 ? reference_ns / jflags_ns : 0.0);
+  }
+}
+
+// For the suite, which has nothing to compare with: the time per
+// operation, with so many synthetic flags, from so many threads.
+void ReportSuite(const char* name, int threads, double ns) {
+  if (JsonOutput()) {
+    printf("{\"benchmark\": \"%s\", \"flags\": %d, \"threads\": %d, "
+           "\"ns_per_op\": %.1f}\n", name, FLAGS_num_flags, threads, ns);
+  } else {
+    char label[64];
+    snprintf(label, sizeof(label), "%s/%d", name, threads);
+    printf("%-32s %12.1f ns\n", label, ns);
+  }
+}
+
+// How many times to run a benchmark that does ops_per_run operations
+// each time, for it to do about FLAGS_iterations of them.
+int32 RunsFor(size_t ops_per_run) {
+  const int32 runs = static_cast<int32>(FLAGS_iterations / (ops_per_run > 0 ? ops_per_run : 1));
+  return runs > 0 ? runs : 1;
+}
+
+// --------------------------------------------------------------------
+// FlagValue::ParseFrom()
+//    The reference parsers are what ParseFrom() did before it had its
+//    own parsing kernels: go through strtoll() and friends, then
+//    strlen() the text to check that all of it was used.
+// --------------------------------------------------------------------
+
+uint64 LibcParseBool(const char* value) {
+  const char* kTrue[] = { "1", "t", "true", "y", "yes" };
+  const char* kFalse[] = { "0", "f", "false", "n", "no" };
+  for (size_t i = 0; i < arraysize(kTrue); ++i) {
+    if (strcasecmp(value, kTrue[i]) == 0)
+      return 1;
+    else if (strcasecmp(value, kFalse[i]) == 0)
+      return 0;
+  }
+  return 2;
+}
+
+uint64 LibcParseInt64(const char* value) {
+  const int base = (value[0] == '0' && (value[1] == 'x' || value[1] == 'X'))
+      ? 16 : 10;
+  char* end;
+  errno = 0;
+  const int64 r = strtoll(value, &end, base);
+  if (errno || end != value + strlen(value))
+    return 0;
+  return static_cast<uint64>(r);
+}
+
+uint64 LibcParseDouble(const char* value) {
+  char* end;
+  errno = 0;
+  const double r = strtod(value, &end);
+  if (errno || end != value + strlen(value))
+    return 0;
+  return static_cast<uint64>(r * 1000);
+}
+
+template <typename T, FlagValue::ValueType kType>
+uint64 JflagsParse(const char* value) {
+  T result = T();
+  FlagValue flag_value(&result, kType, false);
+  flag_value.ParseFrom(value);
+  return static_cast<uint64>(result * 1000);
+}
+
+void BenchmarkParseFrom() {
+  const char* const kBools[] = { "true", "false", "1", "0", "yes", "no",
+                                 "t", "f" };
+  Report("ParseFrom(bool)",
+         NanosPerCall(LibcParseBool, kBools, arraysize(kBools)),
+         NanosPerCall(JflagsParse<bool, FlagValue::FV_BOOL>,
+                      kBools, arraysize(kBools)));
+
+  const char* const kInts[] = { "0", "42", "-17", "8080", "123456789",
+                                "0x7fffffff", "-9223372036854775808",
+                                "18446744073" };
+  Report("ParseFrom(int64)",
+         NanosPerCall(LibcParseInt64, kInts, arraysize(kInts)),
+         NanosPerCall(JflagsParse<int64, FlagValue::FV_INT64>,
+                      kInts, arraysize(kInts)));
+
+  const char* const kDoubles[] = { "0.5", "2.5", "3.14159", "-2.5e-3", "1e22",
+                                   "0.1", "100", "6.02214076e23" };
+  Report("ParseFrom(double)",
+         NanosPerCall(LibcParseDouble, kDoubles, arraysize(kDoubles)),
+         NanosPerCall(JflagsParse<double, FlagValue::FV_DOUBLE>,
+                      kDoubles, arraysize(kDoubles)));
+}
+
+// --------------------------------------------------------------------
+// ParseCommandLineNonHelpFlags()
+//    The reference is how ParseNewCommandLineFlags() used to move the
+//    program arguments to the end of argv: a memmove() of the rest of
+//    argv for each of them.  It doesn't even parse the flags, which
+//    the jflags side does, through the whole registry.
+// --------------------------------------------------------------------
+
+const int kArgvSize = 20000;
+const int kArgsPerFlag = 100;
+
+// One flag for every kArgsPerFlag - 1 program arguments.
+void MakeArgv(std::vector<std::string>* args) {
+  args->push_back("jflags_benchmark");
+  for (int i = 1; i < kArgvSize; ++i) {
+    char arg[32];
+    if (i % kArgsPerFlag == 0)
+      snprintf(arg, sizeof(arg), "--argv_benchmark_flag=%d", i);
+    else
+      snprintf(arg, sizeof(arg), "file%d", i);
+    args->push_back(arg);
+  }
+}
+
+uint64 MemmovePermute(int argc, char** argv) {
+  int first_nonopt = argc;
+  for (int i = 1; i < first_nonopt; i++) {
+    char* arg = argv[i];
+    if (arg[0] != '-' || arg[1] == '\0') {
+      memmove(argv + i, argv + i + 1, (argc - (i + 1)) * sizeof(argv[i]));
+      argv[argc - 1] = arg;
+      first_nonopt--;
+      i--;
+    }
+  }
+  return first_nonopt;
+}
+
+uint64 JflagsPermute(int argc, char** argv) {
+  return ParseCommandLineNonHelpFlags(&argc, &argv, true);
+}
+
+// Times fn over a fresh copy of argv each time, and returns
+// nanoseconds per argument.
+template <typename Fn>
+double NanosPerArg(Fn fn, const std::vector<std::string>& args, int32 runs) {
+  std::vector<char*> argv(args.size());
+  uint64 sink = 0;
+  double seconds = 0;
+  for (int32 i = 0; i < runs; ++i) {
+    for (size_t j = 0; j < args.size(); ++j)
+      argv[j] = const_cast<char*>(args[j].c_str());
+    const double start = Seconds();
+    sink += fn(static_cast<int>(argv.size()), &argv[0]);
+    seconds += Seconds() - start;
+  }
+  benchmark_sink = sink;
+  return seconds * 1e9 / (static_cast<double>(runs) * args.size());
+}
+
+void BenchmarkArgvPermutation() {
+  std::vector<std::string> args;
+  MakeArgv(&args);
+  const int32 runs = FLAGS_iterations / 100000 > 0
+      ? FLAGS_iterations / 100000 : 1;
+  char name[32];
+  snprintf(name, sizeof(name), "argv(%d args)", kArgvSize);
+  Report(name, NanosPerArg(MemmovePermute, args, runs),
+         NanosPerArg(JflagsPermute, args, runs));
+}
+
+// --------------------------------------------------------------------
+// The suite
+//    The synthetic flags are bools, int32s, doubles and strings in
+//    turn, named synthetic_flag_<n>, in files synthetic/dir<n>/
+//    file<n>.cc, a few files to a directory.  Their storage outlives
+//    the registry, which is only deleted at the end of main().
+// --------------------------------------------------------------------
+
+struct SyntheticFlags {
+  std::vector<std::string> names;
+  std::vector<std::string> filenames;
+  std::vector<std::string> settings;  // "--name=value", for argv
+  bool* bools;
+  int32* int32s;
+  double* doubles;
+  std::string* strings;
+};
+
+SyntheticFlags synthetic;
+
+void RegisterSyntheticFlags() {
+  const int n = FLAGS_num_flags > 0 ? FLAGS_num_flags : 1;
+  const int num_files = FLAGS_num_files > 0 ? FLAGS_num_files : 1;
+  synthetic.names.reserve(n);
+  synthetic.filenames.reserve(num_files);
+  for (int i = 0; i < num_files; ++i) {
+    char filename[64];
+    snprintf(filename, sizeof(filename), "synthetic/dir%d/file%d.cc",
+             i / 8, i);
+    synthetic.filenames.push_back(filename);
+  }
+  // Two of each, for the current and the default value.
+  synthetic.bools = new bool[2 * n];
+  synthetic.int32s = new int32[2 * n];
+  synthetic.doubles = new double[2 * n];
+  synthetic.strings = new std::string[2 * n];
+
+  const double start = Seconds();
+  for (int i = 0; i < n; ++i) {
+    char name[32];
+    snprintf(name, sizeof(name), "synthetic_flag_%d", i);
+    synthetic.names.push_back(name);
+    const char* const help = "A synthetic flag of the benchmark suite";
+    const char* const file = synthetic.filenames[i % num_files].c_str();
+    switch (i % 4) {
+      case 0:
+        synthetic.bools[2 * i] = synthetic.bools[2 * i + 1] = false;
+        FlagRegisterer(synthetic.names.back().c_str(), "bool", help, file,
+                       &synthetic.bools[2 * i], &synthetic.bools[2 * i + 1]);
+        synthetic.settings.push_back("--" + synthetic.names.back() + "=true");
+        break;
+      case 1:
+        synthetic.int32s[2 * i] = synthetic.int32s[2 * i + 1] = i;
+        FlagRegisterer(synthetic.names.back().c_str(), "int32", help, file,
+                       &synthetic.int32s[2 * i], &synthetic.int32s[2 * i + 1]);
+        synthetic.settings.push_back("--" + synthetic.names.back() + "=-42");
+        break;
+      case 2:
+        synthetic.doubles[2 * i] = synthetic.doubles[2 * i + 1] = 0.5;
+        FlagRegisterer(synthetic.names.back().c_str(), "double", help, file,
+                       &synthetic.doubles[2 * i],
+                       &synthetic.doubles[2 * i + 1]);
+        synthetic.settings.push_back("--" + synthetic.names.back() + "=2.5");
+        break;
+      default:
+        synthetic.strings[2 * i] = synthetic.strings[2 * i + 1] = name;
+        FlagRegisterer(synthetic.names.back().c_str(), "string", help, file,
+                       &synthetic.strings[2 * i],
+                       &synthetic.strings[2 * i + 1]);
+        synthetic.settings.push_back("--" + synthetic.names.back() +
+                                     "=some value");
+        break;
+    }
+  }
+  ReportSuite("FlagRegisterer", 1, (Seconds() - start) * 1e9 / n);
+}
+
+void DeleteSyntheticFlags() {
+  delete[] synthetic.bools;
+  delete[] synthetic.int32s;
+  delete[] synthetic.doubles;
+  delete[] synthetic.strings;
+}
+
+// Sends what's printed to stdout to the null device while it lives:
+// help and completions are timed, not read.
+class QuietStdout {
+ public:
+  QuietStdout() : saved_(-1) {
+    fflush(stdout);
+#if defined(OS_WINDOWS)
+    const int null_fd = _open("NUL", _O_WRONLY);
+    if (null_fd >= 0) {
+      saved_ = _dup(1);
+      _dup2(null_fd, 1);
+      _close(null_fd);
+    }
+#elif defined(HAVE_UNISTD_H)
+    const int null_fd = open("/dev/null", O_WRONLY);
+    if (null_fd >= 0) {
+      saved_ = dup(1);
+      dup2(null_fd, 1);
+      close(null_fd);
+    }
+#endif
+  }
+  ~QuietStdout() {
+    fflush(stdout);
+    if (saved_ < 0)
+      return;
+#if defined(OS_WINDOWS)
+    _dup2(saved_, 1);
+    _close(saved_);
+#elif defined(HAVE_UNISTD_H)
+    dup2(saved_, 1);
+    close(saved_);
+#endif
+  }
+
+ private:
+  int saved_;
+};
+
+// Lets HandleCommandLineHelpFlags() return, rather than exit.
+void DontExit(int) {
+}
+
+void BenchmarkParseCommandLineFlags() {
+  std::vector<char*> argv(synthetic.settings.size() + 1);
+  const int32 runs = RunsFor(synthetic.settings.size());
+  double seconds = 0;
+  for (int32 i = 0; i < runs; ++i) {
+    argv[0] = const_cast<char*>("jflags_benchmark");
+    for (size_t j = 0; j < synthetic.settings.size(); ++j)
+      argv[j + 1] = const_cast<char*>(synthetic.settings[j].c_str());
+    int argc = static_cast<int>(argv.size());
+    char** args = &argv[0];
+    FlagSaver fs;
+    const double start = Seconds();
+    ParseCommandLineFlags(&argc, &args, true);
+    seconds += Seconds() - start;
+  }
+  ReportSuite("ParseCommandLineFlags", 1,
+              seconds * 1e9 / (static_cast<double>(runs) * synthetic.settings.size()));
+}
+
+void BenchmarkFlagfile() {
+  const std::string filename = FLAGS_benchmark_tmpdir + "/jflags_benchmark.flags";
+  FILE* fp = fopen(filename.c_str(), "w");
+  if (fp == NULL) {
+    fprintf(stderr, "Can't write %s: %s\n", filename.c_str(), strerror(errno));
+    return;
+  }
+  for (size_t i = 0; i < synthetic.settings.size(); ++i)
+    fprintf(fp, "%s\n", synthetic.settings[i].c_str());
+  fclose(fp);
+
+  const int32 runs = RunsFor(synthetic.settings.size());
+  double seconds = 0;
+  for (int32 i = 0; i < runs; ++i) {
+    FlagSaver fs;
+    const double start = Seconds();
+    ReadFromFlagsFile(filename, GetArgv0(), true);
+    seconds += Seconds() - start;
+  }
+  remove(filename.c_str());
+  ReportSuite("ReadFromFlagsFile", 1,
+              seconds * 1e9 / (static_cast<double>(runs) * synthetic.settings.size()));
+}
+
+#if defined(HAVE_PTHREAD) && !defined(NO_THREADS)
+
+struct LookupThread {
+  pthread_t thread;
+  size_t first;  // where in synthetic.names it starts
+  uint64 found;
+};
+
+void* RunLookups(void* arg) {
+  LookupThread* const t = static_cast<LookupThread*>(arg);
+  const size_t n = synthetic.names.size();
+  std::string value;
+  for (int32 i = 0; i < FLAGS_iterations; ++i) {
+    if (GetCommandLineOption(synthetic.names[(t->first + i) % n].c_str(), &value))
+      ++t->found;
+  }
+  return NULL;
+}
+
+// The lookups from the threads, all together, per second.
+void BenchmarkGetCommandLineOption() {
+  for (int threads = 1; threads <= FLAGS_max_threads; threads *= 2) {
+    std::vector<LookupThread> t(threads);
+    const double start = Seconds();
+    for (int i = 0; i < threads; ++i) {
+      t[i].first = i * synthetic.names.size() / threads;
+      t[i].found = 0;
+      pthread_create(&t[i].thread, NULL, &RunLookups, &t[i]);
+    }
+    uint64 found = 0;
+    for (int i = 0; i < threads; ++i) {
+      pthread_join(t[i].thread, NULL);
+      found += t[i].found;
+    }
+    const double seconds = Seconds() - start;
+    benchmark_sink = found;
+    ReportSuite("GetCommandLineOption", threads,
+                seconds * 1e9 / (static_cast<double>(FLAGS_iterations) * threads));
+  }
+}
+
+#else  // no threads
+
+void BenchmarkGetCommandLineOption() {
+  const size_t n = synthetic.names.size();
+  std::string value;
+  uint64 found = 0;
+  const double start = Seconds();
+  for (int32 i = 0; i < FLAGS_iterations; ++i)
+    found += GetCommandLineOption(synthetic.names[i % n].c_str(), &value);
+  benchmark_sink = found;
+  ReportSuite("GetCommandLineOption", 1,
+              (Seconds() - start) * 1e9 / FLAGS_iterations);
+}
+
+#endif
+
+void BenchmarkSetCommandLineOption() {
+  const size_t n = synthetic.names.size();
+  FlagSaver fs;
+  uint64 sink = 0;
+  const double start = Seconds();
+  for (int32 i = 0; i < FLAGS_iterations; ++i) {
+    // Every setting with its flag's own "=value" cut off.
+    const std::string& setting = synthetic.settings[i % n];
+    const size_t equals = setting.find('=');
+    sink += SetCommandLineOption(synthetic.names[i % n].c_str(),
+                                 setting.c_str() + equals + 1).size();
+  }
+  benchmark_sink = sink;
+  ReportSuite("SetCommandLineOption", 1,
+              (Seconds() - start) * 1e9 / FLAGS_iterations);
+}
+
+void BenchmarkFlagSaver() {
+  const int32 runs = RunsFor(synthetic.names.size());
+  const double start = Seconds();
+  for (int32 i = 0; i < runs; ++i) {
+    FlagSaver fs;
+  }
+  ReportSuite("FlagSaver", 1, (Seconds() - start) * 1e9 / runs);
+}
+
+void BenchmarkGetAllFlags() {
+  const int32 runs = RunsFor(synthetic.names.size());
+  uint64 sink = 0;
+  const double start = Seconds();
+  for (int32 i = 0; i < runs; ++i) {
+    std::vector<CommandLineFlagInfo> flags;
+    GetAllFlags(&flags);
+    sink += flags.size();
+  }
+  benchmark_sink = sink;
+  ReportSuite("GetAllFlags", 1, (Seconds() - start) * 1e9 / runs);
+}
+
+// The help and completions, printed to nowhere.
+void BenchmarkReporting() {
+  const int32 runs = RunsFor(synthetic.names.size());
+  double usage_seconds, xml_seconds, completion_seconds;
+  {
+    QuietStdout quiet;
+    double start = Seconds();
+    for (int32 i = 0; i < runs; ++i)
+      ShowUsageWithFlags(GetArgv0());
+    usage_seconds = Seconds() - start;
+
+    void (*const exitfunc)(int) = jflags_exitfunc;
+    jflags_exitfunc = &DontExit;
+    FlagSaver fs;
+    FLAGS_helpxml = true;
+    start = Seconds();
+    for (int32 i = 0; i < runs; ++i)
+      HandleCommandLineHelpFlags();
+    xml_seconds = Seconds() - start;
+    FLAGS_helpxml = false;
+
+    FLAGS_tab_completion_word = "--synthetic_flag_1";
+    start = Seconds();
+    for (int32 i = 0; i < runs; ++i)
+      HandleCommandLineHelpFlags();
+    completion_seconds = Seconds() - start;
+    jflags_exitfunc = exitfunc;
+  }
+  ReportSuite("ShowUsageWithFlags", 1, usage_seconds * 1e9 / runs);
+  ReportSuite("helpxml", 1, xml_seconds * 1e9 / runs);
+  ReportSuite("tab_completion", 1, completion_seconds * 1e9 / runs);
+}
+
+void RunSuite() {
+  if (!JsonOutput())
+    printf("\n%-32s %15s\n", "suite (benchmark/threads)", "time per op");
+  RegisterSyntheticFlags();
+  BenchmarkParseCommandLineFlags();
+  BenchmarkFlagfile();
+  BenchmarkGetCommandLineOption();
+  BenchmarkSetCommandLineOption();
+  BenchmarkFlagSaver();
+  BenchmarkGetAllFlags();
+  BenchmarkReporting();
+}
+
+}  // namespace
+}  // namespace JFLAGS_NAMESPACE
+
+int main(int argc, char** argv) {
+  JFLAGS_NAMESPACE::SetUsageMessage("Microbenchmarks for jflags internals");
+  JFLAGS_NAMESPACE::ParseCommandLineFlags(&argc, &argv, true);
+
+  if (!JFLAGS_NAMESPACE::JsonOutput())
+    printf("%-24s %13s %13s %9s\n", "benchmark", "reference", "jflags",
+           "speedup");
+  JFLAGS_NAMESPACE::BenchmarkParseFrom();
+  JFLAGS_NAMESPACE::BenchmarkArgvPermutation();
+  JFLAGS_NAMESPACE::RunSuite();
+
+  JFLAGS_NAMESPACE::ShutDownCommandLineFlags();
+  JFLAGS_NAMESPACE::DeleteSyntheticFlags();
+  return 0;
+}
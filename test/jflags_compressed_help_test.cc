@@ -0,0 +1,41 @@
+////////////////////////////////////////////////////////////////////////////////
+//                                    jflags
+//
+// This file is distributed under the 3-clause Berkeley Software Distribution
+// License. See LICENSE.txt for details.
+////////////////////////////////////////////////////////////////////////////////
+//
+// A simple program built with jflags_compress_help(), which defines
+// COMPRESS_FLAG_HELP.  The tests check that --help still shows the help,
+// and that the help isn't in the binary as is.  It prints the help of
+// its flags as GetCommandLineFlagInfo() has it.
+
+#include <jflags/jflags.h>
+
+#include <stdio.h>
+
+using JFLAGS_NAMESPACE::SetUsageMessage;
+using JFLAGS_NAMESPACE::ParseCommandLineFlags;
+using JFLAGS_NAMESPACE::GetCommandLineFlagInfoOrDie;
+
+DEFINE_bool(packed_bool, false, "This help text is to be packed");
+DEFINE_int32(packed_int32, 1, "This help text " /* is */ "is to be "
+                              "\"packed\" as\tone");
+DEFINE_atomic_int64(packed_atomic_int64, 2, "An atomic flag's help, packed too");
+DEFINE_string(packed_string, "a, b", "Help (after, a value, with commas)");
+
+// Passed by the tests, like to all the test programs.
+DEFINE_string(test_tmpdir, "", "Dir we use for temp files");
+DEFINE_string(srcdir, "", "Source-dir root");
+
+int main(int argc, char** argv) {
+  SetUsageMessage("Usage message");
+  ParseCommandLineFlags(&argc, &argv, true);
+
+  const char* const kFlags[] = {
+    "packed_bool", "packed_int32", "packed_atomic_int64", "packed_string"
+  };
+  for (size_t i = 0; i < sizeof(kFlags) / sizeof(kFlags[0]); ++i)
+    printf("%s: %s\n", kFlags[i], GetCommandLineFlagInfoOrDie(kFlags[i]).description.c_str());
+  return 0;
+}
@@ -0,0 +1,56 @@
+////////////////////////////////////////////////////////////////////////////////
+//                                    jflags
+//
+// This file is distributed under the 3-clause Berkeley Software Distribution
+// License. See LICENSE.txt for details.
+////////////////////////////////////////////////////////////////////////////////
+//
+// A simple program that uses JFLAGS_FLAG_TABLE.  It prints the flags
+// it's given, for the tests to check that they were all registered,
+// whether they went in the flag table or not.
+
+#define JFLAGS_FLAG_TABLE 1
+#include <jflags/jflags.h>
+
+#include <stdio.h>
+
+using JFLAGS_NAMESPACE::SetUsageMessage;
+using JFLAGS_NAMESPACE::ParseCommandLineFlags;
+using JFLAGS_NAMESPACE::SetCommandLineOption;
+
+DEFINE_bool(table_bool, false, "A bool in the flag table");
+DEFINE_int32(table_int32, 1, "An int32 in the flag table");
+DEFINE_uint64(table_uint64, 2, "A uint64 in the flag table");
+DEFINE_double(table_double, 0.5, "A double in the flag table");
+DEFINE_atomic_int64(table_atomic_int64, 3, "An atomic int64 in the flag table");
+DEFINE_string(table_string, "registered", "A string, registered the usual way");
+
+// Passed by the tests, like to all the test programs.
+DEFINE_string(test_tmpdir, "", "Dir we use for temp files");
+DEFINE_string(srcdir, "", "Source-dir root");
+
+static bool IsPositive(const char*, JFLAGS_NAMESPACE::int32 value) {
+  return value > 0;
+}
+DEFINE_validator(table_int32, &IsPositive);
+
+int main(int argc, char** argv) {
+  SetUsageMessage("Usage message");
+  ParseCommandLineFlags(&argc, &argv, true);
+
+  // Validators and lookups by name work for the table's flags too.
+  if (!SetCommandLineOption("table_int32", "-1").empty())
+    return 1;
+
+  printf("table_bool=%d table_int32=%d table_uint64=%llu table_double=%g "
+         "table_atomic_int64=%lld table_string=%s\n",
+         FLAGS_table_bool, FLAGS_table_int32,
+         static_cast<unsigned long long>(FLAGS_table_uint64),
+         FLAGS_table_double,
+         static_cast<long long>(FLAGS_table_atomic_int64.load()),
+         FLAGS_table_string.c_str());
+
+  // Frees the flags of the table along with the rest.
+  JFLAGS_NAMESPACE::ShutDownCommandLineFlags();
+  return 0;
+}
@@ -0,0 +1,57 @@
+////////////////////////////////////////////////////////////////////////////////
+//                                    jflags
+//
+// This file is distributed under the 3-clause Berkeley Software Distribution
+// License. See LICENSE.txt for details.
+////////////////////////////////////////////////////////////////////////////////
+//
+// A program whose flags get registered after ParseCommandLineFlags(),
+// like those of a plugin that's dlopen()ed late, and picked up by
+// ReparseCommandLineNonHelpFlags().  It prints what the flags end up
+// set to, for the tests to check.
+
+#include <jflags/jflags.h>
+
+#include <stdio.h>
+#include <string>
+
+using JFLAGS_NAMESPACE::FlagRegisterer;
+using JFLAGS_NAMESPACE::int32;
+
+DEFINE_int32(early, 0, "Defined from the start");
+
+// Passed by the tests, like to all the test programs.
+DEFINE_string(test_tmpdir, "", "Dir we use for temp files");
+DEFINE_string(srcdir, "", "Source-dir root");
+
+// The flags of the "plugins".  They must outlive the registry.
+static int32 late_int32 = 0, late_int32_default = 0;
+static std::string late_string("unset"), late_string_default("unset");
+static bool late_bool = false, late_bool_default = false;
+
+int main(int argc, char** argv) {
+  JFLAGS_NAMESPACE::AllowCommandLineReparsing();
+  JFLAGS_NAMESPACE::ParseCommandLineFlags(&argc, &argv, true);
+
+  // Set in the meantime: reparsing mustn't set it back to what argv has.
+  FLAGS_early = -1;
+
+  FlagRegisterer late1("late_int32", "int32", "A late int32",
+                       "jflags_reparse_test.cc", &late_int32,
+                       &late_int32_default);
+  JFLAGS_NAMESPACE::ReparseCommandLineNonHelpFlags();
+
+  FlagRegisterer late2("late_string", "string", "A late string",
+                       "jflags_reparse_test.cc", &late_string,
+                       &late_string_default);
+  FlagRegisterer late3("late_bool", "bool", "A late bool",
+                       "jflags_reparse_test.cc", &late_bool,
+                       &late_bool_default);
+  JFLAGS_NAMESPACE::ReparseCommandLineNonHelpFlags();
+
+  printf("early=%d late_int32=%d late_string=%s late_bool=%d\n",
+         FLAGS_early, late_int32, late_string.c_str(), late_bool);
+
+  JFLAGS_NAMESPACE::ShutDownCommandLineFlags();
+  return 0;
+}
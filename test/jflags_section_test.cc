@@ -0,0 +1,53 @@
+////////////////////////////////////////////////////////////////////////////////
+//                                    jflags
+//
+// This file is distributed under the 3-clause Berkeley Software Distribution
+// License. See LICENSE.txt for details.
+////////////////////////////////////////////////////////////////////////////////
+//
+// A program that applies a flagfile with a section per program twice,
+// from the flagfile cache: once before ParseCommandLineFlags() tells
+// jflags its name, and once after.  Each line of the file remembers
+// whether it matched the program, which must not outlive the name it
+// was matched against.  It prints what the flags were set to each
+// time, for the tests to check.
+
+#include <jflags/jflags.h>
+
+#include <stdio.h>
+#include <string.h>
+#include <string>
+
+DEFINE_int32(everyone, 0, "Set before any section");
+DEFINE_int32(this_program, 0, "Set in the section of this program");
+DEFINE_int32(other_program, 0, "Set in the section of another program");
+
+// Passed by the tests, like to all the test programs.
+DEFINE_string(test_tmpdir, "", "Dir we use for temp files");
+DEFINE_string(srcdir, "", "Source-dir root");
+
+static void ResetFlags() {
+  FLAGS_everyone = FLAGS_this_program = FLAGS_other_program = 0;
+}
+
+int main(int argc, char** argv) {
+  // --srcdir is needed before the flags are parsed.
+  std::string flagfile("flagfile.sections");
+  for (int i = 1; i < argc; ++i)
+    if (strncmp(argv[i], "--srcdir=", 9) == 0)
+      flagfile = std::string(argv[i] + 9) + "/flagfile.sections";
+
+  JFLAGS_NAMESPACE::EnableFlagfileCache(true);
+  JFLAGS_NAMESPACE::SetCommandLineOption("flagfile", flagfile.c_str());
+  printf("before: everyone=%d this_program=%d other_program=%d\n",
+         FLAGS_everyone, FLAGS_this_program, FLAGS_other_program);
+
+  JFLAGS_NAMESPACE::ParseCommandLineFlags(&argc, &argv, true);
+  ResetFlags();
+  JFLAGS_NAMESPACE::SetCommandLineOption("flagfile", flagfile.c_str());
+  printf("after: everyone=%d this_program=%d other_program=%d\n",
+         FLAGS_everyone, FLAGS_this_program, FLAGS_other_program);
+
+  JFLAGS_NAMESPACE::ShutDownCommandLineFlags();
+  return 0;
+}
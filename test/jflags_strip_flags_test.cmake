@@ -1,7 +1,10 @@
 if (NOT BINARY)
   message (FATAl_ERROR "BINARY file to check not specified!")
 endif ()
-file (STRINGS "${BINARY}" strings REGEX "This text should be stripped out")
+if (NOT TEXT)
+  set (TEXT "This text should be stripped out")
+endif ()
+file (STRINGS "${BINARY}" strings REGEX "${TEXT}")
 if (strings)
   message (FATAL_ERROR "Text not stripped from binary like it should be: ${BINARY}")
 endif ()
\ No newline at end of file
@@ -21,6 +21,13 @@
 #ifdef HAVE_UNISTD_H
 #  include <unistd.h>   // for unlink()
 #endif
+#if defined(HAVE_PTHREAD) && !defined(NO_THREADS)
+#  include <pthread.h>
+#endif
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || __GLIBC_MINOR__ >= 33)
+#  include <malloc.h>   // for mallinfo2()
+#  define HAVE_MALLINFO2
+#endif
 #include <vector>
 #include <string>
 TEST_INIT
@@ -48,6 +55,7 @@ DEFINE_string(test_tmpdir, "", "Dir we use for temp files");
 DEFINE_string(srcdir, StringFromEnv("SRCDIR", "."), "Source-dir root, needed to find jflags_unittest_flagfile");
 
 DECLARE_string(tryfromenv);   // in jflags.cc
+DECLARE_string(tab_completion_export);  // in jflags_completions.cc
 
 DEFINE_bool(test_bool, false, "tests bool-ness");
 DEFINE_int32(test_int32, -1, "");
@@ -56,6 +64,10 @@ DEFINE_uint32(test_uint32, 1, "");
 DEFINE_uint64(test_uint64, 2, "");
 DEFINE_double(test_double, -1.0, "");
 DEFINE_string(test_string, "initial", "");
+DEFINE_atomic_bool(test_atomic_bool, true, "");
+DEFINE_atomic_int64(test_atomic_int64, -3, "");
+DEFINE_atomic_double(test_atomic_double, 0.5, "");
+DEFINE_atomic_string(test_atomic_string, "first", "");
 
 //
 // The below ugliness gets some additional code coverage in the -helpxml
@@ -119,6 +131,12 @@ static bool AlwaysFail(const char* flag, bool value) { return value == false; }
 DEFINE_bool(always_fail, false, "will fail to validate when you set it");
 DEFINE_validator(always_fail, AlwaysFail);
 
+// Flags that declare the values they allow
+DEFINE_int32(test_ranged, 5, "used for testing the allowed values");
+DEFINE_range(test_ranged, 1, 10);
+DEFINE_string(test_mode, "fast", "used for testing the allowed values");
+DEFINE_allowed_values(test_mode, "fast,safe,auto");
+
 // See the comment by GetAllFlags in jflags.h
 static bool DeadlockIfCantLockInValidators(const char* flag, bool value) {
   if (!value) {
@@ -336,6 +354,41 @@ TEST(FlagFileTest, ReadFlagsFromString) {
       123.0);
 }
 
+// Tests that Windows and Unix line endings can be mixed.
+TEST(FlagFileTest, ReadFlagsFromStringLineEndings) {
+  TestFlagString(
+      // Flag string
+      "-test_string=windows\r\n"
+      "# a comment\r\n"
+      "\r\n"
+      "--test_bool=true\n"
+      "-test_int32=7\r"
+      "-test_double=7.5",
+      // Expected values
+      "windows",
+      true,
+      7,
+      7.5);
+}
+
+// Tests lines, and runs of whitespace, longer than what the tokenizer
+// looks at in one go.
+TEST(FlagFileTest, ReadFlagsFromStringLongLines) {
+  TestFlagString(
+      // Flag string
+      "                                 \t\v\f\r\n"
+      "-test_string=a value that goes on for a while, = and all\n"
+      "#                             a long comment -test_int32=1\n"
+      "\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t--test_bool\r\n"
+      "                  -test_int32=0000000000000000000000000000042\n"
+      "-test_double=0.25",
+      // Expected values
+      "a value that goes on for a while, = and all",
+      true,
+      42,
+      0.25);
+}
+
 // Tests the filename part of the flagfile
 TEST(FlagFileTest, FilenamesOurfileLast) {
   FLAGS_test_string = "initial";
@@ -606,6 +659,71 @@ TEST(SetFlagValueTest, IllegalValues) {
 }
 
 
+// Tests that numbers parse to exactly what libc makes of them, right at
+// the limits of each type, and for doubles, every last bit.
+TEST(SetFlagValueTest, ParsesLikeLibc) {
+  const char* const kIntegers[] = {
+    "0", "-0", "+7", " 42", "\t-42", "2147483647", "-2147483648",
+    "2147483648", "-2147483649", "4294967295", "4294967296",
+    "9223372036854775807", "-9223372036854775808", "9223372036854775808",
+    "18446744073709551615", "18446744073709551616", "0x7fffffff",
+    "0xFFFFFFFFFFFFFFFF", "0x10000000000000000", "0x", "00012", "1 ", "1x",
+    "-", "+", "--1", "0x-1",
+  };
+  for (size_t i = 0; i < arraysize(kIntegers); ++i) {
+    const char* text = kIntegers[i];
+    const int base = (text[0] == '0' && (text[1] == 'x' || text[1] == 'X'))
+        ? 16 : 10;
+    char* end;
+    errno = 0;
+    const long long r = strtoll(text, &end, base);
+    const bool ok = errno == 0 && *end == '\0';
+    FLAGS_test_int64 = 12345;
+    EXPECT_EQ(ok, !SetCommandLineOption("test_int64", text).empty());
+    EXPECT_EQ(ok ? r : 12345, FLAGS_test_int64);
+    FLAGS_test_int32 = 12345;
+    EXPECT_EQ(ok && r == static_cast<int32>(r),
+              !SetCommandLineOption("test_int32", text).empty());
+
+    errno = 0;
+    const unsigned long long u = strtoull(text, &end, base);
+    const bool uok = errno == 0 && *end == '\0' && !strchr(text, '-');
+    FLAGS_test_uint64 = 12345;
+    EXPECT_EQ(uok, !SetCommandLineOption("test_uint64", text).empty());
+    EXPECT_EQ(uok ? u : 12345, FLAGS_test_uint64);
+  }
+
+  const char* const kDoubles[] = {
+    "0", "-0", "0.1", "0.3", "2.5", "-17.25", "3.14159265358979",
+    "1e22", "1e23", "1e-22", "9007199254740993", "123456789012345678901",
+    "0.000001", "1.7976931348623157e308", "4.9e-324", "2.2250738585072014e-308",
+    "1e-400", "1e400", "0e999999", ".5", "5.", "1e", "1e+", "1.5e-3",
+    "0x1p3", " 7", "7 ", "1,5", "+.e1",
+  };
+  for (size_t i = 0; i < arraysize(kDoubles); ++i) {
+    const char* text = kDoubles[i];
+    char* end;
+    errno = 0;
+    const double d = strtod(text, &end);
+    const bool ok = errno == 0 && *end == '\0';
+    FLAGS_test_double = 12345;
+    EXPECT_EQ(ok, !SetCommandLineOption("test_double", text).empty());
+    const double expected = ok ? d : 12345;
+    EXPECT_EQ(0, memcmp(&expected, &FLAGS_test_double, sizeof(expected)));
+  }
+
+  const char* const kTrue[] = { "1", "t", "T", "true", "TrUe", "y", "yes" };
+  const char* const kNotBools[] = { "", "2", "\x11", "tru", "truee", "yess",
+                                    "on", " 1", "0 " };
+  for (size_t i = 0; i < arraysize(kTrue); ++i) {
+    FLAGS_test_bool = false;
+    EXPECT_FALSE(SetCommandLineOption("test_bool", kTrue[i]).empty());
+    EXPECT_TRUE(FLAGS_test_bool);
+  }
+  for (size_t i = 0; i < arraysize(kNotBools); ++i)
+    EXPECT_EQ("", SetCommandLineOption("test_bool", kNotBools[i]));
+}
+
 // Tests that we only evaluate macro args once
 TEST(MacroArgs, EvaluateOnce) {
   EXPECT_EQ(13, FLAGS_changeable_var);
@@ -843,6 +961,41 @@ TEST(FlagSaverTest, CanSaveVariousTypedFlagValues) {
   EXPECT_EQ("good", FLAGS_test_string);
 }
 
+// Tests that nested FlagSavers, which save against the same snapshot
+// of the flags, each restore the states from when they were created.
+TEST(FlagSaverTest, NestedSaversRestoreTheirOwnStates) {
+  FLAGS_test_int32 = 1;
+  FLAGS_test_double = 1.5;
+  FLAGS_test_uint32 = 1;
+  {
+    FlagSaver outer;
+    FLAGS_test_int32 = 2;
+    SetCommandLineOptionWithMode("test_string", "changed default",
+                                 SET_FLAGS_DEFAULT);
+    {
+      FlagSaver inner;
+      FLAGS_test_int32 = 3;
+      EXPECT_FALSE(SetCommandLineOption("test_double", "3.5").empty());
+      {
+        FlagSaver discarded;
+        FLAGS_test_uint32 = 4;
+        discarded.discard();
+      }
+      EXPECT_EQ(4, FLAGS_test_uint32);
+    }
+    EXPECT_EQ(2, FLAGS_test_int32);
+    EXPECT_EQ(1.5, FLAGS_test_double);
+    EXPECT_EQ(1, FLAGS_test_uint32);
+    EXPECT_EQ("changed default", FLAGS_test_string);
+  }
+  EXPECT_EQ(1, FLAGS_test_int32);
+  EXPECT_NE("changed default", FLAGS_test_string);
+
+  CommandLineFlagInfo info;
+  EXPECT_TRUE(GetCommandLineFlagInfo("test_string", &info));
+  EXPECT_NE("changed default", info.default_value);
+}
+
 TEST(GetAllFlagsTest, BaseTest) {
   vector<CommandLineFlagInfo> flags;
   GetAllFlags(&flags);
@@ -860,6 +1013,108 @@ TEST(GetAllFlagsTest, BaseTest) {
   EXPECT_TRUE(found_test_bool);
 }
 
+class InfoCollector : public FlagVisitor {
+ public:
+  virtual void Visit(const FlagDescriptor& flag) {
+    CommandLineFlagInfo info;
+    info.name = flag.name;
+    info.type = flag.type;
+    info.description = flag.description;
+    flag.AppendCurrentValueTo(&info.current_value);
+    flag.AppendDefaultValueTo(&info.default_value);
+    info.filename = flag.filename;
+    info.has_validator_fn = flag.has_validator_fn;
+    info.constraint = flag.constraint;
+    info.is_default = flag.is_default;
+    info.flag_ptr = flag.flag_ptr;
+    infos.push_back(info);
+
+    char buf[8];
+    const size_t size = flag.FormatCurrentValue(buf, sizeof(buf));
+    EXPECT_EQ(info.current_value.size(), size);
+    EXPECT_EQ(info.current_value.substr(0, sizeof(buf) - 1), string(buf));
+  }
+  vector<CommandLineFlagInfo> infos;
+};
+
+TEST(ForEachFlagTest, VisitsWhatGetAllFlagsReturns) {
+  FLAGS_test_int32 = 119;
+  for (int pass = 0; pass < 2; ++pass) {  // the second time, from the cache
+    vector<CommandLineFlagInfo> flags;
+    GetAllFlags(&flags);
+    InfoCollector collector;
+    ForEachFlag(&collector);
+    EXPECT_EQ(flags.size(), collector.infos.size());
+    for (size_t i = 0; i < flags.size() && i < collector.infos.size(); ++i) {
+      const CommandLineFlagInfo& a = flags[i];
+      const CommandLineFlagInfo& b = collector.infos[i];
+      EXPECT_EQ(a.name, b.name);
+      EXPECT_EQ(a.type, b.type);
+      EXPECT_EQ(a.description, b.description);
+      EXPECT_EQ(a.current_value, b.current_value);
+      EXPECT_EQ(a.default_value, b.default_value);
+      EXPECT_EQ(a.filename, b.filename);
+      EXPECT_EQ(a.has_validator_fn, b.has_validator_fn);
+      EXPECT_EQ(a.constraint, b.constraint);
+      EXPECT_EQ(a.is_default, b.is_default);
+      EXPECT_EQ(a.flag_ptr, b.flag_ptr);
+    }
+  }
+}
+
+class CountingFlagSink : public FlagSink {
+ public:
+  CountingFlagSink() : writes(0) {}
+  virtual void Write(const char* data, size_t size) {
+    text.append(data, size);
+    ++writes;
+  }
+  string text;
+  int writes;
+};
+
+TEST(WriteAllFlagsTest, WritesWhatGetAllFlagsReturns) {
+  FLAGS_test_double = 0.1;
+  FLAGS_test_string = string(10000, 'x');  // longer than WriteAllFlags' buffer
+  vector<CommandLineFlagInfo> flags;
+  GetAllFlags(&flags);
+  string expected;
+  for (vector<CommandLineFlagInfo>::const_iterator i = flags.begin();
+       i != flags.end(); ++i)
+    expected += "--" + i->name + "=" + i->current_value + "\n";
+
+  CountingFlagSink sink;
+  WriteAllFlags(&sink);
+  EXPECT_EQ(expected, sink.text);
+  EXPECT_NE(string::npos, sink.text.find("\n--test_double=0.1\n"));
+  // Buffered, rather than a write per line.
+  EXPECT_LT(sink.writes, static_cast<int>(flags.size() / 4));
+  EXPECT_EQ(expected, CommandlineFlagsIntoString());
+}
+
+TEST(DescribeOneFlagTest, WrapsAndQuotes) {
+  CommandLineFlagInfo info;
+  info.name = "some_flag";
+  info.type = "string";
+  info.description = "a description that is long enough that it has to be "
+                     "wrapped onto a second line";
+  info.default_value = "x&y";
+  info.current_value = "z";
+  info.is_default = false;
+  EXPECT_EQ("    -some_flag (a description that is long enough that it has "
+            "to be wrapped\n"
+            "      onto a second line) type: string default: \"x&y\" "
+            "currently: \"z\"\n",
+            DescribeOneFlag(info));
+  info.type = "int32";
+  info.description = "short";
+  info.constraint = "[0, 9]";
+  info.default_value = "1";
+  info.is_default = true;
+  EXPECT_EQ("    -some_flag (short) type: int32 allowed: [0, 9] default: 1\n",
+            DescribeOneFlag(info));
+}
+
 TEST(ShowUsageWithFlagsTest, BaseTest) {
   // TODO(csilvers): test this by allowing output other than to stdout.
   // Not urgent since this functionality is tested via
@@ -894,8 +1149,13 @@ TEST(GetArgv0Test, BaseTest) {
 
 TEST(GetArgvSumTest, BaseTest) {
   // This number is just the sum of the ASCII values of all the chars
-  // in GetArgv().
-  EXPECT_EQ(4904, GetArgvSum());
+  // in GetArgv(), "/test/argv/for/jflags_unittest argv 2 3rd argv
+  // argv #4" (it was 4904 back when the program was gflags_unittest).
+  EXPECT_EQ(4907, GetArgvSum());
+  uint32 sum = 0;
+  for (const char* c = GetArgv(); *c != '\0'; ++c)
+    sum += static_cast<unsigned char>(*c);
+  EXPECT_EQ(sum, GetArgvSum());
 }
 
 TEST(ProgramInvocationNameTest, BaseTest) {
@@ -966,6 +1226,315 @@ TEST(GetCommandLineOptionTest, NameDoesNotExist) {
   EXPECT_EQ("will not be changed", value);
 }
 
+TEST(GetCommandLineOptionIntoTest, BaseTest) {
+  FLAGS_test_int32 = 400;
+  char buf[8] = "xxxxxxx";
+  EXPECT_TRUE(GetCommandLineOptionInto("test_int32", buf, sizeof(buf)));
+  EXPECT_STREQ("400", buf);
+
+  FLAGS_test_string = "a longer string";
+  EXPECT_FALSE(GetCommandLineOptionInto("test_string", buf, sizeof(buf)));
+  EXPECT_FALSE(GetCommandLineOptionInto("test_int3210", buf, sizeof(buf)));
+}
+
+TEST(GetFlagValueTest, TypedValues) {
+  FLAGS_test_int64 = -1234567890123LL;
+  FLAGS_test_double = 0.25;
+  FLAGS_test_string = "typed";
+  int64 i64 = 0;
+  EXPECT_TRUE(GetFlagValue("test_int64", &i64));
+  EXPECT_EQ(-1234567890123LL, i64);
+  EXPECT_EQ(0.25, GetFlagValue<double>("test_double"));
+  EXPECT_EQ("typed", GetFlagValue<string>("test_string"));
+  EXPECT_FALSE(GetFlagValue<bool>("test_bool", true));
+
+  // The type must match exactly, and unknown names leave OUTPUT alone.
+  int32 i32 = 17;
+  EXPECT_FALSE(GetFlagValue("test_int64", &i32));
+  EXPECT_FALSE(GetFlagValue("test_int3210", &i32));
+  EXPECT_EQ(17, i32);
+  EXPECT_EQ(17, GetFlagValue<int32>("test_int3210", 17));
+}
+
+TEST(GetFlagValueTest, SharedStrings) {
+  FLAGS_test_string = "shared";
+  AtomicStringFlag::Snapshot first;
+  AtomicStringFlag::Snapshot second;
+  EXPECT_TRUE(GetFlagValue("test_string", &first));
+  EXPECT_TRUE(GetFlagValue("test_string", &second));
+  EXPECT_EQ("shared", *first);
+  EXPECT_EQ(&*first, &*second);  // the flag hasn't changed: no new copy
+  EXPECT_FALSE(GetFlagValue("test_int32", &first));
+
+  // A snapshot keeps its value, whichever way the flag changes.
+  SetCommandLineOption("test_string", "set");
+  EXPECT_TRUE(GetFlagValue("test_string", &second));
+  EXPECT_EQ("shared", *first);
+  EXPECT_EQ("set", *second);
+  FLAGS_test_string = "assigned";
+  EXPECT_TRUE(FlagHandle("test_string").Get(&second));
+  EXPECT_EQ("assigned", *second);
+  {
+    FlagSaver fs;
+    SetCommandLineOption("test_string", "saved over");
+    EXPECT_EQ("assigned", *second);
+  }
+  EXPECT_EQ("assigned", FLAGS_test_string);
+  EXPECT_EQ("shared", *first);
+}
+
+#ifdef HAVE_MALLINFO2
+// Each value the flag is read with replaces the one it shared before,
+// which must then go: reading a big flag over and over mustn't pile up
+// its old values, even with a snapshot of the last one alive.
+TEST(GetFlagValueTest, SharedStringsDontPileUp) {
+  const size_t kValueSize = 1 << 20;
+  AtomicStringFlag::Snapshot snapshot;
+  FLAGS_test_string = string(kValueSize, 'a');
+  EXPECT_TRUE(GetFlagValue("test_string", &snapshot));
+  const size_t before = mallinfo2().uordblks;
+  for (int i = 0; i < 50; ++i) {
+    FLAGS_test_string = string(kValueSize, 'b' + i % 2);
+    EXPECT_TRUE(GetFlagValue("test_string", &snapshot));
+  }
+  EXPECT_EQ(kValueSize, snapshot->size());
+  EXPECT_LT(mallinfo2().uordblks, before + 4 * kValueSize);
+  FLAGS_test_string = "initial";
+}
+#endif
+
+TEST(FlagHandleTest, BaseTest) {
+  FlagHandle handle("test_uint64");
+  EXPECT_TRUE(handle.valid());
+  uint64 value = 0;
+  EXPECT_TRUE(handle.Get(&value));
+  EXPECT_EQ(2, value);
+  SetCommandLineOption("test_uint64", "12345");
+  EXPECT_TRUE(handle.Get(&value));
+  EXPECT_EQ(12345, value);
+  char buf[16];
+  EXPECT_TRUE(handle.GetInto(buf, sizeof(buf)));
+  EXPECT_STREQ("12345", buf);
+  string str;
+  EXPECT_FALSE(handle.Get(&str));
+
+  FlagHandle missing("test_int3210");
+  EXPECT_FALSE(missing.valid());
+  EXPECT_FALSE(missing.Get(&value));
+}
+
+TEST(FlagTransactionTest, AllOrNothing) {
+  FLAGS_test_int32 = 1;
+  FLAGS_test_string = "before";
+
+  FlagTransaction txn;
+  txn.Set("test_int32", "2");
+  txn.Set("test_string", "after");
+  txn.Set("test_double", "not a double");
+  txn.Set("no_such_flag", "1");
+  string msg;
+  EXPECT_FALSE(txn.Commit(&msg));
+  EXPECT_EQ(1, FLAGS_test_int32);
+  EXPECT_EQ("before", FLAGS_test_string);
+  EXPECT_NE(string::npos, msg.find("illegal value 'not a double'"));
+  EXPECT_NE(string::npos, msg.find("unknown command line flag 'no_such_flag'"));
+
+  // Commit() forgot the failed settings.
+  txn.Set("test_int32", "2");
+  txn.Set("test_string", "after", SET_FLAGS_DEFAULT);
+  EXPECT_TRUE(txn.Commit(&msg));
+  EXPECT_EQ("test_int32 set to 2\ntest_string set to after\n", msg);
+  EXPECT_EQ(2, FLAGS_test_int32);
+  EXPECT_EQ("before", FLAGS_test_string);  // modified, only default changed
+  EXPECT_EQ("after",
+            GetCommandLineFlagInfoOrDie("test_string").default_value);
+
+  txn.Set("test_bool", "true");
+  EXPECT_TRUE(txn.Commit());
+  EXPECT_TRUE(FLAGS_test_bool);
+  txn.Set("test_bool", "maybe");
+  EXPECT_FALSE(txn.Commit());
+  EXPECT_TRUE(FLAGS_test_bool);
+}
+
+// While validate_calls counts, validates the first time, then fails.
+static int validate_calls = -1;
+static bool FailsSecondCall(const char*, int32) {
+  return validate_calls < 0 || ++validate_calls != 2;
+}
+DEFINE_int32(test_validated_once, 0, "validated by FailsSecondCall()");
+DEFINE_validator(test_validated_once, FailsSecondCall);
+
+TEST(FlagTransactionTest, ValidatesOnlyOnce) {
+  FLAGS_test_int32 = 1;
+  FlagTransaction txn;
+  txn.Set("test_int32", "2");
+  txn.Set("test_validated_once", "3");
+  validate_calls = 0;
+  EXPECT_TRUE(txn.Commit());
+  EXPECT_EQ(1, validate_calls);
+  validate_calls = -1;
+  EXPECT_EQ(2, FLAGS_test_int32);
+  EXPECT_EQ(3, FLAGS_test_validated_once);
+}
+
+struct WatchedChanges {
+  WatchedChanges() : calls(0) {}
+  int calls;
+  string last_flag;
+  string value_seen;  // as read back by the watcher
+};
+
+static void CountChange(const char* flagname, void* data) {
+  WatchedChanges* changes = static_cast<WatchedChanges*>(data);
+  ++changes->calls;
+  changes->last_flag = flagname;
+  // Watchers run without the lock, so they can look at flags.
+  EXPECT_TRUE(GetCommandLineOption(flagname, &changes->value_seen));
+}
+
+TEST(FlagWatcherTest, CalledOncePerChange) {
+  WatchedChanges changes;
+  EXPECT_TRUE(RegisterFlagWatcher(&FLAGS_test_int32, &CountChange, &changes));
+  EXPECT_TRUE(RegisterFlagWatcher("test_int32", &CountChange, &changes));
+  EXPECT_FALSE(RegisterFlagWatcher("no_such_flag", &CountChange, &changes));
+
+  SetCommandLineOption("test_int32", "7");
+  EXPECT_EQ(1, changes.calls);
+  EXPECT_EQ("test_int32", changes.last_flag);
+  EXPECT_EQ("7", changes.value_seen);
+
+  // Not a change
+  SetCommandLineOption("test_int32", "7");
+  SetCommandLineOption("test_int32", "not a number");
+  SetCommandLineOption("test_int64", "7");
+  EXPECT_EQ(1, changes.calls);
+
+  // Coalesced
+  EXPECT_TRUE(ReadFlagsFromString("-test_int32=8\n-test_int32=9\n",
+                                  GetArgv0(), true));
+  EXPECT_EQ(2, changes.calls);
+  EXPECT_EQ("9", changes.value_seen);
+
+  FlagTransaction transaction;
+  transaction.Set("test_int32", "10");
+  EXPECT_TRUE(transaction.Commit());
+  EXPECT_EQ(3, changes.calls);
+
+  {
+    FlagSaver fs;
+    FLAGS_test_int32 = 11;  // direct assignments aren't watched...
+    EXPECT_EQ(3, changes.calls);
+  }
+  // ...but restoring the flag is
+  EXPECT_EQ(4, changes.calls);
+  EXPECT_EQ("10", changes.value_seen);
+
+  EXPECT_TRUE(UnregisterFlagWatcher(&FLAGS_test_int32, &CountChange, &changes));
+  EXPECT_FALSE(UnregisterFlagWatcher("test_int32", &CountChange, &changes));
+  SetCommandLineOption("test_int32", "12");
+  EXPECT_EQ(4, changes.calls);
+}
+
+static FlagAccessStats AccessStatsOf(const FlagsStats& stats,
+                                     const string& name) {
+  FlagAccessStats none = { name, 0, 0 };
+  for (size_t i = 0; i < stats.flags.size(); ++i)
+    if (stats.flags[i].name == name)
+      return stats.flags[i];
+  return none;
+}
+
+TEST(FlagsStatsTest, CountsAccessesByNameWhileEnabled) {
+  FlagsStats before;
+  GetFlagsStats(&before);
+  // Flags registered, and argv parsed, before anyone could ask
+  EXPECT_GT(before.registration.calls, 0);
+  EXPECT_GT(before.parsing.calls, 0);
+
+  string value;
+  EXPECT_TRUE(GetCommandLineOption("test_int32", &value));  // not counted
+  EnableFlagsStats(true);
+  EXPECT_TRUE(GetCommandLineOption("test_int32", &value));
+  int32 int32_value;
+  EXPECT_TRUE(GetFlagValue("test_int32", &int32_value));
+  SetCommandLineOption("test_int32", "5");
+  SetCommandLineOption("test_int32", "not a number");  // not a set
+  EnableFlagsStats(false);
+  SetCommandLineOption("test_int32", "6");  // not counted
+
+  FlagsStats after;
+  GetFlagsStats(&after);
+  EXPECT_EQ(AccessStatsOf(before, "test_int32").reads + 2,
+            AccessStatsOf(after, "test_int32").reads);
+  EXPECT_EQ(AccessStatsOf(before, "test_int32").sets + 1,
+            AccessStatsOf(after, "test_int32").sets);
+  EXPECT_GE(after.lock_acquisitions, before.lock_acquisitions + 4);
+  EXPECT_GE(after.parsing.nanos, before.parsing.nanos);
+  EXPECT_TRUE(FlagsStatsReport().find("test_int32") != string::npos);
+}
+
+static bool IsNotNegative(const char*, int64 value) {
+  return value >= 0 || value == -3;
+}
+
+static bool ValidateNotEmpty(const char*, const string& value) {
+  return !value.empty();
+}
+
+TEST(AtomicFlagTest, SetThroughJflags) {
+  EXPECT_TRUE(FLAGS_test_atomic_bool);
+  EXPECT_EQ(-3, FLAGS_test_atomic_int64.load());
+  EXPECT_EQ(0.5, FLAGS_test_atomic_double);
+  EXPECT_EQ("first", *FLAGS_test_atomic_string.load());
+
+  SetCommandLineOption("test_atomic_bool", "false");
+  SetCommandLineOption("test_atomic_int64", "1234567890123");
+  SetCommandLineOption("test_atomic_double", "2.25");
+  EXPECT_FALSE(FLAGS_test_atomic_bool);
+  EXPECT_EQ(1234567890123LL, FLAGS_test_atomic_int64.load());
+  EXPECT_EQ(2.25, FLAGS_test_atomic_double);
+
+  // A snapshot keeps its value while the flag changes.
+  AtomicStringFlag::Snapshot first = FLAGS_test_atomic_string.load();
+  SetCommandLineOption("test_atomic_string", "second");
+  EXPECT_EQ("first", *first);
+  EXPECT_EQ("second", *FLAGS_test_atomic_string.load());
+  AtomicStringFlag::Snapshot copy = first;
+  first = FLAGS_test_atomic_string.load();
+  EXPECT_EQ("first", *copy);
+  EXPECT_EQ(6u, first->size());
+
+  // The flags are found by their address, like the plain ones.
+  EXPECT_TRUE(RegisterFlagValidator(&FLAGS_test_atomic_int64, &IsNotNegative));
+  EXPECT_TRUE(RegisterFlagValidator(&FLAGS_test_atomic_string,
+                                    &ValidateNotEmpty));
+  EXPECT_EQ("", SetCommandLineOption("test_atomic_int64", "-1"));
+  EXPECT_EQ("", SetCommandLineOption("test_atomic_string", ""));
+  EXPECT_EQ(1234567890123LL, FLAGS_test_atomic_int64.load());
+  EXPECT_EQ("second", *FLAGS_test_atomic_string.load());
+
+  WatchedChanges changes;
+  EXPECT_TRUE(RegisterFlagWatcher(&FLAGS_test_atomic_string, &CountChange,
+                                  &changes));
+  {
+    FlagSaver fs;
+    SetCommandLineOption("test_atomic_string", "third");
+    EXPECT_EQ("third", *FLAGS_test_atomic_string.load());
+  }
+  EXPECT_EQ("second", *FLAGS_test_atomic_string.load());
+  EXPECT_EQ(2, changes.calls);
+  EXPECT_EQ("second", changes.value_seen);
+  EXPECT_TRUE(UnregisterFlagWatcher(&FLAGS_test_atomic_string, &CountChange,
+                                    &changes));
+
+  CommandLineFlagInfo info;
+  EXPECT_TRUE(GetCommandLineFlagInfo("test_atomic_int64", &info));
+  EXPECT_EQ("int64", info.type);
+  EXPECT_EQ("-3", info.default_value);
+  EXPECT_EQ("1234567890123", info.current_value);
+}
+
 TEST(GetCommandLineFlagInfoTest, FlagExists) {
   CommandLineFlagInfo info;
   bool r = GetCommandLineFlagInfo("test_int32", &info);
@@ -1028,6 +1597,41 @@ TEST(GetCommandLineFlagInfoTest, FlagDoesNotExist) {
   EXPECT_EQ(NULL, info.flag_ptr);
 }
 
+TEST(GetCommandLineFlagInfoTest, Compact) {
+  CompactFlagInfo info;
+  EXPECT_TRUE(GetCommandLineFlagInfo("test_int32", &info));
+  EXPECT_STREQ("test_int32", info.name);
+  EXPECT_STREQ("int32", info.type);
+  EXPECT_EQ("-1", info.current_value());
+  EXPECT_EQ("", info.modified_value);
+  EXPECT_TRUE(info.is_default);
+  EXPECT_EQ(&FLAGS_test_int32, info.flag_ptr);
+
+  FLAGS_test_int32 = 7;
+  EXPECT_TRUE(GetCommandLineFlagInfo("test_int32", &info));
+  EXPECT_EQ("7", info.current_value());
+  EXPECT_EQ("-1", info.default_value);
+  EXPECT_FALSE(info.is_default);
+  EXPECT_FALSE(GetCommandLineFlagInfo("test_int3210", &info));
+
+  // The flags of a file share their filename.
+  CompactFlagInfo other;
+  EXPECT_TRUE(GetCommandLineFlagInfo("test_bool", &other));
+  EXPECT_EQ(info.filename, other.filename);
+
+  vector<CompactFlagInfo> flags;
+  GetAllFlagsCompact(&flags);
+  vector<CommandLineFlagInfo> infos;
+  GetAllFlags(&infos);
+  EXPECT_EQ(infos.size(), flags.size());
+  for (size_t i = 0; i < flags.size() && i < infos.size(); ++i) {
+    EXPECT_EQ(infos[i].name, flags[i].name);
+    EXPECT_EQ(infos[i].filename, flags[i].filename);
+    EXPECT_EQ(infos[i].current_value, flags[i].current_value());
+    EXPECT_EQ(infos[i].is_default, flags[i].is_default);
+  }
+}
+
 TEST(GetCommandLineFlagInfoOrDieTest, FlagExistsAndIsDefault) {
   CommandLineFlagInfo info;
   info = GetCommandLineFlagInfoOrDie("test_int32");
@@ -1145,10 +1749,369 @@ TEST(DeprecatedFunctionsTest, ReadFromFlagsFileFailure) {
   EXPECT_EQ(-22, FLAGS_test_int32);   // the -21 from the flagsfile didn't take
 }
 
+TEST(FlagfileCacheTest, RereadsChangedFiles) {
+  EnableFlagfileCache(true);
+  string filename(TmpFile("flagfile_cached"));
+  FILE* fp;
+  EXPECT_EQ(0, SafeFOpen(&fp, filename.c_str(), "w"));
+  fprintf(fp, "--test_int32=30\n");
+  fclose(fp);
+
+  FLAGS_test_int32 = 0;
+  EXPECT_TRUE(ReadFromFlagsFile(filename, GetArgv0(), true));
+  EXPECT_EQ(30, FLAGS_test_int32);
+  FLAGS_test_int32 = 0;
+  EXPECT_TRUE(ReadFromFlagsFile(filename, GetArgv0(), true));  // cached
+  EXPECT_EQ(30, FLAGS_test_int32);
+
+  // A different size is enough to tell, even within the same second.
+  EXPECT_EQ(0, SafeFOpen(&fp, filename.c_str(), "w"));
+  fprintf(fp, "--test_int32=3100\n");
+  fclose(fp);
+  EXPECT_TRUE(ReadFromFlagsFile(filename, GetArgv0(), true));
+  EXPECT_EQ(3100, FLAGS_test_int32);
+  EnableFlagfileCache(false);
+}
+
+TEST(FlagfilePrefetchTest, AppliesNestedFilesInOrder) {
+  string first(TmpFile("flagfile_first"));
+  string second(TmpFile("flagfile_second"));
+  string nested(TmpFile("flagfile_nested"));
+  FILE* fp;
+  EXPECT_EQ(0, SafeFOpen(&fp, first.c_str(), "w"));
+  fprintf(fp, "--test_int32=1\n--flagfile=%s\n--test_int64=10\n"
+              "not_this_program\n--flagfile=/no/such/flagfile\n",
+          nested.c_str());
+  fclose(fp);
+  EXPECT_EQ(0, SafeFOpen(&fp, second.c_str(), "w"));
+  fprintf(fp, "--test_int64=20\n");
+  fclose(fp);
+  EXPECT_EQ(0, SafeFOpen(&fp, nested.c_str(), "w"));
+  fprintf(fp, "--test_int32=3\n--test_int64=30\n");
+  fclose(fp);
+
+  FlagSaver fs;
+  SetCommandLineOption("flagfile_threads", "4");
+  EXPECT_NE("", SetCommandLineOption("flagfile", (first + "," + second).c_str()));
+  EXPECT_EQ(3, FLAGS_test_int32);
+  EXPECT_EQ(20, FLAGS_test_int64);
+}
+
+TEST(CompileFlagfileTest, LoadsLikeTheText) {
+  string text(TmpFile("flagfile_text"));
+  string binary(TmpFile("flagfile_binary"));
+  FILE* fp;
+  EXPECT_EQ(0, SafeFOpen(&fp, text.c_str(), "w"));
+  fprintf(fp, "# a comment\n"
+              "--test_int32=-12\n"
+              "--notest_bool\n"
+              "-test_double=2.5\n"
+              "--test_string=some words\r\n"
+              "--no_such_flag=1\n"
+              "not_this_program\n"
+              "--test_int64=1\n"
+              "*\n"
+              "--test_uint32=7\n");
+  fclose(fp);
+  EXPECT_TRUE(CompileFlagfile(text.c_str(), binary.c_str()));
+  EXPECT_FALSE(CompileFlagfile(text.c_str(), "/no/such/dir/flagfile"));
+
+  FLAGS_test_bool = true;
+  FLAGS_test_int64 = 0;
+  EXPECT_TRUE(ReadFromFlagsFile(binary, GetArgv0(), true));
+  EXPECT_EQ(-12, FLAGS_test_int32);
+  EXPECT_FALSE(FLAGS_test_bool);
+  EXPECT_EQ(2.5, FLAGS_test_double);
+  EXPECT_EQ("some words", FLAGS_test_string);
+  EXPECT_EQ(0, FLAGS_test_int64);
+  EXPECT_EQ(7, FLAGS_test_uint32);
+
+  CommandLineFlagInfo info;
+  EXPECT_TRUE(GetCommandLineFlagInfo("test_int32", &info));
+  EXPECT_FALSE(info.is_default);
+  EXPECT_EQ("-12", info.current_value);
+}
+
+static void WriteFlagfile(const string& filename, const char* contents) {
+  FILE* fp;
+  EXPECT_EQ(0, SafeFOpen(&fp, filename.c_str(), "w"));
+  fputs(contents, fp);
+  fclose(fp);
+}
+
+TEST(ReloadChangedFlagfilesTest, SetsWhatChanged) {
+  string filename(TmpFile("flagfile_reloaded"));
+  WriteFlagfile(filename, "--test_int32=40\n--test_string=from file\n");
+  SetCommandLineOption("flagfile", filename.c_str());
+  EXPECT_EQ(40, FLAGS_test_int32);
+  EXPECT_EQ(0, ReloadChangedFlagfiles());  // reads the files, sets nothing
+
+  WatchedChanges changes;
+  RegisterFlagWatcher(&FLAGS_test_int32, &CountChange, &changes);
+  FLAGS_test_string = "set elsewhere";
+  EXPECT_EQ(0, ReloadChangedFlagfiles());  // nothing changed
+  WriteFlagfile(filename, "--test_int32=4100\n--test_string=from file\n"
+                          "not_this_program\n--test_int64=41\n");
+  EXPECT_EQ(1, ReloadChangedFlagfiles());
+  EXPECT_EQ(4100, FLAGS_test_int32);
+  EXPECT_EQ("set elsewhere", FLAGS_test_string);  // its line didn't change
+  EXPECT_EQ(-2, FLAGS_test_int64);
+  EXPECT_EQ(1, changes.calls);
+  EXPECT_EQ(0, ReloadChangedFlagfiles());
+
+  // A value that doesn't parse is ignored.
+  WriteFlagfile(filename, "--test_int32=forty-two\n--test_string=from file\n");
+  EXPECT_EQ(0, ReloadChangedFlagfiles());
+  EXPECT_EQ(4100, FLAGS_test_int32);
+
+#ifdef HAVE_UNISTD_H
+  if (StartFlagfileReloader(1)) {
+    // Atomically, for the reloader not to see a partly written file.
+    WriteFlagfile(filename + ".new",
+                  "--test_int32=43\n--test_string=from file\n");
+    EXPECT_EQ(0, rename((filename + ".new").c_str(), filename.c_str()));
+    for (int i = 0; i < 5000 && FLAGS_test_int32 != 43; ++i)
+      usleep(1000);
+    StopFlagfileReloader();
+    EXPECT_EQ(43, FLAGS_test_int32);
+    EXPECT_EQ(2, changes.calls);
+  }
+#endif
+  UnregisterFlagWatcher(&FLAGS_test_int32, &CountChange, &changes);
+}
+
+TEST(ReloadChangedFlagfilesTest, LaterSettingsOverrideNestedFiles) {
+  string outer(TmpFile("flagfile_reloaded_outer"));
+  string nested(TmpFile("flagfile_reloaded_nested"));
+  WriteFlagfile(nested, "--test_int32=2\n--test_int64=5\n");
+  WriteFlagfile(outer, ("--flagfile=" + nested + "\n--test_int32=1\n").c_str());
+  FlagSaver fs;
+  SetCommandLineOption("flagfile", outer.c_str());
+  EXPECT_EQ(1, FLAGS_test_int32);
+  EXPECT_EQ(5, FLAGS_test_int64);
+  ReloadChangedFlagfiles();
+
+  // The outer file still sets test_int32 after including the other.
+  WriteFlagfile(nested, "--test_int32=3\n--test_int64=66\n");
+  EXPECT_EQ(1, ReloadChangedFlagfiles());
+  EXPECT_EQ(1, FLAGS_test_int32);
+  EXPECT_EQ(66, FLAGS_test_int64);
+
+  // Until it doesn't anymore.
+  WriteFlagfile(outer, ("--flagfile=" + nested + "\n").c_str());
+  EXPECT_EQ(1, ReloadChangedFlagfiles());
+  EXPECT_EQ(3, FLAGS_test_int32);
+}
+
+TEST(FlagSegmentTest, SyncsWhatWasPublished) {
+  string filename(TmpFile("flag_segment"));
+  remove(filename.c_str());
+  FLAGS_test_int32 = 50;
+  if (!PublishFlagSegment(filename.c_str()))
+    return;  // this build can't map files
+  EXPECT_FALSE(AttachFlagSegment(TmpFile("no_such_segment").c_str()));
+  EXPECT_EQ(0, SyncFlagsFromSegment());  // nothing attached
+  EXPECT_TRUE(AttachFlagSegment(filename.c_str()));
+
+  // Only what differs is set
+  FLAGS_test_int32 = 51;
+  EXPECT_EQ(1, SyncFlagsFromSegment());
+  EXPECT_EQ(50, FLAGS_test_int32);
+  EXPECT_EQ(0, SyncFlagsFromSegment());
+
+  // What was published since is set, whatever it was set to here
+  FLAGS_test_int32 = 53;
+  FLAGS_test_string = "published";
+  EXPECT_TRUE(PublishFlagSegment(filename.c_str()));
+  FLAGS_test_int32 = 0;
+  FLAGS_test_string = "mine";
+  EXPECT_EQ(2, SyncFlagsFromSegment());
+  EXPECT_EQ(53, FLAGS_test_int32);
+  EXPECT_EQ("published", FLAGS_test_string);
+  FLAGS_test_int32 = 0;
+  EXPECT_EQ(0, SyncFlagsFromSegment());  // until it's published again
+  EXPECT_EQ(0, FLAGS_test_int32);
+
+  // Big enough values make the segment grow
+  const string big(100000, 'x');
+  FLAGS_test_string = big;
+  EXPECT_TRUE(PublishFlagSegment(filename.c_str()));
+  FLAGS_test_string = "mine";
+  EXPECT_EQ(1, SyncFlagsFromSegment());
+  EXPECT_EQ(big, FLAGS_test_string);
+  DetachFlagSegment();
+}
+
+#if defined(HAVE_PTHREAD) && !defined(NO_THREADS)
+// Holds the registry lock a little, for the syncers to overlap.
+static bool SleepsAMoment(const char*, int32) {
+  usleep(20);
+  return true;
+}
+DEFINE_int32(test_segment_race, 0, "published and synced from several threads");
+DEFINE_validator(test_segment_race, SleepsAMoment);
+
+// The syncers sync over and over, until they're parked, or done.
+static pthread_mutex_t segment_syncers_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t segment_syncers_changed = PTHREAD_COND_INITIALIZER;
+static bool segment_syncers_park = false;
+static bool segment_syncers_done = false;
+static int segment_syncers_parked = 0;
+
+static void* SyncFromSegmentUntilDone(void*) {
+  pthread_mutex_lock(&segment_syncers_lock);
+  while (!segment_syncers_done) {
+    if (segment_syncers_park) {
+      ++segment_syncers_parked;
+      pthread_cond_broadcast(&segment_syncers_changed);
+      while (segment_syncers_park && !segment_syncers_done)
+        pthread_cond_wait(&segment_syncers_changed, &segment_syncers_lock);
+      --segment_syncers_parked;
+      continue;
+    }
+    pthread_mutex_unlock(&segment_syncers_lock);
+    SyncFlagsFromSegment();
+    pthread_mutex_lock(&segment_syncers_lock);
+  }
+  pthread_mutex_unlock(&segment_syncers_lock);
+  return NULL;
+}
+
+// Two syncers racing the publications mustn't leave the flag on a
+// value older than the one published last.  (The syncers may set it
+// back before it's published, the publisher being synced too: it's
+// what was published that it's checked against, by syncing it all
+// again, from scratch.)
+TEST(FlagSegmentTest, RacingSyncsEndOnTheLastValue) {
+  string filename(TmpFile("flag_segment_race"));
+  remove(filename.c_str());
+  if (!PublishFlagSegment(filename.c_str()))
+    return;  // this build can't map files
+  EXPECT_TRUE(AttachFlagSegment(filename.c_str()));
+  segment_syncers_park = false;
+  segment_syncers_done = false;
+  pthread_t syncers[2];
+  for (int i = 0; i < 2; ++i)
+    pthread_create(&syncers[i], NULL, &SyncFromSegmentUntilDone, NULL);
+  int stale = 0;
+  for (int i = 1; i <= 200; ++i) {
+    SetCommandLineOption("test_segment_race", StringPrintf("%d", i).c_str());
+    EXPECT_TRUE(PublishFlagSegment(filename.c_str()));
+    if (i % 4 != 0)
+      continue;  // let the syncers race a few publications
+    pthread_mutex_lock(&segment_syncers_lock);
+    segment_syncers_park = true;
+    while (segment_syncers_parked < 2)
+      pthread_cond_wait(&segment_syncers_changed, &segment_syncers_lock);
+    pthread_mutex_unlock(&segment_syncers_lock);
+    EXPECT_TRUE(AttachFlagSegment(filename.c_str()));
+    stale += SyncFlagsFromSegment();
+    pthread_mutex_lock(&segment_syncers_lock);
+    segment_syncers_park = false;
+    pthread_cond_broadcast(&segment_syncers_changed);
+    pthread_mutex_unlock(&segment_syncers_lock);
+  }
+  pthread_mutex_lock(&segment_syncers_lock);
+  segment_syncers_done = true;
+  pthread_cond_broadcast(&segment_syncers_changed);
+  pthread_mutex_unlock(&segment_syncers_lock);
+  for (int i = 0; i < 2; ++i)
+    pthread_join(syncers[i], NULL);
+  EXPECT_EQ(0, stale);
+  DetachFlagSegment();
+}
+#endif
+
+TEST(FlagStateTest, RestoresWhatWasSet) {
+  FLAGS_test_int32 = 60;
+  FLAGS_test_string = "saved";
+  FLAGS_test_double = 6.5;
+  const string state = SerializeFlagState();
+  EXPECT_EQ(string::npos, state.find("--"));  // not text
+
+  FLAGS_test_int32 = 61;
+  FLAGS_test_string = "changed";
+  FLAGS_test_double = 7.5;
+  EXPECT_TRUE(RestoreFlagState(state));
+  EXPECT_EQ(60, FLAGS_test_int32);
+  EXPECT_EQ("saved", FLAGS_test_string);
+  EXPECT_EQ(6.5, FLAGS_test_double);
+
+  // Without the same flags, they're found by name.  The fingerprint is
+  // at offset 16, outside of the checksum.
+  string other_program = state;
+  other_program[16] ^= 1;
+  FLAGS_test_int32 = 62;
+  FLAGS_test_string = "changed";
+  EXPECT_TRUE(RestoreFlagState(other_program));
+  EXPECT_EQ(60, FLAGS_test_int32);
+  EXPECT_EQ("saved", FLAGS_test_string);
+
+  string corrupt = state;
+  corrupt[corrupt.size() - 2] ^= 1;
+  FLAGS_test_int32 = 63;
+  EXPECT_FALSE(RestoreFlagState(corrupt));
+  EXPECT_FALSE(RestoreFlagState("--test_int32=64"));
+  EXPECT_EQ(63, FLAGS_test_int32);
+}
+
+DEFINE_int32(test_source_int32, 70, "set by the flag sources");
+
+class TestFlagSource : public FlagSource {
+ public:
+  explicit TestFlagSource(const char* int32_value) : value_(int32_value) {}
+  const char* name() const { return "test"; }
+  bool Fetch(FlagTransaction* settings, string*) {
+    settings->Set("test_source_int32", value_, SET_FLAGS_DEFAULT);
+    settings->Set("test_string", "from source", SET_FLAGS_DEFAULT);
+    return true;
+  }
+
+ private:
+  const char* value_;
+};
+
+TEST(FlagSourceTest, AppliesDefaultsInOneBatch) {
+  FlagsStats before;
+  GetFlagsStats(&before);
+  FLAGS_test_string = "set here";
+
+  AddFlagSource(new TestFlagSource("71"), true);
+  EXPECT_TRUE(WaitForCriticalFlagSources(-1));
+  EXPECT_EQ(71, FLAGS_test_source_int32);  // was at its default
+  EXPECT_EQ("set here", FLAGS_test_string);
+  EXPECT_EQ("from source",
+            GetCommandLineFlagInfoOrDie("test_string").default_value);
+
+  // A value that doesn't parse fails the whole source.
+  AddFlagSource(new TestFlagSource("seventy-two"), true);
+  EXPECT_TRUE(WaitForCriticalFlagSources(10000));
+  EXPECT_EQ(71, FLAGS_test_source_int32);
+
+  FlagsStats after;
+  GetFlagsStats(&after);
+  EXPECT_EQ(before.sources_added + 2, after.sources_added);
+  EXPECT_EQ(before.sources_applied + 1, after.sources_applied);
+  EXPECT_EQ(before.sources_failed + 1, after.sources_failed);
+  EXPECT_EQ(before.sources.calls + 2, after.sources.calls);
+}
+
 TEST(FlagsSetBeforeInitTest, TryFromEnv) {
   EXPECT_EQ("pre-set", FLAGS_test_tryfromenv);
 }
 
+TEST(FromEnvTest, StarSetsEveryFlagTheEnvironmentHas) {
+  setenv("FLAGS_test_int32", "77", 1);
+  setenv("FLAGS_test_string", "from the environment", 1);
+  setenv("FLAGS_not_a_flag_of_this_program", "1", 1);
+  SetCommandLineOption("tryfromenv", "*");
+  EXPECT_EQ(77, FLAGS_test_int32);
+  EXPECT_EQ("from the environment", FLAGS_test_string);
+  unsetenv("FLAGS_test_int32");
+  unsetenv("FLAGS_test_string");
+  unsetenv("FLAGS_not_a_flag_of_this_program");
+}
+
 // The following test case verifies that ParseCommandLineFlags() and
 // ParseCommandLineNonHelpFlags() uses the last definition of a flag
 // in case it's defined more than once.
@@ -1279,6 +2242,42 @@ TEST(ParseCommandLineFlagsAndDashArgs, OneDashArg) {
   EXPECT_EQ(0, ParseTestFlag(false, arraysize(argv) - 1, argv));
 }
 
+// Returns what's left of argv once parsed, space-separated.
+string ParseAndJoinArgv(bool remove_flags, int argc, const char** const_argv) {
+  FlagSaver fs;
+  char** const argv_save = new char*[argc + 1];
+  char** argv = argv_save;
+  memcpy(argv, const_argv, sizeof(*argv)*(argc + 1));
+  const uint32 first_nonopt =
+      ParseCommandLineNonHelpFlags(&argc, &argv, remove_flags);
+  string joined = StringPrintf("%u:", first_nonopt);
+  for (int i = 0; i < argc; ++i)
+    joined += string(" ") + argv[i];
+  delete[] argv_save;
+  return joined;
+}
+
+TEST(ParseCommandLineFlagsAndDashArgs, ProgramArgumentsGoLastInOrder) {
+  const char* argv[] = {
+    "my_test",
+    "a",
+    "--test_flag=1",
+    "b",
+    "--test_string", "s",
+    "-",
+    "--",
+    "c",
+    "--test_flag=2",
+    NULL,
+  };
+
+  EXPECT_EQ("5: my_test --test_flag=1 --test_string s -- c --test_flag=2"
+            " a b -",
+            ParseAndJoinArgv(false, arraysize(argv) - 1, argv));
+  EXPECT_EQ("1: my_test c --test_flag=2 a b -",
+            ParseAndJoinArgv(true, arraysize(argv) - 1, argv));
+}
+
 #ifdef GTEST_HAS_DEATH_TEST
 TEST(ParseCommandLineFlagsUnknownFlagDeathTest,
      FlagIsCompletelyUnknown) {
@@ -1482,6 +2481,186 @@ TEST(FlagsValidator, FlagSaver) {
   EXPECT_EQ("", SetCommandLineOption("test_flag", "50"));  // validator is back
 }
 
+TEST(FlagsConstraint, RangeAndAllowedValues) {
+  EXPECT_EQ("", SetCommandLineOption("test_ranged", "11"));
+  EXPECT_EQ("", SetCommandLineOption("test_ranged", "0"));
+  EXPECT_NE("", SetCommandLineOption("test_ranged", "10"));
+  EXPECT_EQ(10, FLAGS_test_ranged);
+  EXPECT_EQ("", SetCommandLineOption("test_mode", "slow"));
+  EXPECT_EQ("", SetCommandLineOption("test_mode", ""));
+  EXPECT_NE("", SetCommandLineOption("test_mode", "auto"));
+  EXPECT_EQ("auto", FLAGS_test_mode);
+
+  EXPECT_EQ("[1, 10]", GetCommandLineFlagInfoOrDie("test_ranged").constraint);
+  EXPECT_EQ("fast|safe|auto",
+            GetCommandLineFlagInfoOrDie("test_mode").constraint);
+  EXPECT_EQ("", GetCommandLineFlagInfoOrDie("test_flag").constraint);
+
+  // The batched paths check them too
+  FlagTransaction transaction;
+  transaction.Set("test_ranged", "3");
+  transaction.Set("test_mode", "slow");
+  string msg;
+  EXPECT_FALSE(transaction.Commit(&msg));
+  EXPECT_TRUE(msg.find("is not one of its allowed values: fast|safe|auto")
+              != string::npos) << msg;
+  EXPECT_EQ(10, FLAGS_test_ranged);
+  EXPECT_FALSE(ReadFlagsFromString("-test_ranged=-1\n", GetArgv0(), false));
+
+  int32 not_a_flag;
+  EXPECT_FALSE(RegisterFlagRange(&not_a_flag, 1, 10));
+  EXPECT_FALSE(RegisterFlagRange(&FLAGS_test_ranged, 10, 1));
+  EXPECT_TRUE(RegisterFlagRange(&FLAGS_test_ranged, 1, 20));
+  EXPECT_NE("", SetCommandLineOption("test_ranged", "20"));
+  EXPECT_TRUE(RegisterFlagRange(&FLAGS_test_ranged, 1, 10));
+}
+
+TEST(FlagsConstraint, NoAllowedValues) {
+  // Lists of no value are refused, and the values allowed stay.
+  EXPECT_FALSE(RegisterFlagAllowedValues(&FLAGS_test_mode, ""));
+  EXPECT_FALSE(RegisterFlagAllowedValues(&FLAGS_test_mode, ","));
+  EXPECT_FALSE(RegisterFlagAllowedValues(&FLAGS_test_mode, ",,"));
+  EXPECT_FALSE(RegisterFlagAllowedValues(&FLAGS_test_mode, NULL));
+  EXPECT_EQ("fast|safe|auto",
+            GetCommandLineFlagInfoOrDie("test_mode").constraint);
+  FlagSaver fs;
+  EXPECT_NE("", SetCommandLineOption("test_mode", "safe"));
+  EXPECT_EQ("safe", FLAGS_test_mode);
+}
+
+#ifdef GTEST_HAS_DEATH_TEST
+TEST(FlagsConstraintDeathTest, DefaultNotAllowed) {
+  const char* argv[] = {
+    "my_test",
+    NULL,
+  };
+  EXPECT_TRUE(RegisterFlagRange(&FLAGS_test_flag, 0, 10));
+  EXPECT_DEATH(ParseTestFlag(true, arraysize(argv) - 1, argv),
+               "ERROR: --test_flag must be set on the commandline");
+}
+
+TEST(FlagRegistryDeathTest, DefinedTwice) {
+  static int32 current = 1, defvalue = 1;
+  EXPECT_DEATH(FlagRegisterer("test_int32", "int32", "again", "elsewhere.cc",
+                              &current, &defvalue),
+               "was defined more than once");
+  // If jflags_exitfunc doesn't exit, the first one is kept, alone.
+  vector<CommandLineFlagInfo> flags;
+  GetAllFlags(&flags);
+  int named = 0;
+  for (size_t i = 0; i < flags.size(); ++i) {
+    if (flags[i].name == "test_int32") {
+      ++named;
+      EXPECT_NE("elsewhere.cc", flags[i].filename);
+    }
+  }
+  EXPECT_EQ(1, named);
+  EXPECT_FALSE(RegisterFlagRange(&current, 0, 10));
+}
+
+TEST(CompletionIndexTest, ExportsTheFlags) {
+  const string filename(TmpFile("completion_index"));
+  remove(filename.c_str());
+  {
+    FlagSaver fs;
+    FLAGS_tab_completion_export = filename;
+    EXPECT_DEATH(HandleCommandLineCompletions(), "exits once written");
+  }
+  FILE* fp;
+  EXPECT_EQ(0, SafeFOpen(&fp, filename.c_str(), "r"));
+  string index;
+  char buf[4096];
+  for (size_t n; (n = fread(buf, 1, sizeof(buf), fp)) > 0; )
+    index.append(buf, n);
+  fclose(fp);
+  EXPECT_EQ(0, index.find("jflags-completions 1\n"));
+  EXPECT_NE(string::npos, index.find("\ntest_mode\tmodule\tstring\tfast\t"
+                                     "used for testing the allowed values\n"))
+      << index;
+}
+#endif
+
+TEST(FlagOverlayTest, OverridesOnlyWhileCurrent) {
+  FLAGS_test_int32 = 1;
+  FLAGS_test_string = "global";
+  FlagOverlay base;
+  EXPECT_NE("", base.Set("test_int32", "2"));
+  EXPECT_NE("", base.Set("test_string", "base"));
+  FlagOverlay tenant(&base);
+  EXPECT_NE("", tenant.Set("test_int32", "3"));
+
+  // Not an override: nothing changes
+  EXPECT_EQ("", tenant.Set("no_such_flag", "1"));
+  EXPECT_EQ("", tenant.Set("test_int32", "three"));
+  EXPECT_EQ("", tenant.Set("test_ranged", "11"));
+  EXPECT_FALSE(tenant.Clear("test_bool"));
+
+  int32 i = 0;
+  EXPECT_TRUE(GetFlagValue("test_int32", &i));
+  EXPECT_EQ(1, i);
+  {
+    ScopedFlagOverlay use(&tenant);
+    EXPECT_TRUE(GetFlagValue("test_int32", &i));
+    EXPECT_EQ(3, i);
+    EXPECT_EQ("base", GetCommandLineFlagInfoOrDie("test_string").current_value);
+    EXPECT_FALSE(GetCommandLineFlagInfoOrDie("test_string").is_default);
+    EXPECT_EQ(5, GetFlagValue<int32>("test_ranged", 0));
+    {
+      ScopedFlagOverlay none(NULL);
+      EXPECT_EQ("global",
+                GetCommandLineFlagInfoOrDie("test_string").current_value);
+    }
+    string value;
+    EXPECT_TRUE(GetCommandLineOption("test_int32", &value));
+    EXPECT_EQ("3", value);
+    EXPECT_EQ(1, FLAGS_test_int32);  // FLAGS_ aren't overlaid
+  }
+  EXPECT_TRUE(GetFlagValue("test_int32", &i));
+  EXPECT_EQ(1, i);
+
+  EXPECT_TRUE(tenant.Clear("test_int32"));
+  EXPECT_FALSE(tenant.Clear("test_int32"));
+  ScopedFlagOverlay use(&tenant);
+  EXPECT_TRUE(GetFlagValue("test_int32", &i));
+  EXPECT_EQ(2, i);
+}
+
+static int cheap_validations = 0;
+static bool CountCheapValidation(const char*, int32) {
+  ++cheap_validations;
+  return true;
+}
+
+TEST(FlagsValidator, ValidatorThreads) {
+  const char* argv[] = {
+    "my_test",
+    "--test_flag=5",
+    "--validator_threads=3",
+    NULL,
+  };
+  EXPECT_TRUE(RegisterFlagValidator(&FLAGS_test_flag, &ValidateTestFlagIs5));
+  EXPECT_TRUE(RegisterFlagValidator(&FLAGS_test_int32, &CountCheapValidation,
+                                    VALIDATOR_IS_CHEAP));
+  cheap_validations = 0;
+  EXPECT_EQ(5, ParseTestFlag(true, arraysize(argv) - 1, argv));
+  EXPECT_EQ(1, cheap_validations);
+  EXPECT_TRUE(RegisterFlagValidator(&FLAGS_test_flag, NULL));
+  EXPECT_TRUE(RegisterFlagValidator(&FLAGS_test_int32, NULL));
+}
+
+#ifdef GTEST_HAS_DEATH_TEST
+TEST(FlagsValidatorDeathTest, InvalidFlagNeverSetWithValidatorThreads) {
+  const char* argv[] = {
+    "my_test",
+    "--validator_threads=2",
+    NULL,
+  };
+  EXPECT_TRUE(RegisterFlagValidator(&FLAGS_test_flag, &ValidateTestFlagIs5));
+  EXPECT_DEATH(ParseTestFlag(true, arraysize(argv) - 1, argv),
+               "ERROR: --test_flag must be set on the commandline");
+}
+#endif
+
 
 }  // unnamed namespace
 
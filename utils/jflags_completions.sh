@@ -84,11 +84,103 @@ params="$params --tab_completion_word \"$completion_word\""
 # in /tmp, and only cat it to stdout if the command returned a success
 # code, to prevent false positives
 
-# If we think we have a reasonable command to execute, then execute it
-# and hope for the best.
 candidate=$(type -p "$binary")
-if [ ! -z "$candidate" ]; then
-  eval "$candidate 2>/dev/null $params"
-elif [ -f "$binary" ] && [ -x "$binary" ]; then
-  eval "$binary 2>/dev/null $params"
+if [ -z "$candidate" ] && [ -f "$binary" ] && [ -x "$binary" ]; then
+  candidate="$binary"
 fi
+if [ -z "$candidate" ]; then
+  exit 0
+fi
+
+# Plain prefixes are completed from an index of the binary's flags, which
+# it writes with --tab_completion_export, rather than by running it for
+# every <TAB>.  The index is rewritten whenever the binary is newer than
+# it.  Searches with '?' or '+', and whole flag names (which show the
+# details of the flag), still run the binary.
+search_word="${completion_word#\"}"
+while [ "${search_word#-}" != "$search_word" ]; do
+  search_word="${search_word#-}"
+done
+columns=80
+for ((i=1; i<=$(($# - 3)); ++i)); do
+  case "${!i}" in
+    --tab_completion_columns=*) columns="${!i#*=}" ;;
+    --tab_completion_columns) j=$((i + 1)); columns="${!j}" ;;
+  esac
+done
+cache_dir="${JFLAGS_COMPLETIONS_CACHE:-${XDG_CACHE_HOME:-$HOME/.cache}/jflags_completions}"
+if [[ "$search_word" != *[?+]* ]] && mkdir -p "$cache_dir" 2>/dev/null; then
+  executable="$(cd "$(dirname "$candidate")" && pwd)/$(basename "$candidate")"
+  index="$cache_dir/$(echo "$executable" | tr '/' '%')"
+  if [ ! -s "$index" ] || [ "$executable" -nt "$index" ]; then
+    "$executable" --tab_completion_export="$index" >/dev/null 2>&1 || rm -f "$index"
+  fi
+  # The same output as the binary's, but for that of a whole flag name:
+  # exits with 0 if it completed, 2 if the binary has to.
+  [ -s "$index" ] && awk -F '\t' -v word="$search_word" -v columns="$columns" '
+    NR == 1 { if ($0 != "jflags-completions 1") { bad = 1; exit } next }
+    /^#/ { next }
+    substr($1, 1, length(word)) == word {
+      if ($1 == word) { exact = 1; exit }
+      n++; name[n] = $1; location[n] = $2; type[n] = $3; def[n] = $4; help[n] = $5
+      if (n == 1) {
+        prefix = $1
+      } else {
+        l = 0
+        while (l < length(prefix) && substr(prefix, l + 1, 1) == substr($1, l + 1, 1)) l++
+        prefix = substr(prefix, 1, l)
+      }
+    }
+    END {
+      if (bad) exit 2
+      if (exact) exit 2
+      if (n == 0) exit 0
+      if (length(prefix) > length(word)) { printf "--%s", prefix; exit 0 }
+
+      split("module package subpackage other", groups, " ")
+      header["module"] = "-* Matching module flags *-"
+      footer["module"] = "==========================="
+      header["package"] = "-* Matching package flags *-"
+      footer["package"] = "============================"
+      header["subpackage"] = "-* Matching sub-package flags *-"
+      footer["subpackage"] = "================================"
+      header["other"] = "-* Other flags *-"
+      footer["other"] = ""
+      for (i = 1; i <= n; i++) count[location[i]]++
+
+      # Which groups fit, then as many of their flags as do.
+      max_lines = 98
+      lines = 0
+      num_used = 0
+      for (g = 1; g <= 4; g++) {
+        if (lines < max_lines && count[groups[g]] > 0) {
+          used[++num_used] = groups[g]
+          lines += count[groups[g]] + 2 + (footer[groups[g]] != "")
+        }
+      }
+      remaining = max_lines
+      output = 0
+      for (u = 1; u <= num_used; u++) {
+        group = used[u]
+        indent = sprintf("%" (num_used - u) "s", "")
+        if (remaining < 2) continue
+        remaining -= 2
+        dashes = header[group]; gsub(/./, "-", dashes)
+        print indent header[group]
+        print indent dashes
+        for (i = 1; i <= n && remaining > 0; i++) {
+          if (location[i] != group) continue
+          remaining--; output++
+          quote = (type[i] == "string") ? "'\''" : ""
+          line = indent "--" name[i] " [" quote def[i] quote "] "
+          room = columns - length(line)
+          if (room > 0) line = line (length(help[i]) > room ? substr(help[i], 1, room - 3) "..." : help[i])
+          print line
+        }
+        if (footer[group] != "" && remaining >= 1) { remaining--; print indent footer[group] }
+      }
+      print (output != n) ? "~ (Remaining flags hidden) ~" : "~"
+    }' "$index" && exit 0
+fi
+
+eval "$candidate 2>/dev/null $params"
@@ -0,0 +1,607 @@
+////////////////////////////////////////////////////////////////////////////////
+//                                    jflags
+//
+// This file is distributed under the 3-clause Berkeley Software Distribution
+// License. See LICENSE.txt for details.
+////////////////////////////////////////////////////////////////////////////////
+// --------------------------------------------------------------------
+// jflags_pack_help gathers the help of the flags that the DEFINE_*
+// macros define in some C++ sources into a compressed table (see
+// FlagHelp.h), and writes a source that registers the table, for
+// building with COMPRESS_FLAG_HELP:
+//
+//    jflags_pack_help [-i <jflags header>] -o <output.cc> <source>...
+//
+// It reads no further than the sources: it knows the DEFINE_* macros
+// by name, skips comments and preprocessor lines, and only gets a help
+// that's made of string literals.  It warns about the others, whose
+// help --help won't show.
+// --------------------------------------------------------------------
+#include "FlagHelp.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <fstream>
+#include <functional>
+#include <map>
+#include <queue>
+#include <sstream>
+#include <string>
+#include <vector>
+
+using std::make_pair;
+using std::map;
+using std::string;
+using std::vector;
+using namespace JFLAGS_NAMESPACE;
+
+// --------------------------------------------------------------------
+// Finding the flags
+// --------------------------------------------------------------------
+
+static const char * const kDefineMacros[] = {
+    "DEFINE_bool", "DEFINE_int32", "DEFINE_uint32", "DEFINE_int64", "DEFINE_uint64", "DEFINE_double", "DEFINE_string",
+    "DEFINE_atomic_bool", "DEFINE_atomic_int32", "DEFINE_atomic_uint32", "DEFINE_atomic_int64", "DEFINE_atomic_uint64",
+    "DEFINE_atomic_double", "DEFINE_atomic_string",
+};
+
+static bool IsIdentifierChar(char c)
+{
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_';
+}
+
+static bool IsDefineMacro(const string & identifier)
+{
+    for (size_t i = 0; i < sizeof(kDefineMacros) / sizeof(kDefineMacros[0]); ++i)
+    {
+        if (identifier == kDefineMacros[i])
+            return true;
+    }
+    return false;
+}
+
+class SourceScanner
+{
+public:
+    SourceScanner(const string & filename, const string & text) : filename_(filename), text_(text), pos_(0), line_(1) {}
+
+    // Adds the help of the flags of the source to helps.
+    void Scan(map<string, string> * helps);
+
+private:
+    const string & filename_;
+    const string & text_;
+    size_t pos_;
+    int line_;
+
+    bool AtEnd() const { return pos_ >= text_.size(); }
+    char Peek(size_t ahead = 0) const { return pos_ + ahead < text_.size() ? text_[pos_ + ahead] : '\0'; }
+    void Advance()
+    {
+        if (text_[pos_++] == '\n')
+            ++line_;
+    }
+    // Whether only blanks precede pos_ on its line.
+    bool AtLineStart() const
+    {
+        size_t i = pos_;
+        while (i > 0 && (text_[i - 1] == ' ' || text_[i - 1] == '\t'))
+            --i;
+        return i == 0 || text_[i - 1] == '\n';
+    }
+
+    // Skips whitespace and comments.
+    void SkipSpace();
+    void SkipBlockComment();
+    // Skips a string or character literal, appending its bytes to value
+    // (if not NULL).
+    void ReadLiteral(string * value);
+    void SkipPreprocessorLine();
+    string ReadIdentifier();
+    // Skips the value of a flag, up to the comma at its end.
+    bool SkipArgument();
+    void ReadDefine(map<string, string> * helps);
+};
+
+void SourceScanner::SkipSpace()
+{
+    while (!AtEnd())
+    {
+        if (Peek() == ' ' || Peek() == '\t' || Peek() == '\n' || Peek() == '\r' || Peek() == '\f' || Peek() == '\v')
+            Advance();
+        else if (Peek() == '\\' && Peek(1) == '\n')
+        {
+            Advance();
+            Advance();
+        }
+        else if (Peek() == '/' && Peek(1) == '/')
+        {
+            while (!AtEnd() && Peek() != '\n')
+                Advance();
+        }
+        else if (Peek() == '/' && Peek(1) == '*')
+            SkipBlockComment();
+        else
+            break;
+    }
+}
+
+void SourceScanner::SkipBlockComment()
+{
+    Advance();
+    Advance();
+    while (!AtEnd() && !(Peek() == '*' && Peek(1) == '/'))
+        Advance();
+    if (!AtEnd())
+    {
+        Advance();
+        Advance();
+    }
+}
+
+static int HexDigit(char c)
+{
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F')
+        return c - 'A' + 10;
+    return -1;
+}
+
+void SourceScanner::ReadLiteral(string * value)
+{
+    const char quote = Peek();
+    Advance();
+    while (!AtEnd() && Peek() != quote && Peek() != '\n')
+    {
+        char c = Peek();
+        Advance();
+        if (c == '\\' && !AtEnd())
+        {
+            c = Peek();
+            Advance();
+            switch (c)
+            {
+            case 'n': c = '\n'; break;
+            case 't': c = '\t'; break;
+            case 'r': c = '\r'; break;
+            case 'a': c = '\a'; break;
+            case 'b': c = '\b'; break;
+            case 'f': c = '\f'; break;
+            case 'v': c = '\v'; break;
+            case 'x':
+            {
+                int code = 0;
+                while (HexDigit(Peek()) >= 0)
+                {
+                    code = code * 16 + HexDigit(Peek());
+                    Advance();
+                }
+                c = static_cast<char>(code);
+                break;
+            }
+            default:
+                if (c >= '0' && c <= '7')
+                {
+                    int code = c - '0';
+                    for (int digits = 1; digits < 3 && Peek() >= '0' && Peek() <= '7'; ++digits)
+                    {
+                        code = code * 8 + Peek() - '0';
+                        Advance();
+                    }
+                    c = static_cast<char>(code);
+                }
+                break; // \\, \', \", \? and the like are the character itself
+            }
+        }
+        if (value != NULL)
+            value->push_back(c);
+    }
+    if (!AtEnd() && Peek() == quote)
+        Advance();
+}
+
+void SourceScanner::SkipPreprocessorLine()
+{
+    while (!AtEnd() && Peek() != '\n')
+    {
+        if (Peek() == '/' && Peek(1) == '*')
+            SkipBlockComment(); // which may go on to the next lines
+        else if (Peek() == '\\' && Peek(1) == '\n')
+        {
+            Advance();
+            Advance();
+        }
+        else
+            Advance();
+    }
+}
+
+string SourceScanner::ReadIdentifier()
+{
+    const size_t begin = pos_;
+    while (!AtEnd() && IsIdentifierChar(Peek()))
+        Advance();
+    return text_.substr(begin, pos_ - begin);
+}
+
+bool SourceScanner::SkipArgument()
+{
+    int depth = 0;
+    while (!AtEnd())
+    {
+        SkipSpace();
+        const char c = Peek();
+        if (c == '"' || c == '\'')
+            ReadLiteral(NULL);
+        else if (c == '(' || c == '[' || c == '{')
+        {
+            ++depth;
+            Advance();
+        }
+        else if (c == ')' || c == ']' || c == '}')
+        {
+            if (depth == 0)
+                return false;
+            --depth;
+            Advance();
+        }
+        else if (c == ',' && depth == 0)
+        {
+            Advance();
+            return true;
+        }
+        else if (c != '\0')
+            Advance();
+    }
+    return false;
+}
+
+void SourceScanner::ReadDefine(map<string, string> * helps)
+{
+    const int line = line_;
+    SkipSpace();
+    if (Peek() != '(')
+        return; // not a use of the macro
+    Advance();
+    SkipSpace();
+    const string name = ReadIdentifier();
+    SkipSpace();
+    if (name.empty() || Peek() != ',')
+        return;
+    Advance();
+    if (!SkipArgument())
+        return;
+    string help;
+    bool literal = false;
+    for (SkipSpace(); Peek() == '"'; SkipSpace())
+    {
+        ReadLiteral(&help);
+        literal = true;
+    }
+    if (!literal || Peek() != ')')
+    {
+        fprintf(stderr, "%s:%d: warning: the help of flag '%s' isn't a string literal, so it's left out\n", filename_.c_str(), line, name.c_str());
+        return;
+    }
+    helps->insert(make_pair(name, help));
+}
+
+void SourceScanner::Scan(map<string, string> * helps)
+{
+    while (!AtEnd())
+    {
+        SkipSpace();
+        if (AtEnd())
+            break;
+        const char c = Peek();
+        if (c == '#' && AtLineStart())
+            SkipPreprocessorLine();
+        else if (c == '"' || c == '\'')
+            ReadLiteral(NULL);
+        else if (IsIdentifierChar(c))
+        {
+            const string identifier = ReadIdentifier();
+            if (IsDefineMacro(identifier))
+                ReadDefine(helps);
+        }
+        else
+            Advance();
+    }
+}
+
+// --------------------------------------------------------------------
+// Compressing the table
+//    Runs are found with a hash chain over the last 64 KB, greedily.
+// --------------------------------------------------------------------
+
+static const size_t kWindow = 65535;
+static const size_t kMaxMatch = kMinPackedMatch - 1 + (1U << kPackedLengthClasses) - 1;
+static const int kMaxChain = 256;
+
+struct Token
+{
+    int symbol;      // a byte, or 256 + the class of the run's length
+    uint32 length;   // of a run
+    uint32 distance; // back to its start
+};
+
+static int ClassOf(uint32 value)
+{
+    int c = 0;
+    while ((value >> (c + 1)) != 0)
+        ++c;
+    return c;
+}
+
+static const size_t kHashSize = 1 << 15;
+static const size_t kNoPosition = static_cast<size_t>(-1);
+
+static size_t HashAt(const string & data, size_t i)
+{
+    const uint32 bytes = static_cast<unsigned char>(data[i]) | static_cast<unsigned char>(data[i + 1]) << 8 | static_cast<unsigned char>(data[i + 2]) << 16;
+    return (bytes * 2654435761U) >> 17;
+}
+
+static void FindRuns(const string & data, vector<Token> * tokens)
+{
+    vector<size_t> head(kHashSize, kNoPosition); // the last position of each hash
+    vector<size_t> prev(data.size(), kNoPosition);
+    for (size_t i = 0; i < data.size();)
+    {
+        size_t best_length = 0;
+        size_t best_distance = 0;
+        if (i + kMinPackedMatch <= data.size())
+        {
+            const size_t hash = HashAt(data, i);
+            const size_t limit = std::min(kMaxMatch, data.size() - i);
+            int chain = 0;
+            for (size_t j = head[hash]; j != kNoPosition && i - j <= kWindow && chain < kMaxChain; j = prev[j], ++chain)
+            {
+                size_t length = 0;
+                while (length < limit && data[j + length] == data[i + length])
+                    ++length;
+                if (length > best_length)
+                {
+                    best_length = length;
+                    best_distance = i - j;
+                }
+            }
+        }
+        const size_t end = i + (best_length >= kMinPackedMatch ? best_length : 1);
+        if (best_length >= kMinPackedMatch)
+        {
+            const Token token = { 256 + ClassOf(static_cast<uint32>(best_length - kMinPackedMatch + 1)), static_cast<uint32>(best_length), static_cast<uint32>(best_distance) };
+            tokens->push_back(token);
+        }
+        else
+        {
+            const Token token = { static_cast<unsigned char>(data[i]), 0, 0 };
+            tokens->push_back(token);
+        }
+        // Index what the token covers.
+        for (; i < end; ++i)
+        {
+            if (i + kMinPackedMatch <= data.size())
+            {
+                const size_t hash = HashAt(data, i);
+                prev[i] = head[hash];
+                head[hash] = i;
+            }
+        }
+    }
+}
+
+// The lengths of a Huffman code for the symbols, of no more than
+// kMaxPackedCodeLength bits: if the tree is too deep, the counts are
+// flattened until it isn't.
+static void CodeLengths(vector<uint32> counts, vector<int> * lengths)
+{
+    for (;;)
+    {
+        typedef std::pair<uint64, int> Node; // weight, and index in parent
+        std::priority_queue<Node, vector<Node>, std::greater<Node> > queue;
+        vector<int> parent;
+        for (size_t i = 0; i < counts.size(); ++i)
+        {
+            parent.push_back(-1);
+            if (counts[i] > 0)
+                queue.push(Node(counts[i], static_cast<int>(i)));
+        }
+        lengths->assign(counts.size(), 0);
+        if (queue.size() == 1)
+        {
+            (*lengths)[queue.top().second] = 1;
+            return;
+        }
+        while (queue.size() > 1)
+        {
+            const Node a = queue.top();
+            queue.pop();
+            const Node b = queue.top();
+            queue.pop();
+            parent.push_back(-1);
+            parent[a.second] = parent[b.second] = static_cast<int>(parent.size() - 1);
+            queue.push(Node(a.first + b.first, static_cast<int>(parent.size() - 1)));
+        }
+        int longest = 0;
+        for (size_t i = 0; i < counts.size(); ++i)
+        {
+            if (counts[i] == 0)
+                continue;
+            int length = 0;
+            for (int node = parent[i]; node >= 0; node = parent[node])
+                ++length;
+            (*lengths)[i] = length;
+            longest = std::max(longest, length);
+        }
+        if (longest <= kMaxPackedCodeLength)
+            return;
+        for (size_t i = 0; i < counts.size(); ++i)
+        {
+            if (counts[i] > 0)
+                counts[i] = (counts[i] + 1) / 2;
+        }
+    }
+}
+
+class BitWriter
+{
+public:
+    explicit BitWriter(string * out) : out_(out), bit_(8) {}
+
+    void Put(uint32 bit)
+    {
+        if (bit_ == 8)
+        {
+            out_->push_back('\0');
+            bit_ = 0;
+        }
+        (*out_)[out_->size() - 1] |= static_cast<char>(bit << bit_++);
+    }
+
+    void PutBits(uint32 bits, int n) // low bit first
+    {
+        for (int i = 0; i < n; ++i)
+            Put((bits >> i) & 1);
+    }
+
+    void PutValueInClass(uint32 value, int c) { PutBits(value - (1U << c), c); }
+
+private:
+    string * out_;
+    int bit_;
+};
+
+static void Pack(const string & data, string * packed)
+{
+    vector<Token> tokens;
+    FindRuns(data, &tokens);
+    vector<uint32> counts(kPackedHelpSymbols, 0);
+    for (size_t i = 0; i < tokens.size(); ++i)
+        ++counts[tokens[i].symbol];
+    vector<int> lengths;
+    CodeLengths(counts, &lengths);
+
+    // The canonical code: by length, then by symbol.
+    vector<uint32> codes(kPackedHelpSymbols, 0);
+    uint32 code = 0;
+    for (int length = 1; length <= kMaxPackedCodeLength; ++length)
+    {
+        for (int symbol = 0; symbol < kPackedHelpSymbols; ++symbol)
+        {
+            if (lengths[symbol] == length)
+                codes[symbol] = code++;
+        }
+        code <<= 1;
+    }
+
+    packed->assign((kPackedHelpSymbols + 1) / 2, '\0');
+    for (int symbol = 0; symbol < kPackedHelpSymbols; ++symbol)
+        (*packed)[symbol / 2] |= static_cast<char>(lengths[symbol] << (symbol % 2 * 4));
+    BitWriter out(packed);
+    for (size_t i = 0; i < tokens.size(); ++i)
+    {
+        const Token & token = tokens[i];
+        for (int bit = lengths[token.symbol] - 1; bit >= 0; --bit)
+            out.Put((codes[token.symbol] >> bit) & 1);
+        if (token.symbol < 256)
+            continue;
+        out.PutValueInClass(static_cast<uint32>(token.length - kMinPackedMatch + 1), token.symbol - 256);
+        const int distance_class = ClassOf(token.distance);
+        out.PutBits(distance_class, 4);
+        out.PutValueInClass(token.distance, distance_class);
+    }
+}
+
+// --------------------------------------------------------------------
+// main()
+// --------------------------------------------------------------------
+
+static int Usage()
+{
+    fprintf(stderr, "usage: jflags_pack_help [-i <jflags header>] -o <output.cc> <source>...\n");
+    return 1;
+}
+
+int main(int argc, char ** argv)
+{
+    string header = "jflags/jflags.h";
+    string output;
+    vector<string> sources;
+    for (int i = 1; i < argc; ++i)
+    {
+        if (strcmp(argv[i], "-o") == 0 && i + 1 < argc)
+            output = argv[++i];
+        else if (strcmp(argv[i], "-i") == 0 && i + 1 < argc)
+            header = argv[++i];
+        else if (argv[i][0] == '-')
+            return Usage();
+        else
+            sources.push_back(argv[i]);
+    }
+    if (output.empty())
+        return Usage();
+
+    map<string, string> helps; // sorted by name, as the table must be
+    for (size_t i = 0; i < sources.size(); ++i)
+    {
+        std::ifstream in(sources[i].c_str(), std::ios::in | std::ios::binary);
+        if (!in)
+        {
+            fprintf(stderr, "jflags_pack_help: can't read %s\n", sources[i].c_str());
+            return 1;
+        }
+        std::ostringstream text;
+        text << in.rdbuf();
+        const string contents = text.str();
+        SourceScanner(sources[i], contents).Scan(&helps);
+    }
+
+    string table;
+    for (map<string, string>::const_iterator i = helps.begin(); i != helps.end(); ++i)
+    {
+        table.append(i->first.c_str(), i->first.size() + 1);
+        table.append(i->second.c_str(), i->second.size() + 1);
+    }
+    string packed;
+    if (!table.empty())
+        Pack(table, &packed);
+    // Check it, rather than ship help --help can't show.
+    vector<char> unpacked(table.size() + 1);
+    if (!table.empty() && (!UnpackFlagHelp(reinterpret_cast<const unsigned char *>(packed.data()), packed.size(), &unpacked[0], table.size()) ||
+                           memcmp(&unpacked[0], table.data(), table.size()) != 0))
+    {
+        fprintf(stderr, "jflags_pack_help: the help doesn't unpack to what was packed\n");
+        return 1;
+    }
+
+    std::ostringstream source;
+    source << "// Generated by jflags_pack_help from the help of " << helps.size() << " flags, " << table.size() << " bytes of it\n"
+           << "// packed into " << packed.size() << ": do not edit.\n"
+           << "#include <" << header << ">\n";
+    if (!table.empty())
+    {
+        source << "\nnamespace {\n\nconst unsigned char kPackedHelp[] = {";
+        for (size_t i = 0; i < packed.size(); ++i)
+        {
+            static const char kHex[] = "0123456789abcdef";
+            const unsigned char c = static_cast<unsigned char>(packed[i]);
+            source << (i % 16 == 0 ? "\n    " : " ") << "0x" << kHex[c >> 4] << kHex[c & 0xf] << ",";
+        }
+        source << "\n};\n\n"
+               << "const JFLAGS_NAMESPACE::FlagHelpRegisterer packed_help(kPackedHelp, sizeof(kPackedHelp), " << table.size() << ");\n\n"
+               << "} // namespace\n";
+    }
+    std::ofstream out(output.c_str(), std::ios::out | std::ios::binary);
+    out << source.str();
+    if (!out)
+    {
+        fprintf(stderr, "jflags_pack_help: can't write %s\n", output.c_str());
+        return 1;
+    }
+    return 0;
+}